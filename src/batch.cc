@@ -0,0 +1,667 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residbatch - render a collection of PSID / RSID tunes and traces in
+// parallel.
+//
+// Jobs are given as files, directories (searched recursively for .sid and
+// .trc files), or a manifest with one "path [song]" per line. Each worker
+// thread renders one job at a time with its own SID, taking the next job
+// from a shared index as soon as it is done, so that long jobs do not hold
+// up the rest of the batch.
+//
+// Traces may be rendered through a render cache directory shared by all
+// threads, so that traces rendered before, or sharing a prefix with one
+// rendered before, are read from disk.
+//
+// Per-job timings and failures are written as tab separated lines, followed
+// by a throughput summary.
+// ----------------------------------------------------------------------------
+
+#include "psid.h"
+#include "trace.h"
+#include "sink.h"
+#include "silence.h"
+#include "cache.h"
+#include "numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <set>
+#include <algorithm>
+
+using namespace reSID;
+
+struct Job
+{
+  std::string path;
+  int song;
+  // Output file base name.
+  std::string name;
+
+  // Result.
+  bool ok;
+  const char* error;
+  unsigned long long samples;
+  double seconds;
+  bool silence;
+  // Memory node of the render thread at the end of the job, and of the
+  // resampling buffers and filter tables of its SID; -1 if unknown.
+  int node, buffer_node, filter_node;
+};
+
+struct Batch
+{
+  RenderSettings settings;
+  bool use_header;
+  double play_time;
+  double silence_time;
+  std::string output_dir;
+  std::string cache_dir;
+  // Filter tables on the node of each render thread.
+  FilterReplicas replicas;
+  // Cache statistics, summed over the threads.
+  std::atomic<unsigned long> cache_hits, cache_partial_hits, cache_misses;
+  // Output files claimed by jobs.
+  std::mutex output_lock;
+  std::set<std::string> outputs;
+
+  std::vector<Job> jobs;
+  std::atomic<size_t> next_job;
+};
+
+static void usage()
+{
+  fprintf(stderr,
+	  "Usage: residbatch [options] file|directory ...\n"
+	  "  -f manifest  read jobs from manifest, one \"path [song]\" per line\n"
+	  "  -j threads   number of worker threads (default: all cores)\n"
+	  "  -o dir       write WAV files to dir (default: discard output)\n"
+	  "  -C dir       cache trace renders in dir; cached traces are not\n"
+	  "               stopped at silence\n"
+	  "  -R report    write per-job report to file (default: stderr)\n"
+	  "  -t seconds   play time for tunes (default: 180)\n"
+	  "  -S seconds   stop after this much silence (default: off)\n"
+	  "  -r rate      sample rate (default: 44100)\n"
+	  "  -m method    fast, interpolate, resample or fastmem"
+	  " (default: resample)\n"
+	  "  -M model     6581 or 8580 (default: from tune)\n");
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static bool has_suffix(const std::string& path, const char* suffix)
+{
+  size_t n = strlen(suffix);
+  return path.size() >= n &&
+    strcasecmp(path.c_str() + path.size() - n, suffix) == 0;
+}
+
+static bool is_job_file(const std::string& path)
+{
+  return has_suffix(path, ".sid") || has_suffix(path, ".psid") ||
+    has_suffix(path, ".trc");
+}
+
+// ----------------------------------------------------------------------------
+// Collect jobs.
+// ----------------------------------------------------------------------------
+static void add_job(Batch& batch, const std::string& path, int song)
+{
+  Job job;
+  job.path = path;
+  job.song = song;
+  job.ok = false;
+  job.error = 0;
+  job.samples = 0;
+  job.seconds = 0;
+  job.silence = false;
+  job.node = job.buffer_node = job.filter_node = -1;
+  batch.jobs.push_back(job);
+}
+
+static bool scan(Batch& batch, const std::string& path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    return false;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    add_job(batch, path, 0);
+    return true;
+  }
+
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    return false;
+  }
+
+  // Sort entries, so that the job order does not depend on the file system.
+  std::vector<std::string> entries;
+  struct dirent* d;
+  while ((d = readdir(dir))) {
+    if (d->d_name[0] != '.') {
+      entries.push_back(path + "/" + d->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(entries.begin(), entries.end());
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (stat(entries[i].c_str(), &st) < 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      scan(batch, entries[i]);
+    }
+    else if (is_job_file(entries[i])) {
+      add_job(batch, entries[i], 0);
+    }
+  }
+
+  return true;
+}
+
+static bool read_manifest(Batch& batch, const char* filename)
+{
+  FILE* f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+  if (!f) {
+    return false;
+  }
+
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    char* end = line + strlen(line);
+    while (end > line && (end[-1] == '\n' || end[-1] == '\r')) {
+      *--end = 0;
+    }
+    if (!line[0] || line[0] == '#') {
+      continue;
+    }
+
+    // An optional song number follows the last blank.
+    int song = 0;
+    char* blank = strrchr(line, ' ');
+    if (blank) {
+      char* rest;
+      long n = strtol(blank + 1, &rest, 10);
+      if (!*rest && rest != blank + 1) {
+	song = n;
+	*blank = 0;
+      }
+    }
+    add_job(batch, line, song);
+  }
+
+  if (f != stdin) {
+    fclose(f);
+  }
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Output file base names: the input base name, without extension. Collections
+// have many tunes of the same name in different directories, so base names
+// shared by several jobs get the job number added, as "name.N".
+// ----------------------------------------------------------------------------
+static void name_outputs(Batch& batch)
+{
+  std::map<std::string, int> count;
+
+  for (size_t i = 0; i < batch.jobs.size(); i++) {
+    std::string name = batch.jobs[i].path;
+    size_t slash = name.rfind('/');
+    if (slash != std::string::npos) {
+      name = name.substr(slash + 1);
+    }
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos && dot > 0) {
+      name = name.substr(0, dot);
+    }
+    batch.jobs[i].name = name;
+    count[name]++;
+  }
+
+  for (size_t i = 0; i < batch.jobs.size(); i++) {
+    Job& job = batch.jobs[i];
+    if (count[job.name] > 1) {
+      char suffix[32];
+      sprintf(suffix, ".%lu", (unsigned long)i + 1);
+      job.name += suffix;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Output file name: the base name with .wav, and the song number for tunes.
+// ----------------------------------------------------------------------------
+static std::string output_name(const Batch& batch, const Job& job, int song)
+{
+  std::string name = job.name;
+  if (song) {
+    char suffix[16];
+    sprintf(suffix, "-%d", song);
+    name += suffix;
+  }
+  return batch.output_dir + "/" + name + ".wav";
+}
+
+
+// ----------------------------------------------------------------------------
+// Claim an output file, failing if another job of the batch has done so,
+// e.g. for the same tune listed twice.
+// ----------------------------------------------------------------------------
+static bool claim_output(Batch& batch, const std::string& filename)
+{
+  std::lock_guard<std::mutex> lock(batch.output_lock);
+  return batch.outputs.insert(filename).second;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render one job.
+// ----------------------------------------------------------------------------
+static void render(Batch& batch, Job& job, std::vector<short>& scratch,
+		   RenderCache* cache)
+{
+  const int chunk = 4096;
+
+  PSIDPlayer* player = 0;
+  SID* sid = 0;
+  Trace trace;
+  TracePlayer* trace_player = 0;
+  int song = 0;
+  // Trace output rendered through the cache, and the part written so far.
+  std::vector<short> cached;
+  size_t cached_pos = 0;
+
+  if (has_suffix(job.path, ".trc")) {
+    if (!trace.load(job.path.c_str())) {
+      job.error = "cannot load trace";
+      return;
+    }
+    sid = new SID();
+    sid->set_filter_model(batch.replicas.get(batch.settings.model));
+    if (!batch.settings.configure(*sid)) {
+      job.error = "invalid sampling parameters";
+      delete sid;
+      return;
+    }
+    // The allocations may reuse pages first touched by other threads.
+    sid->localize_buffers();
+    if (cache && !cache->render(*sid, trace, batch.settings, cached)) {
+      job.error = "cannot render trace";
+      delete sid;
+      return;
+    }
+    trace_player = new TracePlayer(*sid, trace);
+  }
+  else {
+    player = new PSIDPlayer();
+    if (!player->load(job.path.c_str())) {
+      job.error = "not a playable PSID/RSID file";
+      delete player;
+      return;
+    }
+    song = job.song ? job.song : player->start_song();
+    if (!player->start(song, batch.settings, batch.use_header)) {
+      job.error = "invalid sampling parameters";
+      delete player;
+      return;
+    }
+    // Only name the output by song if there is a choice.
+    if (player->songs() == 1) {
+      song = 0;
+    }
+    SID& chip = player->sid();
+    chip.set_filter_model(batch.replicas.get(player->settings().model));
+    chip.localize_buffers();
+  }
+
+  int sample_freq = (int)batch.settings.sample_freq;
+  unsigned long long total = (unsigned long long)(batch.play_time*sample_freq);
+
+  SilenceDetector detector((cycle_count)(batch.silence_time*
+					 (player ? player->settings() :
+					  batch.settings).clock_freq));
+
+  WavFileSink wav;
+  bool output = !batch.output_dir.empty();
+  std::string filename = output ? output_name(batch, job, song) : "";
+  if (output && !claim_output(batch, filename)) {
+    job.error = "output file of another job";
+  }
+  else if (output && !wav.open(filename.c_str(), sample_freq)) {
+    job.error = "cannot open output file";
+  }
+  else {
+    job.ok = true;
+
+    for (;;) {
+      int n = chunk;
+      if (player && total - job.samples < (unsigned long long)n) {
+	n = total - job.samples;
+      }
+      if (!n) {
+	break;
+      }
+
+      short* buf = output ? wav.reserve(n) : &scratch[0];
+      if (!buf) {
+	job.ok = false;
+	break;
+      }
+      int s;
+      if (player) {
+	s = player->clock(buf, n);
+      }
+      else if (cache) {
+	s = std::min((size_t)n, cached.size() - cached_pos);
+	std::copy(cached.begin() + cached_pos,
+		  cached.begin() + cached_pos + s, buf);
+	cached_pos += s;
+      }
+      else {
+	s = trace_player->clock(buf, n);
+      }
+      if (output && !wav.commit(s)) {
+	job.ok = false;
+	break;
+      }
+      job.samples += s;
+
+      if (s < n) {
+	// End of trace.
+	break;
+      }
+
+      if (batch.silence_time > 0 && (player || !cache)) {
+	SID& chip = player ? player->sid() : *sid;
+	unsigned long long cycle =
+	  player ? player->cycle() : trace_player->cycle();
+	// Silence after the last write of a trace is final.
+	if (detector.check(chip, cycle) ||
+	    (trace_player && detector.silent() &&
+	     trace_player->position() == trace.writes.size()))
+	{
+	  job.silence = true;
+	  break;
+	}
+      }
+    }
+
+    if (output && !wav.close()) {
+      job.ok = false;
+    }
+    if (!job.ok) {
+      job.error = "write error";
+    }
+  }
+
+  SID& chip = player ? player->sid() : *sid;
+  job.node = numa_node();
+  job.buffer_node = numa_buffer_node(chip);
+  job.filter_node = numa_filter_node(chip);
+
+  delete trace_player;
+  delete sid;
+  delete player;
+}
+
+
+// ----------------------------------------------------------------------------
+// Worker thread.
+// ----------------------------------------------------------------------------
+static void worker(Batch* batch)
+{
+  std::vector<short> scratch(4096);
+  RenderCache cache;
+  bool use_cache = !batch->cache_dir.empty();
+
+  if (use_cache && !cache.open(batch->cache_dir.c_str())) {
+    use_cache = false;
+  }
+
+  for (;;) {
+    size_t i = batch->next_job.fetch_add(1, std::memory_order_relaxed);
+    if (i >= batch->jobs.size()) {
+      break;
+    }
+
+    Job& job = batch->jobs[i];
+    double start = now();
+    render(*batch, job, scratch, use_cache ? &cache : 0);
+    job.seconds = now() - start;
+  }
+
+  batch->cache_hits += cache.hits;
+  batch->cache_partial_hits += cache.partial_hits;
+  batch->cache_misses += cache.misses;
+}
+
+
+int main(int argc, char** argv)
+{
+  Batch batch;
+  batch.use_header = true;
+  batch.play_time = 180;
+  batch.silence_time = 0;
+  batch.next_job = 0;
+  batch.cache_hits = batch.cache_partial_hits = batch.cache_misses = 0;
+
+  int threads = std::thread::hardware_concurrency();
+  const char* report_file = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:j:o:C:R:t:S:r:m:M:")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (!read_manifest(batch, optarg)) {
+	fprintf(stderr, "residbatch: %s: cannot read manifest\n", optarg);
+	return 1;
+      }
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'o':
+      batch.output_dir = optarg;
+      break;
+    case 'C':
+      batch.cache_dir = optarg;
+      break;
+    case 'R':
+      report_file = optarg;
+      break;
+    case 't':
+      batch.play_time = atof(optarg);
+      break;
+    case 'S':
+      batch.silence_time = atof(optarg);
+      break;
+    case 'r':
+      batch.settings.sample_freq = atof(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "fast") == 0) {
+	batch.settings.method = SAMPLE_FAST;
+      }
+      else if (strcmp(optarg, "interpolate") == 0) {
+	batch.settings.method = SAMPLE_INTERPOLATE;
+      }
+      else if (strcmp(optarg, "resample") == 0) {
+	batch.settings.method = SAMPLE_RESAMPLE;
+      }
+      else if (strcmp(optarg, "fastmem") == 0) {
+	batch.settings.method = SAMPLE_RESAMPLE_FASTMEM;
+      }
+      else {
+	usage();
+	return 1;
+      }
+      break;
+    case 'M':
+      batch.settings.model = strcmp(optarg, "8580") == 0 ? MOS8580 : MOS6581;
+      batch.use_header = false;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) {
+    if (!scan(batch, argv[i])) {
+      fprintf(stderr, "residbatch: %s: not found\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (batch.jobs.empty()) {
+    usage();
+    return 1;
+  }
+  name_outputs(batch);
+
+  if (!batch.output_dir.empty() &&
+      mkdir(batch.output_dir.c_str(), 0777) < 0)
+  {
+    struct stat st;
+    if (stat(batch.output_dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+      fprintf(stderr, "residbatch: %s: cannot create directory\n",
+	      batch.output_dir.c_str());
+      return 1;
+    }
+  }
+
+  RenderCache cache;
+  if (!batch.cache_dir.empty() && !cache.open(batch.cache_dir.c_str())) {
+    fprintf(stderr, "residbatch: %s: cannot open cache\n",
+	    batch.cache_dir.c_str());
+    return 1;
+  }
+
+  FILE* report = stderr;
+  if (report_file && !(report = fopen(report_file, "w"))) {
+    fprintf(stderr, "residbatch: %s: cannot open report\n", report_file);
+    return 1;
+  }
+
+  if (threads < 1) {
+    threads = 1;
+  }
+  if ((size_t)threads > batch.jobs.size()) {
+    threads = batch.jobs.size();
+  }
+
+  double start = now();
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(std::thread(worker, &batch));
+  }
+  for (int i = 0; i < threads; i++) {
+    workers[i].join();
+  }
+
+  double wall = now() - start;
+
+  // Report.
+  int failures = 0;
+  unsigned long long samples = 0;
+  double cpu = 0;
+
+  // Jobs ended early by silence are reported as "silent".
+  fprintf(report, "# status\tseconds\taudio\tspeed\tpath\n");
+  for (size_t i = 0; i < batch.jobs.size(); i++) {
+    const Job& job = batch.jobs[i];
+    double audio = job.samples/batch.settings.sample_freq;
+    fprintf(report, "%s\t%.3f\t%.1f\t%.1f\t%s",
+	    !job.ok ? "FAIL" : job.silence ? "silent" : "ok", job.seconds, audio,
+	    job.seconds > 0 ? audio/job.seconds : 0, job.path.c_str());
+    if (job.song) {
+      fprintf(report, " %d", job.song);
+    }
+    if (!job.ok) {
+      fprintf(report, "\t%s", job.error);
+      failures++;
+    }
+    fprintf(report, "\n");
+    samples += job.samples;
+    cpu += job.seconds;
+  }
+
+  // Placement of the per job memory, where the nodes are known.
+  int numa_jobs = 0, remote_buffers = 0, remote_filters = 0;
+  for (size_t i = 0; i < batch.jobs.size(); i++) {
+    const Job& job = batch.jobs[i];
+    if (job.node < 0) {
+      continue;
+    }
+    numa_jobs++;
+    remote_buffers += job.buffer_node >= 0 && job.buffer_node != job.node;
+    remote_filters += job.filter_node >= 0 && job.filter_node != job.node;
+  }
+
+  double audio = samples/batch.settings.sample_freq;
+  fprintf(report,
+	  "# %d jobs, %d failed, %d threads, %.3f s wall, %.3f s job time,"
+	  " %.1f s audio, %.1fx realtime, %.1f jobs/s\n",
+	  (int)batch.jobs.size(), failures, threads, wall, cpu, audio,
+	  wall > 0 ? audio/wall : 0, wall > 0 ? batch.jobs.size()/wall : 0);
+
+  if (numa_jobs) {
+    fprintf(report,
+	    "# numa: %d jobs, %d with resampling buffers and %d with filter"
+	    " tables on another node\n",
+	    numa_jobs, remote_buffers, remote_filters);
+  }
+
+  if (!batch.cache_dir.empty()) {
+    fprintf(report, "# cache: %lu hits, %lu partial hits, %lu misses\n",
+	    (unsigned long)batch.cache_hits,
+	    (unsigned long)batch.cache_partial_hits,
+	    (unsigned long)batch.cache_misses);
+  }
+
+  if (report != stderr) {
+    fclose(report);
+  }
+
+  return failures ? 2 : 0;
+}
@@ -0,0 +1,1169 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "c64.h"
+#include <string.h>
+
+namespace reSID
+{
+
+// Status register flags.
+enum {
+  FLAG_C = 0x01,
+  FLAG_Z = 0x02,
+  FLAG_I = 0x04,
+  FLAG_D = 0x08,
+  FLAG_B = 0x10,
+  FLAG_U = 0x20,
+  FLAG_V = 0x40,
+  FLAG_N = 0x80
+};
+
+// Addressing modes.
+enum {
+  IMP, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, INX, INY, IND, REL
+};
+
+static const unsigned char mode_table[256] = {
+  IMP, INX, IMP, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,
+  ABS, INX, IMP, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,
+  IMP, INX, IMP, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,
+  IMP, INX, IMP, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, IND, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,
+  IMM, INX, IMM, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPY, ZPY, IMP, ABY, IMP, ABY, ABX, ABX, ABY, ABY,
+  IMM, INX, IMM, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPY, ZPY, IMP, ABY, IMP, ABY, ABX, ABX, ABY, ABY,
+  IMM, INX, IMM, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,
+  IMM, INX, IMM, INX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,
+  REL, INY, IMP, INY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX
+};
+
+// Cycles per instruction, not including page crossing and branch penalties.
+// The jam instructions are listed with 0 cycles.
+static const unsigned char cycle_table[256] = {
+  7, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
+  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+  6, 6, 0, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
+  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+  6, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,
+  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+  6, 6, 0, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,
+  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+  2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+  2, 6, 0, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,
+  2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+  2, 5, 0, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,
+  2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+  2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7
+};
+
+// Kernal stand-in, see reset().
+struct KernalCode
+{
+  reg16 address;
+  int size;
+  unsigned char code[24];
+};
+
+static const KernalCode kernal_code[] = {
+  // IRQ entry: PHA, TXA, PHA, TYA, PHA, TSX, LDA $0104,X, AND #$10,
+  // BEQ +3, JMP ($0316), JMP ($0314).
+  { 0xff48, 19, { 0x48, 0x8a, 0x48, 0x98, 0x48, 0xba, 0xbd, 0x04, 0x01,
+		  0x29, 0x10, 0xf0, 0x03, 0x6c, 0x16, 0x03, 0x6c, 0x14,
+		  0x03 } },
+  // Default IRQ handler: JMP $EA7E.
+  { 0xea31, 3, { 0x4c, 0x7e, 0xea } },
+  // Acknowledge CIA 1 interrupt and return: LDA $DC0D, PLA, TAY, PLA, TAX,
+  // PLA, RTI.
+  { 0xea7e, 9, { 0xad, 0x0d, 0xdc, 0x68, 0xa8, 0x68, 0xaa, 0x68, 0x40 } },
+  // NMI entry: SEI, JMP ($0318).
+  { 0xfe43, 4, { 0x78, 0x6c, 0x18, 0x03 } },
+  // Default NMI handler: PHA, TXA, PHA, TYA, PHA, LDA $DD0D, JMP $FEBC.
+  { 0xfe47, 11, { 0x48, 0x8a, 0x48, 0x98, 0x48, 0xad, 0x0d, 0xdd, 0x4c,
+		  0xbc, 0xfe } },
+  // Default BRK handler: JMP $EA81.
+  { 0xfe66, 3, { 0x4c, 0x81, 0xea } },
+  // Return from NMI: PLA, TAY, PLA, TAX, PLA, RTI.
+  { 0xfebc, 6, { 0x68, 0xa8, 0x68, 0xaa, 0x68, 0x40 } },
+  // Hardware vectors.
+  { 0xfffa, 6, { 0x43, 0xfe, 0xe2, 0xfc, 0x48, 0xff } }
+};
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+C64::C64()
+{
+  sid = 0;
+  reset(PAL);
+}
+
+
+// ----------------------------------------------------------------------------
+// Reset.
+// RAM is cleared, and the state is set up as left by the Kernal after boot.
+// ----------------------------------------------------------------------------
+void C64::reset(video_standard video)
+{
+  memset(ram, 0, sizeof(ram));
+
+  // The Kernal stand-in only contains the code which tunes commonly depend
+  // on, the rest is filled with RTS so that calls to Kernal routines return
+  // immediately.
+  memset(kernal, 0x60, sizeof(kernal));
+  for (unsigned int i = 0; i < sizeof(kernal_code)/sizeof(*kernal_code); i++) {
+    memcpy(kernal + kernal_code[i].address - 0xe000, kernal_code[i].code,
+	   kernal_code[i].size);
+  }
+
+  // Kernal RAM vectors.
+  ram[0x0314] = 0x31; ram[0x0315] = 0xea;
+  ram[0x0316] = 0x66; ram[0x0317] = 0xfe;
+  ram[0x0318] = 0x47; ram[0x0319] = 0xfe;
+
+  a = x = y = 0;
+  s = 0xff;
+  p = FLAG_U | FLAG_I;
+  pc = IDLE;
+
+  cycles = 0;
+  instruction_cycle = 0;
+  instruction_length = 0;
+
+  port_ddr = 0x2f;
+  port_data = 0x37;
+  set_bank(port_data);
+
+  reset_cia(cia1);
+  reset_cia(cia2);
+  nmi_line = false;
+
+  if (video == PAL) {
+    cycles_per_line = 63;
+    lines = 312;
+  }
+  else {
+    cycles_per_line = 65;
+    lines = 263;
+  }
+  frame_cycle = 0;
+  raster_compare = 0x1ff;
+  memset(vic, 0, sizeof(vic));
+  vic_irq_flags = 0;
+  vic_irq_mask = 0;
+
+  irq_call = 0;
+  irq_call_bank = 0x37;
+
+  // The Kernal sets up CIA 1 timer A for a 60Hz interrupt.
+  set_cia1_timer(video == PAL ? 0x4025 : 0x4295, true);
+}
+
+
+// ----------------------------------------------------------------------------
+// Set SID access handler.
+// ----------------------------------------------------------------------------
+void C64::set_sid(SIDBus* bus)
+{
+  sid = bus;
+}
+
+
+// ----------------------------------------------------------------------------
+// Load data into RAM.
+// ----------------------------------------------------------------------------
+void C64::load(reg16 address, const unsigned char* data, int size)
+{
+  if (address + size > 0x10000) {
+    size = 0x10000 - address;
+  }
+  memcpy(ram + address, data, size);
+}
+
+
+// ----------------------------------------------------------------------------
+// Call subroutine. The return address is the idle loop.
+// ----------------------------------------------------------------------------
+void C64::call(reg16 address, reg8 a)
+{
+  reg16 ret = (IDLE - 1) & 0xffff;
+  push(ret >> 8);
+  push(ret & 0xff);
+  pc = address;
+  this->a = a;
+}
+
+
+// ----------------------------------------------------------------------------
+// Interrupt disable flag.
+// ----------------------------------------------------------------------------
+void C64::disable_irq(bool disable)
+{
+  p = disable ? p | FLAG_I : p & ~FLAG_I;
+}
+
+
+// ----------------------------------------------------------------------------
+// Call subroutine on interrupts, with the given memory configuration.
+// An address of 0 disables the driver hook.
+// ----------------------------------------------------------------------------
+void C64::set_irq_call(reg16 address, reg8 bank)
+{
+  irq_call = address;
+  irq_call_bank = bank;
+}
+
+
+// ----------------------------------------------------------------------------
+// Start CIA 1 timer A in continuous mode.
+// ----------------------------------------------------------------------------
+void C64::set_cia1_timer(reg16 latch, bool irq)
+{
+  cia1.ta = cia1.ta_latch = latch;
+  cia1.cra = 0x01;
+  cia1.icr_mask = irq ? 0x01 : 0x00;
+}
+
+
+// ----------------------------------------------------------------------------
+// Enable the raster interrupt at the given line; -1 disables it.
+// ----------------------------------------------------------------------------
+void C64::set_raster_irq(int line)
+{
+  if (line < 0) {
+    vic_irq_mask &= ~0x01;
+    return;
+  }
+  raster_compare = line;
+  vic[0x11] = (vic[0x11] & 0x7f) | ((line >> 1) & 0x80);
+  vic[0x12] = line & 0xff;
+  vic_irq_mask |= 0x01;
+}
+
+
+// ----------------------------------------------------------------------------
+// Processor port.
+// ----------------------------------------------------------------------------
+void C64::set_bank(reg8 port)
+{
+  port_data = port;
+  // Input bits are pulled up.
+  reg8 bank = (port_data | ~port_ddr) & 0x07;
+  io_visible = (bank & 0x03) && (bank & 0x04);
+  kernal_visible = bank & 0x02;
+}
+
+
+// ----------------------------------------------------------------------------
+// Memory read.
+// ----------------------------------------------------------------------------
+reg8 C64::read(reg16 address)
+{
+  if (likely(address >= 0x0002 && address < 0xd000)) {
+    return ram[address];
+  }
+  if (address < 0x0002) {
+    return address ? (port_data | ~port_ddr) & 0xff : port_ddr;
+  }
+  if (address < 0xe000) {
+    return io_visible ? read_io(address) : ram[address];
+  }
+  return kernal_visible ? kernal[address - 0xe000] : ram[address];
+}
+
+
+// ----------------------------------------------------------------------------
+// Memory write. offset is the cycle of the bus access within the current
+// instruction.
+// ----------------------------------------------------------------------------
+void C64::write(reg16 address, reg8 value, int offset)
+{
+  if (likely(address >= 0x0002) &&
+      (address < 0xd000 || address >= 0xe000 || !io_visible))
+  {
+    ram[address] = value;
+    return;
+  }
+  if (address < 0x0002) {
+    // Writes also go to the underlying RAM.
+    ram[address] = value;
+    if (address) {
+      set_bank(value);
+    }
+    else {
+      port_ddr = value;
+      set_bank(port_data);
+    }
+    return;
+  }
+  write_io(address, value, offset);
+}
+
+
+// ----------------------------------------------------------------------------
+// I/O read.
+// ----------------------------------------------------------------------------
+reg8 C64::read_io(reg16 address)
+{
+  if (address < 0xd400) {
+    reg8 reg = address & 0x3f;
+    int line = raster_line();
+    switch (reg) {
+    case 0x11:
+      return (vic[0x11] & 0x7f) | ((line >> 1) & 0x80);
+    case 0x12:
+      return line & 0xff;
+    case 0x19:
+      return vic_irq_flags | 0x70 | ((vic_irq_flags & vic_irq_mask) ? 0x80 : 0);
+    case 0x1a:
+      return vic_irq_mask | 0xf0;
+    case 0x1e:
+    case 0x1f:
+      return 0x00;
+    default:
+      return reg < 0x2f ? vic[reg] : 0xff;
+    }
+  }
+  if (address < 0xd800) {
+    if (!sid) {
+      return 0x00;
+    }
+    // Reads take place in the last cycle of the instruction.
+    return sid->read_sid(instruction_cycle + instruction_length - 1,
+			 address & 0x1f);
+  }
+  if (address < 0xdc00) {
+    // Color RAM.
+    return ram[address];
+  }
+  if (address < 0xdd00) {
+    return read_cia(cia1, address & 0x0f);
+  }
+  if (address < 0xde00) {
+    return read_cia(cia2, address & 0x0f);
+  }
+  return 0xff;
+}
+
+
+// ----------------------------------------------------------------------------
+// I/O write.
+// ----------------------------------------------------------------------------
+void C64::write_io(reg16 address, reg8 value, int offset)
+{
+  if (address < 0xd400) {
+    reg8 reg = address & 0x3f;
+    switch (reg) {
+    case 0x11:
+      raster_compare = (raster_compare & 0xff) | ((value << 1) & 0x100);
+      break;
+    case 0x12:
+      raster_compare = (raster_compare & 0x100) | value;
+      break;
+    case 0x19:
+      vic_irq_flags &= ~value & 0x0f;
+      break;
+    case 0x1a:
+      vic_irq_mask = value & 0x0f;
+      break;
+    }
+    vic[reg] = value;
+    return;
+  }
+  if (address < 0xd800) {
+    if (sid) {
+      sid->write_sid(instruction_cycle + offset, address & 0x1f, value);
+    }
+    return;
+  }
+  if (address < 0xdc00) {
+    ram[address] = value;
+    return;
+  }
+  if (address < 0xdd00) {
+    write_cia(cia1, address & 0x0f, value);
+    return;
+  }
+  if (address < 0xde00) {
+    write_cia(cia2, address & 0x0f, value);
+    if ((address & 0x0f) == 0x00) {
+      // VIC bank; kept for reads.
+      ram[address] = value;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// CIA.
+// Only the timers and the interrupt control register are emulated; the
+// ports read as unconnected and the time of day clock does not run.
+// ----------------------------------------------------------------------------
+void C64::reset_cia(CIA& cia)
+{
+  cia.ta = cia.tb = 0xffff;
+  cia.ta_latch = cia.tb_latch = 0xffff;
+  cia.cra = cia.crb = 0;
+  cia.icr = cia.icr_mask = 0;
+  cia.pra = cia.prb = 0xff;
+  cia.ddra = cia.ddrb = 0;
+  cia.irq = false;
+}
+
+reg8 C64::read_cia(CIA& cia, reg8 reg)
+{
+  switch (reg) {
+  case 0x00:
+    return cia.pra | ~cia.ddra;
+  case 0x01:
+    return cia.prb | ~cia.ddrb;
+  case 0x02:
+    return cia.ddra;
+  case 0x03:
+    return cia.ddrb;
+  case 0x04:
+    return cia.ta & 0xff;
+  case 0x05:
+    return cia.ta >> 8;
+  case 0x06:
+    return cia.tb & 0xff;
+  case 0x07:
+    return cia.tb >> 8;
+  case 0x0d:
+    {
+      // Reading clears the interrupt flags.
+      reg8 icr = cia.icr | (cia.irq ? 0x80 : 0x00);
+      cia.icr = 0;
+      cia.irq = false;
+      return icr;
+    }
+  case 0x0e:
+    return cia.cra;
+  case 0x0f:
+    return cia.crb;
+  default:
+    return 0x00;
+  }
+}
+
+void C64::write_cia(CIA& cia, reg8 reg, reg8 value)
+{
+  switch (reg) {
+  case 0x00:
+    cia.pra = value;
+    break;
+  case 0x01:
+    cia.prb = value;
+    break;
+  case 0x02:
+    cia.ddra = value;
+    break;
+  case 0x03:
+    cia.ddrb = value;
+    break;
+  case 0x04:
+    cia.ta_latch = (cia.ta_latch & 0xff00) | value;
+    break;
+  case 0x05:
+    cia.ta_latch = (cia.ta_latch & 0x00ff) | (value << 8);
+    // Writing the high byte loads a stopped timer.
+    if (!(cia.cra & 0x01)) {
+      cia.ta = cia.ta_latch;
+    }
+    break;
+  case 0x06:
+    cia.tb_latch = (cia.tb_latch & 0xff00) | value;
+    break;
+  case 0x07:
+    cia.tb_latch = (cia.tb_latch & 0x00ff) | (value << 8);
+    if (!(cia.crb & 0x01)) {
+      cia.tb = cia.tb_latch;
+    }
+    break;
+  case 0x0d:
+    if (value & 0x80) {
+      cia.icr_mask |= value & 0x1f;
+    }
+    else {
+      cia.icr_mask &= ~value;
+    }
+    cia.irq = (cia.icr & cia.icr_mask) != 0;
+    break;
+  case 0x0e:
+    // Force load strobe.
+    if (value & 0x10) {
+      cia.ta = cia.ta_latch;
+    }
+    cia.cra = value & ~0x10;
+    break;
+  case 0x0f:
+    if (value & 0x10) {
+      cia.tb = cia.tb_latch;
+    }
+    cia.crb = value & ~0x10;
+    break;
+  }
+}
+
+// A timer underflows ta + 1 cycles after having the value ta, and is then
+// reloaded from the latch.
+void C64::clock_cia(CIA& cia, cycle_count delta_t)
+{
+  int ta_underflows = 0;
+
+  if (cia.cra & 0x01) {
+    if (delta_t > (cycle_count)cia.ta) {
+      cycle_count period = cia.ta_latch + 1;
+      cycle_count rest = delta_t - cia.ta - 1;
+      ta_underflows = 1 + rest/period;
+      cia.icr |= 0x01;
+      if (cia.cra & 0x08) {
+	// One-shot.
+	cia.cra &= ~0x01;
+	cia.ta = cia.ta_latch;
+	ta_underflows = 1;
+      }
+      else {
+	cia.ta = cia.ta_latch - rest%period;
+      }
+    }
+    else {
+      cia.ta -= delta_t;
+    }
+  }
+
+  if (cia.crb & 0x01) {
+    // Timer B counts either cycles or timer A underflows.
+    cycle_count count = (cia.crb & 0x40) ? ta_underflows : delta_t;
+    if (count > (cycle_count)cia.tb) {
+      cycle_count period = cia.tb_latch + 1;
+      cycle_count rest = count - cia.tb - 1;
+      cia.icr |= 0x02;
+      if (cia.crb & 0x08) {
+	cia.crb &= ~0x01;
+	cia.tb = cia.tb_latch;
+      }
+      else {
+	cia.tb = cia.tb_latch - rest%period;
+      }
+    }
+    else {
+      cia.tb -= count;
+    }
+  }
+
+  if (cia.icr & cia.icr_mask) {
+    cia.irq = true;
+  }
+}
+
+// Cycles until the next timer interrupt.
+cycle_count C64::cia_event(const CIA& cia) const
+{
+  cycle_count next = 0x7fffffff;
+  if ((cia.cra & 0x01) && (cia.icr_mask & 0x01)) {
+    next = cia.ta + 1;
+  }
+  if ((cia.crb & 0x01) && !(cia.crb & 0x40) && (cia.icr_mask & 0x02) &&
+      (cycle_count)cia.tb + 1 < next)
+  {
+    next = cia.tb + 1;
+  }
+  return next;
+}
+
+
+// ----------------------------------------------------------------------------
+// VIC stand-in.
+// ----------------------------------------------------------------------------
+int C64::raster_line() const
+{
+  return frame_cycle/cycles_per_line;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock CIAs and VIC.
+// ----------------------------------------------------------------------------
+void C64::clock_devices(cycle_count delta_t)
+{
+  clock_cia(cia1, delta_t);
+  clock_cia(cia2, delta_t);
+
+  // Raster interrupt at the start of the compare line.
+  int frame_cycles = cycles_per_line*lines;
+  if (raster_compare < lines) {
+    int to_compare = raster_compare*cycles_per_line - frame_cycle;
+    if (to_compare <= 0) {
+      to_compare += frame_cycles;
+    }
+    if (delta_t >= to_compare) {
+      vic_irq_flags |= 0x01;
+    }
+  }
+  frame_cycle = (frame_cycle + delta_t) % frame_cycles;
+}
+
+
+// ----------------------------------------------------------------------------
+// Cycles until the next interrupt source may fire.
+// ----------------------------------------------------------------------------
+cycle_count C64::next_event() const
+{
+  cycle_count next = cia_event(cia1);
+  cycle_count next2 = cia_event(cia2);
+  if (next2 < next) {
+    next = next2;
+  }
+  if ((vic_irq_mask & 0x01) && raster_compare < lines) {
+    int to_compare = raster_compare*cycles_per_line - frame_cycle;
+    if (to_compare <= 0) {
+      to_compare += cycles_per_line*lines;
+    }
+    if (to_compare < next) {
+      next = to_compare;
+    }
+  }
+  return next;
+}
+
+
+// ----------------------------------------------------------------------------
+// Take interrupt.
+// ----------------------------------------------------------------------------
+void C64::interrupt(reg16 vector)
+{
+  push(pc >> 8);
+  push(pc & 0xff);
+  push((p & ~FLAG_B) | FLAG_U);
+  p |= FLAG_I;
+  pc = read(vector) | (read(vector + 1) << 8);
+
+  cycles += 7;
+  clock_devices(7);
+}
+
+
+// ----------------------------------------------------------------------------
+// ALU. Decimal mode follows the NMOS 6502, including the flags which are
+// computed from intermediate results.
+// ----------------------------------------------------------------------------
+void C64::adc(reg8 value)
+{
+  reg8 carry = p & FLAG_C;
+  unsigned int sum = a + value + carry;
+
+  p &= ~(FLAG_N | FLAG_V | FLAG_Z | FLAG_C);
+  if (!(sum & 0xff)) {
+    p |= FLAG_Z;
+  }
+
+  if (p & FLAG_D) {
+    unsigned int lo = (a & 0x0f) + (value & 0x0f) + carry;
+    if (lo > 0x09) {
+      lo += 0x06;
+    }
+    sum = (lo & 0x0f) + (a & 0xf0) + (value & 0xf0) + (lo > 0x0f ? 0x10 : 0);
+    p |= sum & FLAG_N;
+    if ((a ^ sum) & ~(a ^ value) & 0x80) {
+      p |= FLAG_V;
+    }
+    if ((sum & 0x1f0) > 0x90) {
+      sum += 0x60;
+    }
+    if ((sum & 0xff0) > 0xf0) {
+      p |= FLAG_C;
+    }
+  }
+  else {
+    p |= sum & FLAG_N;
+    if ((a ^ sum) & ~(a ^ value) & 0x80) {
+      p |= FLAG_V;
+    }
+    if (sum > 0xff) {
+      p |= FLAG_C;
+    }
+  }
+
+  a = sum & 0xff;
+}
+
+void C64::sbc(reg8 value)
+{
+  reg8 borrow = (p & FLAG_C) ? 0 : 1;
+  unsigned int diff = a - value - borrow;
+
+  // Flags are always computed in binary.
+  p &= ~(FLAG_N | FLAG_V | FLAG_Z | FLAG_C);
+  p |= diff & FLAG_N;
+  if (!(diff & 0xff)) {
+    p |= FLAG_Z;
+  }
+  if ((a ^ diff) & (a ^ value) & 0x80) {
+    p |= FLAG_V;
+  }
+  if (diff < 0x100) {
+    p |= FLAG_C;
+  }
+
+  if (p & FLAG_D) {
+    unsigned int lo = (a & 0x0f) - (value & 0x0f) - borrow;
+    unsigned int result;
+    if (lo & 0x10) {
+      result = ((lo - 0x06) & 0x0f) | ((a & 0xf0) - (value & 0xf0) - 0x10);
+    }
+    else {
+      result = (lo & 0x0f) | ((a & 0xf0) - (value & 0xf0));
+    }
+    if (result & 0x100) {
+      result -= 0x60;
+    }
+    diff = result;
+  }
+
+  a = diff & 0xff;
+}
+
+void C64::compare(reg8 reg, reg8 value)
+{
+  reg8 diff = (reg - value) & 0xff;
+  p = (p & ~(FLAG_N | FLAG_Z | FLAG_C)) | (diff & FLAG_N) |
+    (diff ? 0 : FLAG_Z) | (reg >= value ? FLAG_C : 0);
+}
+
+reg8 C64::asl(reg8 value)
+{
+  reg8 result = (value << 1) & 0xff;
+  p = (p & ~(FLAG_N | FLAG_Z | FLAG_C)) | (result & FLAG_N) |
+    (result ? 0 : FLAG_Z) | (value >> 7);
+  return result;
+}
+
+reg8 C64::lsr(reg8 value)
+{
+  reg8 result = value >> 1;
+  p = (p & ~(FLAG_N | FLAG_Z | FLAG_C)) |
+    (result ? 0 : FLAG_Z) | (value & FLAG_C);
+  return result;
+}
+
+reg8 C64::rol(reg8 value)
+{
+  reg8 result = ((value << 1) | (p & FLAG_C)) & 0xff;
+  p = (p & ~(FLAG_N | FLAG_Z | FLAG_C)) | (result & FLAG_N) |
+    (result ? 0 : FLAG_Z) | (value >> 7);
+  return result;
+}
+
+reg8 C64::ror(reg8 value)
+{
+  reg8 result = (value >> 1) | ((p & FLAG_C) << 7);
+  p = (p & ~(FLAG_N | FLAG_Z | FLAG_C)) | (result & FLAG_N) |
+    (result ? 0 : FLAG_Z) | (value & FLAG_C);
+  return result;
+}
+
+
+// ----------------------------------------------------------------------------
+// Execute until at least the given cycle.
+// ----------------------------------------------------------------------------
+void C64::run(unsigned long long until)
+{
+  while (cycles < until) {
+    // NMI is edge triggered.
+    if (unlikely(cia2.irq != nmi_line)) {
+      nmi_line = cia2.irq;
+      if (nmi_line && !irq_call) {
+	interrupt(0xfffa);
+      }
+    }
+
+    bool irq = cia1.irq || (vic_irq_flags & vic_irq_mask);
+
+    if (irq_call) {
+      // Driver mode; interrupts call the driver subroutine once the CPU is
+      // idle.
+      if (irq && pc == IDLE) {
+	vic_irq_flags = 0;
+	cia1.icr = 0;
+	cia1.irq = false;
+	set_bank(irq_call_bank);
+	call(irq_call, 0);
+      }
+    }
+    else if (irq && !(p & FLAG_I)) {
+      interrupt(0xfffe);
+    }
+
+    if (pc == IDLE) {
+      // Skip ahead to the next event.
+      cycle_count delta_t = next_event();
+      if (cycles + delta_t > until) {
+	delta_t = until - cycles;
+      }
+      cycles += delta_t;
+      clock_devices(delta_t);
+      continue;
+    }
+
+    execute();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Execute one instruction.
+// ----------------------------------------------------------------------------
+void C64::execute()
+{
+  instruction_cycle = cycles;
+
+  reg8 op = read(pc);
+  pc = (pc + 1) & 0xffff;
+
+  int length = cycle_table[op];
+  instruction_length = length;
+
+  // Effective address and page crossing.
+  reg16 ea = 0;
+  bool cross = false;
+
+  switch (mode_table[op]) {
+  case IMP:
+    break;
+  case IMM:
+    ea = pc;
+    pc = (pc + 1) & 0xffff;
+    break;
+  case ZP:
+    ea = read(pc);
+    pc = (pc + 1) & 0xffff;
+    break;
+  case ZPX:
+    ea = (read(pc) + x) & 0xff;
+    pc = (pc + 1) & 0xffff;
+    break;
+  case ZPY:
+    ea = (read(pc) + y) & 0xff;
+    pc = (pc + 1) & 0xffff;
+    break;
+  case ABS:
+    ea = read(pc) | (read((pc + 1) & 0xffff) << 8);
+    pc = (pc + 2) & 0xffff;
+    break;
+  case ABX:
+  case ABY:
+    {
+      reg16 base = read(pc) | (read((pc + 1) & 0xffff) << 8);
+      pc = (pc + 2) & 0xffff;
+      ea = (base + (mode_table[op] == ABX ? x : y)) & 0xffff;
+      cross = (base ^ ea) & 0xff00;
+    }
+    break;
+  case INX:
+    {
+      reg8 zp = (read(pc) + x) & 0xff;
+      pc = (pc + 1) & 0xffff;
+      ea = ram[zp] | (ram[(zp + 1) & 0xff] << 8);
+    }
+    break;
+  case INY:
+    {
+      reg8 zp = read(pc);
+      pc = (pc + 1) & 0xffff;
+      reg16 base = ram[zp] | (ram[(zp + 1) & 0xff] << 8);
+      ea = (base + y) & 0xffff;
+      cross = (base ^ ea) & 0xff00;
+    }
+    break;
+  case IND:
+    {
+      reg16 ptr = read(pc) | (read((pc + 1) & 0xffff) << 8);
+      pc = (pc + 2) & 0xffff;
+      // The high byte is fetched without carry into the page.
+      ea = read(ptr) | (read((ptr & 0xff00) | ((ptr + 1) & 0xff)) << 8);
+    }
+    break;
+  case REL:
+    ea = pc;
+    pc = (pc + 1) & 0xffff;
+    break;
+  }
+
+// Read operand, with page crossing penalty.
+#define LOAD() (instruction_length += cross, read(ea))
+// Store operand in the last cycle.
+#define STORE(v) write(ea, (v), length - 1)
+// Read-modify-write: the unmodified value is written back in the cycle
+// before the modified value.
+#define MODIFY(v, expr) \
+  { reg8 v = read(ea); write(ea, v, length - 2); expr; write(ea, v, length - 1); }
+#define SETNZ(v) (p = (p & ~(FLAG_N | FLAG_Z)) | ((v) & FLAG_N) | ((v) ? 0 : FLAG_Z))
+#define BRANCH(cond) \
+  if (cond) { \
+    reg16 target = (pc + (signed char)read(ea)) & 0xffff; \
+    instruction_length += 1 + (((pc ^ target) & 0xff00) != 0); \
+    pc = target; \
+  }
+
+  switch (op) {
+  // Loads and stores.
+  case 0xa1: case 0xa5: case 0xa9: case 0xad:
+  case 0xb1: case 0xb5: case 0xb9: case 0xbd:
+    a = LOAD(); SETNZ(a); break;
+  case 0xa2: case 0xa6: case 0xae: case 0xb6: case 0xbe:
+    x = LOAD(); SETNZ(x); break;
+  case 0xa0: case 0xa4: case 0xac: case 0xb4: case 0xbc:
+    y = LOAD(); SETNZ(y); break;
+  case 0x81: case 0x85: case 0x8d: case 0x91: case 0x95: case 0x99: case 0x9d:
+    STORE(a); break;
+  case 0x86: case 0x8e: case 0x96:
+    STORE(x); break;
+  case 0x84: case 0x8c: case 0x94:
+    STORE(y); break;
+
+  // Transfers.
+  case 0xaa: x = a; SETNZ(x); break;
+  case 0xa8: y = a; SETNZ(y); break;
+  case 0x8a: a = x; SETNZ(a); break;
+  case 0x98: a = y; SETNZ(a); break;
+  case 0xba: x = s; SETNZ(x); break;
+  case 0x9a: s = x; break;
+
+  // Stack.
+  case 0x48: push(a); break;
+  case 0x08: push(p | FLAG_B | FLAG_U); break;
+  case 0x68: a = pull(); SETNZ(a); break;
+  case 0x28: p = pull() | FLAG_U; break;
+
+  // Logical.
+  case 0x21: case 0x25: case 0x29: case 0x2d:
+  case 0x31: case 0x35: case 0x39: case 0x3d:
+    a &= LOAD(); SETNZ(a); break;
+  case 0x01: case 0x05: case 0x09: case 0x0d:
+  case 0x11: case 0x15: case 0x19: case 0x1d:
+    a |= LOAD(); SETNZ(a); break;
+  case 0x41: case 0x45: case 0x49: case 0x4d:
+  case 0x51: case 0x55: case 0x59: case 0x5d:
+    a ^= LOAD(); SETNZ(a); break;
+  case 0x24: case 0x2c:
+    {
+      reg8 v = LOAD();
+      p = (p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (v & (FLAG_N | FLAG_V)) |
+	((a & v) ? 0 : FLAG_Z);
+    }
+    break;
+
+  // Arithmetic.
+  case 0x61: case 0x65: case 0x69: case 0x6d:
+  case 0x71: case 0x75: case 0x79: case 0x7d:
+    adc(LOAD()); break;
+  case 0xe1: case 0xe5: case 0xe9: case 0xeb: case 0xed:
+  case 0xf1: case 0xf5: case 0xf9: case 0xfd:
+    sbc(LOAD()); break;
+  case 0xc1: case 0xc5: case 0xc9: case 0xcd:
+  case 0xd1: case 0xd5: case 0xd9: case 0xdd:
+    compare(a, LOAD()); break;
+  case 0xe0: case 0xe4: case 0xec:
+    compare(x, LOAD()); break;
+  case 0xc0: case 0xc4: case 0xcc:
+    compare(y, LOAD()); break;
+
+  // Increments and decrements.
+  case 0xe6: case 0xee: case 0xf6: case 0xfe:
+    MODIFY(v, v = (v + 1) & 0xff; SETNZ(v)); break;
+  case 0xc6: case 0xce: case 0xd6: case 0xde:
+    MODIFY(v, v = (v - 1) & 0xff; SETNZ(v)); break;
+  case 0xe8: x = (x + 1) & 0xff; SETNZ(x); break;
+  case 0xc8: y = (y + 1) & 0xff; SETNZ(y); break;
+  case 0xca: x = (x - 1) & 0xff; SETNZ(x); break;
+  case 0x88: y = (y - 1) & 0xff; SETNZ(y); break;
+
+  // Shifts.
+  case 0x0a: a = asl(a); break;
+  case 0x4a: a = lsr(a); break;
+  case 0x2a: a = rol(a); break;
+  case 0x6a: a = ror(a); break;
+  case 0x06: case 0x0e: case 0x16: case 0x1e:
+    MODIFY(v, v = asl(v)); break;
+  case 0x46: case 0x4e: case 0x56: case 0x5e:
+    MODIFY(v, v = lsr(v)); break;
+  case 0x26: case 0x2e: case 0x36: case 0x3e:
+    MODIFY(v, v = rol(v)); break;
+  case 0x66: case 0x6e: case 0x76: case 0x7e:
+    MODIFY(v, v = ror(v)); break;
+
+  // Jumps and calls.
+  case 0x4c: case 0x6c:
+    pc = ea; break;
+  case 0x20:
+    {
+      reg16 ret = (pc - 1) & 0xffff;
+      push(ret >> 8);
+      push(ret & 0xff);
+      pc = ea;
+    }
+    break;
+  case 0x60:
+    pc = pull();
+    pc = ((pc | (pull() << 8)) + 1) & 0xffff;
+    break;
+  case 0x40:
+    p = pull() | FLAG_U;
+    pc = pull();
+    pc |= pull() << 8;
+    break;
+  case 0x00:
+    {
+      reg16 ret = (pc + 1) & 0xffff;
+      push(ret >> 8);
+      push(ret & 0xff);
+      push(p | FLAG_B | FLAG_U);
+      p |= FLAG_I;
+      pc = read(0xfffe) | (read(0xffff) << 8);
+    }
+    break;
+
+  // Branches.
+  case 0x10: BRANCH(!(p & FLAG_N)); break;
+  case 0x30: BRANCH(p & FLAG_N); break;
+  case 0x50: BRANCH(!(p & FLAG_V)); break;
+  case 0x70: BRANCH(p & FLAG_V); break;
+  case 0x90: BRANCH(!(p & FLAG_C)); break;
+  case 0xb0: BRANCH(p & FLAG_C); break;
+  case 0xd0: BRANCH(!(p & FLAG_Z)); break;
+  case 0xf0: BRANCH(p & FLAG_Z); break;
+
+  // Flags.
+  case 0x18: p &= ~FLAG_C; break;
+  case 0x38: p |= FLAG_C; break;
+  case 0x58: p &= ~FLAG_I; break;
+  case 0x78: p |= FLAG_I; break;
+  case 0xb8: p &= ~FLAG_V; break;
+  case 0xd8: p &= ~FLAG_D; break;
+  case 0xf8: p |= FLAG_D; break;
+
+  // NOPs, including the undocumented ones with operands.
+  case 0xea:
+  case 0x1a: case 0x3a: case 0x5a: case 0x7a: case 0xda: case 0xfa:
+  case 0x80: case 0x82: case 0x89: case 0xc2: case 0xe2:
+  case 0x04: case 0x44: case 0x64:
+  case 0x14: case 0x34: case 0x54: case 0x74: case 0xd4: case 0xf4:
+  case 0x0c:
+    break;
+  case 0x1c: case 0x3c: case 0x5c: case 0x7c: case 0xdc: case 0xfc:
+    LOAD(); break;
+
+  // Undocumented instructions.
+  case 0xa3: case 0xa7: case 0xaf: case 0xb3: case 0xb7: case 0xbf:
+    // LAX
+    a = x = LOAD(); SETNZ(a); break;
+  case 0x83: case 0x87: case 0x8f: case 0x97:
+    // SAX
+    STORE(a & x); break;
+  case 0x03: case 0x07: case 0x0f: case 0x13: case 0x17: case 0x1b: case 0x1f:
+    // SLO
+    MODIFY(v, v = asl(v); a |= v; SETNZ(a)); break;
+  case 0x23: case 0x27: case 0x2f: case 0x33: case 0x37: case 0x3b: case 0x3f:
+    // RLA
+    MODIFY(v, v = rol(v); a &= v; SETNZ(a)); break;
+  case 0x43: case 0x47: case 0x4f: case 0x53: case 0x57: case 0x5b: case 0x5f:
+    // SRE
+    MODIFY(v, v = lsr(v); a ^= v; SETNZ(a)); break;
+  case 0x63: case 0x67: case 0x6f: case 0x73: case 0x77: case 0x7b: case 0x7f:
+    // RRA
+    MODIFY(v, v = ror(v); adc(v)); break;
+  case 0xc3: case 0xc7: case 0xcf: case 0xd3: case 0xd7: case 0xdb: case 0xdf:
+    // DCP
+    MODIFY(v, v = (v - 1) & 0xff; compare(a, v)); break;
+  case 0xe3: case 0xe7: case 0xef: case 0xf3: case 0xf7: case 0xfb: case 0xff:
+    // ISB
+    MODIFY(v, v = (v + 1) & 0xff; sbc(v)); break;
+  case 0x0b: case 0x2b:
+    // ANC
+    a &= read(ea); SETNZ(a);
+    p = (p & ~FLAG_C) | ((a >> 7) & FLAG_C);
+    break;
+  case 0x4b:
+    // ALR
+    a = lsr(a & read(ea)); break;
+  case 0x6b:
+    // ARR
+    a = ror(a & read(ea));
+    p = (p & ~(FLAG_C | FLAG_V)) | ((a >> 6) & FLAG_C) |
+      (((a >> 6) ^ (a >> 5)) & 0x01 ? FLAG_V : 0);
+    break;
+  case 0xcb:
+    // SBX
+    {
+      reg8 v = read(ea);
+      reg8 ax = a & x;
+      p = (p & ~FLAG_C) | (ax >= v ? FLAG_C : 0);
+      x = (ax - v) & 0xff;
+      SETNZ(x);
+    }
+    break;
+  case 0xbb:
+    // LAS
+    a = x = s = LOAD() & s; SETNZ(a); break;
+  case 0x8b:
+    // ANE; unstable, using the common magic constant.
+    a = (a | 0xee) & x & read(ea); SETNZ(a); break;
+  case 0xab:
+    // LXA; unstable, using the common magic constant.
+    a = x = (a | 0xee) & read(ea); SETNZ(a); break;
+  case 0x93: case 0x9f:
+    // SHA
+    STORE(a & x & ((ea >> 8) + 1)); break;
+  case 0x9e:
+    // SHX
+    STORE(x & ((ea >> 8) + 1)); break;
+  case 0x9c:
+    // SHY
+    STORE(y & ((ea >> 8) + 1)); break;
+  case 0x9b:
+    // TAS
+    s = a & x; STORE(s & ((ea >> 8) + 1)); break;
+
+  default:
+    // Jam. The CPU is stopped until the next driver call or interrupt.
+    instruction_length = 1;
+    pc = IDLE;
+    break;
+  }
+
+#undef LOAD
+#undef STORE
+#undef MODIFY
+#undef SETNZ
+#undef BRANCH
+
+  cycles += instruction_length;
+  clock_devices(instruction_length);
+}
+
+} // namespace reSID
@@ -0,0 +1,172 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_C64_H
+#define RESID_C64_H
+
+#include "siddefs.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// SID accesses from the C64. Accesses are timestamped with the exact cycle
+// of the bus access, counting from reset.
+// ----------------------------------------------------------------------------
+class SIDBus
+{
+public:
+  virtual ~SIDBus() {}
+  virtual reg8 read_sid(unsigned long long cycle, reg8 offset) = 0;
+  virtual void write_sid(unsigned long long cycle, reg8 offset, reg8 value) = 0;
+};
+
+
+// ----------------------------------------------------------------------------
+// A minimal, headless C64 for playing SID tunes.
+//
+// This is a 6502 (including the stable undocumented opcodes), 64KB RAM
+// with the processor port banking, two CIAs with timers and interrupts,
+// and a stand-in for the VIC which only provides the raster counter and the
+// raster interrupt. There is no display, no DMA cycle stealing (badlines,
+// sprites), no keyboard, and no ROMs; a small Kernal stand-in provides the
+// interrupt entry and exit code and the vectors which tunes depend on.
+//
+// Instructions are executed as a whole, however the SID is accessed on the
+// exact cycle of the bus access within the instruction, including the
+// dummy write of read-modify-write instructions.
+// ----------------------------------------------------------------------------
+class C64
+{
+public:
+  C64();
+
+  enum video_standard { PAL, NTSC };
+
+  void reset(video_standard video);
+  void set_sid(SIDBus* bus);
+
+  // Load data into RAM.
+  void load(reg16 address, const unsigned char* data, int size);
+  reg8 peek(reg16 address) const { return ram[address]; }
+  void poke(reg16 address, reg8 value) { ram[address] = value; }
+
+  // Call a subroutine; the CPU becomes idle when it returns.
+  void call(reg16 address, reg8 a);
+  bool idle() const { return pc == IDLE; }
+  // Set or clear the interrupt disable flag.
+  void disable_irq(bool disable);
+
+  // Driver interrupt hook. When set, interrupts which occur while the CPU
+  // is idle are acknowledged and the subroutine at address is called,
+  // instead of going through the interrupt vectors.
+  void set_irq_call(reg16 address, reg8 bank);
+
+  // Execute until at least the given cycle.
+  void run(unsigned long long until);
+
+  unsigned long long cycle() const { return cycles; }
+
+  // Timer and raster interrupt sources.
+  void set_cia1_timer(reg16 latch, bool irq);
+  void set_raster_irq(int line);
+
+  reg8 read(reg16 address);
+  void write(reg16 address, reg8 value, int offset);
+
+protected:
+  enum {
+    // Return address of call() and of the idle loop.
+    IDLE = 0x0000
+  };
+
+  struct CIA
+  {
+    reg16 ta, tb;
+    reg16 ta_latch, tb_latch;
+    reg8 cra, crb;
+    reg8 icr, icr_mask;
+    reg8 pra, prb, ddra, ddrb;
+    bool irq;
+  };
+
+  void set_bank(reg8 port);
+  reg8 read_io(reg16 address);
+  void write_io(reg16 address, reg8 value, int offset);
+
+  void reset_cia(CIA& cia);
+  reg8 read_cia(CIA& cia, reg8 reg);
+  void write_cia(CIA& cia, reg8 reg, reg8 value);
+  void clock_cia(CIA& cia, cycle_count delta_t);
+  cycle_count cia_event(const CIA& cia) const;
+
+  void clock_devices(cycle_count delta_t);
+  cycle_count next_event() const;
+  int raster_line() const;
+
+  void execute();
+  void interrupt(reg16 vector);
+
+  void adc(reg8 value);
+  void sbc(reg8 value);
+  void compare(reg8 reg, reg8 value);
+  reg8 asl(reg8 value);
+  reg8 lsr(reg8 value);
+  reg8 rol(reg8 value);
+  reg8 ror(reg8 value);
+
+  void push(reg8 value) { ram[0x100 | s] = value; s = (s - 1) & 0xff; }
+  reg8 pull() { s = (s + 1) & 0xff; return ram[0x100 | s]; }
+
+  // CPU registers.
+  reg8 a, x, y, s, p;
+  reg16 pc;
+
+  unsigned long long cycles;
+  // Start of the current instruction, and its number of cycles.
+  unsigned long long instruction_cycle;
+  int instruction_length;
+
+  // Memory configuration.
+  reg8 port_ddr, port_data;
+  bool io_visible, kernal_visible;
+
+  unsigned char ram[0x10000];
+  unsigned char kernal[0x2000];
+
+  CIA cia1, cia2;
+  bool nmi_line;
+
+  // VIC stand-in.
+  int cycles_per_line;
+  int lines;
+  int frame_cycle;
+  int raster_compare;
+  unsigned char vic[0x40];
+  reg8 vic_irq_flags, vic_irq_mask;
+
+  SIDBus* sid;
+
+  reg16 irq_call;
+  reg8 irq_call_bank;
+};
+
+} // namespace reSID
+
+#endif // not RESID_C64_H
@@ -0,0 +1,370 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+
+namespace reSID
+{
+
+static const char checkpoint_magic[8] = { 'r', 'e', 'S', 'I', 'D', 'c', 'k', 'p' };
+
+// Number of stores in this process, for unique temporary file names.
+static std::atomic<unsigned long> store_count(0);
+
+// Checkpoint file header, followed by a SID::State.
+struct CheckpointHeader
+{
+  char magic[8];
+  HashDigest pcm_key;
+  unsigned long long sample_count;
+};
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+RenderCache::RenderCache()
+{
+  max_size = 0;
+  checkpoint_interval = 0;
+  total_size = 0;
+  hits = partial_hits = misses = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Use directory for the cache, creating it if necessary.
+// ----------------------------------------------------------------------------
+bool RenderCache::open(const char* directory, unsigned long long max_size,
+		       size_t checkpoint_interval)
+{
+  if (mkdir(directory, 0777) < 0) {
+    struct stat st;
+    if (stat(directory, &st) < 0 || !S_ISDIR(st.st_mode)) {
+      return false;
+    }
+  }
+
+  this->directory = directory;
+  this->max_size = max_size;
+  this->checkpoint_interval = checkpoint_interval ? checkpoint_interval : 1;
+
+  return evict();
+}
+
+
+// ----------------------------------------------------------------------------
+// File name of cache entry.
+// ----------------------------------------------------------------------------
+std::string RenderCache::path(const HashDigest& key, const char* suffix) const
+{
+  char hex[33];
+  key.hex(hex);
+  return directory + "/" + hex + suffix;
+}
+
+
+// ----------------------------------------------------------------------------
+// Read the first count samples of a .pcm entry (all samples if count is -1),
+// and mark the entry as recently used.
+// ----------------------------------------------------------------------------
+bool RenderCache::read_samples(const HashDigest& key, unsigned long long count,
+			       std::vector<short>& samples)
+{
+  std::string filename = path(key, ".pcm");
+
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fileno(f), &st) < 0 ||
+      (st.st_size % sizeof(short)) != 0 ||
+      (count != (unsigned long long)-1 && count*sizeof(short) > (unsigned long long)st.st_size))
+  {
+    fclose(f);
+    return false;
+  }
+  if (count == (unsigned long long)-1) {
+    count = st.st_size/sizeof(short);
+  }
+
+  samples.resize(count);
+  bool ok = !count || fread(&samples[0], sizeof(short), count, f) == count;
+  fclose(f);
+
+  if (ok) {
+    utimes(filename.c_str(), 0);
+  }
+
+  return ok;
+}
+
+
+// ----------------------------------------------------------------------------
+// Read a .ckp entry.
+// ----------------------------------------------------------------------------
+bool RenderCache::read_checkpoint(const HashDigest& key, HashDigest& pcm_key,
+				  unsigned long long& sample_count,
+				  SID::State& state)
+{
+  std::string filename = path(key, ".ckp");
+
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+
+  CheckpointHeader header;
+  bool ok =
+    fread(&header, sizeof(header), 1, f) == 1 &&
+    memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) == 0 &&
+    fread(&state, sizeof(state), 1, f) == 1;
+  fclose(f);
+
+  if (ok) {
+    pcm_key = header.pcm_key;
+    sample_count = header.sample_count;
+    utimes(filename.c_str(), 0);
+  }
+
+  return ok;
+}
+
+
+// ----------------------------------------------------------------------------
+// Atomically store a cache entry.
+// ----------------------------------------------------------------------------
+bool RenderCache::store(const std::string& filename,
+			const void* data1, size_t size1,
+			const void* data2, size_t size2)
+{
+  char suffix[48];
+  sprintf(suffix, ".tmp%ld.%lu", (long)getpid(),
+	  store_count.fetch_add(1, std::memory_order_relaxed));
+  std::string tmpname = filename + suffix;
+
+  FILE* f = fopen(tmpname.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+
+  bool ok =
+    (!size1 || fwrite(data1, size1, 1, f) == 1) &&
+    (!size2 || fwrite(data2, size2, 1, f) == 1);
+  ok = fclose(f) == 0 && ok;
+
+  // An entry replacing an existing one, e.g. stored by another process in
+  // the meantime, does not add to the size of the cache.
+  struct stat st;
+  unsigned long long replaced =
+    stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+
+  if (!ok || rename(tmpname.c_str(), filename.c_str()) < 0) {
+    unlink(tmpname.c_str());
+    return false;
+  }
+
+  total_size += size1 + size2;
+  total_size -= std::min(replaced, total_size);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render trace, reading from the cache where possible.
+// ----------------------------------------------------------------------------
+bool RenderCache::render(SID& sid, const Trace& trace,
+			 const RenderSettings& settings,
+			 std::vector<short>& samples)
+{
+  size_t size = trace.writes.size();
+
+  // Anything which changes the output must be part of the key.
+  // The checkpoints contain a raw SID::State, so its layout is included as
+  // well.
+  Hash hash;
+  hash.update(resid_version_string);
+  hash.update((unsigned int)sizeof(SID::State));
+  settings.hash(hash);
+
+  // Prefix keys.
+  std::vector<Checkpoint> checkpoints;
+  for (size_t i = checkpoint_interval; i < size; i += checkpoint_interval) {
+    trace.hash(hash, i - checkpoint_interval, i);
+    Checkpoint c = { i, hash.digest(), 0 };
+    checkpoints.push_back(c);
+  }
+  trace.hash(hash, checkpoints.empty() ? 0 : checkpoints.back().index, size);
+  // The tail separates the full key from prefix keys.
+  hash.update("tail");
+  hash.update((unsigned int)trace.tail);
+  HashDigest key = hash.digest();
+
+  // Full hit.
+  if (read_samples(key, (unsigned long long)-1, samples)) {
+    hits++;
+    return true;
+  }
+
+  if (!settings.configure(sid)) {
+    return false;
+  }
+
+  // Partial hit; find the last checkpoint which is present.
+  SID::State* state = new SID::State();
+  TracePlayer player(sid, trace);
+  size_t first = 0;
+
+  for (size_t i = checkpoints.size(); i-- > 0; ) {
+    HashDigest pcm_key;
+    unsigned long long sample_count;
+    if (read_checkpoint(checkpoints[i].key, pcm_key, sample_count, *state) &&
+	read_samples(pcm_key, sample_count, samples))
+    {
+      sid.write_state(*state);
+      player.seek(checkpoints[i].index, sample_count);
+      first = i + 1;
+      break;
+    }
+  }
+
+  if (first) {
+    partial_hits++;
+  }
+  else {
+    samples.clear();
+    misses++;
+  }
+
+  // Render the remainder, saving state at each checkpoint.
+  const int chunk = 4096;
+  size_t s = samples.size();
+
+  for (size_t i = first; ; i++) {
+    player.set_stop(i < checkpoints.size() ? checkpoints[i].index : (size_t)-1);
+
+    for (;;) {
+      samples.resize(s + chunk);
+      int n = player.clock(&samples[s], chunk);
+      s += n;
+      if (n < chunk) {
+	break;
+      }
+    }
+    samples.resize(s);
+
+    if (i == checkpoints.size()) {
+      break;
+    }
+
+    // The full key is not known to be stored until the end; a checkpoint
+    // referencing a missing .pcm entry is simply ignored on lookup.
+    CheckpointHeader header;
+    memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+    header.pcm_key = key;
+    header.sample_count = s;
+    *state = sid.read_state();
+    store(path(checkpoints[i].key, ".ckp"), &header, sizeof(header),
+	  state, sizeof(*state));
+  }
+
+  delete state;
+
+  // A failure to store the result is not an error; the render is complete.
+  store(path(key, ".pcm"), s ? &samples[0] : 0, s*sizeof(short), 0, 0);
+  if (total_size > max_size) {
+    evict();
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Scan the directory, and evict least recently used entries until the cache
+// fits in max_size.
+// ----------------------------------------------------------------------------
+bool RenderCache::evict()
+{
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    return false;
+  }
+
+  struct Entry
+  {
+    time_t mtime;
+    unsigned long long size;
+    std::string filename;
+
+    bool operator<(const Entry& e) const { return mtime < e.mtime; }
+  };
+
+  std::vector<Entry> entries;
+  unsigned long long total = 0;
+
+  struct dirent* d;
+  while ((d = readdir(dir))) {
+    size_t len = strlen(d->d_name);
+    if (len < 4 ||
+	(strcmp(d->d_name + len - 4, ".pcm") != 0 &&
+	 strcmp(d->d_name + len - 4, ".ckp") != 0))
+    {
+      continue;
+    }
+
+    Entry e;
+    e.filename = directory + "/" + d->d_name;
+    struct stat st;
+    if (stat(e.filename.c_str(), &st) < 0) {
+      continue;
+    }
+    e.mtime = st.st_mtime;
+    e.size = st.st_size;
+    total += e.size;
+    entries.push_back(e);
+  }
+  closedir(dir);
+
+  if (total > max_size) {
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size() && total > max_size; i++) {
+      if (unlink(entries[i].filename.c_str()) == 0) {
+	total -= entries[i].size;
+      }
+    }
+  }
+
+  total_size = total;
+  return true;
+}
+
+} // namespace reSID
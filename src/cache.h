@@ -0,0 +1,106 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_CACHE_H
+#define RESID_CACHE_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "hash.h"
+#include "trace.h"
+#include <string>
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Content-addressed render cache on local disk.
+//
+// Renders are keyed by a hash of the library version, the render settings
+// and the trace. A finished render is stored as <key>.pcm, containing the
+// raw samples in host byte order.
+//
+// Every checkpoint_interval writes, a checkpoint <prefix key>.ckp is stored
+// as well, keyed by the hash of the trace prefix. A checkpoint holds the
+// complete SID state at that point, the number of samples rendered so far,
+// and the key of a .pcm file containing those samples. A trace which shares
+// a prefix with a previously rendered trace (e.g. the same tune played for
+// a longer time) is thus continued from the last common checkpoint rather
+// than rendered from scratch.
+//
+// Cache entries are evicted least recently used first; the modification
+// time of a file is updated on each hit. The size of the cache is counted
+// in memory from the entries stored since the directory was last scanned,
+// and the directory is only scanned again once the count exceeds max_size.
+// Entries stored by other RenderCache objects are thus only seen on the
+// next scan.
+//
+// Entries are written to a temporary file with a name unique to the
+// process and the store, which is renamed into place, so that several
+// threads and processes may share a cache directory.
+// ----------------------------------------------------------------------------
+class RenderCache
+{
+public:
+  RenderCache();
+
+  bool open(const char* directory, unsigned long long max_size = 1ULL << 30,
+	    size_t checkpoint_interval = 1 << 12);
+
+  // Render trace, reading from the cache where possible. The SID is
+  // configured according to settings. Returns false on error.
+  bool render(SID& sid, const Trace& trace, const RenderSettings& settings,
+	      std::vector<short>& samples);
+
+  // Scan the directory, and evict least recently used entries until the
+  // cache fits in max_size.
+  bool evict();
+
+  // Statistics.
+  unsigned long hits;
+  unsigned long partial_hits;
+  unsigned long misses;
+
+protected:
+  struct Checkpoint
+  {
+    size_t index;
+    HashDigest key;
+    unsigned long long sample_count;
+  };
+
+  std::string path(const HashDigest& key, const char* suffix) const;
+  bool read_samples(const HashDigest& key, unsigned long long count,
+		    std::vector<short>& samples);
+  bool read_checkpoint(const HashDigest& key, HashDigest& pcm_key,
+		       unsigned long long& sample_count, SID::State& state);
+  bool store(const std::string& filename, const void* data1, size_t size1,
+	     const void* data2, size_t size2);
+
+  std::string directory;
+  unsigned long long max_size;
+  size_t checkpoint_interval;
+  // Size of the cache as of the last scan, plus the entries stored since.
+  unsigned long long total_size;
+};
+
+} // namespace reSID
+
+#endif // not RESID_CACHE_H
@@ -0,0 +1,452 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residcheck - run by "make check".
+//
+// Renders a generated trace with each of the rendering engines, and
+// compares the output with that of a plain SID rendering the trace with
+// TracePlayer, for both chip models and all sampling methods. The filter
+// bias and voice mask differ from the defaults, and are set up for each
+// engine as for the plain SID.
+//
+// The output must be identical. SIDFanout, SIDBatch and SIDMatrix clock the
+// chips cycle by cycle with SAMPLE_FAST, whereas SID::clock() clocks the
+// chip in larger steps; for these, the output is compared with that of a
+// plain SID clocked cycle by cycle with the same sampling points.
+// ----------------------------------------------------------------------------
+
+#include "fanout.h"
+#include "multisid.h"
+#include "sidbatch.h"
+#include "segment.h"
+#include "pipeline.h"
+#include "matrix.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace reSID;
+
+enum {
+  // Samples per clock() call.
+  CHUNK = 1000
+};
+
+// ----------------------------------------------------------------------------
+// A trace of about two seconds, with random writes to the voice and filter
+// registers after an initial setup playing all voices through the filter.
+// ----------------------------------------------------------------------------
+static void generate(Trace& trace)
+{
+  static const reg8 setup[][2] = {
+    { 0x00, 0x00 }, { 0x01, 0x08 }, { 0x02, 0x00 }, { 0x03, 0x08 },
+    { 0x05, 0x09 }, { 0x06, 0xa8 }, { 0x04, 0x41 },
+    { 0x07, 0x80 }, { 0x08, 0x0c }, { 0x0c, 0x22 }, { 0x0d, 0xc6 },
+    { 0x0b, 0x21 },
+    { 0x0e, 0x40 }, { 0x0f, 0x21 }, { 0x13, 0x00 }, { 0x14, 0xf0 },
+    { 0x12, 0x15 },
+    { 0x15, 0x05 }, { 0x16, 0x40 }, { 0x17, 0xf3 }, { 0x18, 0x1f }
+  };
+
+  trace.clear();
+  for (size_t i = 0; i < sizeof(setup)/sizeof(*setup); i++) {
+    trace.add(i ? 20 : 0, setup[i][0], setup[i][1]);
+  }
+
+  // Fixed sequence, as the output must not vary from run to run.
+  unsigned int seed = 1;
+  for (int i = 0; i < 1000; i++) {
+    seed = seed*1103515245 + 12345;
+    reg8 offset = (seed >> 16)%0x19;
+    seed = seed*1103515245 + 12345;
+    reg8 value = seed >> 16;
+    seed = seed*1103515245 + 12345;
+    cycle_count delta = (seed >> 16)%4000;
+    // Keep the volume up, so that the output is mostly not silent.
+    if (offset == 0x18) {
+      value |= 0x08;
+    }
+    trace.add(delta, offset, value);
+  }
+  trace.tail = 20000;
+}
+
+
+// ----------------------------------------------------------------------------
+// Play a trace on an engine with the interface of SID, applying each write
+// after clocking its delta.
+// ----------------------------------------------------------------------------
+template<class Engine>
+static void play(Engine& engine, const Trace& trace,
+		 std::vector<short>& samples)
+{
+  short buf[CHUNK];
+  samples.clear();
+  for (size_t i = 0; i <= trace.writes.size(); i++) {
+    cycle_count delta_t =
+      i < trace.writes.size() ? trace.writes[i].delta : trace.tail;
+    while (delta_t > 0) {
+      int s = engine.clock(delta_t, buf, CHUNK);
+      samples.insert(samples.end(), buf, buf + s);
+    }
+    if (i < trace.writes.size()) {
+      engine.write(trace.writes[i].offset, trace.writes[i].value);
+    }
+  }
+}
+
+// Adapters from the engines to the interface of play().
+
+// A plain SID sampled as by SID::clock() with SAMPLE_FAST, however clocked
+// cycle by cycle by the single cycle SID::clock(), rather than in larger
+// steps.
+struct CycleEngine
+{
+  enum { FIXP_SHIFT = 16, FIXP_MASK = 0xffff };
+
+  SID sid;
+  cycle_count cycles_per_sample;
+  cycle_count sample_offset;
+
+  int clock(cycle_count& delta_t, short* buf, int n)
+  {
+    int s;
+    for (s = 0; s < n; s++) {
+      cycle_count next_sample_offset =
+	sample_offset + cycles_per_sample + (1 << (FIXP_SHIFT - 1));
+      cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+      if (delta_t_sample > delta_t) {
+	delta_t_sample = delta_t;
+      }
+      for (int i = 0; i < delta_t_sample; i++) {
+	sid.clock();
+      }
+      if ((delta_t -= delta_t_sample) == 0) {
+	sample_offset -= delta_t_sample << FIXP_SHIFT;
+	break;
+      }
+      sample_offset =
+	(next_sample_offset & FIXP_MASK) - (1 << (FIXP_SHIFT - 1));
+      buf[s] = sid.output();
+    }
+    return s;
+  }
+  void write(reg8 offset, reg8 value) { sid.write(offset, value); }
+};
+
+struct FanoutEngine
+{
+  SIDFanout fanout;
+
+  int clock(cycle_count& delta_t, short* buf, int n)
+  {
+    return fanout.clock(delta_t, &buf, n);
+  }
+  void write(reg8 offset, reg8 value) { fanout.write(offset, value); }
+};
+
+struct MultiSIDEngine
+{
+  MultiSID multi;
+
+  int clock(cycle_count& delta_t, short* buf, int n)
+  {
+    return multi.clock(delta_t, buf, n);
+  }
+  void write(reg8 offset, reg8 value) { multi.sid(0).write(offset, value); }
+};
+
+// Both chips of the batch play the trace; the second chip is checked.
+struct BatchEngine
+{
+  SIDBatch batch;
+
+  int clock(cycle_count& delta_t, short* buf, int n)
+  {
+    short frames[2*CHUNK];
+    int s = batch.clock(delta_t, frames, n);
+    for (int i = 0; i < s; i++) {
+      buf[i] = frames[2*i + 1];
+    }
+    return s;
+  }
+  void write(reg8 offset, reg8 value)
+  {
+    batch.write(0, offset, value);
+    batch.write(1, offset, value);
+  }
+};
+
+struct MatrixEngine
+{
+  SIDMatrix matrix;
+
+  int clock(cycle_count& delta_t, short* buf, int n)
+  {
+    return matrix.clock(delta_t, buf, n);
+  }
+  void write(reg8 offset, reg8 value) { matrix.write(0, offset, value); }
+};
+
+
+// ----------------------------------------------------------------------------
+// Renders with each engine. Returns false for rejected settings.
+// ----------------------------------------------------------------------------
+static bool render_plain(const RenderSettings& settings, const Trace& trace,
+			 std::vector<short>& samples)
+{
+  SID sid;
+  if (!settings.configure(sid)) {
+    return false;
+  }
+  TracePlayer player(sid, trace);
+  short buf[CHUNK];
+  samples.clear();
+  int s;
+  while ((s = player.clock(buf, CHUNK)) > 0) {
+    samples.insert(samples.end(), buf, buf + s);
+  }
+  return true;
+}
+
+static bool render_cycles(const RenderSettings& settings,
+			  const Trace& trace, std::vector<short>& samples)
+{
+  CycleEngine engine;
+  if (!settings.configure(engine.sid)) {
+    return false;
+  }
+  engine.cycles_per_sample =
+    cycle_count(settings.clock_freq/settings.sample_freq*
+		(1 << CycleEngine::FIXP_SHIFT) + 0.5);
+  engine.sample_offset = 0;
+  play(engine, trace, samples);
+  return true;
+}
+
+static bool render_fanout(const RenderSettings& settings,
+			  const Trace& trace, std::vector<short>& samples)
+{
+  FanoutEngine engine;
+  SIDFanout& fanout = engine.fanout;
+  if (!settings.configure(fanout.sid())) {
+    return false;
+  }
+  int b = fanout.add_backend();
+  fanout.enable_filter(b, settings.filter);
+  fanout.enable_external_filter(b, settings.external_filter);
+  fanout.adjust_filter_bias(b, settings.filter_bias);
+  fanout.set_voice_mask(settings.voice_mask);
+  play(engine, trace, samples);
+  return true;
+}
+
+static bool render_multisid(const RenderSettings& settings,
+			    const Trace& trace, std::vector<short>& samples)
+{
+  MultiSIDEngine engine;
+  MultiSID& multi = engine.multi;
+  multi.set_chips(1);
+  multi.sid(0).set_chip_model(settings.model);
+  if (!multi.set_sampling_parameters(settings.clock_freq, settings.method,
+				     settings.sample_freq, settings.pass_freq,
+				     settings.filter_scale))
+  {
+    return false;
+  }
+  settings.restart(multi.sid(0));
+  play(engine, trace, samples);
+  return true;
+}
+
+static bool render_batch(const RenderSettings& settings, const Trace& trace,
+			 std::vector<short>& samples)
+{
+  BatchEngine engine;
+  SIDBatch& batch = engine.batch;
+  if (!batch.open(2, settings.model, settings.clock_freq, settings.method,
+		  settings.sample_freq, settings.pass_freq,
+		  settings.filter_scale))
+  {
+    return false;
+  }
+  // The initial state, as in RenderSettings::restart().
+  batch.enable_filter(settings.filter);
+  batch.enable_external_filter(settings.external_filter);
+  for (int c = 0; c < 2; c++) {
+    batch.adjust_filter_bias(c, settings.filter_bias);
+    batch.write_state(c, SID::State());
+    batch.set_voice_mask(c, settings.voice_mask);
+  }
+  play(engine, trace, samples);
+  return true;
+}
+
+static bool render_segments(const RenderSettings& settings,
+			    const Trace& trace, std::vector<short>& samples)
+{
+  // Short overlaps, so that the MOS8580 segments are checked for
+  // convergence and some are rendered again.
+  SegmentRenderer renderer(1 << 14);
+  SID sid;
+  return renderer.render(sid, trace, settings, samples, 8, 4);
+}
+
+static bool render_pipeline(const RenderSettings& settings,
+			    const Trace& trace, std::vector<short>& samples)
+{
+  SID sid;
+  if (!settings.configure(sid)) {
+    return false;
+  }
+  PipelinedRenderer::render(sid, trace, samples);
+  return true;
+}
+
+static bool render_matrix(const RenderSettings& settings,
+			  const Trace& trace, std::vector<short>& samples)
+{
+  MatrixEngine engine;
+  SIDMatrix& matrix = engine.matrix;
+  matrix.set_chips(1);
+  matrix.sid(0).set_chip_model(settings.model);
+  if (!matrix.set_sampling_parameters(settings.clock_freq, settings.method,
+				      settings.sample_freq,
+				      settings.pass_freq,
+				      settings.filter_scale))
+  {
+    return false;
+  }
+  settings.restart(matrix.sid(0));
+  play(engine, trace, samples);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Compare the output of an engine with the reference output. Returns false
+// on mismatch.
+// ----------------------------------------------------------------------------
+static bool compare(const char* engine, const char* setting,
+		    const std::vector<short>& reference,
+		    const std::vector<short>& samples)
+{
+  printf("%-9s %s: ", engine, setting);
+
+  if (samples.size() != reference.size()) {
+    printf("FAIL, %lu samples, expected %lu\n",
+	   (unsigned long)samples.size(), (unsigned long)reference.size());
+    return false;
+  }
+
+  size_t differing = 0;
+  size_t first = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    if (samples[i] != reference[i] && !differing++) {
+      first = i;
+    }
+  }
+
+  if (differing) {
+    printf("FAIL, %lu samples differ, from sample %lu\n",
+	   (unsigned long)differing, (unsigned long)first);
+    return false;
+  }
+
+  printf("ok\n");
+  return true;
+}
+
+
+int main()
+{
+  static const struct {
+    const char* name;
+    bool (*render)(const RenderSettings&, const Trace&,
+		   std::vector<short>&);
+    // Whether the chips are clocked cycle by cycle with SAMPLE_FAST.
+    bool cycle_by_cycle;
+  } engines[] = {
+    { "fanout", render_fanout, true },
+    { "multisid", render_multisid, false },
+    { "batch", render_batch, true },
+    { "segments", render_segments, false },
+    { "pipeline", render_pipeline, false },
+    { "matrix", render_matrix, true }
+  };
+  static const chip_model models[] = { MOS6581, MOS8580 };
+  static const struct {
+    const char* name;
+    sampling_method method;
+  } methods[] = {
+    { "fast", SAMPLE_FAST },
+    { "interpolate", SAMPLE_INTERPOLATE },
+    { "resample", SAMPLE_RESAMPLE },
+    { "fastmem", SAMPLE_RESAMPLE_FASTMEM }
+  };
+
+  Trace trace;
+  generate(trace);
+
+  RenderSettings settings;
+  settings.filter_bias = 0.3;
+  settings.voice_mask = 0x05;
+
+  int failed = 0;
+  for (int m = 0; m < 2; m++) {
+    for (int k = 0; k < 4; k++) {
+      settings.model = models[m];
+      settings.method = methods[k].method;
+
+      char setting[64];
+      snprintf(setting, sizeof(setting), "%s %s",
+	       models[m] == MOS6581 ? "6581" : "8580", methods[k].name);
+
+      std::vector<short> plain, cycles, samples;
+      if (!render_plain(settings, trace, plain) ||
+	  (settings.method == SAMPLE_FAST &&
+	   !render_cycles(settings, trace, cycles)))
+      {
+	printf("plain     %s: FAIL, sampling parameters rejected\n",
+	       setting);
+	failed++;
+	continue;
+      }
+
+      for (size_t e = 0; e < sizeof(engines)/sizeof(*engines); e++) {
+	const std::vector<short>& reference =
+	  settings.method == SAMPLE_FAST && engines[e].cycle_by_cycle ?
+	  cycles : plain;
+	if (!engines[e].render(settings, trace, samples)) {
+	  printf("%-9s %s: FAIL, sampling parameters rejected\n",
+		 engines[e].name, setting);
+	  failed++;
+	}
+	else if (!compare(engines[e].name, setting, reference, samples)) {
+	  failed++;
+	}
+      }
+    }
+  }
+
+  if (failed) {
+    printf("%d checks failed\n", failed);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "clipgen.h"
+#include <math.h>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// SplitMix64, seeded per clip.
+// ----------------------------------------------------------------------------
+class ClipRandom
+{
+public:
+  ClipRandom(unsigned long long seed, unsigned long long id)
+  {
+    state = seed ^ (id*0xd1342543de82ef95ULL);
+    next();
+  }
+
+  unsigned long long next()
+  {
+    unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [lo, hi].
+  int range(int lo, int hi)
+  {
+    return lo + (int)(next()%(unsigned long long)(hi - lo + 1));
+  }
+
+  // True with probability percent/100.
+  bool chance(int percent)
+  {
+    return range(0, 99) < percent;
+  }
+
+protected:
+  unsigned long long state;
+};
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+ClipGenerator::ClipGenerator(unsigned long long seed, int frames,
+			     cycle_count frame_cycles, double clock_freq)
+{
+  this->seed = seed;
+  this->frames = frames;
+  this->frame_cycles = frame_cycles;
+  this->clock_freq = clock_freq;
+}
+
+
+// ----------------------------------------------------------------------------
+// Generate clip parameters.
+// ----------------------------------------------------------------------------
+void ClipGenerator::generate(unsigned long long id, ClipParams& params,
+			     chip_model model, bool random_model) const
+{
+  static const int scales[3][7] = {
+    { 0, 2, 4, 5, 7, 9, 11 },	// Major.
+    { 0, 2, 3, 5, 7, 8, 10 },	// Natural minor.
+    { 0, 2, 4, 7, 9, 12, 14 }	// Pentatonic.
+  };
+  // Waveforms, with combined waveforms and noise less likely.
+  static const reg8 waveforms[] = {
+    0x10, 0x10, 0x20, 0x20, 0x20, 0x40, 0x40, 0x40, 0x80, 0x50, 0x60, 0x30
+  };
+  // Filter modes: low pass, band pass, high pass and notch.
+  static const reg4 modes[] = { 0x1, 0x1, 0x2, 0x4, 0x5 };
+
+  ClipRandom random(seed, id);
+
+  params.id = id;
+  params.model = random_model ? (random.chance(50) ? MOS8580 : MOS6581) : model;
+
+  // Chord on a random root; voice 1 is the bass.
+  const int* scale = scales[random.range(0, 2)];
+  int root = random.range(36, 59);
+  int degree = random.range(0, 6);
+  int voices = random.range(1, 3);
+
+  for (int i = 0; i < 3; i++) {
+    ClipVoice& voice = params.voice[i];
+
+    int step = degree + 2*i;
+    int note = root + scale[step%7] + 12*(step/7) + (i ? 12 : 0);
+    if (random.chance(20)) {
+      note += 12;
+    }
+    voice.note = note;
+
+    double f = 440*pow(2.0, (note - 69)/12.0)*16777216.0/clock_freq;
+    voice.freq = f < 65535 ? (reg16)(f + 0.5) : 0xffff;
+
+    // Voices beyond the chord still run, as modulation sources.
+    voice.gate = i < voices;
+
+    reg8 control =
+      waveforms[random.range(0, sizeof(waveforms)/sizeof(*waveforms) - 1)];
+    if (random.chance(15)) {
+      // Ring modulation replaces the triangle output.
+      control = 0x14;
+    }
+    if (random.chance(15)) {
+      control |= 0x02;
+    }
+    voice.control = control;
+
+    voice.pw = random.range(0x100, 0xf00);
+    voice.pwm = (control & 0x40) && random.chance(50) ?
+      random.range(8, 64)*(random.chance(50) ? 1 : -1) : 0;
+
+    // Mostly short attacks.
+    voice.attack = random.chance(60) ? random.range(0, 4) : random.range(0, 15);
+    voice.decay = random.range(0, 15);
+    voice.sustain = random.range(0, 15);
+    voice.release = random.range(0, 15);
+    voice.gate_frames = random.range(frames/5, frames*4/5);
+  }
+
+  params.route = 0;
+  params.mode = 0;
+  params.resonance = 0;
+  params.cutoff_start = params.cutoff_end = 0x7ff;
+  if (random.chance(60)) {
+    params.route = random.range(1, 7);
+    params.mode = modes[random.range(0, sizeof(modes)/sizeof(*modes) - 1)];
+    params.resonance = random.range(0, 15);
+    params.cutoff_start = random.range(0, 0x7ff);
+    params.cutoff_end = random.chance(70) ?
+      random.range(0, 0x7ff) : params.cutoff_start;
+  }
+  params.volume = random.range(10, 15);
+}
+
+
+// ----------------------------------------------------------------------------
+// Generate register program. Writes are spaced like absolute stores from a
+// player routine, and the first write of each frame is at the frame start.
+// ----------------------------------------------------------------------------
+void ClipGenerator::program(const ClipParams& params, Trace& trace) const
+{
+  const cycle_count spacing = 4;
+
+  trace.clear();
+
+  // Cycles since the last write, and since the start of the frame.
+  cycle_count delta = 0;
+  cycle_count elapsed = 0;
+
+#define WRITE(offset, value) \
+  (trace.add(delta, offset, value), elapsed += delta, delta = spacing)
+
+  int pw[3], pwm[3];
+  reg12 cutoff = params.cutoff_start;
+
+  WRITE(0x15, cutoff & 0x07);
+  WRITE(0x16, cutoff >> 3);
+  WRITE(0x17, params.resonance << 4 | params.route);
+  WRITE(0x18, params.mode << 4 | params.volume);
+
+  for (int i = 0; i < 3; i++) {
+    const ClipVoice& voice = params.voice[i];
+    reg8 base = i*7;
+    pw[i] = voice.pw;
+    pwm[i] = voice.pwm;
+    WRITE(base + 0x00, voice.freq & 0xff);
+    WRITE(base + 0x01, voice.freq >> 8);
+    WRITE(base + 0x02, voice.pw & 0xff);
+    WRITE(base + 0x03, voice.pw >> 8);
+    WRITE(base + 0x05, voice.attack << 4 | voice.decay);
+    WRITE(base + 0x06, voice.sustain << 4 | voice.release);
+    WRITE(base + 0x04, voice.control | (voice.gate ? 0x01 : 0x00));
+  }
+
+  for (int frame = 1; frame < frames; frame++) {
+    // Move the first write of the frame to its start.
+    delta = frame*frame_cycles - elapsed;
+
+    int sweep = params.cutoff_start +
+      ((int)params.cutoff_end - (int)params.cutoff_start)*frame/(frames - 1);
+    if ((reg12)sweep != cutoff) {
+      cutoff = sweep;
+      WRITE(0x15, cutoff & 0x07);
+      WRITE(0x16, cutoff >> 3);
+    }
+
+    for (int i = 0; i < 3; i++) {
+      const ClipVoice& voice = params.voice[i];
+      reg8 base = i*7;
+
+      if (pwm[i]) {
+	// Bounce between narrow pulses.
+	if (pw[i] + pwm[i] < 0x080 || pw[i] + pwm[i] > 0xf80) {
+	  pwm[i] = -pwm[i];
+	}
+	pw[i] += pwm[i];
+	WRITE(base + 0x02, pw[i] & 0xff);
+	WRITE(base + 0x03, pw[i] >> 8);
+      }
+
+      if (voice.gate && frame == voice.gate_frames) {
+	WRITE(base + 0x04, voice.control);
+      }
+    }
+  }
+
+#undef WRITE
+
+  trace.tail = frames*frame_cycles - elapsed;
+}
+
+} // namespace reSID
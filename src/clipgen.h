@@ -0,0 +1,102 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_CLIPGEN_H
+#define RESID_CLIPGEN_H
+
+#include "siddefs.h"
+#include "trace.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Parameters of a synthetic clip. These are the labels stored with the
+// rendered audio.
+// ----------------------------------------------------------------------------
+struct ClipVoice
+{
+  // Gate on, or only used as sync / ring modulation source.
+  bool gate;
+  // MIDI note number, and the resulting frequency register value.
+  int note;
+  reg16 freq;
+  // Control register bits: waveform (bits 4-7), ring (bit 2), sync (bit 1).
+  reg8 control;
+  // Pulse width, and pulse width change per frame (0 for no PWM).
+  reg12 pw;
+  int pwm;
+  reg4 attack, decay, sustain, release;
+  // Number of frames before the gate is turned off.
+  int gate_frames;
+};
+
+struct ClipParams
+{
+  unsigned long long id;
+  chip_model model;
+  ClipVoice voice[3];
+  // Filter cutoff at the start and end of the clip, swept linearly.
+  reg12 cutoff_start, cutoff_end;
+  reg4 resonance;
+  // Filter routing ($d417 bits 0-2) and mode ($d418 bits 4-6).
+  reg4 route;
+  reg4 mode;
+  reg4 volume;
+};
+
+
+// ----------------------------------------------------------------------------
+// Generator of randomized but musically plausible register programs, e.g.
+// for producing labelled training data.
+//
+// Each clip holds one to three voices playing notes from a scale, with
+// random waveforms including combined waveforms, ADSR envelopes, pulse
+// width modulation, sync and ring modulation, and a filter sweep. The
+// program is updated once per frame, like a player routine.
+//
+// The parameters of a clip only depend on the seed and the clip id, so that
+// any subset of clips can be generated independently, in any order and on
+// any number of threads, with identical results.
+// ----------------------------------------------------------------------------
+class ClipGenerator
+{
+public:
+  ClipGenerator(unsigned long long seed = 0, int frames = 100,
+		cycle_count frame_cycles = 19656, double clock_freq = 985248);
+
+  // Random parameters for clip number id. model is used unless random_model
+  // is set, in which case the model is chosen at random as well.
+  void generate(unsigned long long id, ClipParams& params,
+		chip_model model = MOS6581, bool random_model = false) const;
+
+  // Register program playing the parameters for frames*frame_cycles cycles.
+  void program(const ClipParams& params, Trace& trace) const;
+
+  int frames;
+  cycle_count frame_cycles;
+
+protected:
+  unsigned long long seed;
+  double clock_freq;
+};
+
+} // namespace reSID
+
+#endif // not RESID_CLIPGEN_H
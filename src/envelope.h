@@ -90,6 +90,7 @@ protected:
   static const DAC<8> model_dac[2];
 
 friend class SID;
+friend class SIDBatch;
 };
 
 
@@ -197,6 +197,8 @@ protected:
   int vlp, vhp;
 
 friend class SID;
+friend class SIDBatch;
+friend class SIDMatrix;
 };
 
 
@@ -0,0 +1,380 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "fanout.h"
+#include <string.h>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SIDFanout::SIDFanout()
+{
+  ring_index = 0;
+  model = front.sid_model;
+  voice_mask = 0x07;
+  memset(filter_register, 0, sizeof(filter_register));
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+SIDFanout::~SIDFanout()
+{
+  for (size_t b = 0; b < backend.size(); b++) {
+    delete[] backend[b]->ring;
+    delete backend[b];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Add back-end.
+// ----------------------------------------------------------------------------
+int SIDFanout::add_backend()
+{
+  sync_model();
+
+  Backend* be = new Backend();
+  be->filter.set_chip_model(model);
+  be->filter.set_voice_mask(voice_mask);
+  be->filter.writeFC_LO(filter_register[0]);
+  be->filter.writeFC_HI(filter_register[1]);
+  be->filter.writeRES_FILT(filter_register[2]);
+  be->filter.writeMODE_VOL(filter_register[3]);
+  be->sample_prev = be->sample_now = 0;
+  be->ring = new short[SID::RINGSIZE*2];
+  memset(be->ring, 0, sizeof(short)*SID::RINGSIZE*2);
+
+  backend.push_back(be);
+  return (int)backend.size() - 1;
+}
+
+
+// ----------------------------------------------------------------------------
+// Back-end settings.
+// ----------------------------------------------------------------------------
+void SIDFanout::enable_filter(int b, bool enable)
+{
+  backend[b]->filter.enable_filter(enable);
+}
+
+void SIDFanout::enable_external_filter(int b, bool enable)
+{
+  backend[b]->extfilt.enable_filter(enable);
+}
+
+void SIDFanout::adjust_filter_bias(int b, double dac_bias)
+{
+  backend[b]->filter.adjust_filter_bias(dac_bias);
+}
+
+void SIDFanout::set_filter_model(int b, const FilterModel* filter_model)
+{
+  sync_model();
+  backend[b]->filter.set_model(filter_model);
+}
+
+void SIDFanout::input(int b, short sample)
+{
+  backend[b]->filter.input(sample);
+}
+
+
+// ----------------------------------------------------------------------------
+// Voice mask, for the front-end and all back-ends.
+// ----------------------------------------------------------------------------
+void SIDFanout::set_voice_mask(reg4 mask)
+{
+  voice_mask = mask;
+  front.set_voice_mask(mask);
+  for (size_t b = 0; b < backend.size(); b++) {
+    backend[b]->filter.set_voice_mask(mask);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Reset.
+// ----------------------------------------------------------------------------
+void SIDFanout::reset()
+{
+  front.reset();
+  memset(filter_register, 0, sizeof(filter_register));
+
+  for (size_t b = 0; b < backend.size(); b++) {
+    Backend* be = backend[b];
+    be->filter.reset();
+    be->extfilt.reset();
+    be->sample_prev = be->sample_now = 0;
+    memset(be->ring, 0, sizeof(short)*SID::RINGSIZE*2);
+  }
+  ring_index = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Write register. Writes which the front-end pipelines are mirrored to the
+// back-ends when they take effect, in clock().
+// ----------------------------------------------------------------------------
+void SIDFanout::write(reg8 offset, reg8 value)
+{
+  front.write(offset, value);
+  if (!front.write_pipeline) {
+    mirror(offset, value);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Write filter register to all back-ends.
+// ----------------------------------------------------------------------------
+void SIDFanout::mirror(reg8 offset, reg8 value)
+{
+  if (offset < 0x15 || offset > 0x18) {
+    return;
+  }
+
+  filter_register[offset - 0x15] = value;
+
+  for (size_t b = 0; b < backend.size(); b++) {
+    Filter& filter = backend[b]->filter;
+    switch (offset) {
+    case 0x15:
+      filter.writeFC_LO(value);
+      break;
+    case 0x16:
+      filter.writeFC_HI(value);
+      break;
+    case 0x17:
+      filter.writeRES_FILT(value);
+      break;
+    case 0x18:
+      filter.writeMODE_VOL(value);
+      break;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Follow chip model changes of the front-end.
+// ----------------------------------------------------------------------------
+void SIDFanout::sync_model()
+{
+  if (front.sid_model == model) {
+    return;
+  }
+
+  model = front.sid_model;
+  for (size_t b = 0; b < backend.size(); b++) {
+    backend[b]->filter.set_chip_model(model);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the oscillators and envelopes of the front-end one cycle; this is
+// the first part of SID::clock().
+// ----------------------------------------------------------------------------
+RESID_INLINE
+void SIDFanout::clock_front()
+{
+  int i;
+
+  // Clock amplitude modulators.
+  for (i = 0; i < 3; i++) {
+    front.voice[i].envelope.clock();
+  }
+
+  // Clock oscillators.
+  for (i = 0; i < 3; i++) {
+    front.voice[i].wave.clock();
+  }
+
+  // Synchronize oscillators.
+  for (i = 0; i < 3; i++) {
+    front.voice[i].wave.synchronize();
+  }
+
+  // Calculate waveform output.
+  for (i = 0; i < 3; i++) {
+    front.voice[i].wave.set_waveform_output();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock with audio sampling. The sampling phase and FIR tables are those
+// of the front-end, so SID::set_sampling_parameters() applies to all
+// back-ends.
+// ----------------------------------------------------------------------------
+int SIDFanout::clock(cycle_count& delta_t, short** buf, int n,
+		     int interleave)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const int RINGSIZE = SID::RINGSIZE;
+  const int RINGMASK = SID::RINGMASK;
+
+  sync_model();
+
+  sampling_method method = front.sampling;
+  bool ring = method == SAMPLE_RESAMPLE || method == SAMPLE_RESAMPLE_FASTMEM;
+  int nb = (int)backend.size();
+  int s;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset =
+      front.sample_offset + front.cycles_per_sample;
+    if (method == SAMPLE_FAST) {
+      next_sample_offset += 1 << (FIXP_SHIFT - 1);
+    }
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    for (int i = delta_t_sample; i > 0; i--) {
+      clock_front();
+
+      int v1 = front.voice[0].output();
+      int v2 = front.voice[1].output();
+      int v3 = front.voice[2].output();
+
+      for (int b = 0; b < nb; b++) {
+	Backend* be = backend[b];
+	be->filter.clock(v1, v2, v3);
+	be->extfilt.clock(be->filter.output());
+
+	if (ring) {
+	  be->ring[ring_index] = be->ring[ring_index + RINGSIZE] =
+	    be->extfilt.output();
+	}
+	else if (i <= 2) {
+	  be->sample_prev = be->sample_now;
+	  be->sample_now = be->extfilt.output();
+	}
+      }
+
+      if (ring) {
+	++ring_index &= RINGMASK;
+      }
+
+      // Pipelined writes on the MOS8580.
+      if (unlikely(front.write_pipeline)) {
+	front.write();
+	mirror(front.write_address, front.bus_value);
+      }
+
+      // Age bus value.
+      if (unlikely(!--front.bus_value_ttl)) {
+	front.bus_value = 0;
+      }
+    }
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      front.sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    if (method == SAMPLE_FAST) {
+      front.sample_offset =
+	(next_sample_offset & FIXP_MASK) - (1 << (FIXP_SHIFT - 1));
+    }
+    else {
+      front.sample_offset = next_sample_offset & FIXP_MASK;
+    }
+
+    for (int b = 0; b < nb; b++) {
+      Backend* be = backend[b];
+      int v;
+
+      if (method == SAMPLE_FAST) {
+	v = be->sample_now;
+      }
+      else if (method == SAMPLE_INTERPOLATE) {
+	v = be->sample_prev + (front.sample_offset*
+			       (be->sample_now - be->sample_prev) >> FIXP_SHIFT);
+      }
+      else if (method == SAMPLE_RESAMPLE) {
+	int fir_offset = front.sample_offset*front.fir_RES >> FIXP_SHIFT;
+	int fir_offset_rmd = front.sample_offset*front.fir_RES & FIXP_MASK;
+	short* fir_start = front.fir + fir_offset*front.fir_N;
+	short* sample_start =
+	  be->ring + ring_index - front.fir_N - 1 + RINGSIZE;
+
+	// Convolution with filter impulse response.
+	int w1 = 0;
+	for (int j = 0; j < front.fir_N; j++) {
+	  w1 += sample_start[j]*fir_start[j];
+	}
+
+	// Use next FIR table, wrap around to first FIR table using
+	// next sample.
+	if (unlikely(++fir_offset == front.fir_RES)) {
+	  fir_offset = 0;
+	  ++sample_start;
+	}
+	fir_start = front.fir + fir_offset*front.fir_N;
+
+	// Convolution with filter impulse response.
+	int w2 = 0;
+	for (int k = 0; k < front.fir_N; k++) {
+	  w2 += sample_start[k]*fir_start[k];
+	}
+
+	// Linear interpolation.
+	v = w1 + (fir_offset_rmd*(w2 - w1) >> FIXP_SHIFT);
+	v >>= SID::FIR_SHIFT;
+      }
+      else {
+	int fir_offset = front.sample_offset*front.fir_RES >> FIXP_SHIFT;
+	short* fir_start = front.fir + fir_offset*front.fir_N;
+	short* sample_start = be->ring + ring_index - front.fir_N + RINGSIZE;
+
+	// Convolution with filter impulse response.
+	v = 0;
+	for (int j = 0; j < front.fir_N; j++) {
+	  v += sample_start[j]*fir_start[j];
+	}
+	v >>= SID::FIR_SHIFT;
+      }
+
+      // Saturated arithmetics to guard against 16 bit sample overflow.
+      const int half = 1 << 15;
+      if (v >= half) {
+	v = half - 1;
+      }
+      else if (v < -half) {
+	v = -half;
+      }
+
+      buf[b][s*interleave] = v;
+    }
+  }
+
+  return s;
+}
+
+} // namespace reSID
@@ -0,0 +1,105 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_FANOUT_H
+#define RESID_FANOUT_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// One digital SID front-end feeding several analog back-ends.
+//
+// The oscillators, envelopes and register logic of the SID are clocked once
+// per cycle, and the voice outputs are fed to any number of back-ends, each
+// a Filter and ExternalFilter with its own filter bias, filter model tables
+// (see FilterModel) and EXT IN level. Filter register writes go to all
+// back-ends. This makes e.g. filter bias sweeps or A/B comparisons of model
+// parameters cost one digital emulation plus one analog emulation per
+// back-end, rather than full emulations.
+//
+// All back-ends are clocked cycle by cycle. With SAMPLE_FAST, the output of
+// the cycle at each sampling point is taken, so the output differs slightly
+// from that of SID::clock() with SAMPLE_FAST, which clocks the filter in
+// larger steps. The other sampling methods produce the same output as SID
+// for a back-end with the same settings. The analog stage of the SID itself
+// is not clocked.
+// ----------------------------------------------------------------------------
+class SIDFanout
+{
+public:
+  SIDFanout();
+  ~SIDFanout();
+
+  // The front-end; use it for the chip model, sampling parameters and
+  // reads. Register writes and clocking must go through the fanout.
+  // Changing the chip model resets the back-ends.
+  SID& sid() { return front; }
+
+  // Number of back-ends, and adding a back-end. New back-ends have the
+  // chip model of the front-end, default settings, and all filter
+  // registers as currently written. Returns the index of the back-end.
+  int backends() const { return (int)backend.size(); }
+  int add_backend();
+
+  void enable_filter(int b, bool enable);
+  void enable_external_filter(int b, bool enable);
+  void adjust_filter_bias(int b, double dac_bias);
+  void set_filter_model(int b, const FilterModel* model);
+  // EXT IN (16 bits).
+  void input(int b, short sample);
+
+  void set_voice_mask(reg4 mask);
+
+  void reset();
+  void write(reg8 offset, reg8 value);
+
+  // Clock for delta_t cycles or n samples, writing sample s of back-end b
+  // to buf[b][s*interleave]. Returns the number of samples.
+  int clock(cycle_count& delta_t, short** buf, int n, int interleave = 1);
+
+protected:
+  struct Backend
+  {
+    Filter filter;
+    ExternalFilter extfilt;
+    short sample_prev, sample_now;
+    short* ring;
+  };
+
+  void clock_front();
+  void mirror(reg8 offset, reg8 value);
+  void sync_model();
+
+  SID front;
+  std::vector<Backend*> backend;
+  int ring_index;
+  chip_model model;
+  reg4 voice_mask;
+  // Filter registers 0x15 - 0x18, for new back-ends.
+  reg8 filter_register[4];
+};
+
+} // namespace reSID
+
+#endif // not RESID_FANOUT_H
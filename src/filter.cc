@@ -169,242 +169,36 @@ static model_filter_init_t model_filter_init[2] = {
   }
 };
 
-unsigned short Filter::vcr_kVg[1 << 16];
-unsigned short Filter::vcr_n_Ids_term[1 << 16];
-
 Filter::model_filter_t Filter::model_filter[2];
 
 
 // ----------------------------------------------------------------------------
-// Constructor.
+// Build the tables of the built-in models.
 // ----------------------------------------------------------------------------
-Filter::Filter()
+bool Filter::build_tables()
 {
-  static bool class_init;
-
-  if (!class_init) {
-    // Temporary table for op-amp transfer function.
-    int* opamp = new int[1 << 16];
-
-    for (int m = 0; m < 2; m++) {
-      model_filter_init_t& fi = model_filter_init[m];
-      model_filter_t& mf = model_filter[m];
-
-      // Convert op-amp voltage transfer to 16 bit values.
-      double vmin = fi.opamp_voltage[0][0];
-      double opamp_max = fi.opamp_voltage[0][1];
-      double kVddt = fi.k*(fi.Vdd - fi.Vth);
-      double vmax = kVddt < opamp_max ? opamp_max : kVddt;
-      double denorm = vmax - vmin;
-      double norm = 1.0/denorm;
-
-      // Scaling and translation constants.
-      double N16 = norm*((1u << 16) - 1);
-      double N30 = norm*((1u << 30) - 1);
-      double N31 = norm*((1u << 31) - 1);
-      mf.vo_N16 = (int)(N16);  // FIXME: Remove?
-
-      // The "zero" output level of the voices.
-      // The digital range of one voice is 20 bits; create a scaling term
-      // for multiplication which fits in 11 bits.
-      double N14 = norm*(1u << 14);
-      mf.voice_scale_s14 = (int)(N14*fi.voice_voltage_range);
-      mf.voice_DC = (int)(N16*(fi.voice_DC_voltage - vmin));
-
-      // Vdd - Vth, normalized so that translated values can be subtracted:
-      // k*Vddt - x = (k*Vddt - t) - (x - t)
-      mf.kVddt = (int)(N16*(kVddt - vmin) + 0.5);
-
-      // Normalized snake current factor, 1 cycle at 1MHz.
-      // Fit in 5 bits.
-      mf.n_snake = (int)(denorm*(1 << 13)*(fi.uCox/(2*fi.k)*fi.WL_snake*1.0e-6/fi.C) + 0.5);
-
-      // Create lookup table mapping op-amp voltage across output and input
-      // to input voltage: vo - vx -> vx
-      // FIXME: No variable length arrays in ISO C++, hardcoding to max 50
-      // points.
-      // double_point scaled_voltage[fi.opamp_voltage_size];
-      double_point scaled_voltage[50];
-
-      for (int i = 0; i < fi.opamp_voltage_size; i++) {
-	// The target output range is 16 bits, in order to fit in an unsigned
-	// short.
-	//
-	// The y axis is temporarily scaled to 31 bits for maximum accuracy in
-	// the calculated derivative.
-	//
-	// Values are normalized using
-	//
-	//   x_n = m*2^N*(x - xmin)
-	//
-	// and are translated back later (for fixed point math) using
-	//
-	//   m*2^N*x = x_n - m*2^N*xmin
-	//
-	scaled_voltage[fi.opamp_voltage_size - 1 - i][0] = int((N16*(fi.opamp_voltage[i][1] - fi.opamp_voltage[i][0]) + (1 << 16))/2 + 0.5);
-	scaled_voltage[fi.opamp_voltage_size - 1 - i][1] = N31*(fi.opamp_voltage[i][0] - vmin);
-      }
-
-      // Clamp x to 16 bits (rounding may cause overflow).
-      if (scaled_voltage[fi.opamp_voltage_size - 1][0] >= (1 << 16)) {
-	// The last point is repeated.
-	scaled_voltage[fi.opamp_voltage_size - 1][0] =
-	  scaled_voltage[fi.opamp_voltage_size - 2][0] = (1 << 16) - 1;
-      }
-
-      interpolate(scaled_voltage, scaled_voltage + fi.opamp_voltage_size - 1,
-		  PointPlotter<int>(opamp), 1.0);
-
-      // Store both fn and dfn in the same table.
-      mf.ak = (int)scaled_voltage[0][0];
-      mf.bk = (int)scaled_voltage[fi.opamp_voltage_size - 1][0];
-      int j;
-      for (j = 0; j < mf.ak; j++) {
-	opamp[j] = 0;
-      }
-      int f = opamp[j] - (opamp[j + 1] - opamp[j]);
-      for (; j <= mf.bk; j++) {
-	int fp = f;
-	f = opamp[j];  // Scaled by m*2^31
-	// m*2^31*dy/1 = (m*2^31*dy)/(m*2^16*dx) = 2^15*dy/dx
-	int df = f - fp;  // Scaled by 2^15
-
-	// High 16 bits (15 bits + sign bit): 2^11*dfn
-	// Low 16 bits (unsigned):            m*2^16*(fn - xmin)
-	opamp[j] = ((df << (16 + 11 - 15)) & ~0xffff) | (f >> 15);
-      }
-      for (; j < (1 << 16); j++) {
-	opamp[j] = 0;
-      }
-
-      // Create lookup tables for gains / summers.
-
-      // 4 bit "resistor" ladders in the bandpass resonance gain and the audio
-      // output gain necessitate 16 gain tables.
-      // From die photographs of the bandpass and volume "resistor" ladders
-      // it follows that gain ~ vol/8 and 1/Q ~ ~res/8 (assuming ideal
-      // op-amps and ideal "resistors").
-      for (int n8 = 0; n8 < 16; n8++) {
-	int n = n8 << 4;  // Scaled by 2^7
-	int x = mf.ak;
-	for (int vi = 0; vi < (1 << 16); vi++) {
-	  mf.gain[n8][vi] = solve_gain(opamp, n, vi, x, mf);
-	}
-      }
-
-      // The filter summer operates at n ~ 1, and has 5 fundamentally different
-      // input configurations (2 - 6 input "resistors").
-      //
-      // Note that all "on" transistors are modeled as one. This is not
-      // entirely accurate, since the input for each transistor is different,
-      // and transistors are not linear components. However modeling all
-      // transistors separately would be extremely costly.
-      int offset = 0;
-      int size;
-      for (int k = 0; k < 5; k++) {
-	int idiv = 2 + k;        // 2 - 6 input "resistors".
-	int n_idiv = idiv << 7;  // n*idiv, scaled by 2^7
-	size = idiv << 16;
-	int x = mf.ak;
-	for (int vi = 0; vi < size; vi++) {
-	  mf.summer[offset + vi] =
-	    solve_gain(opamp, n_idiv, vi/idiv, x, mf);
-	}
-	offset += size;
-      }
-
-      // The audio mixer operates at n ~ 8/6, and has 8 fundamentally different
-      // input configurations (0 - 7 input "resistors").
-      //
-      // All "on", transistors are modeled as one - see comments above for
-      // the filter summer.
-      offset = 0;
-      size = 1;  // Only one lookup element for 0 input "resistors".
-      for (int l = 0; l < 8; l++) {
-	int idiv = l;                 // 0 - 7 input "resistors".
-	int n_idiv = (idiv << 7)*8/6; // n*idiv, scaled by 2^7
-	if (idiv == 0) {
-	  // Avoid division by zero; the result will be correct since
-	  // n_idiv = 0.
-	  idiv = 1;
-	}
-	int x = mf.ak;
-	for (int vi = 0; vi < size; vi++) {
-	  mf.mixer[offset + vi] =
-	    solve_gain(opamp, n_idiv, vi/idiv, x, mf);
-	}
-	offset += size;
-	size = (l + 1) << 16;
-      }
-
-      // Create lookup table mapping capacitor voltage to op-amp input voltage:
-      // vc -> vx
-      for (int m = 0; m < (1 << 16); m++) {
-	mf.opamp_rev[m] = opamp[m] & 0xffff;
-      }
-
-      mf.vc_max = (int)(N30*(fi.opamp_voltage[0][1] - fi.opamp_voltage[0][0]));
-      mf.vc_min = (int)(N30*(fi.opamp_voltage[fi.opamp_voltage_size - 1][1] - fi.opamp_voltage[fi.opamp_voltage_size - 1][0]));
-
-      // DAC table.
-      int bits = 11;
-      mf.f0_dac = DAC<11>(fi.dac_2R_div_R, fi.dac_term);
-      for (int n = 0; n < (1 << bits); n++) {
-	mf.f0_dac[n] = (unsigned short)(N16*(fi.dac_zero + mf.f0_dac[n]*fi.dac_scale/(1 << bits) - vmin) + 0.5);
-      }
-    }
+  for (int m = 0; m < 2; m++) {
+    FilterModelParameters parameters;
+    model_parameters((chip_model)m, parameters);
+    build_model((chip_model)m, parameters, model_filter[m]);
+  }
 
-    // Free temporary table.
-    delete[] opamp;
-
-    // VCR - 6581 only.
-    model_filter_init_t& fi = model_filter_init[MOS6581];
-
-    double N16 = model_filter[MOS6581].vo_N16;
-    double vmin = N16*fi.opamp_voltage[0][0];
-    double k = fi.k;
-    double kVddt = N16*(k*(fi.Vdd - fi.Vth));
-
-    for (int i = 0; i < (1 << 16); i++) {
-      // The table index is right-shifted 16 times in order to fit in
-      // 16 bits; the argument to sqrt is thus multiplied by (1 << 16).
-      //
-      // The returned value must be corrected for translation. Vg always
-      // takes part in a subtraction as follows:
-      //
-      //   k*Vg - Vx = (k*Vg - t) - (Vx - t)
-      //
-      // I.e. k*Vg - t must be returned.
-      double Vg = kVddt - sqrt((double)i*(1 << 16));
-      vcr_kVg[i] = (unsigned short)(k*Vg - vmin + 0.5);
-    }
+  return true;
+}
 
-    /*
-      EKV model:
-
-      Ids = Is*(if - ir)
-      Is = 2*u*Cox*Ut^2/k*W/L
-      if = ln^2(1 + e^((k*(Vg - Vt) - Vs)/(2*Ut))
-      ir = ln^2(1 + e^((k*(Vg - Vt) - Vd)/(2*Ut))
-    */
-    double kVt = fi.k*fi.Vth;
-    double Ut = fi.Ut;
-    double Is = 2*fi.uCox*Ut*Ut/fi.k*fi.WL_vcr;
-    // Normalized current factor for 1 cycle at 1MHz.
-    double N15 = N16/2;
-    double n_Is = N15*1.0e-6/fi.C*Is;
-
-    // kVg_Vx = k*Vg - Vx
-    // I.e. if k != 1.0, Vg must be scaled accordingly.
-    for (int kVg_Vx = 0; kVg_Vx < (1 << 16); kVg_Vx++) {
-      double log_term = log1p(exp((kVg_Vx/N16 - kVt)/(2*Ut)));
-      // Scaled by m*2^15
-      vcr_n_Ids_term[kVg_Vx] = (unsigned short)(n_Is*log_term*log_term);
-    }
 
-    class_init = true;
-  }
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+Filter::Filter()
+{
+  // The tables are built once, by the first constructor call. Concurrent
+  // first calls wait for it to finish; later calls only check a flag.
+  static bool class_init = build_tables();
+  (void)class_init;
 
+  custom_model = 0;
+  dac_bias = 0;
   enable_filter(true);
   set_chip_model(MOS6581);
   set_voice_mask(0x07);
@@ -413,6 +207,260 @@ Filter::Filter()
 }
 
 
+// ----------------------------------------------------------------------------
+// Default model parameters.
+// ----------------------------------------------------------------------------
+void Filter::model_parameters(chip_model model, FilterModelParameters& p)
+{
+  const model_filter_init_t& fi = model_filter_init[model];
+
+  for (int i = 0; i < fi.opamp_voltage_size; i++) {
+    p.opamp_voltage[i][0] = fi.opamp_voltage[i][0];
+    p.opamp_voltage[i][1] = fi.opamp_voltage[i][1];
+  }
+  p.opamp_voltage_size = fi.opamp_voltage_size;
+  p.voice_voltage_range = fi.voice_voltage_range;
+  p.voice_DC_voltage = fi.voice_DC_voltage;
+  p.C = fi.C;
+  p.Vdd = fi.Vdd;
+  p.Vth = fi.Vth;
+  p.Ut = fi.Ut;
+  p.k = fi.k;
+  p.uCox = fi.uCox;
+  p.WL_vcr = fi.WL_vcr;
+  p.WL_snake = fi.WL_snake;
+  p.dac_zero = fi.dac_zero;
+  p.dac_scale = fi.dac_scale;
+  p.dac_2R_div_R = fi.dac_2R_div_R;
+  p.dac_term = fi.dac_term;
+}
+
+
+// ----------------------------------------------------------------------------
+// Build lookup tables for a set of model parameters.
+// ----------------------------------------------------------------------------
+void Filter::build_model(chip_model model, const FilterModelParameters& fi,
+			 model_filter_t& mf)
+{
+  // Temporary table for op-amp transfer function.
+  int* opamp = new int[1 << 16];
+
+  // Convert op-amp voltage transfer to 16 bit values.
+  double vmin = fi.opamp_voltage[0][0];
+  double opamp_max = fi.opamp_voltage[0][1];
+  double kVddt = fi.k*(fi.Vdd - fi.Vth);
+  double vmax = kVddt < opamp_max ? opamp_max : kVddt;
+  double denorm = vmax - vmin;
+  double norm = 1.0/denorm;
+
+  // Scaling and translation constants.
+  double N16 = norm*((1u << 16) - 1);
+  double N30 = norm*((1u << 30) - 1);
+  double N31 = norm*((1u << 31) - 1);
+  mf.vo_N16 = (int)(N16);  // FIXME: Remove?
+
+  // The "zero" output level of the voices.
+  // The digital range of one voice is 20 bits; create a scaling term
+  // for multiplication which fits in 11 bits.
+  double N14 = norm*(1u << 14);
+  mf.voice_scale_s14 = (int)(N14*fi.voice_voltage_range);
+  mf.voice_DC = (int)(N16*(fi.voice_DC_voltage - vmin));
+
+  // Vdd - Vth, normalized so that translated values can be subtracted:
+  // k*Vddt - x = (k*Vddt - t) - (x - t)
+  mf.kVddt = (int)(N16*(kVddt - vmin) + 0.5);
+
+  // Normalized snake current factor, 1 cycle at 1MHz.
+  // Fit in 5 bits.
+  mf.n_snake = (int)(denorm*(1 << 13)*(fi.uCox/(2*fi.k)*fi.WL_snake*1.0e-6/fi.C) + 0.5);
+
+  // Create lookup table mapping op-amp voltage across output and input
+  // to input voltage: vo - vx -> vx
+  // FIXME: No variable length arrays in ISO C++, hardcoding to max 50
+  // points.
+  // double_point scaled_voltage[fi.opamp_voltage_size];
+  double_point scaled_voltage[50];
+
+  for (int i = 0; i < fi.opamp_voltage_size; i++) {
+    // The target output range is 16 bits, in order to fit in an unsigned
+    // short.
+    //
+    // The y axis is temporarily scaled to 31 bits for maximum accuracy in
+    // the calculated derivative.
+    //
+    // Values are normalized using
+    //
+    //   x_n = m*2^N*(x - xmin)
+    //
+    // and are translated back later (for fixed point math) using
+    //
+    //   m*2^N*x = x_n - m*2^N*xmin
+    //
+    scaled_voltage[fi.opamp_voltage_size - 1 - i][0] = int((N16*(fi.opamp_voltage[i][1] - fi.opamp_voltage[i][0]) + (1 << 16))/2 + 0.5);
+    scaled_voltage[fi.opamp_voltage_size - 1 - i][1] = N31*(fi.opamp_voltage[i][0] - vmin);
+  }
+
+  // Clamp x to 16 bits (rounding may cause overflow).
+  if (scaled_voltage[fi.opamp_voltage_size - 1][0] >= (1 << 16)) {
+    // The last point is repeated.
+    scaled_voltage[fi.opamp_voltage_size - 1][0] =
+      scaled_voltage[fi.opamp_voltage_size - 2][0] = (1 << 16) - 1;
+  }
+
+  interpolate(scaled_voltage, scaled_voltage + fi.opamp_voltage_size - 1,
+	      PointPlotter<int>(opamp), 1.0);
+
+  // Store both fn and dfn in the same table.
+  mf.ak = (int)scaled_voltage[0][0];
+  mf.bk = (int)scaled_voltage[fi.opamp_voltage_size - 1][0];
+  int j;
+  for (j = 0; j < mf.ak; j++) {
+    opamp[j] = 0;
+  }
+  int f = opamp[j] - (opamp[j + 1] - opamp[j]);
+  for (; j <= mf.bk; j++) {
+    int fp = f;
+    f = opamp[j];  // Scaled by m*2^31
+    // m*2^31*dy/1 = (m*2^31*dy)/(m*2^16*dx) = 2^15*dy/dx
+    int df = f - fp;  // Scaled by 2^15
+
+    // High 16 bits (15 bits + sign bit): 2^11*dfn
+    // Low 16 bits (unsigned):            m*2^16*(fn - xmin)
+    opamp[j] = ((df << (16 + 11 - 15)) & ~0xffff) | (f >> 15);
+  }
+  for (; j < (1 << 16); j++) {
+    opamp[j] = 0;
+  }
+
+  // Create lookup tables for gains / summers.
+
+  // 4 bit "resistor" ladders in the bandpass resonance gain and the audio
+  // output gain necessitate 16 gain tables.
+  // From die photographs of the bandpass and volume "resistor" ladders
+  // it follows that gain ~ vol/8 and 1/Q ~ ~res/8 (assuming ideal
+  // op-amps and ideal "resistors").
+  for (int n8 = 0; n8 < 16; n8++) {
+    int n = n8 << 4;  // Scaled by 2^7
+    int x = mf.ak;
+    for (int vi = 0; vi < (1 << 16); vi++) {
+      mf.gain[n8][vi] = solve_gain(opamp, n, vi, x, mf);
+    }
+  }
+
+  // The filter summer operates at n ~ 1, and has 5 fundamentally different
+  // input configurations (2 - 6 input "resistors").
+  //
+  // Note that all "on" transistors are modeled as one. This is not
+  // entirely accurate, since the input for each transistor is different,
+  // and transistors are not linear components. However modeling all
+  // transistors separately would be extremely costly.
+  int offset = 0;
+  int size;
+  for (int k = 0; k < 5; k++) {
+    int idiv = 2 + k;        // 2 - 6 input "resistors".
+    int n_idiv = idiv << 7;  // n*idiv, scaled by 2^7
+    size = idiv << 16;
+    int x = mf.ak;
+    for (int vi = 0; vi < size; vi++) {
+      mf.summer[offset + vi] =
+	solve_gain(opamp, n_idiv, vi/idiv, x, mf);
+    }
+    offset += size;
+  }
+
+  // The audio mixer operates at n ~ 8/6, and has 8 fundamentally different
+  // input configurations (0 - 7 input "resistors").
+  //
+  // All "on", transistors are modeled as one - see comments above for
+  // the filter summer.
+  offset = 0;
+  size = 1;  // Only one lookup element for 0 input "resistors".
+  for (int l = 0; l < 8; l++) {
+    int idiv = l;                 // 0 - 7 input "resistors".
+    int n_idiv = (idiv << 7)*8/6; // n*idiv, scaled by 2^7
+    if (idiv == 0) {
+      // Avoid division by zero; the result will be correct since
+      // n_idiv = 0.
+      idiv = 1;
+    }
+    int x = mf.ak;
+    for (int vi = 0; vi < size; vi++) {
+      mf.mixer[offset + vi] =
+	solve_gain(opamp, n_idiv, vi/idiv, x, mf);
+    }
+    offset += size;
+    size = (l + 1) << 16;
+  }
+
+  // Create lookup table mapping capacitor voltage to op-amp input voltage:
+  // vc -> vx
+  for (int m = 0; m < (1 << 16); m++) {
+    mf.opamp_rev[m] = opamp[m] & 0xffff;
+  }
+
+  mf.vc_max = (int)(N30*(fi.opamp_voltage[0][1] - fi.opamp_voltage[0][0]));
+  mf.vc_min = (int)(N30*(fi.opamp_voltage[fi.opamp_voltage_size - 1][1] - fi.opamp_voltage[fi.opamp_voltage_size - 1][0]));
+
+  // DAC table.
+  int bits = 11;
+  mf.f0_dac = DAC<11>(fi.dac_2R_div_R, fi.dac_term);
+  for (int n = 0; n < (1 << bits); n++) {
+    mf.f0_dac[n] = (unsigned short)(N16*(fi.dac_zero + mf.f0_dac[n]*fi.dac_scale/(1 << bits) - vmin) + 0.5);
+  }
+
+  // Free temporary table.
+  delete[] opamp;
+
+  // VCR - 6581 only. The tables are not touched for the MOS8580, so that
+  // their pages are never allocated. Note that the scaling constants here
+  // are based on the truncated vo_N16.
+  if (model != MOS6581) {
+    return;
+  }
+
+  N16 = mf.vo_N16;
+  vmin = N16*fi.opamp_voltage[0][0];
+  double k = fi.k;
+  kVddt = N16*(k*(fi.Vdd - fi.Vth));
+
+  for (int i = 0; i < (1 << 16); i++) {
+    // The table index is right-shifted 16 times in order to fit in
+    // 16 bits; the argument to sqrt is thus multiplied by (1 << 16).
+    //
+    // The returned value must be corrected for translation. Vg always
+    // takes part in a subtraction as follows:
+    //
+    //   k*Vg - Vx = (k*Vg - t) - (Vx - t)
+    //
+    // I.e. k*Vg - t must be returned.
+    double Vg = kVddt - sqrt((double)i*(1 << 16));
+    mf.vcr_kVg[i] = (unsigned short)(k*Vg - vmin + 0.5);
+  }
+
+  /*
+    EKV model:
+
+    Ids = Is*(if - ir)
+    Is = 2*u*Cox*Ut^2/k*W/L
+    if = ln^2(1 + e^((k*(Vg - Vt) - Vs)/(2*Ut))
+    ir = ln^2(1 + e^((k*(Vg - Vt) - Vd)/(2*Ut))
+  */
+  double kVt = fi.k*fi.Vth;
+  double Ut = fi.Ut;
+  double Is = 2*fi.uCox*Ut*Ut/fi.k*fi.WL_vcr;
+  // Normalized current factor for 1 cycle at 1MHz.
+  double N15 = N16/2;
+  double n_Is = N15*1.0e-6/fi.C*Is;
+
+  // kVg_Vx = k*Vg - Vx
+  // I.e. if k != 1.0, Vg must be scaled accordingly.
+  for (int kVg_Vx = 0; kVg_Vx < (1 << 16); kVg_Vx++) {
+    double log_term = log1p(exp((kVg_Vx/N16 - kVt)/(2*Ut)));
+    // Scaled by m*2^15
+    mf.vcr_n_Ids_term[kVg_Vx] = (unsigned short)(n_Is*log_term*log_term);
+  }
+}
+
 // ----------------------------------------------------------------------------
 // Enable filter.
 // ----------------------------------------------------------------------------
@@ -431,16 +479,32 @@ void Filter::enable_filter(bool enable)
 // ----------------------------------------------------------------------------
 void Filter::adjust_filter_bias(double dac_bias)
 {
-  Vw_bias = int(dac_bias*model_filter[sid_model].vo_N16);
+  this->dac_bias = dac_bias;
+  Vw_bias = int(dac_bias*model->vo_N16);
   set_w0();
 }
 
+
+// ----------------------------------------------------------------------------
+// Use lookup tables built for other model parameters. The tables are only
+// used while the chip model matches the model they were built for; 0
+// selects the built-in tables.
+// ----------------------------------------------------------------------------
+void Filter::set_model(const FilterModel* filter_model)
+{
+  custom_model = filter_model;
+  set_chip_model(sid_model);
+}
+
 // ----------------------------------------------------------------------------
 // Set chip model.
 // ----------------------------------------------------------------------------
 void Filter::set_chip_model(chip_model model)
 {
   sid_model = model;
+  this->model = custom_model && custom_model->sid_model == model ?
+    custom_model->tables : &model_filter[model];
+  Vw_bias = int(dac_bias*this->model->vo_N16);
   /* We initialize the state variables again just to make sure that
    * the earlier model didn't leave behind some foreign, unrecoverable
    * state. Hopefully set_chip_model() only occurs simultaneously with
@@ -519,7 +583,7 @@ void Filter::writeMODE_VOL(reg8 mode_vol)
 // Set filter cutoff frequency.
 void Filter::set_w0()
 {
-  model_filter_t& f = model_filter[sid_model];
+  model_filter_t& f = *model;
   int Vw = Vw_bias + f.f0_dac[fc];
   Vddt_Vw_2 = unsigned(f.kVddt - Vw)*unsigned(f.kVddt - Vw) >> 1;
 
@@ -662,4 +726,53 @@ void Filter::set_sum_mix()
     & voice_mask;
 }
 
+
+// ----------------------------------------------------------------------------
+// Filter model built from parameters.
+// ----------------------------------------------------------------------------
+FilterModel::FilterModel()
+{
+  sid_model = MOS6581;
+  tables = 0;
+}
+
+FilterModel::~FilterModel()
+{
+  delete tables;
+}
+
+bool FilterModel::build(chip_model model, const FilterModelParameters& p)
+{
+  // Basic sanity checks; the tables are 16 bit fixed point, so parameters
+  // far from the measured values are rejected rather than wrapping around.
+  int n = p.opamp_voltage_size;
+  if (n < 4 || n > FilterModelParameters::MAX_OPAMP_POINTS ||
+      p.C <= 0 || p.k <= 0 || p.Ut <= 0 || p.uCox < 0 || p.WL_vcr < 0 ||
+      p.WL_snake < 0 || p.dac_scale <= 0 || p.Vdd <= p.Vth ||
+      p.voice_voltage_range <= 0)
+  {
+    return false;
+  }
+  for (int i = 1; i < n; i++) {
+    // Input voltages must increase, output voltages decrease.
+    if (p.opamp_voltage[i][0] < p.opamp_voltage[i - 1][0] ||
+	p.opamp_voltage[i][1] > p.opamp_voltage[i - 1][1])
+    {
+      return false;
+    }
+  }
+  if (p.opamp_voltage[0][0] >= p.opamp_voltage[n - 1][0]) {
+    return false;
+  }
+
+  // The tables are not value-initialized, which would touch the pages of
+  // the VCR tables, unused for the MOS8580; build_model() fills the rest.
+  if (!tables) {
+    tables = new Filter::model_filter_t;
+  }
+  sid_model = model;
+  Filter::build_model(model, p, *tables);
+  return true;
+}
+
 } // namespace reSID
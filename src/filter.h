@@ -338,6 +338,41 @@ struct mixer_offset<0>
 };
 
 
+// ----------------------------------------------------------------------------
+// Analog model parameters of the filter. The default values, measured on
+// real chips, are found in filter.cc; see Filter::model_parameters().
+// ----------------------------------------------------------------------------
+struct FilterModelParameters
+{
+  enum { MAX_OPAMP_POINTS = 50 };
+
+  // Op-amp voltage transfer function, vi -> vo. The first and the last
+  // points are repeated.
+  double opamp_voltage[MAX_OPAMP_POINTS][2];
+  int opamp_voltage_size;
+  // Voice output characteristics.
+  double voice_voltage_range;
+  double voice_DC_voltage;
+  // Capacitor value.
+  double C;
+  // Transistor parameters.
+  double Vdd;
+  double Vth;
+  double Ut;
+  double k;
+  double uCox;
+  double WL_vcr;
+  double WL_snake;
+  // DAC parameters.
+  double dac_zero;
+  double dac_scale;
+  double dac_2R_div_R;
+  bool dac_term;
+};
+
+class FilterModel;
+class SID;
+
 class Filter
 {
 public:
@@ -348,6 +383,10 @@ public:
   void set_chip_model(chip_model model);
   void set_voice_mask(reg4 mask);
 
+  // Default model parameters, and use of tables built for other parameters.
+  static void model_parameters(chip_model model, FilterModelParameters& p);
+  void set_model(const FilterModel* filter_model);
+
   void clock(int voice1, int voice2, int voice3);
   void clock(cycle_count delta_t, int voice1, int voice2, int voice3);
   void reset();
@@ -436,18 +475,54 @@ protected:
     unsigned short mixer[mixer_offset<8>::value];
     // Cutoff frequency DAC output voltage table. FC is an 11 bit register.
     DAC<11> f0_dac;
+
+    // VCR - 6581 only.
+    unsigned short vcr_kVg[1 << 16];
+    unsigned short vcr_n_Ids_term[1 << 16];
   } model_filter_t;
 
-  int solve_gain(int* opamp, int n, int vi_t, int& x, model_filter_t& mf);
+  static void build_model(chip_model model, const FilterModelParameters& fi,
+			  model_filter_t& mf);
+  static int solve_gain(int* opamp, int n, int vi_t, int& x, model_filter_t& mf);
   int solve_integrate_6581(int dt, int vi_t, int& x, int& vc, model_filter_t& mf);
 
-  // VCR - 6581 only.
-  static unsigned short vcr_kVg[1 << 16];
-  static unsigned short vcr_n_Ids_term[1 << 16];
   // Common parameters.
   static model_filter_t model_filter[2];
+  static bool build_tables();
+
+  // Tables in use, either built-in or custom.
+  model_filter_t* model;
+  const FilterModel* custom_model;
+  double dac_bias;
 
 friend class SID;
+friend class FilterModel;
+friend class SIDBatch;
+friend class FilterReplicas;
+friend class SIDMatrix;
+friend int numa_filter_node(const SID& sid);
+};
+
+
+// ----------------------------------------------------------------------------
+// Filter lookup tables built for a set of model parameters, e.g. for
+// fitting the model to a particular chip. A FilterModel may be shared by
+// any number of filters, and must outlive them.
+// ----------------------------------------------------------------------------
+class FilterModel
+{
+public:
+  FilterModel();
+  ~FilterModel();
+
+  // Build tables. Returns false for parameters which are out of range.
+  bool build(chip_model model, const FilterModelParameters& parameters);
+
+protected:
+  chip_model sid_model;
+  Filter::model_filter_t* tables;
+
+friend class Filter;
 };
 
 
@@ -465,7 +540,7 @@ friend class SID;
 RESID_INLINE
 void Filter::clock(int voice1, int voice2, int voice3)
 {
-  model_filter_t& f = model_filter[sid_model];
+  model_filter_t& f = *model;
 
   v1 = (voice1*f.voice_scale_s14 >> 18) + f.voice_DC;
   v2 = (voice2*f.voice_scale_s14 >> 18) + f.voice_DC;
@@ -569,7 +644,7 @@ void Filter::clock(int voice1, int voice2, int voice3)
 RESID_INLINE
 void Filter::clock(cycle_count delta_t, int voice1, int voice2, int voice3)
 {
-  model_filter_t& f = model_filter[sid_model];
+  model_filter_t& f = *model;
 
   v1 = (voice1*f.voice_scale_s14 >> 18) + f.voice_DC;
   v2 = (voice2*f.voice_scale_s14 >> 18) + f.voice_DC;
@@ -714,7 +789,7 @@ void Filter::input(short sample)
   // The upside is that the MOS8580 "digi boost" works without a separate (DC)
   // input interface.
   // Note that the input is 16 bits, compared to the 20 bit voice output.
-  model_filter_t& f = model_filter[sid_model];
+  model_filter_t& f = *model;
   ve = (sample*f.voice_scale_s14*3 >> 14) + f.mixer[0];
 }
 
@@ -725,7 +800,7 @@ void Filter::input(short sample)
 RESID_INLINE
 short Filter::output()
 {
-  model_filter_t& f = model_filter[sid_model];
+  model_filter_t& f = *model;
 
   // Writing the switch below manually would be tedious and error-prone;
   // it is rather generated by the following Perl program:
@@ -1529,7 +1604,7 @@ int Filter::solve_integrate_6581(int dt, int vi, int& vx, int& vc,
 
   // VCR gate voltage.       // Scaled by m*2^16
   // Vg = Vddt - sqrt(((Vddt - Vw)^2 + Vgdt^2)/2)
-  int kVg = vcr_kVg[(Vddt_Vw_2 + (Vgdt_2 >> 1)) >> 16];
+  int kVg = mf.vcr_kVg[(Vddt_Vw_2 + (Vgdt_2 >> 1)) >> 16];
 
   // VCR voltages for EKV model table lookup.
   int Vgs = kVg - vx;
@@ -1538,7 +1613,7 @@ int Filter::solve_integrate_6581(int dt, int vi, int& vx, int& vc,
   if (Vgd < 0) Vgd = 0;
 
   // VCR current, scaled by m*2^15*2^15 = m*2^30
-  int n_I_vcr = (vcr_n_Ids_term[Vgs] - vcr_n_Ids_term[Vgd]) << 15;
+  int n_I_vcr = (mf.vcr_n_Ids_term[Vgs] - mf.vcr_n_Ids_term[Vgd]) << 15;
 
   // Change in capacitor charge.
   vc -= (n_I_snake + n_I_vcr)*dt;
@@ -0,0 +1,609 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residfit - fit filter model parameters to a recording of a real chip.
+//
+// The recording must have been made while playing the given trace, starting
+// at the first write; filter sweeps over the full cutoff range with a few
+// resonance settings make good calibration material. The difference between
+// the recording and a render is measured as the mean squared difference of
+// their levels in 1/6 octave bands, over short-time Fourier transform
+// frames. Bands are used rather than single bins to get a smooth error
+// surface, which is not dominated by bins close to the noise floor.
+//
+// The parameters are fitted by compass search: in each iteration, every
+// parameter is stepped up and down, all candidates are rendered in parallel,
+// and the best improvement is taken, doubling the step of the parameter
+// which improved. If there is no improvement, the step sizes are halved.
+// The result is written as a profile of "name value" lines.
+//
+// Parameters are filter_bias, the model_filter_init entries dac_zero,
+// dac_scale, dac_2R_div_R, WL_vcr, WL_snake, uCox, Vth, Vdd, k,
+// voice_voltage_range and voice_DC_voltage, and opampN for the output
+// voltage of op-amp transfer function point N.
+// ----------------------------------------------------------------------------
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+using namespace reSID;
+
+struct Candidate
+{
+  FilterModelParameters model;
+  double filter_bias;
+  double error;
+};
+
+struct Parameter
+{
+  std::string name;
+  double* (*field)(Candidate& c, int index);
+  int index;
+  // Initial step, and smallest step considered.
+  double step;
+  double tolerance;
+};
+
+static double* field_filter_bias(Candidate& c, int) { return &c.filter_bias; }
+static double* field_dac_zero(Candidate& c, int) { return &c.model.dac_zero; }
+static double* field_dac_scale(Candidate& c, int) { return &c.model.dac_scale; }
+static double* field_dac_2R_div_R(Candidate& c, int)
+{
+  return &c.model.dac_2R_div_R;
+}
+static double* field_WL_vcr(Candidate& c, int) { return &c.model.WL_vcr; }
+static double* field_WL_snake(Candidate& c, int) { return &c.model.WL_snake; }
+static double* field_uCox(Candidate& c, int) { return &c.model.uCox; }
+static double* field_Vth(Candidate& c, int) { return &c.model.Vth; }
+static double* field_Vdd(Candidate& c, int) { return &c.model.Vdd; }
+static double* field_k(Candidate& c, int) { return &c.model.k; }
+static double* field_voice_voltage_range(Candidate& c, int)
+{
+  return &c.model.voice_voltage_range;
+}
+static double* field_voice_DC_voltage(Candidate& c, int)
+{
+  return &c.model.voice_DC_voltage;
+}
+static double* field_opamp(Candidate& c, int index)
+{
+  return &c.model.opamp_voltage[index][1];
+}
+
+static const struct {
+  const char* name;
+  double* (*field)(Candidate& c, int index);
+} fields[] = {
+  { "filter_bias", field_filter_bias },
+  { "dac_zero", field_dac_zero },
+  { "dac_scale", field_dac_scale },
+  { "dac_2R_div_R", field_dac_2R_div_R },
+  { "WL_vcr", field_WL_vcr },
+  { "WL_snake", field_WL_snake },
+  { "uCox", field_uCox },
+  { "Vth", field_Vth },
+  { "Vdd", field_Vdd },
+  { "k", field_k },
+  { "voice_voltage_range", field_voice_voltage_range },
+  { "voice_DC_voltage", field_voice_DC_voltage }
+};
+
+static const int n_fields = sizeof(fields)/sizeof(*fields);
+
+struct Fit
+{
+  RenderSettings settings;
+  const Trace* trace;
+  std::vector<double> reference;
+  size_t samples;
+
+  std::vector<Candidate> candidates;
+  std::atomic<size_t> next;
+};
+
+static void usage()
+{
+  fprintf(stderr,
+	  "Usage: residfit [options] recording.wav trace.trc\n"
+	  "  -p list      comma separated parameters to fit\n"
+	  "               (default: filter_bias,dac_zero,dac_scale,WL_vcr,uCox)\n"
+	  "  -i profile   start from profile\n"
+	  "  -o profile   write fitted profile (default: stdout)\n"
+	  "  -n count     maximum number of iterations (default: 100)\n"
+	  "  -j threads   number of worker threads (default: all cores)\n"
+	  "  -M model     6581 or 8580 (default: 6581)\n"
+	  "  -m method    fast, interpolate, resample or fastmem"
+	  " (default: resample)\n"
+	  "  -q           quiet\n");
+}
+
+
+// ----------------------------------------------------------------------------
+// Read the first channel of a 16 bit PCM WAV file.
+// ----------------------------------------------------------------------------
+static unsigned int le(const unsigned char* p, int n)
+{
+  unsigned int v = 0;
+  for (int i = n - 1; i >= 0; i--) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+static bool read_wav(const char* filename, std::vector<short>& samples,
+		     int& sample_freq)
+{
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return false;
+  }
+  std::vector<unsigned char> data;
+  unsigned char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+
+  if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0 ||
+      memcmp(&data[8], "WAVE", 4) != 0)
+  {
+    return false;
+  }
+
+  int channels = 0, bits = 0;
+  size_t pos = 12;
+  while (pos + 8 <= data.size()) {
+    const unsigned char* chunk = &data[pos];
+    size_t size = le(chunk + 4, 4);
+    size_t avail = data.size() - pos - 8;
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && avail >= 16) {
+      if (le(chunk + 8, 2) != 1) {
+	return false;
+      }
+      channels = le(chunk + 10, 2);
+      sample_freq = le(chunk + 12, 4);
+      bits = le(chunk + 22, 2);
+    }
+    else if (memcmp(chunk, "data", 4) == 0) {
+      if (!channels || bits != 16) {
+	return false;
+      }
+      // Tolerate truncated files, and data chunks left open by recorders.
+      if (size > avail) {
+	size = avail;
+      }
+      size_t frames = size/(2*channels);
+      samples.resize(frames);
+      for (size_t i = 0; i < frames; i++) {
+	samples[i] = (short)le(chunk + 8 + i*2*channels, 2);
+      }
+      return true;
+    }
+    pos += 8 + size + (size & 1);
+  }
+
+  return false;
+}
+
+
+// ----------------------------------------------------------------------------
+// Band levels of Hann windowed frames.
+// ----------------------------------------------------------------------------
+static const int FRAME_SIZE = 2048;
+static const int FRAME_STEP = 1024;
+// Lowest band edge, as an FFT bin.
+static const int FIRST_BIN = 2;
+
+static void fft(std::vector<double>& re, std::vector<double>& im)
+{
+  int n = (int)re.size();
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      double t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  for (int len = 2; len <= n; len <<= 1) {
+    double a = -2*M_PI/len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < len/2; k++) {
+	double wr = cos(a*k), wi = sin(a*k);
+	double xr = re[i + k + len/2]*wr - im[i + k + len/2]*wi;
+	double xi = re[i + k + len/2]*wi + im[i + k + len/2]*wr;
+	re[i + k + len/2] = re[i + k] - xr;
+	im[i + k + len/2] = im[i + k] - xi;
+	re[i + k] += xr;
+	im[i + k] += xi;
+      }
+    }
+  }
+}
+
+static void spectrum(const short* samples, size_t n,
+		     std::vector<double>& out)
+{
+  out.clear();
+  std::vector<double> re(FRAME_SIZE), im(FRAME_SIZE);
+  for (size_t start = 0; start + FRAME_SIZE <= n; start += FRAME_STEP) {
+    for (int i = 0; i < FRAME_SIZE; i++) {
+      double w = 0.5 - 0.5*cos(2*M_PI*i/FRAME_SIZE);
+      re[i] = samples[start + i]*w/32768.0;
+      im[i] = 0;
+    }
+    fft(re, im);
+    double lo = FIRST_BIN;
+    while (lo < FRAME_SIZE/2) {
+      double hi = lo*1.122462048309373;  // 2^(1/6)
+      double p = 0;
+      int i;
+      for (i = (int)lo; i < (int)hi || i == (int)lo; i++) {
+	if (i > FRAME_SIZE/2) {
+	  break;
+	}
+	p += re[i]*re[i] + im[i]*im[i];
+      }
+      // Floor at -100 dB, so that silence does not dominate.
+      out.push_back(10*log10(p + 1e-10));
+      lo = i;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Evaluate candidates in parallel.
+// ----------------------------------------------------------------------------
+static void evaluate(Fit* fit)
+{
+  SID sid;
+  FilterModel model;
+  std::vector<short> samples(fit->samples);
+  std::vector<double> s;
+
+  if (!fit->settings.configure(sid)) {
+    return;
+  }
+
+  for (;;) {
+    size_t i = fit->next.fetch_add(1, std::memory_order_relaxed);
+    if (i >= fit->candidates.size()) {
+      break;
+    }
+    Candidate& c = fit->candidates[i];
+    c.error = HUGE_VAL;
+    if (!model.build(fit->settings.model, c.model)) {
+      continue;
+    }
+
+    RenderSettings settings = fit->settings;
+    settings.filter_bias = c.filter_bias;
+    sid.set_filter_model(&model);
+    settings.restart(sid);
+
+    TracePlayer player(sid, *fit->trace);
+    size_t n = 0;
+    while (n < fit->samples) {
+      int k = player.clock(&samples[n], (int)
+			   (fit->samples - n < 65536 ? fit->samples - n : 65536));
+      if (!k) {
+	break;
+      }
+      n += k;
+    }
+    // Pad with silence if the trace ends early.
+    for (; n < fit->samples; n++) {
+      samples[n] = 0;
+    }
+
+    spectrum(&samples[0], fit->samples, s);
+    double sum = 0;
+    for (size_t j = 0; j < s.size(); j++) {
+      double d = s[j] - fit->reference[j];
+      sum += d*d;
+    }
+    c.error = s.empty() ? HUGE_VAL : sum/s.size();
+
+    sid.set_filter_model(0);
+  }
+}
+
+static void evaluate_all(Fit& fit, int threads)
+{
+  fit.next = 0;
+  int n = threads < (int)fit.candidates.size() ?
+    threads : (int)fit.candidates.size();
+  std::vector<std::thread> workers;
+  for (int i = 1; i < n; i++) {
+    workers.push_back(std::thread(evaluate, &fit));
+  }
+  evaluate(&fit);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Parameters and profiles.
+// ----------------------------------------------------------------------------
+static bool find_parameter(const std::string& name, Parameter& p,
+			   const Candidate& start)
+{
+  p.name = name;
+  if (name.compare(0, 5, "opamp") == 0 && name.size() > 5) {
+    char* end;
+    long index = strtol(name.c_str() + 5, &end, 10);
+    // The repeated end points are not free.
+    if (*end || index < 2 || index > start.model.opamp_voltage_size - 3) {
+      return false;
+    }
+    p.field = field_opamp;
+    p.index = index;
+    p.step = 0.05;
+    p.tolerance = 0.001;
+    return true;
+  }
+
+  for (int i = 0; i < n_fields; i++) {
+    if (name == fields[i].name) {
+      p.field = fields[i].field;
+      p.index = 0;
+      Candidate c = start;
+      double v = fabs(*p.field(c, 0));
+      // Relative steps, except for the bias which is centered on zero.
+      p.step = p.field == field_filter_bias ? 0.1 : v > 0 ? 0.05*v : 0.05;
+      p.tolerance = p.step/256;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool read_profile(const char* filename, Candidate& c)
+{
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    return false;
+  }
+  char name[64];
+  double value;
+  bool ok = true;
+  while (ok && fscanf(f, "%63s %lf", name, &value) == 2) {
+    Parameter p;
+    ok = find_parameter(name, p, c);
+    if (ok) {
+      *p.field(c, p.index) = value;
+    }
+  }
+  ok = ok && feof(f);
+  fclose(f);
+  return ok;
+}
+
+static void write_profile(FILE* f, Candidate& c)
+{
+  for (int i = 0; i < n_fields; i++) {
+    fprintf(f, "%s %.9g\n", fields[i].name, *fields[i].field(c, 0));
+  }
+  for (int i = 2; i <= c.model.opamp_voltage_size - 3; i++) {
+    fprintf(f, "opamp%d %.9g\n", i, c.model.opamp_voltage[i][1]);
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  const char* list = "filter_bias,dac_zero,dac_scale,WL_vcr,uCox";
+  const char* input_profile = 0;
+  const char* output_profile = 0;
+  int iterations = 100;
+  int threads = std::thread::hardware_concurrency();
+  bool quiet = false;
+  Fit fit;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:i:o:n:j:M:m:q")) != -1) {
+    switch (opt) {
+    case 'p':
+      list = optarg;
+      break;
+    case 'i':
+      input_profile = optarg;
+      break;
+    case 'o':
+      output_profile = optarg;
+      break;
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'M':
+      fit.settings.model = strcmp(optarg, "8580") == 0 ? MOS8580 : MOS6581;
+      break;
+    case 'm':
+      if (strcmp(optarg, "fast") == 0) {
+	fit.settings.method = SAMPLE_FAST;
+      }
+      else if (strcmp(optarg, "interpolate") == 0) {
+	fit.settings.method = SAMPLE_INTERPOLATE;
+      }
+      else if (strcmp(optarg, "resample") == 0) {
+	fit.settings.method = SAMPLE_RESAMPLE;
+      }
+      else if (strcmp(optarg, "fastmem") == 0) {
+	fit.settings.method = SAMPLE_RESAMPLE_FASTMEM;
+      }
+      else {
+	usage();
+	return 1;
+      }
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind != argc - 2) {
+    usage();
+    return 1;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  std::vector<short> recording;
+  int sample_freq;
+  if (!read_wav(argv[optind], recording, sample_freq)) {
+    fprintf(stderr, "residfit: %s: not a 16 bit PCM WAV file\n",
+	    argv[optind]);
+    return 1;
+  }
+  Trace trace;
+  if (!trace.load(argv[optind + 1])) {
+    fprintf(stderr, "residfit: %s: cannot load trace\n", argv[optind + 1]);
+    return 1;
+  }
+
+  fit.settings.sample_freq = sample_freq;
+  fit.trace = &trace;
+  fit.samples = recording.size();
+  spectrum(&recording[0], fit.samples, fit.reference);
+  if (fit.reference.empty()) {
+    fprintf(stderr, "residfit: %s: recording too short\n", argv[optind]);
+    return 1;
+  }
+
+  Candidate best;
+  Filter::model_parameters(fit.settings.model, best.model);
+  best.filter_bias = fit.settings.filter_bias;
+  if (input_profile && !read_profile(input_profile, best)) {
+    fprintf(stderr, "residfit: %s: invalid profile\n", input_profile);
+    return 1;
+  }
+
+  std::vector<Parameter> parameters;
+  std::string names = list;
+  for (size_t pos = 0; pos <= names.size(); ) {
+    size_t comma = names.find(',', pos);
+    if (comma == std::string::npos) {
+      comma = names.size();
+    }
+    Parameter p;
+    if (!find_parameter(names.substr(pos, comma - pos), p, best)) {
+      fprintf(stderr, "residfit: %s: unknown parameter\n",
+	      names.substr(pos, comma - pos).c_str());
+      return 1;
+    }
+    parameters.push_back(p);
+    pos = comma + 1;
+  }
+
+  fit.candidates.assign(1, best);
+  evaluate_all(fit, threads);
+  best = fit.candidates[0];
+  if (best.error == HUGE_VAL) {
+    fprintf(stderr, "residfit: invalid starting parameters\n");
+    return 1;
+  }
+  if (!quiet) {
+    fprintf(stderr, "residfit: start, error %.4f\n", best.error);
+  }
+
+  for (int iteration = 1; iteration <= iterations; iteration++) {
+    // Candidates stepping each parameter up and down.
+    fit.candidates.clear();
+    std::vector<size_t> stepped;
+    bool converged = true;
+    for (size_t i = 0; i < parameters.size(); i++) {
+      Parameter& p = parameters[i];
+      if (p.step < p.tolerance) {
+	continue;
+      }
+      converged = false;
+      for (int sign = -1; sign <= 1; sign += 2) {
+	Candidate c = best;
+	*p.field(c, p.index) += sign*p.step;
+	fit.candidates.push_back(c);
+	stepped.push_back(i);
+      }
+    }
+    if (converged) {
+      break;
+    }
+
+    evaluate_all(fit, threads);
+
+    size_t b = 0;
+    for (size_t i = 1; i < fit.candidates.size(); i++) {
+      if (fit.candidates[i].error < fit.candidates[b].error) {
+	b = i;
+      }
+    }
+
+    if (fit.candidates[b].error < best.error) {
+      best = fit.candidates[b];
+      parameters[stepped[b]].step *= 2;
+    }
+    else {
+      for (size_t i = 0; i < parameters.size(); i++) {
+	parameters[i].step /= 2;
+      }
+    }
+
+    if (!quiet) {
+      fprintf(stderr, "residfit: iteration %d, %d candidates, error %.4f\n",
+	      iteration, (int)fit.candidates.size(), best.error);
+    }
+  }
+
+  FILE* f = stdout;
+  if (output_profile && !(f = fopen(output_profile, "w"))) {
+    fprintf(stderr, "residfit: %s: cannot open\n", output_profile);
+    return 1;
+  }
+  write_profile(f, best);
+  if (f != stdout && fclose(f) != 0) {
+    fprintf(stderr, "residfit: %s: write error\n", output_profile);
+    return 1;
+  }
+
+  return 0;
+}
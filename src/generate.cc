@@ -0,0 +1,359 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residgen - render randomized register programs to sharded WAV files with
+// labels, e.g. as training data.
+//
+// Clip number i of shard k is clip id k*clips_per_shard + i. The clips of a
+// shard are written back to back to shard-k.wav, and their parameters to
+// shard-k.tsv, one tab separated line per clip with its sample offset and
+// length in the WAV file. The label file is written once the audio is
+// complete, so a shard without labels is incomplete, and is rendered again
+// if the generator is restarted with -k.
+//
+// Shards are rendered in parallel, each worker thread taking the next shard
+// from a shared index. Since clips only depend on the seed and their id,
+// the output does not depend on the number of threads.
+// ----------------------------------------------------------------------------
+
+#include "clipgen.h"
+#include "sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+using namespace reSID;
+
+struct Generator
+{
+  ClipGenerator clips;
+  RenderSettings settings;
+  bool random_model;
+  unsigned long long count;
+  unsigned long long per_shard;
+  unsigned long long shards;
+  bool keep;
+  std::string output_dir;
+
+  std::atomic<unsigned long long> next_shard;
+  std::atomic<unsigned long long> rendered_clips;
+  std::atomic<unsigned long long> rendered_samples;
+  std::atomic<int> failures;
+};
+
+static void usage()
+{
+  fprintf(stderr,
+	  "Usage: residgen [options] -o dir\n"
+	  "  -n clips     number of clips (default: 1000)\n"
+	  "  -c clips     clips per shard (default: 1000)\n"
+	  "  -j threads   number of worker threads (default: all cores)\n"
+	  "  -s seed      random seed (default: 0)\n"
+	  "  -f frames    clip length in 50 Hz frames (default: 100)\n"
+	  "  -k           keep complete shards from an earlier run\n"
+	  "  -r rate      sample rate (default: 44100)\n"
+	  "  -m method    fast, interpolate, resample or fastmem"
+	  " (default: resample)\n"
+	  "  -M model     6581 or 8580 (default: random per clip)\n");
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static std::string shard_name(const Generator& gen, unsigned long long shard,
+			      const char* suffix)
+{
+  char name[64];
+  sprintf(name, "/shard-%05llu%s", shard, suffix);
+  return gen.output_dir + name;
+}
+
+
+// ----------------------------------------------------------------------------
+// Labels.
+// ----------------------------------------------------------------------------
+static void write_label_header(FILE* f)
+{
+  fprintf(f, "id\toffset\tsamples\tmodel");
+  for (int i = 1; i <= 3; i++) {
+    fprintf(f,
+	    "\tv%d_gate\tv%d_note\tv%d_freq\tv%d_control\tv%d_pw\tv%d_pwm"
+	    "\tv%d_attack\tv%d_decay\tv%d_sustain\tv%d_release"
+	    "\tv%d_gate_frames",
+	    i, i, i, i, i, i, i, i, i, i, i);
+  }
+  fprintf(f, "\tcutoff_start\tcutoff_end\tresonance\troute\tmode\tvolume\n");
+}
+
+static void write_label(FILE* f, const ClipParams& params,
+			unsigned long long offset, unsigned long long samples)
+{
+  fprintf(f, "%llu\t%llu\t%llu\t%s", params.id, offset, samples,
+	  params.model == MOS8580 ? "8580" : "6581");
+  for (int i = 0; i < 3; i++) {
+    const ClipVoice& voice = params.voice[i];
+    fprintf(f, "\t%d\t%d\t%u\t%u\t%u\t%d\t%u\t%u\t%u\t%u\t%d",
+	    voice.gate, voice.note, voice.freq, voice.control, voice.pw,
+	    voice.pwm, voice.attack, voice.decay, voice.sustain, voice.release,
+	    voice.gate_frames);
+  }
+  fprintf(f, "\t%u\t%u\t%u\t%u\t%u\t%u\n",
+	  params.cutoff_start, params.cutoff_end, params.resonance,
+	  params.route, params.mode, params.volume);
+}
+
+
+// ----------------------------------------------------------------------------
+// Render one shard.
+// ----------------------------------------------------------------------------
+static bool render_shard(Generator& gen, SID& sid, unsigned long long shard)
+{
+  const int chunk = 4096;
+
+  std::string labels_name = shard_name(gen, shard, ".tsv");
+  struct stat st;
+  if (gen.keep && stat(labels_name.c_str(), &st) == 0) {
+    return true;
+  }
+
+  WavFileSink wav;
+  if (!wav.open(shard_name(gen, shard, ".wav").c_str(),
+		(int)gen.settings.sample_freq))
+  {
+    return false;
+  }
+
+  // Labels are renamed into place once the audio is complete.
+  std::string tmp_name = shard_name(gen, shard, ".tsv.tmp");
+  FILE* labels = fopen(tmp_name.c_str(), "w");
+  if (!labels) {
+    wav.close();
+    return false;
+  }
+  write_label_header(labels);
+
+  RenderSettings settings = gen.settings;
+  ClipParams params;
+  Trace trace;
+  unsigned long long offset = 0;
+
+  unsigned long long first = shard*gen.per_shard;
+  unsigned long long last = first + gen.per_shard;
+  if (last > gen.count) {
+    last = gen.count;
+  }
+
+  bool ok = true;
+  for (unsigned long long id = first; ok && id < last; id++) {
+    gen.clips.generate(id, params, gen.settings.model, gen.random_model);
+    gen.clips.program(params, trace);
+
+    settings.model = params.model;
+    settings.restart(sid);
+    TracePlayer player(sid, trace);
+
+    for (;;) {
+      short* buf = wav.reserve(chunk);
+      if (!buf) {
+	ok = false;
+	break;
+      }
+      int n = player.clock(buf, chunk);
+      if (!wav.commit(n)) {
+	ok = false;
+	break;
+      }
+      if (n < chunk) {
+	break;
+      }
+    }
+
+    unsigned long long samples = player.samples();
+    write_label(labels, params, offset, samples);
+    offset += samples;
+    gen.rendered_clips++;
+    gen.rendered_samples += samples;
+  }
+
+  ok = wav.close() && ok;
+  ok = fclose(labels) == 0 && ok;
+  if (!ok || rename(tmp_name.c_str(), labels_name.c_str()) < 0) {
+    unlink(tmp_name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Worker thread.
+// ----------------------------------------------------------------------------
+static void worker(Generator* gen)
+{
+  SID sid;
+  if (!gen->settings.configure(sid)) {
+    gen->failures++;
+    return;
+  }
+
+  for (;;) {
+    unsigned long long shard =
+      gen->next_shard.fetch_add(1, std::memory_order_relaxed);
+    if (shard >= gen->shards) {
+      break;
+    }
+
+    if (!render_shard(*gen, sid, shard)) {
+      fprintf(stderr, "residgen: %s: write error\n",
+	      shard_name(*gen, shard, ".wav").c_str());
+      gen->failures++;
+    }
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  Generator gen;
+  gen.random_model = true;
+  gen.count = 1000;
+  gen.per_shard = 1000;
+  gen.keep = false;
+  gen.next_shard = 0;
+  gen.rendered_clips = 0;
+  gen.rendered_samples = 0;
+  gen.failures = 0;
+
+  int threads = std::thread::hardware_concurrency();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:j:s:f:ko:r:m:M:")) != -1) {
+    switch (opt) {
+    case 'n':
+      gen.count = strtoull(optarg, 0, 10);
+      break;
+    case 'c':
+      gen.per_shard = strtoull(optarg, 0, 10);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 's':
+      gen.clips = ClipGenerator(strtoull(optarg, 0, 0), gen.clips.frames);
+      break;
+    case 'f':
+      gen.clips.frames = atoi(optarg);
+      break;
+    case 'k':
+      gen.keep = true;
+      break;
+    case 'o':
+      gen.output_dir = optarg;
+      break;
+    case 'r':
+      gen.settings.sample_freq = atof(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "fast") == 0) {
+	gen.settings.method = SAMPLE_FAST;
+      }
+      else if (strcmp(optarg, "interpolate") == 0) {
+	gen.settings.method = SAMPLE_INTERPOLATE;
+      }
+      else if (strcmp(optarg, "resample") == 0) {
+	gen.settings.method = SAMPLE_RESAMPLE;
+      }
+      else if (strcmp(optarg, "fastmem") == 0) {
+	gen.settings.method = SAMPLE_RESAMPLE_FASTMEM;
+      }
+      else {
+	usage();
+	return 1;
+      }
+      break;
+    case 'M':
+      gen.settings.model = strcmp(optarg, "8580") == 0 ? MOS8580 : MOS6581;
+      gen.random_model = false;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind != argc || gen.output_dir.empty() || !gen.count ||
+      !gen.per_shard || gen.clips.frames < 2)
+  {
+    usage();
+    return 1;
+  }
+
+  if (mkdir(gen.output_dir.c_str(), 0777) < 0) {
+    struct stat st;
+    if (stat(gen.output_dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+      fprintf(stderr, "residgen: %s: cannot create directory\n",
+	      gen.output_dir.c_str());
+      return 1;
+    }
+  }
+
+  gen.shards = (gen.count + gen.per_shard - 1)/gen.per_shard;
+
+  if (threads < 1) {
+    threads = 1;
+  }
+  if ((unsigned long long)threads > gen.shards) {
+    threads = gen.shards;
+  }
+
+  double start = now();
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(std::thread(worker, &gen));
+  }
+  for (int i = 0; i < threads; i++) {
+    workers[i].join();
+  }
+
+  double wall = now() - start;
+  double audio = gen.rendered_samples/gen.settings.sample_freq;
+  fprintf(stderr,
+	  "residgen: %llu clips in %llu shards, %d failed, %d threads,"
+	  " %.3f s wall, %.1f s audio, %.1fx realtime, %.1f clips/s\n",
+	  (unsigned long long)gen.rendered_clips, gen.shards,
+	  (int)gen.failures, threads, wall, audio,
+	  wall > 0 ? audio/wall : 0,
+	  wall > 0 ? gen.rendered_clips/wall : 0);
+
+  return gen.failures ? 2 : 0;
+}
@@ -0,0 +1,228 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "hash.h"
+#include <string.h>
+
+namespace reSID
+{
+
+static const unsigned long long c1 = 0x87c37b91114253d5ULL;
+static const unsigned long long c2 = 0x4cf5ad432745937fULL;
+
+static inline unsigned long long rotl64(unsigned long long x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long fmix64(unsigned long long k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline unsigned long long get64(const unsigned char* p)
+{
+  unsigned long long v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+
+// ----------------------------------------------------------------------------
+// Hex representation of digest.
+// ----------------------------------------------------------------------------
+void HashDigest::hex(char* str) const
+{
+  static const char digits[] = "0123456789abcdef";
+
+  for (int i = 0; i < 16; i++) {
+    str[i] = digits[(h1 >> (60 - 4*i)) & 0xf];
+    str[i + 16] = digits[(h2 >> (60 - 4*i)) & 0xf];
+  }
+  str[32] = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+Hash::Hash(unsigned long long seed)
+{
+  h1 = h2 = seed;
+  length = 0;
+  buffered = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Hash one 16 byte block.
+// ----------------------------------------------------------------------------
+void Hash::block(const unsigned char* data)
+{
+  unsigned long long k1 = get64(data);
+  unsigned long long k2 = get64(data + 8);
+
+  k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+  h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+
+  k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+  h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+}
+
+
+// ----------------------------------------------------------------------------
+// Add data to hash.
+// ----------------------------------------------------------------------------
+void Hash::update(const void* data, size_t size)
+{
+  const unsigned char* p = (const unsigned char*)data;
+  length += size;
+
+  // Complete buffered block.
+  if (buffered) {
+    size_t n = 16 - buffered;
+    if (n > size) {
+      n = size;
+    }
+    memcpy(buffer + buffered, p, n);
+    buffered += n;
+    p += n;
+    size -= n;
+    if (buffered < 16) {
+      return;
+    }
+    block(buffer);
+    buffered = 0;
+  }
+
+  for (; size >= 16; p += 16, size -= 16) {
+    block(p);
+  }
+
+  memcpy(buffer, p, size);
+  buffered = size;
+}
+
+void Hash::update(unsigned int value)
+{
+  unsigned char b[4];
+  for (int i = 0; i < 4; i++) {
+    b[i] = (value >> 8*i) & 0xff;
+  }
+  update(b, sizeof(b));
+}
+
+void Hash::update(unsigned long long value)
+{
+  unsigned char b[8];
+  for (int i = 0; i < 8; i++) {
+    b[i] = (value >> 8*i) & 0xff;
+  }
+  update(b, sizeof(b));
+}
+
+void Hash::update(int value)
+{
+  update((unsigned int)value);
+}
+
+void Hash::update(double value)
+{
+  unsigned long long bits;
+  memcpy(&bits, &value, sizeof(bits));
+  update(bits);
+}
+
+void Hash::update(const char* str)
+{
+  // Include the terminating zero to separate consecutive strings.
+  update(str, strlen(str) + 1);
+}
+
+
+// ----------------------------------------------------------------------------
+// Finalize a copy of the hash state.
+// ----------------------------------------------------------------------------
+HashDigest Hash::digest() const
+{
+  unsigned long long d1 = h1, d2 = h2;
+  unsigned long long k1 = 0, k2 = 0;
+
+  // Tail.
+  switch (buffered) {
+  case 15: k2 ^= (unsigned long long)buffer[14] << 48;
+    // fall through
+  case 14: k2 ^= (unsigned long long)buffer[13] << 40;
+    // fall through
+  case 13: k2 ^= (unsigned long long)buffer[12] << 32;
+    // fall through
+  case 12: k2 ^= (unsigned long long)buffer[11] << 24;
+    // fall through
+  case 11: k2 ^= (unsigned long long)buffer[10] << 16;
+    // fall through
+  case 10: k2 ^= (unsigned long long)buffer[9] << 8;
+    // fall through
+  case 9:  k2 ^= (unsigned long long)buffer[8];
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; d2 ^= k2;
+    // fall through
+  case 8:  k1 ^= (unsigned long long)buffer[7] << 56;
+    // fall through
+  case 7:  k1 ^= (unsigned long long)buffer[6] << 48;
+    // fall through
+  case 6:  k1 ^= (unsigned long long)buffer[5] << 40;
+    // fall through
+  case 5:  k1 ^= (unsigned long long)buffer[4] << 32;
+    // fall through
+  case 4:  k1 ^= (unsigned long long)buffer[3] << 24;
+    // fall through
+  case 3:  k1 ^= (unsigned long long)buffer[2] << 16;
+    // fall through
+  case 2:  k1 ^= (unsigned long long)buffer[1] << 8;
+    // fall through
+  case 1:  k1 ^= (unsigned long long)buffer[0];
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; d1 ^= k1;
+  }
+
+  // Finalization.
+  d1 ^= length;
+  d2 ^= length;
+
+  d1 += d2;
+  d2 += d1;
+
+  d1 = fmix64(d1);
+  d2 = fmix64(d2);
+
+  d1 += d2;
+  d2 += d1;
+
+  HashDigest d;
+  d.h1 = d1;
+  d.h2 = d2;
+  return d;
+}
+
+} // namespace reSID
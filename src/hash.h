@@ -0,0 +1,87 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_HASH_H
+#define RESID_HASH_H
+
+#include <stddef.h>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// 128 bit hash digest.
+// ----------------------------------------------------------------------------
+class HashDigest
+{
+public:
+  unsigned long long h1, h2;
+
+  bool operator==(const HashDigest& d) const
+  {
+    return h1 == d.h1 && h2 == d.h2;
+  }
+  bool operator!=(const HashDigest& d) const
+  {
+    return !(*this == d);
+  }
+
+  // 32 hex digits plus terminating zero.
+  void hex(char* str) const;
+};
+
+
+// ----------------------------------------------------------------------------
+// Incremental 128 bit hash, used for content addressing.
+//
+// This is MurmurHash3 (x64, 128 bit) by Austin Appleby, restructured for
+// streaming input. It is fast and well distributed, but it is not a
+// cryptographic hash; it must not be used to protect against deliberate
+// collisions.
+//
+// Multi-byte values are hashed in little endian byte order, so that digests
+// do not depend on the host.
+// ----------------------------------------------------------------------------
+class Hash
+{
+public:
+  Hash(unsigned long long seed = 0);
+
+  void update(const void* data, size_t size);
+  void update(unsigned int value);
+  void update(unsigned long long value);
+  void update(int value);
+  void update(double value);
+  void update(const char* str);
+
+  // The hash may be updated further after calling digest().
+  HashDigest digest() const;
+
+protected:
+  void block(const unsigned char* data);
+
+  unsigned long long h1, h2;
+  unsigned long long length;
+  unsigned char buffer[16];
+  int buffered;
+};
+
+} // namespace reSID
+
+#endif // not RESID_HASH_H
@@ -0,0 +1,587 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "matrix.h"
+#include <string.h>
+#include <math.h>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SIDMatrix::SIDMatrix()
+{
+  memset(gain, 0, sizeof(gain));
+  memset(stem, 0, sizeof(stem));
+  memset(ring, 0, sizeof(ring));
+
+  chip[0] = new SID();
+  n_chips = 1;
+  stem_model[0] = chip[0]->sid_model;
+  stem_filter_model[0] = chip[0]->filter.custom_model;
+  pipelined_offset[0] = -1;
+  pipelined_value[0] = 0;
+
+  n_channels = 1;
+  ring[0] = new short[SID::RINGSIZE*2];
+  memset(ring[0], 0, sizeof(short)*SID::RINGSIZE*2);
+  sample_prev[0] = sample_now[0] = 0;
+  ring_index = 0;
+
+  gain[0][CHIP_OUTPUT] = 1 << GAIN_SHIFT;
+  update_routes();
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+SIDMatrix::~SIDMatrix()
+{
+  for (int i = 0; i < n_chips; i++) {
+    for (int v = 0; v < 3; v++) {
+      delete stem[i][v];
+    }
+    delete chip[i];
+  }
+  for (int c = 0; c < n_channels; c++) {
+    delete[] ring[c];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Set number of chips. The output of new chips has unit gain in all
+// channels.
+// ----------------------------------------------------------------------------
+bool SIDMatrix::set_chips(int n)
+{
+  if (n < 1 || n > MAX_CHIPS) {
+    return false;
+  }
+
+  while (n_chips < n) {
+    int i = n_chips++;
+    chip[i] = new SID();
+    chip[i]->sampling = chip[0]->sampling;
+    stem_model[i] = chip[i]->sid_model;
+    stem_filter_model[i] = chip[i]->filter.custom_model;
+    pipelined_offset[i] = -1;
+    pipelined_value[i] = 0;
+    for (int c = 0; c < n_channels; c++) {
+      gain[c][i*SOURCES + CHIP_OUTPUT] = 1 << GAIN_SHIFT;
+    }
+  }
+  while (n_chips > n) {
+    int i = --n_chips;
+    for (int v = 0; v < 3; v++) {
+      delete stem[i][v];
+      stem[i][v] = 0;
+    }
+    delete chip[i];
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      for (int k = 0; k < SOURCES; k++) {
+	gain[c][i*SOURCES + k] = 0;
+      }
+    }
+  }
+
+  update_routes();
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Set number of channels. The output of each chip has unit gain in new
+// channels.
+// ----------------------------------------------------------------------------
+bool SIDMatrix::set_channels(int n)
+{
+  if (n < 1 || n > MAX_CHANNELS) {
+    return false;
+  }
+
+  while (n_channels < n) {
+    int c = n_channels++;
+    ring[c] = new short[SID::RINGSIZE*2];
+    memset(ring[c], 0, sizeof(short)*SID::RINGSIZE*2);
+    sample_prev[c] = sample_now[c] = 0;
+    for (int i = 0; i < n_chips; i++) {
+      gain[c][i*SOURCES + CHIP_OUTPUT] = 1 << GAIN_SHIFT;
+    }
+  }
+  while (n_channels > n) {
+    int c = --n_channels;
+    delete[] ring[c];
+    ring[c] = 0;
+    memset(gain[c], 0, sizeof(gain[c]));
+  }
+
+  update_routes();
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Set gain of a source in a channel.
+// ----------------------------------------------------------------------------
+bool SIDMatrix::set_gain(int c, int i, int source, double gain)
+{
+  if (c < 0 || c >= n_channels || i < 0 || i >= n_chips ||
+      source < 0 || source >= SOURCES || gain < -8 || gain > 8)
+  {
+    return false;
+  }
+
+  this->gain[c][i*SOURCES + source] =
+    (int)floor(gain*(1 << GAIN_SHIFT) + 0.5);
+  update_routes();
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Collect the nonzero gains, and create the stems which are routed and
+// delete those which are not.
+// ----------------------------------------------------------------------------
+void SIDMatrix::update_routes()
+{
+  route.clear();
+  memset(routed, 0, sizeof(routed));
+
+  for (int c = 0; c < n_channels; c++) {
+    for (int k = 0; k < n_chips*SOURCES; k++) {
+      if (gain[c][k]) {
+	Route r;
+	r.channel = c;
+	r.source = k;
+	r.gain = gain[c][k];
+	route.push_back(r);
+	routed[k] = true;
+      }
+    }
+  }
+
+  for (int i = 0; i < n_chips; i++) {
+    sync_stems(i);
+
+    SID::State state;
+    bool have_state = false;
+
+    for (int v = 0; v < 3; v++) {
+      if (!routed[i*SOURCES + v]) {
+	delete stem[i][v];
+	stem[i][v] = 0;
+	continue;
+      }
+      if (stem[i][v]) {
+	continue;
+      }
+
+      // The filter registers are taken from the chip.
+      if (!have_state) {
+	state = chip[i]->read_state();
+	have_state = true;
+      }
+
+      Stem* st = new Stem();
+      st->filter.set_model(stem_filter_model[i]);
+      st->filter.set_chip_model(stem_model[i]);
+      st->filter.set_voice_mask(1 << v);
+      st->filter.enable_filter(chip[i]->filter.enabled);
+      st->filter.adjust_filter_bias(chip[i]->filter.dac_bias);
+      st->filter.writeFC_LO(state.sid_register[0x15]);
+      st->filter.writeFC_HI(state.sid_register[0x16]);
+      st->filter.writeRES_FILT(state.sid_register[0x17]);
+      st->filter.writeMODE_VOL(state.sid_register[0x18]);
+      st->extfilt.enable_filter(chip[i]->extfilt.enabled);
+      stem[i][v] = st;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Follow changes of the chip model and filter settings of a chip. Changing
+// the chip model or filter model resets the stems.
+// ----------------------------------------------------------------------------
+void SIDMatrix::sync_stems(int i)
+{
+  SID& sid = *chip[i];
+  bool model_changed = stem_model[i] != sid.sid_model ||
+    stem_filter_model[i] != sid.filter.custom_model;
+
+  stem_model[i] = sid.sid_model;
+  stem_filter_model[i] = sid.filter.custom_model;
+
+  for (int v = 0; v < 3; v++) {
+    Stem* st = stem[i][v];
+    if (!st) {
+      continue;
+    }
+    if (model_changed) {
+      st->filter.set_model(stem_filter_model[i]);
+      st->filter.set_chip_model(stem_model[i]);
+    }
+    if (st->filter.enabled != sid.filter.enabled) {
+      st->filter.enable_filter(sid.filter.enabled);
+    }
+    if (model_changed || st->filter.dac_bias != sid.filter.dac_bias) {
+      st->filter.adjust_filter_bias(sid.filter.dac_bias);
+    }
+    if (st->extfilt.enabled != sid.extfilt.enabled) {
+      st->extfilt.enable_filter(sid.extfilt.enabled);
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Set sampling parameters; see SID::set_sampling_parameters().
+// ----------------------------------------------------------------------------
+bool SIDMatrix::set_sampling_parameters(double clock_freq,
+					sampling_method method,
+					double sample_freq, double pass_freq,
+					double filter_scale)
+{
+  if (!chip[0]->set_sampling_parameters(clock_freq, method, sample_freq,
+					pass_freq, filter_scale))
+  {
+    return false;
+  }
+
+  // The other chips are not sampled, however the handling of writes
+  // depends on the sampling method.
+  for (int i = 1; i < n_chips; i++) {
+    chip[i]->sampling = method;
+  }
+
+  for (int c = 0; c < n_channels; c++) {
+    sample_prev[c] = sample_now[c] = 0;
+    memset(ring[c], 0, sizeof(short)*SID::RINGSIZE*2);
+  }
+  ring_index = 0;
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Reset.
+// ----------------------------------------------------------------------------
+void SIDMatrix::reset()
+{
+  for (int i = 0; i < n_chips; i++) {
+    chip[i]->reset();
+    pipelined_offset[i] = -1;
+    for (int v = 0; v < 3; v++) {
+      if (stem[i][v]) {
+	stem[i][v]->filter.reset();
+	stem[i][v]->extfilt.reset();
+      }
+    }
+  }
+
+  for (int c = 0; c < n_channels; c++) {
+    sample_prev[c] = sample_now[c] = 0;
+    memset(ring[c], 0, sizeof(short)*SID::RINGSIZE*2);
+  }
+  ring_index = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Write register. Writes which the chip pipelines are mirrored to the stems
+// when they take effect, in clock().
+// ----------------------------------------------------------------------------
+void SIDMatrix::write(int i, reg8 offset, reg8 value)
+{
+  chip[i]->write(offset, value);
+  if (chip[i]->write_pipeline) {
+    pipelined_offset[i] = offset;
+    pipelined_value[i] = value;
+  }
+  else {
+    mirror(i, offset, value);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Write filter register to the stems of a chip.
+// ----------------------------------------------------------------------------
+void SIDMatrix::mirror(int i, reg8 offset, reg8 value)
+{
+  if (offset < 0x15 || offset > 0x18) {
+    return;
+  }
+
+  for (int v = 0; v < 3; v++) {
+    if (!stem[i][v]) {
+      continue;
+    }
+    Filter& filter = stem[i][v]->filter;
+    switch (offset) {
+    case 0x15:
+      filter.writeFC_LO(value);
+      break;
+    case 0x16:
+      filter.writeFC_HI(value);
+      break;
+    case 0x17:
+      filter.writeRES_FILT(value);
+      break;
+    case 0x18:
+      filter.writeMODE_VOL(value);
+      break;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the oscillators, envelopes and register logic of a chip one cycle;
+// this is SID::clock() without the filter and the external filter.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+void SIDMatrix::clock_digital(SID& sid)
+{
+  int i;
+
+  // Clock amplitude modulators.
+  for (i = 0; i < 3; i++) {
+    sid.voice[i].envelope.clock();
+  }
+
+  // Clock oscillators.
+  for (i = 0; i < 3; i++) {
+    sid.voice[i].wave.clock();
+  }
+
+  // Synchronize oscillators.
+  for (i = 0; i < 3; i++) {
+    sid.voice[i].wave.synchronize();
+  }
+
+  // Calculate waveform output.
+  for (i = 0; i < 3; i++) {
+    sid.voice[i].wave.set_waveform_output();
+  }
+
+  // Pipelined writes on the MOS8580.
+  if (unlikely(sid.write_pipeline)) {
+    sid.write();
+  }
+
+  // Age bus value.
+  if (unlikely(!--sid.bus_value_ttl)) {
+    sid.bus_value = 0;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock with audio sampling of each channel.
+// ----------------------------------------------------------------------------
+int SIDMatrix::clock(cycle_count& delta_t, short* buf, int n)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const int RINGSIZE = SID::RINGSIZE;
+  const int RINGMASK = SID::RINGMASK;
+  const int half = 1 << 15;
+
+  for (int i = 0; i < n_chips; i++) {
+    sync_stems(i);
+  }
+
+  SID& front = *chip[0];
+  sampling_method method = front.sampling;
+  bool resample =
+    method == SAMPLE_RESAMPLE || method == SAMPLE_RESAMPLE_FASTMEM;
+  const Route* r = route.empty() ? 0 : &route[0];
+  int nr = (int)route.size();
+  int source[MAX_CHIPS*SOURCES];
+  // A term is up to 2^30, and a channel sums up to MAX_CHIPS*SOURCES terms.
+  long long mix[MAX_CHANNELS];
+  int s;
+
+  memset(source, 0, sizeof(source));
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset =
+      front.sample_offset + front.cycles_per_sample;
+    if (method == SAMPLE_FAST) {
+      next_sample_offset += 1 << (FIXP_SHIFT - 1);
+    }
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    for (int t = delta_t_sample; t > 0; t--) {
+      // Sources.
+      for (int i = 0; i < n_chips; i++) {
+	SID& sid = *chip[i];
+	int* src = source + i*SOURCES;
+
+	if (routed[i*SOURCES + CHIP_OUTPUT]) {
+	  sid.clock();
+	  src[CHIP_OUTPUT] = sid.output();
+	}
+	else {
+	  clock_digital(sid);
+	}
+
+	Stem** st = stem[i];
+	if (st[0] || st[1] || st[2]) {
+	  int v1 = sid.voice[0].output();
+	  int v2 = sid.voice[1].output();
+	  int v3 = sid.voice[2].output();
+	  for (int v = 0; v < 3; v++) {
+	    if (st[v]) {
+	      st[v]->filter.clock(v1, v2, v3);
+	      st[v]->extfilt.clock(st[v]->filter.output());
+	      src[v] = st[v]->extfilt.output();
+	    }
+	  }
+	}
+
+	if (unlikely(pipelined_offset[i] >= 0)) {
+	  mirror(i, pipelined_offset[i], pipelined_value[i]);
+	  pipelined_offset[i] = -1;
+	}
+      }
+
+      // Mix, with clipping.
+      for (int c = 0; c < n_channels; c++) {
+	mix[c] = 0;
+      }
+      for (int k = 0; k < nr; k++) {
+	mix[r[k].channel] += (long long)r[k].gain*source[r[k].source];
+      }
+      for (int c = 0; c < n_channels; c++) {
+	int v = (int)(mix[c] >> GAIN_SHIFT);
+	if (v >= half) {
+	  v = half - 1;
+	}
+	else if (v < -half) {
+	  v = -half;
+	}
+
+	if (resample) {
+	  ring[c][ring_index] = ring[c][ring_index + RINGSIZE] = v;
+	}
+	else if (t <= 2) {
+	  sample_prev[c] = sample_now[c];
+	  sample_now[c] = v;
+	}
+      }
+
+      if (resample) {
+	++ring_index &= RINGMASK;
+      }
+    }
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      front.sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    if (method == SAMPLE_FAST) {
+      front.sample_offset =
+	(next_sample_offset & FIXP_MASK) - (1 << (FIXP_SHIFT - 1));
+    }
+    else {
+      front.sample_offset = next_sample_offset & FIXP_MASK;
+    }
+
+    for (int c = 0; c < n_channels; c++) {
+      int v;
+
+      if (method == SAMPLE_FAST) {
+	v = sample_now[c];
+      }
+      else if (method == SAMPLE_INTERPOLATE) {
+	v = sample_prev[c] + (front.sample_offset*
+			      (sample_now[c] - sample_prev[c]) >> FIXP_SHIFT);
+      }
+      else if (method == SAMPLE_RESAMPLE) {
+	int fir_offset = front.sample_offset*front.fir_RES >> FIXP_SHIFT;
+	int fir_offset_rmd = front.sample_offset*front.fir_RES & FIXP_MASK;
+	short* fir_start = front.fir + fir_offset*front.fir_N;
+	short* sample_start =
+	  ring[c] + ring_index - front.fir_N - 1 + RINGSIZE;
+
+	// Convolution with filter impulse response.
+	int w1 = 0;
+	for (int j = 0; j < front.fir_N; j++) {
+	  w1 += sample_start[j]*fir_start[j];
+	}
+
+	// Use next FIR table, wrap around to first FIR table using
+	// next sample.
+	if (unlikely(++fir_offset == front.fir_RES)) {
+	  fir_offset = 0;
+	  ++sample_start;
+	}
+	fir_start = front.fir + fir_offset*front.fir_N;
+
+	// Convolution with filter impulse response.
+	int w2 = 0;
+	for (int k = 0; k < front.fir_N; k++) {
+	  w2 += sample_start[k]*fir_start[k];
+	}
+
+	// Linear interpolation.
+	v = w1 + (fir_offset_rmd*(w2 - w1) >> FIXP_SHIFT);
+	v >>= SID::FIR_SHIFT;
+      }
+      else {
+	int fir_offset = front.sample_offset*front.fir_RES >> FIXP_SHIFT;
+	short* fir_start = front.fir + fir_offset*front.fir_N;
+	short* sample_start = ring[c] + ring_index - front.fir_N + RINGSIZE;
+
+	// Convolution with filter impulse response.
+	v = 0;
+	for (int j = 0; j < front.fir_N; j++) {
+	  v += sample_start[j]*fir_start[j];
+	}
+	v >>= SID::FIR_SHIFT;
+      }
+
+      // Saturated arithmetics to guard against 16 bit sample overflow.
+      if (v >= half) {
+	v = half - 1;
+      }
+      else if (v < -half) {
+	v = -half;
+      }
+
+      buf[s*n_channels + c] = v;
+    }
+  }
+
+  return s;
+}
+
+} // namespace reSID
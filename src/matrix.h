@@ -0,0 +1,139 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_MATRIX_H
+#define RESID_MATRIX_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Routing and panning of several SIDs, and optionally of separate voices, to
+// several output channels, e.g. for stereo.
+//
+// The sources of each chip are its output, and stems of its three voices.
+// A stem is the voice alone through a filter and external filter of its
+// own, i.e. the output of the chip with a voice mask selecting the voice,
+// so that three stems cost one digital emulation plus three analog stages
+// rather than three full emulations. The stems take the chip model and
+// filter settings of the chip, and register writes through the matrix.
+//
+// Every cycle the sources are mixed into the channels according to a
+// matrix of gains, with clipping, and each channel is sampled once; with
+// SAMPLE_RESAMPLE and SAMPLE_RESAMPLE_FASTMEM this is one FIR convolution
+// per channel rather than one per source. Only routed sources are
+// computed; the analog stage of a chip is only clocked while its output is
+// routed.
+//
+// As in MultiSID, the sampling parameters and FIR tables are those of the
+// first chip. As in SIDFanout, all chips are clocked cycle by cycle, so
+// SAMPLE_FAST takes the output of the cycle at each sampling point.
+// ----------------------------------------------------------------------------
+class SIDMatrix
+{
+public:
+  SIDMatrix();
+  ~SIDMatrix();
+
+  enum {
+    MAX_CHIPS = 8,
+    MAX_CHANNELS = 8,
+    // Sources of a chip: voices 0 - 2, and the chip output.
+    SOURCES = 4,
+    CHIP_OUTPUT = 3
+  };
+
+  // Set the number of chips, 1 - MAX_CHIPS, and of channels,
+  // 1 - MAX_CHANNELS. Existing chips and gains are kept. By default there
+  // is one channel, and the output of each chip has unit gain.
+  bool set_chips(int n);
+  int chips() const { return n_chips; }
+  bool set_channels(int n);
+  int channels() const { return n_channels; }
+
+  // The chips; use these for the chip model, filter settings and reads.
+  // Register writes must go through the matrix.
+  SID& sid(int i) { return *chip[i]; }
+
+  // Gain of a source of chip i in channel c, from -8 to 8.
+  bool set_gain(int c, int i, int source, double gain);
+
+  bool set_sampling_parameters(double clock_freq, sampling_method method,
+			       double sample_freq, double pass_freq = -1,
+			       double filter_scale = 0.97);
+
+  void reset();
+  void write(int i, reg8 offset, reg8 value);
+
+  // Clock for delta_t cycles or n sample frames, writing sample s of
+  // channel c to buf[s*channels() + c]. Returns the number of frames.
+  int clock(cycle_count& delta_t, short* buf, int n);
+
+protected:
+  enum { GAIN_SHIFT = 12 };
+
+  struct Stem
+  {
+    Filter filter;
+    ExternalFilter extfilt;
+  };
+
+  // Nonzero gain of a source in a channel.
+  struct Route
+  {
+    int channel;
+    int source;
+    int gain;
+  };
+
+  void update_routes();
+  void sync_stems(int i);
+  void mirror(int i, reg8 offset, reg8 value);
+  void clock_digital(SID& sid);
+
+  SID* chip[MAX_CHIPS];
+  int n_chips;
+  int n_channels;
+
+  // Stems of each chip, created when routed.
+  Stem* stem[MAX_CHIPS][3];
+  chip_model stem_model[MAX_CHIPS];
+  const FilterModel* stem_filter_model[MAX_CHIPS];
+
+  // Writes which a chip pipelines, mirrored to the stems in the next cycle.
+  int pipelined_offset[MAX_CHIPS];
+  reg8 pipelined_value[MAX_CHIPS];
+
+  int gain[MAX_CHANNELS][MAX_CHIPS*SOURCES];
+  std::vector<Route> route;
+  bool routed[MAX_CHIPS*SOURCES];
+
+  // Output of each channel, as in SID.
+  short sample_prev[MAX_CHANNELS], sample_now[MAX_CHANNELS];
+  short* ring[MAX_CHANNELS];
+  int ring_index;
+};
+
+} // namespace reSID
+
+#endif // not RESID_MATRIX_H
@@ -0,0 +1,244 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "memo.h"
+#include <unordered_map>
+#include <algorithm>
+
+namespace reSID
+{
+
+// Boundary at which a state was first seen.
+struct MemoEntry
+{
+  size_t index;
+  size_t sample;
+};
+
+struct DigestHasher
+{
+  size_t operator()(const HashDigest& d) const { return d.h1; }
+};
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+MemoRenderer::MemoRenderer(cycle_count min_gap)
+{
+  this->min_gap = min_gap;
+  boundaries = loops = 0;
+  copied_samples = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Hash state field by field, since the structure contains padding.
+// The ring buffer is hashed starting at the current position, so that
+// states which only differ in the position of the ring buffer, and thus
+// produce identical output, hash equal.
+// ----------------------------------------------------------------------------
+HashDigest MemoRenderer::hash_state(const SID::State& state,
+				    int ignore_noise)
+{
+  Hash hash;
+  int i;
+
+  hash.update(state.sid_register, sizeof(state.sid_register));
+  hash.update((unsigned int)state.bus_value);
+  hash.update((int)state.bus_value_ttl);
+  hash.update((int)state.write_pipeline);
+  hash.update((unsigned int)state.write_address);
+  hash.update((unsigned int)state.voice_mask);
+
+  for (i = 0; i < 3; i++) {
+    hash.update((unsigned int)state.accumulator[i]);
+    if (!(ignore_noise & (1 << i))) {
+      hash.update((unsigned int)state.shift_register[i]);
+      hash.update((int)state.shift_register_reset[i]);
+      hash.update((int)state.shift_pipeline[i]);
+      hash.update((unsigned int)state.noise_output[i]);
+    }
+    hash.update((unsigned int)state.pulse_output[i]);
+    hash.update((int)state.floating_output_ttl[i]);
+
+    hash.update((unsigned int)state.rate_counter[i]);
+    hash.update((unsigned int)state.rate_counter_period[i]);
+    hash.update((unsigned int)state.exponential_counter[i]);
+    hash.update((unsigned int)state.exponential_counter_period[i]);
+    hash.update((unsigned int)state.envelope_counter[i]);
+    hash.update((int)state.envelope_state[i]);
+    hash.update((unsigned int)state.hold_zero[i]);
+    hash.update((int)state.envelope_pipeline[i]);
+
+    hash.update((unsigned int)state.msb_rising[i]);
+    hash.update((unsigned int)state.tri_saw_pipeline[i]);
+    hash.update((unsigned int)state.osc3[i]);
+    hash.update((unsigned int)state.waveform_output[i]);
+  }
+
+  hash.update(state.filter_Vhp);
+  hash.update(state.filter_Vbp);
+  hash.update(state.filter_Vbp_x);
+  hash.update(state.filter_Vbp_vc);
+  hash.update(state.filter_Vlp);
+  hash.update(state.filter_Vlp_x);
+  hash.update(state.filter_Vlp_vc);
+  hash.update(state.filter_ve);
+  hash.update(state.filter_v3);
+  hash.update(state.filter_v2);
+  hash.update(state.filter_v1);
+
+  hash.update(state.extfilt_vlp);
+  hash.update(state.extfilt_vhp);
+
+  hash.update((int)state.sample_offset);
+  hash.update((int)state.sample_prev);
+  hash.update((int)state.sample_now);
+
+  int ringsize = sizeof(state.sample)/sizeof(*state.sample);
+  int index = state.sample_index & (ringsize - 1);
+  hash.update(state.sample + index, (ringsize - index)*sizeof(short));
+  hash.update(state.sample, index*sizeof(short));
+
+  return hash.digest();
+}
+
+
+// ----------------------------------------------------------------------------
+// Render trace.
+// ----------------------------------------------------------------------------
+bool MemoRenderer::render(SID& sid, const Trace& trace,
+			  const RenderSettings& settings,
+			  std::vector<short>& samples)
+{
+  boundaries = loops = 0;
+  copied_samples = 0;
+
+  if (!settings.configure(sid)) {
+    return false;
+  }
+
+  const std::vector<Trace::Write>& writes = trace.writes;
+  size_t size = writes.size();
+
+  // Index of the last write selecting noise, per voice.
+  size_t last_noise[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < size; i++) {
+    reg8 offset = writes[i].offset;
+    if ((offset == 0x04 || offset == 0x0b || offset == 0x12) &&
+	(writes[i].value & 0x80))
+    {
+      last_noise[offset/7] = i + 1;
+    }
+  }
+
+  TracePlayer player(sid, trace);
+  std::unordered_map<HashDigest, MemoEntry, DigestHasher> seen;
+  SID::State* state = new SID::State();
+
+  samples.clear();
+  const int chunk = 4096;
+  size_t s = 0;
+
+  for (;;) {
+    // Render up to the next boundary, or to the end.
+    size_t next = player.position() + 1;
+    while (next < size && writes[next].delta < min_gap) {
+      next++;
+    }
+    player.set_stop(next < size ? next : (size_t)-1);
+
+    for (;;) {
+      samples.resize(s + chunk);
+      int n = player.clock(&samples[s], chunk);
+      s += n;
+      if (n < chunk) {
+	break;
+      }
+    }
+    samples.resize(s);
+
+    if (next >= size) {
+      break;
+    }
+
+    boundaries++;
+    *state = sid.read_state();
+    int ignore_noise = 0;
+    for (int v = 0; v < 3; v++) {
+      if (next >= last_noise[v] && !(state->sid_register[v*7 + 4] & 0x80)) {
+	ignore_noise |= 1 << v;
+      }
+    }
+    HashDigest key = hash_state(*state, ignore_noise);
+
+    std::unordered_map<HashDigest, MemoEntry, DigestHasher>::iterator i =
+      seen.find(key);
+    if (i == seen.end()) {
+      MemoEntry entry = { next, s };
+      seen[key] = entry;
+      continue;
+    }
+
+    // Copy loops for as long as the writes repeat.
+    size_t first = i->second.index;
+    size_t length = next - first;
+    size_t first_sample = i->second.sample;
+    size_t loop_samples = s - first_sample;
+    size_t position = next;
+
+    for (;;) {
+      if (position + length > size) {
+	break;
+      }
+      size_t j;
+      for (j = 0; j < length; j++) {
+	const Trace::Write& a = writes[first + j];
+	const Trace::Write& b = writes[position + j];
+	if (a.delta != b.delta || a.offset != b.offset || a.value != b.value) {
+	  break;
+	}
+      }
+      if (j < length) {
+	break;
+      }
+
+      samples.resize(s + loop_samples);
+      std::copy(samples.begin() + first_sample,
+		samples.begin() + first_sample + loop_samples,
+		samples.begin() + s);
+      s += loop_samples;
+      position += length;
+      loops++;
+      copied_samples += loop_samples;
+    }
+
+    if (position != next) {
+      // The SID state is the same as after the copied loops.
+      player.seek(position, s);
+    }
+  }
+
+  delete state;
+
+  return true;
+}
+
+} // namespace reSID
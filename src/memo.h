@@ -0,0 +1,84 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_MEMO_H
+#define RESID_MEMO_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "hash.h"
+#include "trace.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Trace rendering with loop memoization.
+//
+// At each pattern boundary, the complete emulation state is hashed; this
+// includes the filter integrators, the external filter, and the sampling
+// phase and resampling ring buffer. If the same state was seen at an
+// earlier boundary, and the writes following the earlier boundary repeat
+// up to the current one, the output is known to repeat as well: the samples
+// rendered since the earlier boundary are copied, and the trace is skipped
+// ahead by one loop without clocking the SID. Since the state at the end of
+// the copied loop is again the same, this repeats for as long as the writes
+// do.
+//
+// The output is identical to that of a plain render. Note that a state only
+// repeats if every part of it does; in particular the sampling phase only
+// repeats if the loop length is a multiple of the (fixed point) number of
+// cycles per sample, and oscillators only repeat if they are in phase, e.g.
+// reset by the test bit.
+//
+// The noise shift register is clocked whether or not noise is selected, and
+// so practically never repeats. Since the whole trace is known in advance,
+// the shift register of a voice is left out of the state once the voice
+// does not select noise for the rest of the trace; it can then no longer
+// affect the output.
+//
+// Pattern boundaries are taken to be writes following a pause of at least
+// min_gap cycles, which for frame based players are the frame starts.
+// ----------------------------------------------------------------------------
+class MemoRenderer
+{
+public:
+  MemoRenderer(cycle_count min_gap = 2000);
+
+  bool render(SID& sid, const Trace& trace, const RenderSettings& settings,
+	      std::vector<short>& samples);
+
+  // Hash of the complete state, independent of the position of the
+  // resampling ring buffer. The noise shift registers of the voices in
+  // ignore_noise (bit 0 - 2) are left out.
+  static HashDigest hash_state(const SID::State& state, int ignore_noise = 0);
+
+  // Statistics for the last render.
+  size_t boundaries;
+  size_t loops;
+  unsigned long long copied_samples;
+
+protected:
+  cycle_count min_gap;
+};
+
+} // namespace reSID
+
+#endif // not RESID_MEMO_H
@@ -0,0 +1,474 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residsynth - play MIDI on a pool of SIDs.
+//
+// The input is a Standard MIDI File, or "-" for a raw MIDI byte stream on
+// standard input, e.g. from a MIDI port or another program. Output is a WAV
+// file, or raw 16 bit native endian PCM on standard output for piping to an
+// audio player.
+//
+// A MIDI file is rendered as fast as possible, with each event at its exact
+// sample. A live stream is rendered in blocks paced to real time: events
+// arriving during one block are played in the next, at the same position
+// within the block as they arrived, so the latency is one block, without
+// jitter. Blocks that are not rendered in time are counted as late.
+// ----------------------------------------------------------------------------
+
+#include "synth.h"
+#include "sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+using namespace reSID;
+
+struct MidiEvent
+{
+  double time;
+  unsigned char msg[3];
+};
+
+static void usage()
+{
+  fprintf(stderr,
+	  "Usage: residsynth [options] file.mid|-\n"
+	  "  -c chips     number of SIDs, three voices each (default: 4)\n"
+	  "  -b samples   block size (default: 64)\n"
+	  "  -t seconds   play time after the last event (default: 2)\n"
+	  "  -o file.wav  write WAV file (default: raw PCM to stdout)\n"
+	  "  -r rate      sample rate (default: 44100)\n"
+	  "  -m method    fast, interpolate, resample or fastmem"
+	  " (default: resample)\n"
+	  "  -M model     6581 or 8580 (default: 8580)\n"
+	  "  -q           quiet\n");
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Number of data bytes following a status byte.
+static int data_bytes(int status)
+{
+  switch (status & 0xf0) {
+  case 0xc0:
+  case 0xd0:
+    return 1;
+  case 0xf0:
+    return 0;
+  default:
+    return 2;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Standard MIDI File reader. All tracks are merged, and event times are
+// converted to seconds following the tempo map.
+// ----------------------------------------------------------------------------
+struct TrackEvent
+{
+  unsigned long long tick;
+  int order;
+  int tempo;
+  unsigned char msg[3];
+};
+
+static bool tick_order(const TrackEvent& a, const TrackEvent& b)
+{
+  return a.tick < b.tick || (a.tick == b.tick && a.order < b.order);
+}
+
+static unsigned int be(const unsigned char* p, int n)
+{
+  unsigned int v = 0;
+  for (int i = 0; i < n; i++) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+static bool read_midi_file(const char* filename, std::vector<MidiEvent>& out)
+{
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return false;
+  }
+  std::vector<unsigned char> data;
+  unsigned char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+
+  size_t size = data.size();
+  const unsigned char* p = data.empty() ? 0 : &data[0];
+  if (size < 14 || memcmp(p, "MThd", 4) != 0 || be(p + 4, 4) < 6) {
+    return false;
+  }
+  int tracks = be(p + 10, 2);
+  int division = be(p + 12, 2);
+  size_t pos = 8 + be(p + 4, 4);
+
+  std::vector<TrackEvent> events;
+  int order = 0;
+
+  for (int t = 0; t < tracks && pos + 8 <= size; t++) {
+    size_t length = be(p + pos + 4, 4);
+    bool is_track = memcmp(p + pos, "MTrk", 4) == 0;
+    pos += 8;
+    if (length > size - pos) {
+      return false;
+    }
+    if (!is_track) {
+      pos += length;
+      t--;
+      continue;
+    }
+
+    size_t i = pos, end = pos + length;
+    pos = end;
+    unsigned long long tick = 0;
+    int running = 0;
+
+    while (i < end) {
+      unsigned int delta = 0;
+      do {
+	delta = delta << 7 | (p[i] & 0x7f);
+      } while (p[i++] & 0x80 && i < end);
+      tick += delta;
+      if (i >= end) {
+	break;
+      }
+
+      int status = p[i];
+      if (status == 0xff || status == 0xf0 || status == 0xf7) {
+	// Meta event or sysex.
+	int type = status == 0xff ? p[++i] : 0;
+	i++;
+	unsigned int len = 0;
+	while (i < end) {
+	  len = len << 7 | (p[i] & 0x7f);
+	  if (!(p[i++] & 0x80)) {
+	    break;
+	  }
+	}
+	if (len > end - i) {
+	  break;
+	}
+	if (type == 0x51 && len == 3) {
+	  TrackEvent e = { tick, order++, (int)be(p + i, 3), { 0, 0, 0 } };
+	  events.push_back(e);
+	}
+	i += len;
+	continue;
+      }
+
+      if (status & 0x80) {
+	running = status;
+	i++;
+      }
+      else if (!running) {
+	return false;
+      }
+      TrackEvent e = { tick, order++, 0, { (unsigned char)running, 0, 0 } };
+      for (int j = 0; j < data_bytes(running) && i < end; j++) {
+	e.msg[1 + j] = p[i++];
+      }
+      events.push_back(e);
+    }
+  }
+
+  std::stable_sort(events.begin(), events.end(), tick_order);
+
+  // Convert ticks to seconds.
+  double tempo = 500000e-6;
+  double seconds_per_tick = division & 0x8000 ?
+    1.0/((256 - (division >> 8))*(division & 0xff)) : tempo/division;
+  double time = 0;
+  unsigned long long tick = 0;
+
+  for (size_t i = 0; i < events.size(); i++) {
+    const TrackEvent& e = events[i];
+    time += (e.tick - tick)*seconds_per_tick;
+    tick = e.tick;
+    if (e.tempo) {
+      if (!(division & 0x8000)) {
+	seconds_per_tick = e.tempo*1e-6/division;
+      }
+      continue;
+    }
+    MidiEvent m = { time, { e.msg[0], e.msg[1], e.msg[2] } };
+    out.push_back(m);
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Raw MIDI stream parser with running status.
+// ----------------------------------------------------------------------------
+struct StreamParser
+{
+  StreamParser() : status(0), count(0) {}
+
+  // Returns true when a complete message is in msg.
+  bool put(unsigned char byte)
+  {
+    if (byte >= 0xf8) {
+      // Real time messages are ignored.
+      return false;
+    }
+    if (byte & 0x80) {
+      status = byte < 0xf0 ? byte : 0;
+      count = 0;
+      return false;
+    }
+    if (!status) {
+      return false;
+    }
+    msg[0] = status;
+    msg[1 + count++] = byte;
+    if (count == data_bytes(status)) {
+      count = 0;
+      return true;
+    }
+    return false;
+  }
+
+  int status;
+  int count;
+  unsigned char msg[3];
+};
+
+
+// ----------------------------------------------------------------------------
+// Output.
+// ----------------------------------------------------------------------------
+static bool output(WavFileSink* wav, const short* buf, int n)
+{
+  if (wav) {
+    short* p = wav->reserve(n);
+    if (!p) {
+      return false;
+    }
+    memcpy(p, buf, n*sizeof(short));
+    return wav->commit(n);
+  }
+  if (fwrite(buf, sizeof(short), n, stdout) != (size_t)n) {
+    return false;
+  }
+  // Keep latency bounded when piping to a player.
+  return fflush(stdout) == 0;
+}
+
+
+int main(int argc, char** argv)
+{
+  int chips = 4;
+  int block = 64;
+  double tail = 2;
+  const char* output_file = 0;
+  bool quiet = false;
+  RenderSettings settings;
+  settings.model = MOS8580;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:b:t:o:r:m:M:q")) != -1) {
+    switch (opt) {
+    case 'c':
+      chips = atoi(optarg);
+      break;
+    case 'b':
+      block = atoi(optarg);
+      break;
+    case 't':
+      tail = atof(optarg);
+      break;
+    case 'o':
+      output_file = optarg;
+      break;
+    case 'r':
+      settings.sample_freq = atof(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "fast") == 0) {
+	settings.method = SAMPLE_FAST;
+      }
+      else if (strcmp(optarg, "interpolate") == 0) {
+	settings.method = SAMPLE_INTERPOLATE;
+      }
+      else if (strcmp(optarg, "resample") == 0) {
+	settings.method = SAMPLE_RESAMPLE;
+      }
+      else if (strcmp(optarg, "fastmem") == 0) {
+	settings.method = SAMPLE_RESAMPLE_FASTMEM;
+      }
+      else {
+	usage();
+	return 1;
+      }
+      break;
+    case 'M':
+      settings.model = strcmp(optarg, "6581") == 0 ? MOS6581 : MOS8580;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1 || chips < 1 || block < 1) {
+    usage();
+    return 1;
+  }
+
+  bool live = strcmp(argv[optind], "-") == 0;
+  std::vector<MidiEvent> events;
+  if (!live && !read_midi_file(argv[optind], events)) {
+    fprintf(stderr, "residsynth: %s: not a MIDI file\n", argv[optind]);
+    return 1;
+  }
+
+  SIDSynth synth;
+  if (!synth.open(chips, settings)) {
+    fprintf(stderr, "residsynth: invalid sampling parameters\n");
+    return 1;
+  }
+
+  int sample_freq = (int)settings.sample_freq;
+  WavFileSink wav;
+  if (output_file && !wav.open(output_file, sample_freq)) {
+    fprintf(stderr, "residsynth: %s: cannot open\n", output_file);
+    return 1;
+  }
+  WavFileSink* sink = output_file ? &wav : 0;
+
+  std::vector<short> buf(block);
+  unsigned long long sample = 0;
+  long long tail_samples = (long long)(tail*sample_freq);
+  int late = 0;
+
+  if (!live) {
+    size_t e = 0;
+    long long remaining = tail_samples;
+    while (e < events.size() || remaining > 0) {
+      unsigned long long end = sample + block;
+      for (; e < events.size(); e++) {
+	unsigned long long at =
+	  (unsigned long long)(events[e].time*sample_freq + 0.5);
+	if (at >= end) {
+	  break;
+	}
+	synth.midi(at > sample ? at - sample : 0, events[e].msg);
+      }
+      synth.render(&buf[0], block);
+      if (!output(sink, &buf[0], block)) {
+	fprintf(stderr, "residsynth: write error\n");
+	return 1;
+      }
+      sample = end;
+      if (e == events.size()) {
+	remaining -= block;
+      }
+    }
+  }
+  else {
+    StreamParser parser;
+    double block_time = (double)block/sample_freq;
+    double start = now();
+    double deadline = start + block_time;
+    long long remaining = tail_samples;
+    bool eof = false;
+
+    while (!eof || remaining > 0) {
+      // Collect events until the end of the current block, placing them
+      // at their arrival offset in the next one.
+      for (;;) {
+	double t = now();
+	if (eof || t >= deadline) {
+	  break;
+	}
+	struct pollfd pfd = { 0, POLLIN, 0 };
+	int ms = (int)((deadline - t)*1000) + 1;
+	if (poll(&pfd, 1, ms) <= 0) {
+	  continue;
+	}
+	unsigned char bytes[256];
+	ssize_t n = read(0, bytes, sizeof(bytes));
+	if (n <= 0) {
+	  eof = true;
+	  break;
+	}
+	t = now();
+	int offset = (int)((t - (deadline - block_time))*sample_freq);
+	offset = offset < 0 ? 0 : offset >= block ? block - 1 : offset;
+	for (ssize_t i = 0; i < n; i++) {
+	  if (parser.put(bytes[i])) {
+	    synth.midi(offset, parser.msg);
+	  }
+	}
+      }
+
+      synth.render(&buf[0], block);
+      if (!output(sink, &buf[0], block)) {
+	fprintf(stderr, "residsynth: write error\n");
+	return 1;
+      }
+      sample += block;
+      if (eof) {
+	remaining -= block;
+      }
+
+      deadline += block_time;
+      if (now() > deadline) {
+	// Skip ahead rather than trying to catch up.
+	late++;
+	deadline = now() + block_time;
+      }
+    }
+  }
+
+  if (sink && !wav.close()) {
+    fprintf(stderr, "residsynth: %s: write error\n", output_file);
+    return 1;
+  }
+
+  if (!quiet) {
+    fprintf(stderr, "residsynth: %.1f s, %d voices, %d late blocks\n",
+	    (double)sample/sample_freq, synth.voices(), late);
+  }
+
+  return 0;
+}
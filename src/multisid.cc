@@ -0,0 +1,431 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "multisid.h"
+#include <string.h>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+MultiSID::MultiSID()
+{
+  chip[0] = new SID();
+  n_chips = 1;
+  clock_frequency[0] = 0;
+  set_phase_step(0);
+  sample = 0;
+  sample_index = 0;
+  sample_prev = sample_now = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+MultiSID::~MultiSID()
+{
+  for (int i = 0; i < n_chips; i++) {
+    delete chip[i];
+  }
+  delete[] sample;
+}
+
+
+// ----------------------------------------------------------------------------
+// Set number of chips.
+// ----------------------------------------------------------------------------
+bool MultiSID::set_chips(int n)
+{
+  if (n < 1 || n > MAX_CHIPS) {
+    return false;
+  }
+
+  while (n_chips < n) {
+    chip[n_chips] = new SID();
+    chip[n_chips]->sampling = chip[0]->sampling;
+    clock_frequency[n_chips] = 0;
+    set_phase_step(n_chips++);
+  }
+  while (n_chips > n) {
+    delete chip[--n_chips];
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Set sampling parameters; see SID::set_sampling_parameters().
+// ----------------------------------------------------------------------------
+bool MultiSID::set_sampling_parameters(double clock_freq,
+				       sampling_method method,
+				       double sample_freq, double pass_freq,
+				       double filter_scale)
+{
+  if (!chip[0]->set_sampling_parameters(clock_freq, method, sample_freq,
+					pass_freq, filter_scale))
+  {
+    return false;
+  }
+
+  // The other chips are not sampled, however the handling of writes
+  // depends on the sampling method.
+  for (int i = 1; i < n_chips; i++) {
+    chip[i]->sampling = method;
+  }
+
+  for (int i = 0; i < n_chips; i++) {
+    set_phase_step(i);
+  }
+
+  sample_prev = sample_now = 0;
+
+  delete[] sample;
+  sample = 0;
+  sample_index = 0;
+
+  if (method == SAMPLE_RESAMPLE || method == SAMPLE_RESAMPLE_FASTMEM) {
+    sample = new short[SID::RINGSIZE*2];
+    memset(sample, 0, sizeof(short)*SID::RINGSIZE*2);
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Set the clock frequency of a chip.
+// ----------------------------------------------------------------------------
+bool MultiSID::set_clock_frequency(int i, double clock_freq)
+{
+  if (i < 0 || i >= n_chips || clock_freq < 0) {
+    return false;
+  }
+
+  clock_frequency[i] = clock_freq;
+  set_phase_step(i);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Chip cycles per cycle of the time base. A chip running at the time base
+// is clocked exactly once per cycle, as without a clock frequency.
+// ----------------------------------------------------------------------------
+void MultiSID::set_phase_step(int i)
+{
+  const unsigned long long one = 1ULL << PHASE_SHIFT;
+  double time_base = chip[0]->clock_frequency;
+
+  phase[i] = 0;
+  if (!clock_frequency[i] || clock_frequency[i] == time_base) {
+    phase_step[i] = one;
+  }
+  else {
+    phase_step[i] =
+      (unsigned long long)(clock_frequency[i]/time_base*one + 0.5);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Reset.
+// ----------------------------------------------------------------------------
+void MultiSID::reset()
+{
+  for (int i = 0; i < n_chips; i++) {
+    chip[i]->reset();
+    phase[i] = 0;
+  }
+
+  // Clear the mix and the sampling position, so that a reset MultiSID
+  // renders the same output as a newly set up one.
+  chip[0]->sample_offset = 0;
+  sample_prev = sample_now = 0;
+  sample_index = 0;
+  if (sample) {
+    memset(sample, 0, sizeof(short)*SID::RINGSIZE*2);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clocking - delta_t cycles.
+// ----------------------------------------------------------------------------
+void MultiSID::clock(cycle_count delta_t)
+{
+  // The time base is advanced in steps of at most MAX_STEP cycles, so that
+  // neither the phase nor the chip cycle count can overflow.
+  while (delta_t > 0) {
+    cycle_count delta_t_step = delta_t < MAX_STEP ? delta_t : MAX_STEP;
+    for (int i = 0; i < n_chips; i++) {
+      phase[i] += phase_step[i]*(unsigned long long)delta_t_step;
+      chip[i]->clock(cycle_count(phase[i] >> PHASE_SHIFT));
+      phase[i] &= PHASE_MASK;
+    }
+    delta_t -= delta_t_step;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clocking with audio sampling of the mix; see SID::clock().
+// ----------------------------------------------------------------------------
+int MultiSID::clock(cycle_count& delta_t, short* buf, int n, int interleave)
+{
+  switch (chip[0]->sampling) {
+  default:
+  case SAMPLE_FAST:
+    return clock_fast(delta_t, buf, n, interleave);
+  case SAMPLE_INTERPOLATE:
+    return clock_interpolate(delta_t, buf, n, interleave);
+  case SAMPLE_RESAMPLE:
+    return clock_resample(delta_t, buf, n, interleave);
+  case SAMPLE_RESAMPLE_FASTMEM:
+    return clock_resample_fastmem(delta_t, buf, n, interleave);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clocking with audio sampling - delta clocking picking nearest sample.
+// ----------------------------------------------------------------------------
+int MultiSID::clock_fast(cycle_count& delta_t, short* buf, int n,
+			 int interleave)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  cycle_count& sample_offset = chip[0]->sample_offset;
+  int s;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset = sample_offset + chip[0]->cycles_per_sample + (1 << (FIXP_SHIFT - 1));
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    clock(delta_t_sample);
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    sample_offset = (next_sample_offset & FIXP_MASK) - (1 << (FIXP_SHIFT - 1));
+    buf[s*interleave] = output();
+  }
+
+  return s;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clocking with audio sampling - cycle based with linear sample
+// interpolation.
+// ----------------------------------------------------------------------------
+int MultiSID::clock_interpolate(cycle_count& delta_t, short* buf, int n,
+				int interleave)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  cycle_count& sample_offset = chip[0]->sample_offset;
+  int s;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset = sample_offset + chip[0]->cycles_per_sample;
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    for (int i = delta_t_sample; i > 0; i--) {
+      clock_chips();
+      if (unlikely(i <= 2)) {
+	sample_prev = sample_now;
+	sample_now = output();
+      }
+    }
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    sample_offset = next_sample_offset & FIXP_MASK;
+
+    buf[s*interleave] =
+      sample_prev + (sample_offset*(sample_now - sample_prev) >> FIXP_SHIFT);
+  }
+
+  return s;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clocking with audio sampling - cycle based with audio resampling of the
+// mix.
+// ----------------------------------------------------------------------------
+int MultiSID::clock_resample(cycle_count& delta_t, short* buf, int n,
+			     int interleave)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const int RINGSIZE = SID::RINGSIZE;
+  const int RINGMASK = SID::RINGMASK;
+  SID& sid = *chip[0];
+  cycle_count& sample_offset = sid.sample_offset;
+  int s;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset = sample_offset + sid.cycles_per_sample;
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    for (int i = 0; i < delta_t_sample; i++) {
+      clock_chips();
+      sample[sample_index] = sample[sample_index + RINGSIZE] = output();
+      ++sample_index &= RINGMASK;
+    }
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    sample_offset = next_sample_offset & FIXP_MASK;
+
+    int fir_offset = sample_offset*sid.fir_RES >> FIXP_SHIFT;
+    int fir_offset_rmd = sample_offset*sid.fir_RES & FIXP_MASK;
+    short* fir_start = sid.fir + fir_offset*sid.fir_N;
+    short* sample_start = sample + sample_index - sid.fir_N - 1 + RINGSIZE;
+
+    // Convolution with filter impulse response.
+    int v1 = 0;
+    for (int j = 0; j < sid.fir_N; j++) {
+      v1 += sample_start[j]*fir_start[j];
+    }
+
+    // Use next FIR table, wrap around to first FIR table using
+    // next sample.
+    if (unlikely(++fir_offset == sid.fir_RES)) {
+      fir_offset = 0;
+      ++sample_start;
+    }
+    fir_start = sid.fir + fir_offset*sid.fir_N;
+
+    // Convolution with filter impulse response.
+    int v2 = 0;
+    for (int k = 0; k < sid.fir_N; k++) {
+      v2 += sample_start[k]*fir_start[k];
+    }
+
+    // Linear interpolation.
+    int v = v1 + (fir_offset_rmd*(v2 - v1) >> FIXP_SHIFT);
+
+    v >>= SID::FIR_SHIFT;
+
+    // Saturated arithmetics to guard against 16 bit sample overflow.
+    const int half = 1 << 15;
+    if (v >= half) {
+      v = half - 1;
+    }
+    else if (v < -half) {
+      v = -half;
+    }
+
+    buf[s*interleave] = v;
+  }
+
+  return s;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clocking with audio sampling - cycle based with audio resampling of the
+// mix, using one large FIR table per sampling phase.
+// ----------------------------------------------------------------------------
+int MultiSID::clock_resample_fastmem(cycle_count& delta_t, short* buf, int n,
+				     int interleave)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const int RINGSIZE = SID::RINGSIZE;
+  const int RINGMASK = SID::RINGMASK;
+  SID& sid = *chip[0];
+  cycle_count& sample_offset = sid.sample_offset;
+  int s;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset = sample_offset + sid.cycles_per_sample;
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    for (int i = 0; i < delta_t_sample; i++) {
+      clock_chips();
+      sample[sample_index] = sample[sample_index + RINGSIZE] = output();
+      ++sample_index &= RINGMASK;
+    }
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    sample_offset = next_sample_offset & FIXP_MASK;
+
+    int fir_offset = sample_offset*sid.fir_RES >> FIXP_SHIFT;
+    short* fir_start = sid.fir + fir_offset*sid.fir_N;
+    short* sample_start = sample + sample_index - sid.fir_N + RINGSIZE;
+
+    // Convolution with filter impulse response.
+    int v = 0;
+    for (int j = 0; j < sid.fir_N; j++) {
+      v += sample_start[j]*fir_start[j];
+    }
+
+    v >>= SID::FIR_SHIFT;
+
+    // Saturated arithmetics to guard against 16 bit sample overflow.
+    const int half = 1 << 15;
+    if (v >= half) {
+      v = half - 1;
+    }
+    else if (v < -half) {
+      v = -half;
+    }
+
+    buf[s*interleave] = v;
+  }
+
+  return s;
+}
+
+} // namespace reSID
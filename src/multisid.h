@@ -0,0 +1,148 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_MULTISID_H
+#define RESID_MULTISID_H
+
+#include "siddefs.h"
+#include "sid.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Several SIDs on a common cycle timeline, e.g. for stereo or 3SID tunes,
+// mixed to a single output.
+//
+// The chip outputs are summed every cycle, with clipping, and the sum is
+// sampled once. With SAMPLE_RESAMPLE and SAMPLE_RESAMPLE_FASTMEM the FIR
+// convolution, which dominates the cost of resampling, is thus done once
+// per output sample rather than once per chip. The output is the same as
+// summing the outputs of separately sampled chips, except for rounding and
+// for clipping taking place before rather than after resampling.
+//
+// The sampling parameters and FIR tables are those of the first chip; the
+// other chips are only clocked. Chip model, filter settings and register
+// reads and writes go directly to the chips through sid().
+//
+// The chips may run at clock frequencies other than the clock frequency
+// given to set_sampling_parameters(), e.g. to mix a PAL and an NTSC chip,
+// or a chip on an accelerator. That frequency is then the time base: all
+// cycle counts, including delta_t of clock(), are in cycles of the time
+// base, and a phase accumulator per chip decides how many of its own
+// cycles to run in each. The mix is formed once per cycle of the time base,
+// with each chip contributing its latest output, and resampled once as
+// above. Chips clocked faster than the time base are thus only sampled at
+// its rate; the time base should be the fastest clock where this matters.
+// ----------------------------------------------------------------------------
+class MultiSID
+{
+public:
+  MultiSID();
+  ~MultiSID();
+
+  enum { MAX_CHIPS = 8 };
+
+  // Set the number of chips, 1 - MAX_CHIPS. Existing chips are kept.
+  bool set_chips(int n);
+  int chips() const { return n_chips; }
+  SID& sid(int i) { return *chip[i]; }
+
+  bool set_sampling_parameters(double clock_freq, sampling_method method,
+			       double sample_freq, double pass_freq = -1,
+			       double filter_scale = 0.97);
+  // Clock frequency of chip i; 0 selects the clock frequency of the time
+  // base.
+  bool set_clock_frequency(int i, double clock_freq);
+
+  void clock(cycle_count delta_t);
+  int clock(cycle_count& delta_t, short* buf, int n, int interleave = 1);
+  void reset();
+
+  // Sum of the chip outputs, with clipping.
+  short output()
+  {
+    int v = 0;
+    for (int i = 0; i < n_chips; i++) {
+      v += chip[i]->output();
+    }
+
+    const int half = 1 << 15;
+    if (v >= half) {
+      v = half - 1;
+    }
+    else if (v < -half) {
+      v = -half;
+    }
+    return v;
+  }
+
+protected:
+  enum {
+    // Fixed point phase of the chip clocks, in cycles of the time base.
+    PHASE_SHIFT = 32,
+    PHASE_MASK = 0xffffffff
+  };
+
+  enum {
+    // Maximum number of cycles of the time base clocked in one step by
+    // clock(delta_t); chips up to 2048 times as fast as the time base.
+    MAX_STEP = 1 << 20
+  };
+
+  // Clock all chips one cycle of the time base.
+  void clock_chips()
+  {
+    for (int i = 0; i < n_chips; i++) {
+      phase[i] += phase_step[i];
+      for (int j = int(phase[i] >> PHASE_SHIFT); j > 0; j--) {
+	chip[i]->clock();
+      }
+      phase[i] &= PHASE_MASK;
+    }
+  }
+
+  void set_phase_step(int i);
+  int clock_fast(cycle_count& delta_t, short* buf, int n, int interleave);
+  int clock_interpolate(cycle_count& delta_t, short* buf, int n,
+			int interleave);
+  int clock_resample(cycle_count& delta_t, short* buf, int n,
+		     int interleave);
+  int clock_resample_fastmem(cycle_count& delta_t, short* buf, int n,
+			     int interleave);
+
+  SID* chip[MAX_CHIPS];
+  int n_chips;
+
+  // Chip clock frequencies, or 0 for the time base, and chip cycles per
+  // cycle of the time base.
+  double clock_frequency[MAX_CHIPS];
+  unsigned long long phase_step[MAX_CHIPS];
+  unsigned long long phase[MAX_CHIPS];
+
+  short sample_prev, sample_now;
+
+  // Ring buffer of mixed samples, as in SID.
+  short* sample;
+  int sample_index;
+};
+
+} // namespace reSID
+
+#endif // not RESID_MULTISID_H
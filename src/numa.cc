@@ -0,0 +1,170 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "numa.h"
+
+#if RESID_NUMA
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Memory node of the calling thread.
+// ----------------------------------------------------------------------------
+int numa_node()
+{
+#if RESID_NUMA
+  unsigned int cpu, node;
+  if (syscall(__NR_getcpu, &cpu, &node, 0) == 0) {
+    return (int)node;
+  }
+#endif
+  return -1;
+}
+
+
+// ----------------------------------------------------------------------------
+// Memory node of the page holding address.
+// ----------------------------------------------------------------------------
+int numa_node_of(const void* address)
+{
+#if RESID_NUMA
+  int node;
+  if (syscall(__NR_get_mempolicy, &node, 0, 0, address,
+	      MPOL_F_NODE | MPOL_F_ADDR) == 0)
+  {
+    return node;
+  }
+#else
+  (void)address;
+#endif
+  return -1;
+}
+
+
+// ----------------------------------------------------------------------------
+// Bind pages to the node of the calling thread.
+// ----------------------------------------------------------------------------
+bool numa_bind_local(void* address, size_t size)
+{
+#if RESID_NUMA
+  int node = numa_node();
+  unsigned long mask[16];
+  const unsigned long bits = sizeof(mask)*8;
+  if (node < 0 || (unsigned long)node >= bits || !size) {
+    return false;
+  }
+  memset(mask, 0, sizeof(mask));
+  mask[node/(8*sizeof(long))] = 1UL << node%(8*sizeof(long));
+
+  // The range is extended to whole pages.
+  unsigned long page_size = sysconf(_SC_PAGESIZE);
+  unsigned long begin = (unsigned long)address & ~(page_size - 1);
+  unsigned long end = ((unsigned long)address + size + page_size - 1) &
+    ~(page_size - 1);
+
+  return syscall(__NR_mbind, begin, end - begin, MPOL_PREFERRED, mask, bits,
+		 MPOL_MF_MOVE) == 0;
+#else
+  (void)address;
+  (void)size;
+  return false;
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Memory nodes of the buffers and filter tables of a SID.
+// ----------------------------------------------------------------------------
+int numa_buffer_node(const SID& sid)
+{
+  if (sid.fir) {
+    return numa_node_of(sid.fir);
+  }
+  if (sid.sample) {
+    return numa_node_of(sid.sample);
+  }
+  return -1;
+}
+
+int numa_filter_node(const SID& sid)
+{
+  return numa_node_of(sid.filter.model);
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor. Constructing a Filter builds the built-in tables, if this has
+// not been done already.
+// ----------------------------------------------------------------------------
+FilterReplicas::FilterReplicas()
+{
+  Filter filter;
+  (void)filter;
+
+  for (int model = 0; model < 2; model++) {
+    builtin_node[model] = numa_node_of(&Filter::model_filter[model]);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor. The tables must not be used by any filter.
+// ----------------------------------------------------------------------------
+FilterReplicas::~FilterReplicas()
+{
+  for (size_t i = 0; i < replica.size(); i++) {
+    delete replica[i];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Filter tables on the node of the calling thread.
+// ----------------------------------------------------------------------------
+const FilterModel* FilterReplicas::get(chip_model model)
+{
+  int node = numa_node();
+  if (node < 0 || node == builtin_node[model]) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  size_t i = node*2 + model;
+  if (i >= replica.size()) {
+    replica.resize(i + 1);
+  }
+  if (!replica[i]) {
+    // Build the tables in this thread, placing the pages on its node.
+    FilterModelParameters parameters;
+    Filter::model_parameters(model, parameters);
+    FilterModel* filter_model = new FilterModel();
+    filter_model->build(model, parameters);
+    replica[i] = filter_model;
+  }
+  return replica[i];
+}
+
+} // namespace reSID
@@ -0,0 +1,93 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_NUMA_H
+#define RESID_NUMA_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "filter.h"
+#include <mutex>
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Memory node of the CPU running the calling thread, and memory node of the
+// page holding an address. Both return -1 where this is unknown, i.e. when
+// built without RESID_NUMA or if the page has not been touched.
+// ----------------------------------------------------------------------------
+int numa_node();
+int numa_node_of(const void* address);
+
+// ----------------------------------------------------------------------------
+// Place the pages holding [address, address + size) on the memory node of
+// the calling thread, moving pages already placed on another node, and
+// pages touched later. Returns false where this is not supported.
+// ----------------------------------------------------------------------------
+bool numa_bind_local(void* address, size_t size);
+
+// ----------------------------------------------------------------------------
+// Memory node of the resampling buffers of a SID, i.e. the FIR tables, or
+// the sample ring without FIR tables, and memory node of the filter tables
+// it uses. Both return -1 where this is unknown, or without buffers.
+// ----------------------------------------------------------------------------
+int numa_buffer_node(const SID& sid);
+int numa_filter_node(const SID& sid);
+
+
+// ----------------------------------------------------------------------------
+// Per node copies of the built-in filter tables.
+//
+// The built-in tables of Filter, of a few MB per chip model, are placed on
+// the memory node of the thread which constructed the first Filter. Render
+// threads on other nodes of a multi-socket host read them across the
+// interconnect for every sample. get() returns tables on the node of the
+// calling thread, built on first use by that thread, so that the pages are
+// placed locally; on the node holding the built-in tables, and where the
+// node is unknown, it returns 0, which selects the built-in tables. The
+// result is passed to SID::set_filter_model(), before rendering.
+//
+// Render threads should be pinned to a node, e.g. by numactl, as the
+// tables are only local while the thread stays on the node. The wave
+// tables of WaveformGenerator are not replicated; at 128 KB they are kept
+// in the caches of each socket.
+// ----------------------------------------------------------------------------
+class FilterReplicas
+{
+public:
+  FilterReplicas();
+  ~FilterReplicas();
+
+  // May be called from any thread.
+  const FilterModel* get(chip_model model);
+
+protected:
+  // Node of the built-in tables per chip model.
+  int builtin_node[2];
+
+  std::mutex lock;
+  // Indexed by node*2 + chip model.
+  std::vector<FilterModel*> replica;
+};
+
+} // namespace reSID
+
+#endif // not RESID_NUMA_H
@@ -0,0 +1,235 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "pcmring.h"
+#include <string.h>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+PCMRing::PCMRing() :
+  tail(0), closed(false), head(0),
+  n_underruns(0), n_underrun_frames(0), n_overruns(0), n_overrun_frames(0)
+{
+  ring = 0;
+  scratch = 0;
+  capacity = 0;
+  mask = 0;
+  max_frames = 0;
+  low_watermark = high_watermark = 0;
+  reserved_scratch = false;
+  refill = true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+PCMRing::~PCMRing()
+{
+  delete[] ring;
+  delete[] scratch;
+}
+
+
+// ----------------------------------------------------------------------------
+// Allocate the ring. Not thread safe; call before starting the threads.
+// ----------------------------------------------------------------------------
+bool PCMRing::open(int sample_freq, int channels, int capacity,
+		   int max_frames)
+{
+  if (channels < 1 || capacity < 1 || max_frames < 1) {
+    return false;
+  }
+
+  unsigned int size = 1;
+  while (size < (unsigned int)capacity) {
+    size <<= 1;
+  }
+
+  delete[] ring;
+  delete[] scratch;
+  ring = new short[(size + max_frames)*channels];
+  scratch = new short[max_frames*channels];
+  memset(ring, 0, sizeof(short)*(size + max_frames)*channels);
+
+  this->sample_freq = sample_freq;
+  n_channels = channels;
+  data_size = 0;
+  this->capacity = size;
+  mask = size - 1;
+  this->max_frames = max_frames;
+  set_watermarks(size/4, size*3/4);
+
+  tail = head = 0;
+  closed = false;
+  reserved_scratch = false;
+  refill = true;
+  n_underruns = n_overruns = 0;
+  n_underrun_frames = n_overrun_frames = 0;
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Watermarks, in frames.
+// ----------------------------------------------------------------------------
+void PCMRing::set_watermarks(int low, int high)
+{
+  if (high > (int)capacity) {
+    high = capacity;
+  }
+  if (low > high) {
+    low = high;
+  }
+  low_watermark = low;
+  high_watermark = high;
+}
+
+
+// ----------------------------------------------------------------------------
+// Return storage for n frames at the write position, or scratch storage if
+// the ring does not have room.
+// ----------------------------------------------------------------------------
+short* PCMRing::reserve(int n)
+{
+  if (unlikely(n > max_frames)) {
+    return 0;
+  }
+
+  unsigned int t = tail.load(std::memory_order_relaxed);
+  unsigned int free = capacity - (t - head.load(std::memory_order_acquire));
+
+  reserved_scratch = (unsigned int)n > free;
+  if (unlikely(reserved_scratch)) {
+    return scratch;
+  }
+  return ring + (t & mask)*n_channels;
+}
+
+
+// ----------------------------------------------------------------------------
+// Copy n frames into the ring at frame index t.
+// ----------------------------------------------------------------------------
+void PCMRing::copy_in(const short* src, unsigned int t, int n)
+{
+  unsigned int pos = t & mask;
+  unsigned int first = capacity - pos < (unsigned int)n ? capacity - pos : n;
+
+  memcpy(ring + pos*n_channels, src, sizeof(short)*first*n_channels);
+  memcpy(ring, src + first*n_channels, sizeof(short)*(n - first)*n_channels);
+}
+
+
+// ----------------------------------------------------------------------------
+// Commit n frames written into the storage returned by reserve().
+// ----------------------------------------------------------------------------
+bool PCMRing::commit(int n)
+{
+  unsigned int t = tail.load(std::memory_order_relaxed);
+
+  if (unlikely(reserved_scratch)) {
+    // Keep what fits.
+    unsigned int free = capacity - (t - head.load(std::memory_order_acquire));
+    int m = (unsigned int)n < free ? n : free;
+    copy_in(scratch, t, m);
+    if (m < n) {
+      n_overruns.fetch_add(1, std::memory_order_relaxed);
+      n_overrun_frames.fetch_add(n - m, std::memory_order_relaxed);
+    }
+    n = m;
+  }
+  else {
+    // Fold frames written past the end of the ring back to the start.
+    unsigned int pos = t & mask;
+    if (pos + n > capacity) {
+      memcpy(ring, ring + capacity*n_channels,
+	     sizeof(short)*(pos + n - capacity)*n_channels);
+    }
+  }
+
+  data_size += (unsigned long long)n*n_channels*sizeof(short);
+  tail.store(t + n, std::memory_order_release);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Mark the end of the output.
+// ----------------------------------------------------------------------------
+bool PCMRing::close()
+{
+  closed.store(true, std::memory_order_release);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Number of frames the render thread should render now.
+// ----------------------------------------------------------------------------
+int PCMRing::demand()
+{
+  int level = fill();
+
+  if (level < low_watermark) {
+    refill = true;
+  }
+  if (!refill) {
+    return 0;
+  }
+  if (level >= high_watermark) {
+    refill = false;
+    return 0;
+  }
+  return high_watermark - level;
+}
+
+
+// ----------------------------------------------------------------------------
+// Read n frames, padding with silence.
+// ----------------------------------------------------------------------------
+int PCMRing::read(short* buf, int n)
+{
+  unsigned int h = head.load(std::memory_order_relaxed);
+  unsigned int available = tail.load(std::memory_order_acquire) - h;
+  int m = (unsigned int)n < available ? n : available;
+
+  unsigned int pos = h & mask;
+  unsigned int first = capacity - pos < (unsigned int)m ? capacity - pos : m;
+  memcpy(buf, ring + pos*n_channels, sizeof(short)*first*n_channels);
+  memcpy(buf + first*n_channels, ring,
+	 sizeof(short)*(m - first)*n_channels);
+  head.store(h + m, std::memory_order_release);
+
+  if (m < n) {
+    memset(buf + m*n_channels, 0, sizeof(short)*(n - m)*n_channels);
+    if (!closed.load(std::memory_order_acquire)) {
+      n_underruns.fetch_add(1, std::memory_order_relaxed);
+      n_underrun_frames.fetch_add(n - m, std::memory_order_relaxed);
+    }
+  }
+
+  return m;
+}
+
+} // namespace reSID
@@ -0,0 +1,114 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_PCMRING_H
+#define RESID_PCMRING_H
+
+#include "siddefs.h"
+#include "sink.h"
+#include <atomic>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Lock-free single producer / single consumer ring of PCM sample frames,
+// between a render thread and an audio callback.
+//
+// The render thread uses the sink interface, so that SID::clock() renders
+// straight into the ring: reserve() returns storage at the write position,
+// with room past the end of the ring for up to max_frames frames, which is
+// folded back to the start by commit(). If there is not enough free space,
+// reserve() returns a scratch buffer, and commit() keeps what fits and
+// counts an overrun.
+//
+// The audio callback calls read(), which never blocks or allocates; if
+// fewer frames are available than requested, the rest is filled with
+// silence and an underrun is counted. After close(), running empty is not
+// counted as an underrun.
+//
+// The render thread keeps the fill level between the watermarks by
+// rendering demand() frames whenever it is nonzero: once the fill level
+// has dropped below the low watermark, the demand is the number of frames
+// to reach the high watermark.
+// ----------------------------------------------------------------------------
+class PCMRing : public SampleSink
+{
+public:
+  PCMRing();
+  ~PCMRing();
+
+  // The capacity is rounded up to a power of two. Returns false for
+  // invalid sizes.
+  bool open(int sample_freq, int channels = 1, int capacity = 1 << 14,
+	    int max_frames = 4096);
+  void set_watermarks(int low, int high);
+
+  // Render thread.
+  short* reserve(int n);
+  bool commit(int n);
+  bool close();
+  int demand();
+
+  // Audio callback. Returns the number of frames read before running
+  // empty; the buffer is always filled with n frames.
+  int read(short* buf, int n);
+
+  // Fill level in frames; may be called from either thread.
+  int fill() const
+  {
+    return tail.load(std::memory_order_acquire) -
+      head.load(std::memory_order_acquire);
+  }
+
+  // Statistics; may be called from any thread.
+  unsigned long underruns() const { return n_underruns; }
+  unsigned long long underrun_frames() const { return n_underrun_frames; }
+  unsigned long overruns() const { return n_overruns; }
+  unsigned long long overrun_frames() const { return n_overrun_frames; }
+
+protected:
+  void copy_in(const short* src, unsigned int t, int n);
+
+  short* ring;
+  short* scratch;
+  unsigned int capacity;
+  unsigned int mask;
+  int max_frames;
+  int low_watermark, high_watermark;
+
+  // Frame indices are only ever incremented; the difference is the fill
+  // level. Producer and consumer indices are kept on separate cache lines.
+  alignas(64) std::atomic<unsigned int> tail;
+  std::atomic<bool> closed;
+  alignas(64) std::atomic<unsigned int> head;
+
+  // Producer state.
+  bool reserved_scratch;
+  bool refill;
+
+  std::atomic<unsigned long> n_underruns;
+  std::atomic<unsigned long long> n_underrun_frames;
+  std::atomic<unsigned long> n_overruns;
+  std::atomic<unsigned long long> n_overrun_frames;
+};
+
+} // namespace reSID
+
+#endif // not RESID_PCMRING_H
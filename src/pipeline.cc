@@ -0,0 +1,319 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "pipeline.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor. The number of blocks is rounded up to a power of two.
+// ----------------------------------------------------------------------------
+PipelinedRenderer::PipelinedRenderer(int block_size, int blocks) :
+  block_size(block_size), tail(0), done(false), head(0), quit(false)
+{
+  unsigned int size = 1;
+  while (size < (unsigned int)blocks) {
+    size <<= 1;
+  }
+
+  block = new short[size*block_size];
+  length = new int[size];
+  mask = size - 1;
+
+  sid = 0;
+  trace = 0;
+  cycle_output = 0;
+  cycles_left = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+PipelinedRenderer::~PipelinedRenderer()
+{
+  stop();
+  delete[] block;
+  delete[] length;
+}
+
+
+// ----------------------------------------------------------------------------
+// Start the emulation thread.
+// ----------------------------------------------------------------------------
+bool PipelinedRenderer::start(SID& sid, const Trace& trace)
+{
+  if (sid.sampling != SAMPLE_RESAMPLE &&
+      sid.sampling != SAMPLE_RESAMPLE_FASTMEM)
+  {
+    return false;
+  }
+
+  stop();
+
+  this->sid = &sid;
+  this->trace = &trace;
+  tail = head = 0;
+  done = quit = false;
+  cycle_output = 0;
+  cycles_left = 0;
+
+  thread = std::thread(emulate, this);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Stop the emulation thread.
+// ----------------------------------------------------------------------------
+void PipelinedRenderer::stop()
+{
+  quit = true;
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Emulation thread: play the trace, applying writes at their exact cycles,
+// and queue the output of each cycle.
+// ----------------------------------------------------------------------------
+void PipelinedRenderer::emulate(PipelinedRenderer* pipeline)
+{
+  SID& sid = *pipeline->sid;
+  const std::vector<Trace::Write>& writes = pipeline->trace->writes;
+  const int block_size = pipeline->block_size;
+  const unsigned int mask = pipeline->mask;
+  unsigned int t = 0;
+  short* out = pipeline->block;
+  int pos = 0;
+
+  for (size_t i = 0; i <= writes.size(); i++) {
+    cycle_count delta_t = i < writes.size() ?
+      writes[i].delta : pipeline->trace->tail;
+
+    while (delta_t > 0) {
+      // Clock up to the end of the block.
+      int n = block_size - pos;
+      if (n > delta_t) {
+	n = delta_t;
+      }
+      for (int j = 0; j < n; j++) {
+	sid.clock();
+	out[pos++] = sid.output();
+      }
+      delta_t -= n;
+
+      if (pos < block_size) {
+	break;
+      }
+
+      // Queue the block, and wait for a free one.
+      pipeline->length[t & mask] = pos;
+      pipeline->tail.store(++t, std::memory_order_release);
+      while (t - pipeline->head.load(std::memory_order_acquire) > mask) {
+	if (pipeline->quit.load(std::memory_order_relaxed)) {
+	  return;
+	}
+	std::this_thread::yield();
+      }
+      out = pipeline->block + (t & mask)*block_size;
+      pos = 0;
+    }
+
+    if (i < writes.size()) {
+      sid.write(writes[i].offset, writes[i].value);
+    }
+  }
+
+  if (pos) {
+    pipeline->length[t & mask] = pos;
+    pipeline->tail.store(++t, std::memory_order_release);
+  }
+  pipeline->done.store(true, std::memory_order_release);
+}
+
+
+// ----------------------------------------------------------------------------
+// Release the current block and wait for the next one. Returns false at the
+// end of the trace.
+// ----------------------------------------------------------------------------
+bool PipelinedRenderer::fetch()
+{
+  unsigned int h = head.load(std::memory_order_relaxed);
+
+  if (cycle_output) {
+    head.store(++h, std::memory_order_release);
+    cycle_output = 0;
+  }
+
+  for (;;) {
+    if (tail.load(std::memory_order_acquire) != h) {
+      cycle_output = block + (h & mask)*block_size;
+      cycles_left = length[h & mask];
+      return true;
+    }
+    if (done.load(std::memory_order_acquire) &&
+	tail.load(std::memory_order_acquire) == h)
+    {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Resample the queued cycle outputs; see SID::clock_resample() and
+// SID::clock_resample_fastmem().
+// ----------------------------------------------------------------------------
+int PipelinedRenderer::read(short* buf, int n, int interleave)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const int RINGSIZE = SID::RINGSIZE;
+  const int RINGMASK = SID::RINGMASK;
+  SID& chip = *sid;
+  short* sample = chip.sample;
+  int s;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset =
+      chip.sample_offset + chip.cycles_per_sample;
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    // Move the outputs of the cycles up to the sampling point into the
+    // ring buffer.
+    cycle_count i = 0;
+    while (i < delta_t_sample) {
+      if (!cycles_left && !fetch()) {
+	break;
+      }
+      int m = delta_t_sample - i;
+      if (m > cycles_left) {
+	m = cycles_left;
+      }
+      for (int j = 0; j < m; j++) {
+	sample[chip.sample_index] = sample[chip.sample_index + RINGSIZE] =
+	  cycle_output[j];
+	++chip.sample_index &= RINGMASK;
+      }
+      cycle_output += m;
+      cycles_left -= m;
+      i += m;
+    }
+
+    // As in SID::clock(), there is no sample at the last cycle.
+    if (i < delta_t_sample || (!cycles_left && !fetch())) {
+      chip.sample_offset -= i << FIXP_SHIFT;
+      break;
+    }
+
+    chip.sample_offset = next_sample_offset & FIXP_MASK;
+
+    int fir_offset = chip.sample_offset*chip.fir_RES >> FIXP_SHIFT;
+    short* fir_start = chip.fir + fir_offset*chip.fir_N;
+    int v;
+
+    if (chip.sampling == SAMPLE_RESAMPLE) {
+      int fir_offset_rmd = chip.sample_offset*chip.fir_RES & FIXP_MASK;
+      short* sample_start =
+	sample + chip.sample_index - chip.fir_N - 1 + RINGSIZE;
+
+      // Convolution with filter impulse response.
+      int v1 = 0;
+      for (int j = 0; j < chip.fir_N; j++) {
+	v1 += sample_start[j]*fir_start[j];
+      }
+
+      // Use next FIR table, wrap around to first FIR table using
+      // next sample.
+      if (unlikely(++fir_offset == chip.fir_RES)) {
+	fir_offset = 0;
+	++sample_start;
+      }
+      fir_start = chip.fir + fir_offset*chip.fir_N;
+
+      // Convolution with filter impulse response.
+      int v2 = 0;
+      for (int k = 0; k < chip.fir_N; k++) {
+	v2 += sample_start[k]*fir_start[k];
+      }
+
+      // Linear interpolation.
+      v = v1 + (fir_offset_rmd*(v2 - v1) >> FIXP_SHIFT);
+    }
+    else {
+      short* sample_start = sample + chip.sample_index - chip.fir_N + RINGSIZE;
+
+      // Convolution with filter impulse response.
+      v = 0;
+      for (int j = 0; j < chip.fir_N; j++) {
+	v += sample_start[j]*fir_start[j];
+      }
+    }
+
+    v >>= SID::FIR_SHIFT;
+
+    // Saturated arithmetics to guard against 16 bit sample overflow.
+    const int half = 1 << 15;
+    if (v >= half) {
+      v = half - 1;
+    }
+    else if (v < -half) {
+      v = -half;
+    }
+
+    buf[s*interleave] = v;
+  }
+
+  return s;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render whole trace.
+// ----------------------------------------------------------------------------
+void PipelinedRenderer::render(SID& sid, const Trace& trace,
+			       std::vector<short>& samples)
+{
+  PipelinedRenderer pipeline;
+  TracePlayer player(sid, trace);
+  bool pipelined = pipeline.start(sid, trace);
+  const int chunk = 4096;
+  size_t s = 0;
+
+  samples.clear();
+  for (;;) {
+    samples.resize(s + chunk);
+    int n = pipelined ?
+      pipeline.read(&samples[s], chunk) : player.clock(&samples[s], chunk);
+    s += n;
+    if (n < chunk) {
+      break;
+    }
+  }
+  samples.resize(s);
+
+  pipeline.stop();
+}
+
+} // namespace reSID
@@ -0,0 +1,97 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_PIPELINE_H
+#define RESID_PIPELINE_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "trace.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Two-stage render pipeline for SAMPLE_RESAMPLE and SAMPLE_RESAMPLE_FASTMEM.
+//
+// The cycle emulation and the FIR convolution of SID::clock() take about
+// the same time when resampling. Here an emulation thread plays a trace,
+// clocking the SID cycle by cycle and passing the output of each cycle on
+// through a lock-free single producer / single consumer queue of blocks,
+// while the thread calling read() runs the resampling. Only the resampling
+// ring buffer and sampling phase of the SID are used by the reading thread,
+// and the emulation thread does not touch them, so the output, and the
+// state of the SID when done, are identical to those of TracePlayer.
+//
+// The emulation thread waits while the queue is full, and read() waits for
+// the emulation thread while the queue is empty.
+// ----------------------------------------------------------------------------
+class PipelinedRenderer
+{
+public:
+  PipelinedRenderer(int block_size = 4096, int blocks = 16);
+  ~PipelinedRenderer();
+
+  // Start playing trace on the SID, which must be configured for
+  // SAMPLE_RESAMPLE or SAMPLE_RESAMPLE_FASTMEM and must not be used by
+  // others until stop(). Returns false for other sampling methods.
+  bool start(SID& sid, const Trace& trace);
+  // Render up to n samples. Returns the number of samples rendered, which
+  // is less than n at the end of the trace.
+  int read(short* buf, int n, int interleave = 1);
+  // Stop the emulation thread, e.g. before the end of the trace.
+  void stop();
+
+  // Render the whole trace; falls back to TracePlayer for other sampling
+  // methods.
+  static void render(SID& sid, const Trace& trace,
+		     std::vector<short>& samples);
+
+protected:
+  static void emulate(PipelinedRenderer* pipeline);
+  bool fetch();
+
+  SID* sid;
+  const Trace* trace;
+  std::thread thread;
+
+  // Blocks of cycle outputs, and their lengths.
+  short* block;
+  int* length;
+  int block_size;
+  unsigned int mask;
+
+  // Block indices are only ever incremented; the difference is the fill
+  // level. Producer and consumer indices are kept on separate cache lines.
+  alignas(64) std::atomic<unsigned int> tail;
+  std::atomic<bool> done;
+  alignas(64) std::atomic<unsigned int> head;
+  std::atomic<bool> quit;
+
+  // Consumer position in the current block.
+  const short* cycle_output;
+  int cycles_left;
+};
+
+} // namespace reSID
+
+#endif // not RESID_PIPELINE_H
@@ -0,0 +1,200 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residplay - render a PSID / RSID tune to a WAV file, or as raw 16 bit
+// native endian PCM to standard output.
+// ----------------------------------------------------------------------------
+
+#include "psid.h"
+#include "sink.h"
+#include "silence.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace reSID;
+
+static void usage()
+{
+  fprintf(stderr,
+	  "Usage: residplay [options] tune.sid\n"
+	  "  -s song      song number (default: start song)\n"
+	  "  -t seconds   play time (default: 180)\n"
+	  "  -S seconds   stop after this much silence (default: off)\n"
+	  "  -o file.wav  write WAV file (default: raw PCM to stdout)\n"
+	  "  -r rate      sample rate (default: 44100)\n"
+	  "  -m method    fast, interpolate, resample or fastmem"
+	  " (default: resample)\n"
+	  "  -M model     6581 or 8580 (default: from tune)\n"
+	  "  -T file      save SID writes as a trace\n"
+	  "  -q           quiet\n");
+}
+
+int main(int argc, char** argv)
+{
+  int song = 0;
+  double seconds = 180;
+  double silence = 0;
+  const char* output = 0;
+  const char* trace_file = 0;
+  const char* model = 0;
+  bool quiet = false;
+  RenderSettings settings;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:t:S:o:r:m:M:T:q")) != -1) {
+    switch (opt) {
+    case 's':
+      song = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'S':
+      silence = atof(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'r':
+      settings.sample_freq = atof(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "fast") == 0) {
+	settings.method = SAMPLE_FAST;
+      }
+      else if (strcmp(optarg, "interpolate") == 0) {
+	settings.method = SAMPLE_INTERPOLATE;
+      }
+      else if (strcmp(optarg, "resample") == 0) {
+	settings.method = SAMPLE_RESAMPLE;
+      }
+      else if (strcmp(optarg, "fastmem") == 0) {
+	settings.method = SAMPLE_RESAMPLE_FASTMEM;
+      }
+      else {
+	usage();
+	return 1;
+      }
+      break;
+    case 'M':
+      model = optarg;
+      break;
+    case 'T':
+      trace_file = optarg;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage();
+    return 1;
+  }
+
+  PSIDPlayer player;
+  if (!player.load(argv[optind])) {
+    fprintf(stderr, "residplay: %s: not a playable PSID/RSID file\n",
+	    argv[optind]);
+    return 1;
+  }
+
+  Trace trace;
+  if (trace_file) {
+    player.set_trace(&trace);
+  }
+
+  if (!player.start(song, settings)) {
+    fprintf(stderr, "residplay: invalid sampling parameters\n");
+    return 1;
+  }
+
+  // An explicit model overrides the header.
+  if (model) {
+    settings = player.settings();
+    settings.model = strcmp(model, "8580") == 0 ? MOS8580 : MOS6581;
+    player.start(song, settings, false);
+  }
+
+  if (!quiet) {
+    fprintf(stderr, "%s - %s (%s), song %d/%d, %s %s\n",
+	    player.title(), player.author(), player.released(),
+	    song ? song : player.start_song(), player.songs(),
+	    player.settings().clock_freq < 1000000 ? "PAL" : "NTSC",
+	    player.settings().model == MOS8580 ? "8580" : "6581");
+  }
+
+  int sample_freq = (int)player.settings().sample_freq;
+  long long remaining = (long long)(seconds*sample_freq);
+  const int chunk = 4096;
+
+  WavFileSink wav;
+  if (output && !wav.open(output, sample_freq)) {
+    fprintf(stderr, "residplay: %s: cannot open\n", output);
+    return 1;
+  }
+
+  short buf[chunk];
+  SilenceDetector detector((cycle_count)(silence*
+					 player.settings().clock_freq));
+
+  while (remaining > 0) {
+    int n = remaining < chunk ? (int)remaining : chunk;
+    if (output) {
+      short* p = wav.reserve(n);
+      if (!p || !wav.commit(player.clock(p, n))) {
+	fprintf(stderr, "residplay: %s: write error\n", output);
+	return 1;
+      }
+    }
+    else {
+      player.clock(buf, n);
+      if (fwrite(buf, sizeof(short), n, stdout) != (size_t)n) {
+	return 1;
+      }
+    }
+    remaining -= n;
+
+    if (silence > 0 && detector.check(player.sid(), player.cycle())) {
+      if (!quiet) {
+	fprintf(stderr, "Stopped on silence.\n");
+      }
+      break;
+    }
+  }
+
+  if (output && !wav.close()) {
+    fprintf(stderr, "residplay: %s: write error\n", output);
+    return 1;
+  }
+
+  if (trace_file && !trace.save(trace_file)) {
+    fprintf(stderr, "residplay: %s: cannot write trace\n", trace_file);
+    return 1;
+  }
+
+  return 0;
+}
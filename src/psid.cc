@@ -0,0 +1,392 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "psid.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace reSID
+{
+
+// Header field offsets.
+enum {
+  PSID_VERSION = 0x04,
+  PSID_DATA_OFFSET = 0x06,
+  PSID_LOAD = 0x08,
+  PSID_INIT = 0x0a,
+  PSID_PLAY = 0x0c,
+  PSID_SONGS = 0x0e,
+  PSID_START_SONG = 0x10,
+  PSID_SPEED = 0x12,
+  PSID_NAME = 0x16,
+  PSID_AUTHOR = 0x36,
+  PSID_RELEASED = 0x56,
+  PSID_FLAGS = 0x76,
+  PSID_V1_SIZE = 0x76,
+  PSID_V2_SIZE = 0x7c
+};
+
+static unsigned int get16(const unsigned char* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned long get32(const unsigned char* p)
+{
+  return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+PSIDPlayer::PSIDPlayer()
+{
+  load_address = init_address = play_address = 0;
+  n_songs = first_song = 0;
+  speed = 0;
+  flags = 0;
+  is_rsid = false;
+  name[0] = author_name[0] = release_info[0] = 0;
+
+  configured = false;
+  cycles_per_sample = 0;
+  buf = 0;
+  buf_n = buf_s = 0;
+  buf_interleave = 1;
+  overflow_pos = 0;
+  sid_cycle = 0;
+
+  trace = 0;
+  trace_cycle = 0;
+
+  machine.set_sid(this);
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+PSIDPlayer::~PSIDPlayer()
+{
+}
+
+
+// ----------------------------------------------------------------------------
+// Load tune from file.
+// ----------------------------------------------------------------------------
+bool PSIDPlayer::load(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return false;
+  }
+
+  // A tune can at most fill the 64KB address space.
+  std::vector<unsigned char> file(PSID_V2_SIZE + 2 + 0x10000);
+  size_t size = fread(&file[0], 1, file.size(), f);
+  fclose(f);
+
+  return load(&file[0], size);
+}
+
+
+// ----------------------------------------------------------------------------
+// Load tune from memory.
+// ----------------------------------------------------------------------------
+bool PSIDPlayer::load(const unsigned char* file, int size)
+{
+  if (size < PSID_V1_SIZE ||
+      (memcmp(file, "PSID", 4) != 0 && memcmp(file, "RSID", 4) != 0))
+  {
+    return false;
+  }
+
+  int version = get16(file + PSID_VERSION);
+  int data_offset = get16(file + PSID_DATA_OFFSET);
+  if (version < 1 || version > 4 || data_offset > size ||
+      data_offset < (version == 1 ? PSID_V1_SIZE : PSID_V2_SIZE))
+  {
+    return false;
+  }
+
+  is_rsid = file[0] == 'R';
+  load_address = get16(file + PSID_LOAD);
+  init_address = get16(file + PSID_INIT);
+  play_address = get16(file + PSID_PLAY);
+  n_songs = get16(file + PSID_SONGS);
+  first_song = get16(file + PSID_START_SONG);
+  speed = get32(file + PSID_SPEED);
+  flags = version >= 2 ? get16(file + PSID_FLAGS) : 0;
+
+  // Compute! Sidplayer MUS data requires a separate player.
+  if (flags & 0x01) {
+    return false;
+  }
+
+  memcpy(name, file + PSID_NAME, 32);
+  memcpy(author_name, file + PSID_AUTHOR, 32);
+  memcpy(release_info, file + PSID_RELEASED, 32);
+  name[32] = author_name[32] = release_info[32] = 0;
+
+  if (n_songs < 1) {
+    n_songs = 1;
+  }
+  if (first_song < 1 || first_song > n_songs) {
+    first_song = 1;
+  }
+
+  // A load address of 0 means that the data is prefixed by the load
+  // address, in little endian.
+  const unsigned char* p = file + data_offset;
+  int n = size - data_offset;
+  if (!load_address) {
+    if (n < 2) {
+      return false;
+    }
+    load_address = p[0] | (p[1] << 8);
+    p += 2;
+    n -= 2;
+  }
+  if (!init_address) {
+    init_address = load_address;
+  }
+
+  data.assign(p, p + n);
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Header clock and model.
+// ----------------------------------------------------------------------------
+C64::video_standard PSIDPlayer::video() const
+{
+  return ((flags >> 2) & 0x03) == 0x02 ? C64::NTSC : C64::PAL;
+}
+
+chip_model PSIDPlayer::model() const
+{
+  return ((flags >> 4) & 0x03) == 0x02 ? MOS8580 : MOS6581;
+}
+
+
+// ----------------------------------------------------------------------------
+// Memory configuration for calling a routine, as used by the common PSID
+// players: I/O and Kernal are banked in unless they would cover the routine.
+// ----------------------------------------------------------------------------
+reg8 PSIDPlayer::bank(reg16 address)
+{
+  if (address < 0xa000) {
+    return 0x37;
+  }
+  if (address < 0xd000) {
+    return 0x36;
+  }
+  if (address >= 0xe000) {
+    return 0x35;
+  }
+  return 0x34;
+}
+
+
+// ----------------------------------------------------------------------------
+// Start song.
+// ----------------------------------------------------------------------------
+bool PSIDPlayer::start(int song, const RenderSettings& settings,
+		       bool use_header)
+{
+  if (data.empty()) {
+    return false;
+  }
+  if (song < 1 || song > n_songs) {
+    song = first_song;
+  }
+
+  RenderSettings previous = render_settings;
+  render_settings = settings;
+  C64::video_standard standard = video();
+  if (use_header) {
+    render_settings.clock_freq = standard == C64::PAL ? 985248 : 1022727;
+    if ((flags >> 4) & 0x03) {
+      render_settings.model = model();
+    }
+  }
+  else {
+    standard = settings.clock_freq < 1000000 ? C64::PAL : C64::NTSC;
+  }
+
+  // The resampling filter is only recalculated if the sampling parameters
+  // have changed, e.g. not for another tune on a player which is reused.
+  if (configured && render_settings.same_sampling(previous)) {
+    render_settings.restart(chip);
+  }
+  else if (!(configured = render_settings.configure(chip))) {
+    return false;
+  }
+  cycles_per_sample = render_settings.clock_freq/render_settings.sample_freq;
+
+  overflow.clear();
+  overflow_pos = 0;
+  sid_cycle = 0;
+  if (trace) {
+    trace->clear();
+  }
+  trace_cycle = 0;
+
+  machine.reset(standard);
+  machine.load(load_address, &data[0], data.size());
+
+  // Speed bits for songs beyond 32 are taken from bit 31.
+  bool cia_speed = (speed >> (song <= 32 ? song - 1 : 31)) & 0x01;
+
+  if (is_rsid) {
+    // RSID tunes run in the environment left by the Kernal, with CIA 1
+    // providing the 60Hz interrupt.
+    machine.write(0x0001, 0x37, 0);
+    machine.disable_irq(false);
+  }
+  else if (!play_address) {
+    // The init routine installs an interrupt handler.
+    machine.write(0x0001, bank(init_address), 0);
+    machine.disable_irq(false);
+  }
+  else {
+    // The play routine is called by the driver, on a raster interrupt at
+    // 50/60Hz or on CIA 1 timer A interrupts. The init routine may
+    // reprogram the timer.
+    machine.write(0x0001, bank(init_address), 0);
+    machine.set_cia1_timer(standard == C64::PAL ? 0x4025 : 0x4295,
+			   cia_speed);
+    machine.set_raster_irq(cia_speed ? -1 : 0);
+    machine.set_irq_call(play_address, bank(play_address));
+  }
+
+  machine.call(init_address, song - 1);
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Capture writes.
+// ----------------------------------------------------------------------------
+void PSIDPlayer::set_trace(Trace* trace)
+{
+  this->trace = trace;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock SID up to the given cycle, rendering into the output buffer, or
+// into the overflow buffer once the output buffer is full.
+// ----------------------------------------------------------------------------
+void PSIDPlayer::sync(unsigned long long cycle)
+{
+  if (cycle <= sid_cycle) {
+    return;
+  }
+
+  cycle_count delta_t = cycle - sid_cycle;
+  sid_cycle = cycle;
+
+  while (delta_t > 0) {
+    if (buf_s < buf_n) {
+      buf_s += chip.clock(delta_t, buf + buf_s*buf_interleave, buf_n - buf_s,
+			  buf_interleave);
+    }
+    else {
+      size_t s = overflow.size();
+      int n = (int)(delta_t/cycles_per_sample) + 2;
+      overflow.resize(s + n);
+      overflow.resize(s + chip.clock(delta_t, &overflow[s], n));
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// SID accesses from the C64.
+// ----------------------------------------------------------------------------
+reg8 PSIDPlayer::read_sid(unsigned long long cycle, reg8 offset)
+{
+  sync(cycle);
+  return chip.read(offset);
+}
+
+void PSIDPlayer::write_sid(unsigned long long cycle, reg8 offset, reg8 value)
+{
+  sync(cycle);
+  chip.write(offset, value);
+
+  if (trace) {
+    if (cycle < trace_cycle) {
+      cycle = trace_cycle;
+    }
+    trace->add(cycle - trace_cycle, offset, value);
+    trace_cycle = cycle;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Render n samples.
+// ----------------------------------------------------------------------------
+int PSIDPlayer::clock(short* buf, int n, int interleave)
+{
+  if (!cycles_per_sample) {
+    return 0;
+  }
+
+  int s = 0;
+
+  // Samples left over from the previous call.
+  while (s < n && overflow_pos < overflow.size()) {
+    buf[s++*interleave] = overflow[overflow_pos++];
+  }
+  if (overflow_pos == overflow.size()) {
+    overflow.clear();
+    overflow_pos = 0;
+  }
+
+  this->buf = buf;
+  buf_n = n;
+  buf_s = s;
+  buf_interleave = interleave;
+
+  // Run the C64 far enough to fill the buffer; the SID is clocked on each
+  // access, and up to the end of the last instruction.
+  while (buf_s < buf_n) {
+    machine.run(machine.cycle() +
+		(unsigned long long)((buf_n - buf_s)*cycles_per_sample) + 1);
+    sync(machine.cycle());
+  }
+
+  this->buf = 0;
+  buf_n = buf_s = 0;
+
+  if (trace) {
+    trace->tail = sid_cycle - trace_cycle;
+  }
+
+  return n;
+}
+
+} // namespace reSID
@@ -0,0 +1,127 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_PSID_H
+#define RESID_PSID_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "c64.h"
+#include "trace.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Headless PSID / RSID tune player.
+//
+// The tune runs on the C64 core, and SID accesses are applied on their exact
+// cycles. There is no audio device; clock() renders samples straight into
+// the caller's buffer, running the C64 only as far as needed.
+//
+// PSID tunes with a play address are driven by a raster interrupt (VBI
+// speed) or by CIA 1 timer A (CIA speed), calling the play routine directly.
+// PSID tunes without a play address, and RSID tunes, install their own
+// interrupt handlers, which are taken through the vectors.
+//
+// Only the first SID is emulated; second and third SID addresses in v3 and
+// v4 headers are ignored.
+// ----------------------------------------------------------------------------
+class PSIDPlayer : public SIDBus
+{
+public:
+  PSIDPlayer();
+  ~PSIDPlayer();
+
+  bool load(const char* filename);
+  bool load(const unsigned char* data, int size);
+
+  const char* title() const { return name; }
+  const char* author() const { return author_name; }
+  const char* released() const { return release_info; }
+  int songs() const { return n_songs; }
+  int start_song() const { return first_song; }
+  bool rsid() const { return is_rsid; }
+
+  // Clock and model from the header flags. Unspecified values are reported
+  // as PAL and MOS6581.
+  C64::video_standard video() const;
+  chip_model model() const;
+
+  // Start song (1 - songs(), 0 for the start song). Unless use_header is
+  // false, the clock frequency and chip model in settings are replaced by
+  // the ones specified in the header.
+  bool start(int song, const RenderSettings& settings, bool use_header = true);
+
+  // Render n samples.
+  int clock(short* buf, int n, int interleave = 1);
+
+  // Number of cycles clocked.
+  unsigned long long cycle() const { return sid_cycle; }
+
+  // Append all SID writes to a trace, from the next call to start().
+  void set_trace(Trace* trace);
+
+  SID& sid() { return chip; }
+  C64& c64() { return machine; }
+  const RenderSettings& settings() const { return render_settings; }
+
+  // SIDBus.
+  reg8 read_sid(unsigned long long cycle, reg8 offset);
+  void write_sid(unsigned long long cycle, reg8 offset, reg8 value);
+
+protected:
+  static reg8 bank(reg16 address);
+  void sync(unsigned long long cycle);
+
+  SID chip;
+  C64 machine;
+  RenderSettings render_settings;
+  // Whether the SID is configured for the sampling parameters of
+  // render_settings.
+  bool configured;
+  double cycles_per_sample;
+
+  // Tune.
+  std::vector<unsigned char> data;
+  reg16 load_address, init_address, play_address;
+  int n_songs, first_song;
+  unsigned long speed;
+  unsigned int flags;
+  bool is_rsid;
+  char name[33], author_name[33], release_info[33];
+
+  // Output buffer of the current clock() call. Samples produced by syncing
+  // the SID beyond the end of the buffer are kept for the next call.
+  short* buf;
+  int buf_n, buf_s, buf_interleave;
+  std::vector<short> overflow;
+  size_t overflow_pos;
+
+  // Cycle up to which the SID has been clocked.
+  unsigned long long sid_cycle;
+
+  Trace* trace;
+  unsigned long long trace_cycle;
+};
+
+} // namespace reSID
+
+#endif // not RESID_PSID_H
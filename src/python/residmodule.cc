@@ -0,0 +1,565 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// Python binding.
+//
+// Rendering writes straight into any writable buffer of 16 bit samples,
+// e.g. a NumPy int16 array, through the buffer protocol, and the GIL is
+// released while the SID is clocked, so that Python threads rendering on
+// separate SID objects run in parallel.
+//
+//   import resid, numpy
+//   sid = resid.SID(model="8580", sample_freq=48000)
+//   sid.write(0x18, 0x0f)
+//   buf = numpy.zeros(48000, numpy.int16)
+//   n = sid.clock(buf)
+//
+// render_batch() renders a list of register programs into the rows of a
+// two dimensional buffer, on a pool of native threads. A program is a
+// buffer of unsigned 32 bit (delta, offset, value) triples, with delta in
+// cycles since the previous write, as in a trace file. Each row is rendered
+// on a SID in its initial state, and programs extending beyond the end of
+// the row are cut off.
+//
+// Sampling configuration is given as keyword arguments, with the defaults
+// of RenderSettings:
+//
+//   model="6581"|"8580", clock_freq, method="fast"|"interpolate"|
+//   "resample"|"fastmem", sample_freq, pass_freq, filter_scale,
+//   filter_bias, filter, external_filter, voice_mask
+// ----------------------------------------------------------------------------
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "trace.h"
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+using namespace reSID;
+
+static const char* method_names[] = {
+  "fast", "interpolate", "resample", "fastmem"
+};
+
+static const sampling_method methods[] = {
+  SAMPLE_FAST, SAMPLE_INTERPOLATE, SAMPLE_RESAMPLE, SAMPLE_RESAMPLE_FASTMEM
+};
+
+
+// ----------------------------------------------------------------------------
+// Parse sampling configuration from keyword arguments.
+// ----------------------------------------------------------------------------
+static bool parse_settings(PyObject* args, PyObject* kwargs,
+			   RenderSettings& settings)
+{
+  static const char* keywords[] = {
+    "model", "clock_freq", "method", "sample_freq", "pass_freq",
+    "filter_scale", "filter_bias", "filter", "external_filter",
+    "voice_mask", 0
+  };
+
+  const char* model = 0;
+  const char* method = 0;
+  int filter = settings.filter;
+  int external_filter = settings.external_filter;
+  unsigned int voice_mask = settings.voice_mask;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$sdsddddppI",
+				   (char**)keywords, &model,
+				   &settings.clock_freq, &method,
+				   &settings.sample_freq, &settings.pass_freq,
+				   &settings.filter_scale,
+				   &settings.filter_bias, &filter,
+				   &external_filter, &voice_mask))
+  {
+    return false;
+  }
+
+  if (model) {
+    if (strcmp(model, "6581") == 0) {
+      settings.model = MOS6581;
+    }
+    else if (strcmp(model, "8580") == 0) {
+      settings.model = MOS8580;
+    }
+    else {
+      PyErr_SetString(PyExc_ValueError, "model must be \"6581\" or \"8580\"");
+      return false;
+    }
+  }
+
+  if (method) {
+    int i;
+    for (i = 0; i < 4; i++) {
+      if (strcmp(method, method_names[i]) == 0) {
+	settings.method = methods[i];
+	break;
+      }
+    }
+    if (i == 4) {
+      PyErr_SetString(PyExc_ValueError, "unknown sampling method");
+      return false;
+    }
+  }
+
+  settings.filter = filter;
+  settings.external_filter = external_filter;
+  settings.voice_mask = voice_mask & 0x0f;
+
+  return true;
+}
+
+static PyObject* settings_dict(const RenderSettings& settings)
+{
+  const char* method = "";
+  for (int i = 0; i < 4; i++) {
+    if (settings.method == methods[i]) {
+      method = method_names[i];
+    }
+  }
+
+  return Py_BuildValue("{s:s,s:d,s:s,s:d,s:d,s:d,s:d,s:O,s:O,s:I}",
+		       "model", settings.model == MOS8580 ? "8580" : "6581",
+		       "clock_freq", settings.clock_freq,
+		       "method", method,
+		       "sample_freq", settings.sample_freq,
+		       "pass_freq", settings.pass_freq,
+		       "filter_scale", settings.filter_scale,
+		       "filter_bias", settings.filter_bias,
+		       "filter", settings.filter ? Py_True : Py_False,
+		       "external_filter",
+		       settings.external_filter ? Py_True : Py_False,
+		       "voice_mask", settings.voice_mask);
+}
+
+
+// ----------------------------------------------------------------------------
+// Buffers of 16 bit samples.
+// ----------------------------------------------------------------------------
+static bool is_format(const Py_buffer& view, char type)
+{
+  const char* format = view.format ? view.format : "B";
+  if (*format == '@' || *format == '=' || *format == '<') {
+    format++;
+  }
+  return format[0] == type && !format[1];
+}
+
+static bool get_samples(PyObject* object, Py_buffer& view)
+{
+  if (PyObject_GetBuffer(object, &view,
+			 PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS)
+      < 0)
+  {
+    return false;
+  }
+  if (!is_format(view, 'h')) {
+    PyErr_SetString(PyExc_TypeError, "sample buffer must be of type int16");
+    PyBuffer_Release(&view);
+    return false;
+  }
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// SID object.
+// ----------------------------------------------------------------------------
+struct SIDObject
+{
+  PyObject_HEAD
+  SID* sid;
+  RenderSettings* settings;
+};
+
+static int SID_init(SIDObject* self, PyObject* args, PyObject* kwargs)
+{
+  RenderSettings settings;
+  if (!parse_settings(args, kwargs, settings)) {
+    return -1;
+  }
+  if (!self->sid) {
+    self->sid = new SID();
+    self->settings = new RenderSettings();
+  }
+  if (!settings.configure(*self->sid)) {
+    PyErr_SetString(PyExc_ValueError, "invalid sampling parameters");
+    return -1;
+  }
+  *self->settings = settings;
+  return 0;
+}
+
+// SID objects are only usable once __init__ has run.
+static bool check_init(SIDObject* self)
+{
+  if (!self->sid) {
+    PyErr_SetString(PyExc_RuntimeError, "SID object is not initialized");
+    return false;
+  }
+  return true;
+}
+
+static void SID_dealloc(SIDObject* self)
+{
+  delete self->sid;
+  delete self->settings;
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* SID_reset(SIDObject* self, PyObject*)
+{
+  if (!check_init(self)) {
+    return 0;
+  }
+  self->settings->restart(*self->sid);
+  Py_RETURN_NONE;
+}
+
+static PyObject* SID_write(SIDObject* self, PyObject* args)
+{
+  unsigned int offset, value;
+  if (!check_init(self) || !PyArg_ParseTuple(args, "II", &offset, &value)) {
+    return 0;
+  }
+  self->sid->write(offset & 0x1f, value & 0xff);
+  Py_RETURN_NONE;
+}
+
+static PyObject* SID_read(SIDObject* self, PyObject* args)
+{
+  unsigned int offset;
+  if (!check_init(self) || !PyArg_ParseTuple(args, "I", &offset)) {
+    return 0;
+  }
+  return PyLong_FromLong(self->sid->read(offset & 0x1f));
+}
+
+// Render into buffer, for at most the given number of cycles. Returns the
+// number of samples rendered and the number of cycles left.
+static PyObject* SID_clock(SIDObject* self, PyObject* args)
+{
+  PyObject* object;
+  long long cycles = -1;
+  if (!check_init(self) || !PyArg_ParseTuple(args, "O|L", &object, &cycles)) {
+    return 0;
+  }
+
+  Py_buffer view;
+  if (!get_samples(object, view)) {
+    return 0;
+  }
+
+  short* buf = (short*)view.buf;
+  Py_ssize_t size = view.len/sizeof(short);
+  Py_ssize_t rendered = 0;
+  bool limited = cycles >= 0;
+  const cycle_count max_delta = 1 << 30;
+
+  Py_BEGIN_ALLOW_THREADS
+  while (rendered < size && (!limited || cycles > 0)) {
+    cycle_count delta_t = !limited || cycles > max_delta ?
+      max_delta : (cycle_count)cycles;
+    cycle_count requested = delta_t;
+    int n = size - rendered < (1 << 30) ? size - rendered : (1 << 30);
+    rendered += self->sid->clock(delta_t, buf + rendered, n);
+    if (limited) {
+      cycles -= requested - delta_t;
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&view);
+  return Py_BuildValue("(nL)", rendered, limited ? cycles : 0LL);
+}
+
+static PyObject* SID_get_settings(SIDObject* self, void*)
+{
+  if (!check_init(self)) {
+    return 0;
+  }
+  return settings_dict(*self->settings);
+}
+
+static PyMethodDef SID_methods[] = {
+  { "reset", (PyCFunction)SID_reset, METH_NOARGS,
+    "Put the SID in its initial state." },
+  { "write", (PyCFunction)SID_write, METH_VARARGS,
+    "write(offset, value): write SID register." },
+  { "read", (PyCFunction)SID_read, METH_VARARGS,
+    "read(offset): read SID register." },
+  { "clock", (PyCFunction)SID_clock, METH_VARARGS,
+    "clock(buffer[, cycles]) -> (samples, cycles_left): render into an int16\n"
+    "buffer until it is full, or for at most the given number of cycles." },
+  { 0 }
+};
+
+static PyGetSetDef SID_getset[] = {
+  { "settings", (getter)SID_get_settings, 0,
+    "Sampling configuration.", 0 },
+  { 0 }
+};
+
+static PyTypeObject SIDType = {
+  PyVarObject_HEAD_INIT(0, 0)
+};
+
+
+// ----------------------------------------------------------------------------
+// Batch rendering.
+// ----------------------------------------------------------------------------
+struct BatchJob
+{
+  RenderSettings settings;
+  std::vector<Trace> traces;
+  short* out;
+  Py_ssize_t row_size;
+  std::atomic<size_t> next_row;
+  std::atomic<bool> failed;
+};
+
+static void batch_worker(BatchJob* job)
+{
+  SID sid;
+  if (!job->settings.configure(sid)) {
+    job->failed = true;
+    return;
+  }
+
+  for (;;) {
+    size_t i = job->next_row.fetch_add(1, std::memory_order_relaxed);
+    if (i >= job->traces.size()) {
+      break;
+    }
+
+    if (i) {
+      job->settings.restart(sid);
+    }
+    TracePlayer player(sid, job->traces[i]);
+    short* row = job->out + i*job->row_size;
+    Py_ssize_t rendered = 0;
+    while (rendered < job->row_size) {
+      int n = job->row_size - rendered < (1 << 30) ?
+	job->row_size - rendered : (1 << 30);
+      int m = player.clock(row + rendered, n);
+      rendered += m;
+      if (m < n) {
+	break;
+      }
+    }
+
+    // The trace may end short of the row, due to rounding of the sampling
+    // phase, and since the last cycle yields no sample; clock on.
+    while (rendered < job->row_size) {
+      cycle_count delta_t = 1 << 30;
+      int n = job->row_size - rendered < (1 << 30) ?
+	job->row_size - rendered : (1 << 30);
+      int m = sid.clock(delta_t, row + rendered, n);
+      if (!m) {
+	break;
+      }
+      rendered += m;
+    }
+    memset(row + rendered, 0, sizeof(short)*(job->row_size - rendered));
+  }
+}
+
+static PyObject* render_batch(PyObject*, PyObject* args, PyObject* kwargs)
+{
+  PyObject* programs;
+  PyObject* object;
+  int threads = 0;
+
+  // Positional arguments and threads are parsed here, the rest as settings.
+  if (!PyArg_ParseTuple(args, "OO", &programs, &object)) {
+    return 0;
+  }
+  PyObject* settings_kwargs = 0;
+  if (kwargs) {
+    settings_kwargs = PyDict_Copy(kwargs);
+    PyObject* t = PyDict_GetItemString(settings_kwargs, "threads");
+    if (t) {
+      threads = PyLong_AsLong(t);
+      PyDict_DelItemString(settings_kwargs, "threads");
+      if (PyErr_Occurred()) {
+	Py_DECREF(settings_kwargs);
+	return 0;
+      }
+    }
+  }
+
+  BatchJob* job = new BatchJob();
+  PyObject* empty = PyTuple_New(0);
+  bool ok = parse_settings(empty, settings_kwargs, job->settings);
+  Py_DECREF(empty);
+  Py_XDECREF(settings_kwargs);
+  if (!ok) {
+    delete job;
+    return 0;
+  }
+
+  PyObject* sequence = PySequence_Fast(programs, "programs must be a sequence");
+  if (!sequence) {
+    delete job;
+    return 0;
+  }
+  Py_ssize_t rows = PySequence_Fast_GET_SIZE(sequence);
+
+  Py_buffer view;
+  if (!get_samples(object, view)) {
+    Py_DECREF(sequence);
+    delete job;
+    return 0;
+  }
+  if (view.ndim != 2 || view.shape[0] != rows) {
+    PyErr_SetString(PyExc_ValueError,
+		    "output must have one row per program");
+    PyBuffer_Release(&view);
+    Py_DECREF(sequence);
+    delete job;
+    return 0;
+  }
+  job->out = (short*)view.buf;
+  job->row_size = view.shape[1];
+
+  // Copy programs to traces. Programs are cut at the end of the row.
+  unsigned long long cycles = (unsigned long long)
+    (job->row_size*job->settings.clock_freq/job->settings.sample_freq) + 1;
+  job->traces.resize(rows);
+  for (Py_ssize_t i = 0; ok && i < rows; i++) {
+    Py_buffer program;
+    if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(sequence, i), &program,
+			   PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+    {
+      ok = false;
+      break;
+    }
+    if (!(is_format(program, 'I') || is_format(program, 'L')) ||
+	program.itemsize != 4 || (program.len/4)%3)
+    {
+      PyErr_SetString(PyExc_TypeError,
+		      "program must be uint32 (delta, offset, value) triples");
+      PyBuffer_Release(&program);
+      ok = false;
+      break;
+    }
+
+    Trace& trace = job->traces[i];
+    const unsigned int* w = (const unsigned int*)program.buf;
+    Py_ssize_t n = program.len/12;
+    unsigned long long time = 0;
+    for (Py_ssize_t j = 0; j < n; j++, w += 3) {
+      if (time + w[0] >= cycles) {
+	break;
+      }
+      time += w[0];
+      trace.add(w[0], w[1] & 0x1f, w[2] & 0xff);
+    }
+    // Play on from the last write kept; any remainder is clocked by the
+    // worker.
+    trace.tail = cycles - time < (1ULL << 30) ?
+      (cycle_count)(cycles - time) : 1 << 30;
+    PyBuffer_Release(&program);
+  }
+  Py_DECREF(sequence);
+
+  if (ok) {
+    if (threads <= 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    if (threads > rows) {
+      threads = rows;
+    }
+    job->next_row = 0;
+    job->failed = false;
+
+    Py_BEGIN_ALLOW_THREADS
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+      workers.push_back(std::thread(batch_worker, job));
+    }
+    if (threads > 0) {
+      batch_worker(job);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (job->failed) {
+      PyErr_SetString(PyExc_ValueError, "invalid sampling parameters");
+      ok = false;
+    }
+  }
+
+  PyBuffer_Release(&view);
+  delete job;
+
+  if (!ok) {
+    return 0;
+  }
+  Py_RETURN_NONE;
+}
+
+
+static PyMethodDef module_methods[] = {
+  { "render_batch", (PyCFunction)(void(*)(void))render_batch,
+    METH_VARARGS | METH_KEYWORDS,
+    "render_batch(programs, out, *, threads=0, **settings): render each\n"
+    "program of uint32 (delta, offset, value) triples into the\n"
+    "corresponding row of the two dimensional int16 buffer out." },
+  { 0 }
+};
+
+static PyModuleDef module = {
+  PyModuleDef_HEAD_INIT, "resid", "reSID MOS6581 / MOS8580 SID emulator.",
+  -1, module_methods
+};
+
+PyMODINIT_FUNC PyInit_resid()
+{
+  SIDType.tp_name = "resid.SID";
+  SIDType.tp_basicsize = sizeof(SIDObject);
+  SIDType.tp_flags = Py_TPFLAGS_DEFAULT;
+  SIDType.tp_doc = "SID(**settings): SID chip with sampling configuration.";
+  SIDType.tp_new = PyType_GenericNew;
+  SIDType.tp_init = (initproc)SID_init;
+  SIDType.tp_dealloc = (destructor)SID_dealloc;
+  SIDType.tp_methods = SID_methods;
+  SIDType.tp_getset = SID_getset;
+  if (PyType_Ready(&SIDType) < 0) {
+    return 0;
+  }
+
+  PyObject* m = PyModule_Create(&module);
+  if (!m) {
+    return 0;
+  }
+  Py_INCREF(&SIDType);
+  if (PyModule_AddObject(m, "SID", (PyObject*)&SIDType) < 0) {
+    Py_DECREF(&SIDType);
+    Py_DECREF(m);
+    return 0;
+  }
+  return m;
+}
@@ -0,0 +1,40 @@
+# Build the reSID Python binding.
+#
+# reSID must be configured first, since the binding is compiled against the
+# generated siddefs.h. For a separate build directory, set RESID_BUILD to
+# its path:
+#
+#   cd .. && ./configure && cd python && python3 setup.py build_ext --inplace
+
+import os
+import re
+from setuptools import setup, Extension
+
+here = os.path.dirname(os.path.abspath(__file__))
+srcdir = os.path.dirname(here)
+builddir = os.environ.get('RESID_BUILD', srcdir)
+
+# Compile the library sources into the extension, since libresid.a is not
+# built as position independent code.
+with open(os.path.join(srcdir, 'Makefile.am')) as f:
+    makefile = f.read().replace('\\\n', ' ')
+library = re.search(r'^libresid_a_SOURCES\s*=(.*)$', makefile, re.M)
+sources = [os.path.relpath(os.path.join(srcdir, s), here)
+           for s in library.group(1).split()]
+
+with open(os.path.join(srcdir, 'configure.ac')) as f:
+    version = re.search(r'AC_INIT\(\[[^]]*\], \[([^]]*)\]', f.read()).group(1)
+
+setup(
+    name='resid',
+    version=version,
+    description='reSID MOS6581 / MOS8580 SID emulator',
+    ext_modules=[
+        Extension('resid',
+                  sources=['residmodule.cc'] + sources,
+                  include_dirs=[builddir, srcdir],
+                  define_macros=[('VERSION', '"%s"' % version)],
+                  extra_compile_args=['-O3', '-fno-exceptions'],
+                  language='c++'),
+    ],
+)
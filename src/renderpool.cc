@@ -0,0 +1,247 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "renderpool.h"
+#include "psid.h"
+#include "sink.h"
+#include <thread>
+#include <algorithm>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+RenderPool::RenderPool()
+{
+  slice = 1 << 14;
+  remaining = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+RenderPool::~RenderPool()
+{
+  clear();
+}
+
+
+// ----------------------------------------------------------------------------
+// Add jobs.
+// ----------------------------------------------------------------------------
+int RenderPool::add(SID& sid, const Trace& trace, SampleSink* sink,
+		    unsigned long long max_samples)
+{
+  Job j;
+  j.trace_player = new TracePlayer(sid, trace);
+  j.player = 0;
+  j.sink = sink;
+  j.max_samples = max_samples;
+
+  long long index;
+  double fraction;
+  sid.sample_position(trace.cycles(), index, fraction);
+  j.length = max_samples && (unsigned long long)index > max_samples ?
+    max_samples : index;
+
+  j.ok = true;
+  j.samples = 0;
+  job.push_back(j);
+  return (int)job.size() - 1;
+}
+
+int RenderPool::add(PSIDPlayer& player, unsigned long long samples,
+		    SampleSink* sink)
+{
+  Job j;
+  j.trace_player = 0;
+  j.player = &player;
+  j.sink = sink;
+  j.max_samples = samples;
+  j.length = samples;
+  j.ok = true;
+  j.samples = 0;
+  job.push_back(j);
+  return (int)job.size() - 1;
+}
+
+void RenderPool::clear()
+{
+  for (size_t i = 0; i < job.size(); i++) {
+    delete job[i].trace_player;
+  }
+  job.clear();
+}
+
+
+// ----------------------------------------------------------------------------
+// Samples per slice. Shorter slices balance better at the tail of a run,
+// longer slices have less scheduling overhead.
+// ----------------------------------------------------------------------------
+void RenderPool::set_slice(int samples)
+{
+  slice = samples > 0 ? samples : 1;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render one slice of a job. Returns true if the job is done.
+// ----------------------------------------------------------------------------
+bool RenderPool::render_slice(Job& j, Worker& w)
+{
+  int n = slice;
+  if (j.max_samples && j.max_samples - j.samples < (unsigned long long)n) {
+    n = j.max_samples - j.samples;
+  }
+
+  short* buf = j.sink ? j.sink->reserve(n) : &w.scratch[0];
+  if (!buf) {
+    j.ok = false;
+    return true;
+  }
+
+  int s = j.player ? j.player->clock(buf, n) : j.trace_player->clock(buf, n);
+  j.samples += s;
+
+  if (j.sink && !j.sink->commit(s)) {
+    j.ok = false;
+    return true;
+  }
+
+  // A trace player renders less than requested at the end of the trace.
+  return s < n || (j.max_samples && j.samples == j.max_samples);
+}
+
+
+// ----------------------------------------------------------------------------
+// Take the next job for worker w; the most recent job from its own deque,
+// else the oldest job from another worker's deque. Returns false if there
+// are no more jobs.
+// ----------------------------------------------------------------------------
+bool RenderPool::next(int w, int& j)
+{
+  int workers = (int)worker.size();
+
+  for (;;) {
+    {
+      Worker& self = *worker[w];
+      std::lock_guard<std::mutex> guard(self.lock);
+      if (!self.jobs.empty()) {
+	j = self.jobs.back();
+	self.jobs.pop_back();
+	return true;
+      }
+    }
+
+    for (int i = 1; i < workers; i++) {
+      Worker& victim = *worker[(w + i)%workers];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.jobs.empty()) {
+	j = victim.jobs.front();
+	victim.jobs.pop_front();
+	return true;
+      }
+    }
+
+    // Jobs being rendered by other workers may still be pushed back.
+    if (!remaining.load(std::memory_order_acquire)) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Worker thread.
+// ----------------------------------------------------------------------------
+void RenderPool::work(RenderPool* pool, int w)
+{
+  Worker& self = *pool->worker[w];
+  int j;
+
+  while (pool->next(w, j)) {
+    if (pool->render_slice(pool->job[j], self)) {
+      pool->remaining.fetch_sub(1, std::memory_order_release);
+    }
+    else {
+      std::lock_guard<std::mutex> guard(self.lock);
+      self.jobs.push_back(j);
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Render all jobs.
+// ----------------------------------------------------------------------------
+bool RenderPool::run(int threads)
+{
+  if (threads < 1) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (threads > (int)job.size()) {
+    threads = (int)job.size();
+  }
+  if (threads < 1) {
+    return true;
+  }
+
+  // Deal the jobs longest first, so that the first job taken by each worker
+  // (from the back of its deque) is the longest one it was dealt.
+  std::vector<std::pair<unsigned long long, int> > order;
+  for (size_t i = 0; i < job.size(); i++) {
+    order.push_back(std::make_pair(job[i].length, (int)i));
+  }
+  std::stable_sort(order.begin(), order.end());
+
+  for (int w = 0; w < threads; w++) {
+    worker.push_back(new Worker());
+    worker[w]->scratch.resize(slice);
+  }
+  for (size_t i = 0; i < order.size(); i++) {
+    worker[i%threads]->jobs.push_back(order[i].second);
+  }
+  remaining = (int)job.size();
+
+  std::vector<std::thread> workers;
+  for (int w = 1; w < threads; w++) {
+    workers.push_back(std::thread(work, this, w));
+  }
+  work(this, 0);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  for (int w = 0; w < threads; w++) {
+    delete worker[w];
+  }
+  worker.clear();
+
+  bool ok = true;
+  for (size_t i = 0; i < job.size(); i++) {
+    ok = ok && job[i].ok;
+  }
+  return ok;
+}
+
+} // namespace reSID
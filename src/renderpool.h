@@ -0,0 +1,115 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_RENDERPOOL_H
+#define RESID_RENDERPOOL_H
+
+#include "siddefs.h"
+#include "trace.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace reSID
+{
+
+class PSIDPlayer;
+class SampleSink;
+
+// ----------------------------------------------------------------------------
+// Render many independent jobs on a work-stealing thread pool.
+//
+// A job is a SID playing a trace, or a PSID player, with an optional sink
+// receiving its output. Jobs are rendered in slices of a fixed number of
+// samples. Each worker has a deque of jobs; it renders the job at the back
+// of its own deque slice by slice, pushing it back after each slice, and
+// when its deque is empty it steals the job at the front of another
+// worker's deque. Jobs are initially dealt to the workers longest first, so
+// that long jobs start early and short jobs fill in at the tail.
+//
+// A job is only ever rendered by one worker at a time, with slices in
+// order, and the slice size does not depend on the number of threads, so
+// the output is identical for any number of threads.
+// ----------------------------------------------------------------------------
+class RenderPool
+{
+public:
+  RenderPool();
+  ~RenderPool();
+
+  // Add a SID, configured and in its initial state, playing a trace. The
+  // job ends at the end of the trace, or after max_samples if nonzero.
+  // Returns the job number.
+  int add(SID& sid, const Trace& trace, SampleSink* sink = 0,
+	  unsigned long long max_samples = 0);
+  // Add a started PSID player, rendering the given number of samples.
+  int add(PSIDPlayer& player, unsigned long long samples,
+	  SampleSink* sink = 0);
+
+  int jobs() const { return (int)job.size(); }
+  void clear();
+
+  // Samples per slice.
+  void set_slice(int samples);
+
+  // Render all jobs, with the given number of threads (0 for all cores).
+  // Returns false if a sink failed; see ok().
+  bool run(int threads = 0);
+
+  // Results.
+  bool ok(int j) const { return job[j].ok; }
+  unsigned long long samples(int j) const { return job[j].samples; }
+
+protected:
+  struct Job
+  {
+    TracePlayer* trace_player;
+    PSIDPlayer* player;
+    SampleSink* sink;
+    unsigned long long max_samples;
+    // Estimated length, for the initial order.
+    unsigned long long length;
+
+    bool ok;
+    unsigned long long samples;
+  };
+
+  struct Worker
+  {
+    std::mutex lock;
+    std::deque<int> jobs;
+    std::vector<short> scratch;
+  };
+
+  static void work(RenderPool* pool, int w);
+  bool render_slice(Job& j, Worker& worker);
+  bool next(int w, int& j);
+
+  std::vector<Job> job;
+  int slice;
+
+  // Workers, and number of jobs not yet done, during run().
+  std::vector<Worker*> worker;
+  std::atomic<int> remaining;
+};
+
+} // namespace reSID
+
+#endif // not RESID_RENDERPOOL_H
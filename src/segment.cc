@@ -0,0 +1,390 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "segment.h"
+#include "memo.h"
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+namespace reSID
+{
+
+// Shared state of the parallel pass.
+struct SegmentRenderer::Pass
+{
+  const Trace* trace;
+  const RenderSettings* settings;
+  std::vector<Segment>* segment;
+  std::atomic<size_t> next;
+  std::atomic<bool> failed;
+  bool exact;
+};
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SegmentRenderer::SegmentRenderer(cycle_count overlap) :
+  overlap(overlap)
+{
+  segments = rerendered = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the oscillators and envelopes delta_t cycles, cycle by cycle; this
+// is SID::clock() without the filter, the external filter, and sampling.
+// ----------------------------------------------------------------------------
+void SegmentRenderer::clock_digital(SID& sid, cycle_count delta_t)
+{
+  for (; delta_t > 0; delta_t--) {
+    int i;
+
+    // Clock amplitude modulators.
+    for (i = 0; i < 3; i++) {
+      sid.voice[i].envelope.clock();
+    }
+
+    // Clock oscillators.
+    for (i = 0; i < 3; i++) {
+      sid.voice[i].wave.clock();
+    }
+
+    // Synchronize oscillators.
+    for (i = 0; i < 3; i++) {
+      sid.voice[i].wave.synchronize();
+    }
+
+    // Calculate waveform output.
+    for (i = 0; i < 3; i++) {
+      sid.voice[i].wave.set_waveform_output();
+    }
+
+    // Pipelined writes on the MOS8580.
+    if (unlikely(sid.write_pipeline)) {
+      sid.write();
+    }
+
+    // Age bus value.
+    if (unlikely(!--sid.bus_value_ttl)) {
+      sid.bus_value = 0;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the chip delta_t cycles, cycle by cycle, up to a sampling point or
+// a write; this is SID::clock_interpolate() or SID::clock_resample() without
+// computing the output sample.
+// ----------------------------------------------------------------------------
+void SegmentRenderer::clock_exact(SID& sid, cycle_count delta_t)
+{
+  if (sid.sampling == SAMPLE_INTERPOLATE) {
+    for (int i = delta_t; i > 0; i--) {
+      sid.clock();
+      if (unlikely(i <= 2)) {
+	sid.sample_prev = sid.sample_now;
+	sid.sample_now = sid.output();
+      }
+    }
+  }
+  else {
+    for (int i = 0; i < delta_t; i++) {
+      int index = sid.sample_index;
+      sid.clock();
+      sid.sample[index] = sid.sample[index + SID::RINGSIZE] = sid.output();
+      sid.sample_index = (index + 1) & SID::RINGMASK;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Pre-pass, taking the snapshots at the segment starts. The sampling phase
+// is advanced as in SID::clock(). Unless exact, only the oscillators and
+// envelopes are clocked.
+// ----------------------------------------------------------------------------
+void SegmentRenderer::prepass(SID& sid, const Trace& trace,
+			      std::vector<Segment>& segment, bool exact)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const std::vector<Trace::Write>& writes = trace.writes;
+  cycle_count sample_offset = sid.sample_offset;
+  size_t k = 1;
+
+  for (size_t i = 0; i < writes.size() && k < segment.size(); i++) {
+    while (k < segment.size() && segment[k].start == i) {
+      SID::State* state = segment[k++].snapshot;
+      *state = sid.read_state();
+      state->sample_offset = sample_offset;
+    }
+
+    cycle_count delta_t = writes[i].delta;
+    if (!exact) {
+      clock_digital(sid, delta_t);
+    }
+
+    while (delta_t) {
+      cycle_count next_sample_offset = sample_offset + sid.cycles_per_sample;
+      cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+      if (delta_t_sample > delta_t) {
+	delta_t_sample = delta_t;
+      }
+
+      if (exact) {
+	clock_exact(sid, delta_t_sample);
+      }
+
+      if ((delta_t -= delta_t_sample) == 0) {
+	sample_offset -= delta_t_sample << FIXP_SHIFT;
+	break;
+      }
+
+      sample_offset = next_sample_offset & FIXP_MASK;
+    }
+
+    sid.write(writes[i].offset, writes[i].value);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Render a segment. Unless from_start, the SID is in the state at write
+// start, and the output up to write begin is discarded. Otherwise the SID
+// is in the state at write begin.
+// ----------------------------------------------------------------------------
+void SegmentRenderer::render_segment(SID& sid, const Trace& trace,
+				     Segment& segment, bool from_start)
+{
+  TracePlayer player(sid, trace);
+  const int chunk = 4096;
+  size_t s;
+
+  if (!from_start) {
+    std::vector<short> scratch(chunk);
+    player.seek(segment.start);
+    player.set_stop(segment.begin);
+    while (player.clock(&scratch[0], chunk) == chunk) ;
+    segment.begin_hash = MemoRenderer::hash_state(sid.read_state());
+  }
+
+  player.seek(segment.begin);
+  player.set_stop(segment.end < trace.writes.size() ?
+		  segment.end : (size_t)-1);
+
+  segment.samples.clear();
+  s = 0;
+  for (;;) {
+    segment.samples.resize(s + chunk);
+    int n = player.clock(&segment.samples[s], chunk);
+    s += n;
+    if (n < chunk) {
+      break;
+    }
+  }
+  segment.samples.resize(s);
+
+  *segment.end_state = sid.read_state();
+}
+
+
+// ----------------------------------------------------------------------------
+// Worker thread of the parallel pass.
+// ----------------------------------------------------------------------------
+void SegmentRenderer::worker(Pass* pass)
+{
+  std::vector<Segment>& segment = *pass->segment;
+  SID sid;
+
+  if (!pass->settings->configure(sid)) {
+    pass->failed = true;
+    return;
+  }
+
+  for (;;) {
+    size_t k = pass->next.fetch_add(1, std::memory_order_relaxed);
+    if (k >= segment.size()) {
+      break;
+    }
+
+    sid.write_state(*segment[k].snapshot);
+    render_segment(sid, *pass->trace, segment[k], k == 0 || pass->exact);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Render trace.
+// ----------------------------------------------------------------------------
+bool SegmentRenderer::render(SID& sid, const Trace& trace,
+			     const RenderSettings& settings,
+			     std::vector<short>& samples, int n, int threads)
+{
+  segments = 1;
+  rerendered = 0;
+
+  if (!settings.configure(sid)) {
+    return false;
+  }
+
+  if (threads < 1) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (n < 1) {
+    n = threads;
+  }
+
+  // The MOS6581 pre-pass is exact, otherwise segments shorter than the
+  // overlap are not worthwhile.
+  bool exact = sid.sid_model == MOS6581;
+  const std::vector<Trace::Write>& writes = trace.writes;
+  unsigned long long cycles = trace.cycles();
+  if (!exact && n > 1 && cycles/n < (unsigned long long)overlap) {
+    n = cycles/overlap;
+  }
+
+  if (n < 2 || settings.method == SAMPLE_FAST) {
+    TracePlayer player(sid, trace);
+    const int chunk = 4096;
+    size_t s = 0;
+
+    samples.clear();
+    for (;;) {
+      samples.resize(s + chunk);
+      int m = player.clock(&samples[s], chunk);
+      s += m;
+      if (m < chunk) {
+	break;
+      }
+    }
+    samples.resize(s);
+    return true;
+  }
+
+  // Split at the first write at or after each multiple of cycles/n, and
+  // unless exact, start each segment at the last write at least overlap
+  // cycles earlier.
+  std::vector<Segment> segment;
+  std::vector<unsigned long long> position(writes.size() + 1);
+  position[0] = 0;
+  for (size_t i = 0; i < writes.size(); i++) {
+    position[i + 1] = position[i] + writes[i].delta;
+  }
+
+  size_t i = 0;
+  for (int k = 0; k < n; k++) {
+    unsigned long long target = cycles*k/n;
+    while (i < writes.size() && position[i] < target) {
+      i++;
+    }
+    if (k > 0 && (i == writes.size() || i == segment.back().begin)) {
+      continue;
+    }
+
+    Segment seg;
+    seg.snapshot = new SID::State();
+    seg.end_state = new SID::State();
+    seg.begin_hash.h1 = seg.begin_hash.h2 = 0;
+    seg.begin = i;
+    seg.start = i;
+    while (!exact && seg.start > 0 &&
+	   position[i] - position[seg.start] < (unsigned long long)overlap)
+    {
+      seg.start--;
+    }
+    seg.end = writes.size();
+    if (k > 0) {
+      segment.back().end = i;
+    }
+    segment.push_back(seg);
+  }
+
+  *segment[0].snapshot = sid.read_state();
+
+  // Pre-pass. Unless exact, the analog state, which is not clocked, and
+  // the output samples are cleared.
+  prepass(sid, trace, segment, exact);
+  for (size_t k = 1; !exact && k < segment.size(); k++) {
+    SID::State& state = *segment[k].snapshot;
+    state.filter_Vhp = 0;
+    state.filter_Vbp = state.filter_Vbp_x = state.filter_Vbp_vc = 0;
+    state.filter_Vlp = state.filter_Vlp_x = state.filter_Vlp_vc = 0;
+    state.filter_v3 = state.filter_v2 = state.filter_v1 = 0;
+    state.extfilt_vlp = state.extfilt_vhp = 0;
+    state.sample_index = 0;
+    state.sample_prev = state.sample_now = 0;
+    memset(state.sample, 0, sizeof(state.sample));
+  }
+
+  // Parallel pass.
+  Pass pass;
+  pass.trace = &trace;
+  pass.settings = &settings;
+  pass.segment = &segment;
+  pass.next = 0;
+  pass.failed = false;
+  pass.exact = exact;
+
+  if (threads > (int)segment.size()) {
+    threads = (int)segment.size();
+  }
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++) {
+    workers.push_back(std::thread(worker, &pass));
+  }
+  worker(&pass);
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  // Unless exact, verify convergence, rendering segments again from the end
+  // state of the previous segment where necessary. Stitch the output.
+  bool ok = !pass.failed;
+  samples.clear();
+  for (size_t k = 0; ok && k < segment.size(); k++) {
+    if (!exact && k > 0 &&
+	segment[k].begin_hash !=
+	MemoRenderer::hash_state(*segment[k - 1].end_state))
+    {
+      sid.write_state(*segment[k - 1].end_state);
+      render_segment(sid, trace, segment[k], true);
+      rerendered++;
+    }
+    samples.insert(samples.end(),
+		   segment[k].samples.begin(), segment[k].samples.end());
+  }
+
+  if (ok) {
+    sid.write_state(*segment.back().end_state);
+  }
+
+  segments = (int)segment.size();
+  for (size_t k = 0; k < segment.size(); k++) {
+    delete segment[k].snapshot;
+    delete segment[k].end_state;
+  }
+
+  return ok;
+}
+
+} // namespace reSID
@@ -0,0 +1,109 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_SEGMENT_H
+#define RESID_SEGMENT_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "hash.h"
+#include "trace.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Rendering of a single long trace on several threads.
+//
+// The trace is split into segments of about equal length at write
+// boundaries, and the segments are rendered in parallel, each starting
+// from a snapshot of the state at its start. The snapshots are taken in a
+// pre-pass, which clocks the chip cycle by cycle without computing output
+// samples. The sampling phase follows from the cycle count and is exact.
+//
+// For the MOS6581, the pre-pass clocks the filter and external filter as
+// well, and keeps the interpolation samples or the resampling ring buffer,
+// skipping only the resampling convolution. The snapshots are thus exact,
+// and each segment is rendered from the snapshot at its first write.
+//
+// For the MOS8580, the pre-pass only clocks the oscillators and envelopes,
+// skipping the filter, external filter and resampling, which is most of
+// the work. The filter and external filter state, and the last output
+// samples, are thus not known at the start of a segment. Each segment is
+// therefore started at least overlap cycles early, from a snapshot with
+// this state cleared, and its output up to the segment start is discarded.
+// Since the filter is linear and forgets its initial state, the state at
+// the segment start normally converges to the state reached by the
+// previous segment within a fraction of a second; this is verified by
+// comparing state hashes, see MemoRenderer::hash_state(). A segment which
+// has not converged is rendered again from the end state of the previous
+// segment, after the parallel pass.
+//
+// The output is thus always identical to that of a plain render.
+//
+// SAMPLE_FAST clocks the oscillators in steps which depend on the sampling
+// points, so no cheaper exact pre-pass exists, and the trace is rendered
+// on a single thread.
+// ----------------------------------------------------------------------------
+class SegmentRenderer
+{
+public:
+  SegmentRenderer(cycle_count overlap = 1 << 20);
+
+  // Render trace in the given number of segments on the given number of
+  // threads (0 for all cores). The SID is configured according to
+  // settings, and is left in the state at the end of the trace.
+  bool render(SID& sid, const Trace& trace, const RenderSettings& settings,
+	      std::vector<short>& samples, int segments = 0, int threads = 0);
+
+  // Statistics for the last render.
+  int segments;
+  int rerendered;
+
+protected:
+  struct Segment
+  {
+    // Writes [begin, end), started from the snapshot at write start.
+    size_t start, begin, end;
+    SID::State* snapshot;
+
+    // Hash of the state reached at write begin, state at write end, and
+    // output from write begin.
+    HashDigest begin_hash;
+    SID::State* end_state;
+    std::vector<short> samples;
+  };
+
+  struct Pass;
+
+  void prepass(SID& sid, const Trace& trace, std::vector<Segment>& segment,
+	       bool exact);
+  static void clock_digital(SID& sid, cycle_count delta_t);
+  static void clock_exact(SID& sid, cycle_count delta_t);
+  static void render_segment(SID& sid, const Trace& trace, Segment& segment,
+			     bool from_start);
+  static void worker(Pass* pass);
+
+  cycle_count overlap;
+};
+
+} // namespace reSID
+
+#endif // not RESID_SEGMENT_H
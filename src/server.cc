@@ -0,0 +1,603 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// residserver - local render daemon.
+//
+// Listens on a Unix socket or on a localhost TCP port. Each connection
+// carries one request, a single line:
+//
+//   RENDER <path> [key=value ...]
+//
+// where path is a PSID/RSID file or a trace (.trc) on the local file
+// system, or "-" for a PSID/RSID file following the request line, of the
+// size given by data=<bytes>. Other keys are song, seconds (play time,
+// default 180; traces play to the end), rate, method (fast, interpolate,
+// resample, fastmem) and model (6581, 8580).
+//
+// The reply is a line "OK <sample rate> <channels>" or "ERR <message>".
+// After OK, 16 bit native endian PCM follows in chunks, each preceded by
+// its size in bytes as a little endian u32. A chunk of size 0 ends the
+// stream.
+//
+// The server is tuned for time to first chunk rather than throughput: the
+// model tables are initialized at start-up, configured SIDs are reused for
+// requests with the same sampling parameters, and the first chunks are
+// small and sent as soon as they are rendered, growing to full size as the
+// stream proceeds.
+//
+// Connections are served by a fixed pool of worker threads, taking them
+// from a queue of accepted connections. A connection arriving while the
+// queue is full is answered with "ERR busy" and closed.
+// ----------------------------------------------------------------------------
+
+#include "psid.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+using namespace reSID;
+
+enum {
+  // First and maximum chunk size, in samples.
+  FIRST_CHUNK = 256,
+  MAX_CHUNK = 8192,
+  MAX_REQUEST = 4096,
+  // A tune can at most fill the 64KB address space.
+  MAX_DATA = 0x10000 + 0x100,
+  // Idle SIDs and players kept configured.
+  MAX_IDLE = 4,
+  // Accepted connections waiting for a worker.
+  MAX_QUEUE = 64
+};
+
+static void usage()
+{
+  fprintf(stderr,
+	  "Usage: residserver [options] -u socket | -p port\n"
+	  "  -u socket    listen on Unix socket\n"
+	  "  -p port      listen on localhost TCP port\n"
+	  "  -j threads   number of worker threads (default: all cores)\n");
+}
+
+// ----------------------------------------------------------------------------
+// Socket I/O.
+// ----------------------------------------------------------------------------
+static bool send_all(int fd, const void* data, size_t size)
+{
+  const char* p = (const char*)data;
+  while (size) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool send_line(int fd, const char* line)
+{
+  return send_all(fd, line, strlen(line));
+}
+
+static bool send_chunk(int fd, const short* samples, int n)
+{
+  unsigned int size = n*sizeof(short);
+  unsigned char header[4] = {
+    (unsigned char)size, (unsigned char)(size >> 8),
+    (unsigned char)(size >> 16), (unsigned char)(size >> 24)
+  };
+  return send_all(fd, header, sizeof(header)) &&
+    (!n || send_all(fd, samples, size));
+}
+
+// Read request line. Bytes following the line are left in rest.
+static bool read_request(int fd, std::string& line, std::string& rest)
+{
+  char buf[512];
+  while (line.size() < MAX_REQUEST) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      return false;
+    }
+    line.append(buf, n);
+    size_t eol = line.find('\n');
+    if (eol != std::string::npos) {
+      rest = line.substr(eol + 1);
+      line.resize(eol);
+      if (!line.empty() && line[line.size() - 1] == '\r') {
+	line.resize(line.size() - 1);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool read_data(int fd, std::string& data, size_t size)
+{
+  char buf[4096];
+  while (data.size() < size) {
+    size_t want = size - data.size();
+    ssize_t n = recv(fd, buf, want < sizeof(buf) ? want : sizeof(buf), 0);
+    if (n <= 0) {
+      return false;
+    }
+    data.append(buf, n);
+  }
+  data.resize(size);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Request.
+// ----------------------------------------------------------------------------
+struct Request
+{
+  std::string path;
+  int song;
+  double seconds;
+  size_t data_size;
+  bool use_header;
+  RenderSettings settings;
+};
+
+static const char* parse_request(const std::string& line, Request& request)
+{
+  request.song = 0;
+  request.seconds = -1;
+  request.data_size = 0;
+  request.use_header = true;
+
+  std::vector<std::string> words;
+  size_t pos = 0;
+  while (pos < line.size()) {
+    size_t end = line.find(' ', pos);
+    if (end == std::string::npos) {
+      end = line.size();
+    }
+    if (end > pos) {
+      words.push_back(line.substr(pos, end - pos));
+    }
+    pos = end + 1;
+  }
+
+  if (words.size() < 2 || words[0] != "RENDER") {
+    return "bad request";
+  }
+  request.path = words[1];
+
+  for (size_t i = 2; i < words.size(); i++) {
+    size_t eq = words[i].find('=');
+    if (eq == std::string::npos) {
+      return "bad parameter";
+    }
+    std::string key = words[i].substr(0, eq);
+    const char* value = words[i].c_str() + eq + 1;
+
+    if (key == "song") {
+      request.song = atoi(value);
+    }
+    else if (key == "seconds") {
+      request.seconds = atof(value);
+    }
+    else if (key == "rate") {
+      request.settings.sample_freq = atof(value);
+    }
+    else if (key == "data") {
+      request.data_size = strtoul(value, 0, 10);
+      if (request.data_size > MAX_DATA) {
+	return "data too large";
+      }
+    }
+    else if (key == "method") {
+      if (strcmp(value, "fast") == 0) {
+	request.settings.method = SAMPLE_FAST;
+      }
+      else if (strcmp(value, "interpolate") == 0) {
+	request.settings.method = SAMPLE_INTERPOLATE;
+      }
+      else if (strcmp(value, "resample") == 0) {
+	request.settings.method = SAMPLE_RESAMPLE;
+      }
+      else if (strcmp(value, "fastmem") == 0) {
+	request.settings.method = SAMPLE_RESAMPLE_FASTMEM;
+      }
+      else {
+	return "bad method";
+      }
+    }
+    else if (key == "model") {
+      request.settings.model =
+	strcmp(value, "8580") == 0 ? MOS8580 : MOS6581;
+      request.use_header = false;
+    }
+    else {
+      return "unknown parameter";
+    }
+  }
+
+  if (request.path == "-" && !request.data_size) {
+    return "missing data";
+  }
+
+  return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Idle SIDs for traces, and players for tunes, kept configured so that
+// requests with the sampling parameters of an earlier request do not wait
+// for the resampling filter to be calculated, which takes some 200 ms for
+// fastmem.
+// ----------------------------------------------------------------------------
+struct IdleSID
+{
+  RenderSettings settings;
+  SID* sid;
+};
+
+static std::mutex pool_lock;
+static std::vector<IdleSID> idle_sids;
+static std::vector<PSIDPlayer*> idle_players;
+
+// Returns a SID in the initial state for settings, or 0 for invalid
+// settings.
+static SID* acquire_sid(const RenderSettings& settings)
+{
+  SID* sid = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(pool_lock);
+    for (size_t i = idle_sids.size(); i-- > 0; ) {
+      if (idle_sids[i].settings.same_sampling(settings)) {
+	sid = idle_sids[i].sid;
+	idle_sids.erase(idle_sids.begin() + i);
+	break;
+      }
+    }
+  }
+
+  if (sid) {
+    settings.restart(*sid);
+  }
+  else {
+    sid = new SID();
+    if (!settings.configure(*sid)) {
+      delete sid;
+      sid = 0;
+    }
+  }
+  return sid;
+}
+
+static void release_sid(const RenderSettings& settings, SID* sid)
+{
+  std::lock_guard<std::mutex> lock(pool_lock);
+  if (idle_sids.size() == MAX_IDLE) {
+    delete idle_sids[0].sid;
+    idle_sids.erase(idle_sids.begin());
+  }
+  IdleSID idle;
+  idle.settings = settings;
+  idle.sid = sid;
+  idle_sids.push_back(idle);
+}
+
+// Prefers a player last started with the same sampling parameters; see
+// PSIDPlayer::start().
+static PSIDPlayer* acquire_player(const RenderSettings& settings)
+{
+  std::lock_guard<std::mutex> lock(pool_lock);
+  if (idle_players.empty()) {
+    return new PSIDPlayer();
+  }
+
+  size_t i = idle_players.size() - 1;
+  for (size_t j = 0; j < idle_players.size(); j++) {
+    if (idle_players[j]->settings().same_sampling(settings)) {
+      i = j;
+    }
+  }
+  PSIDPlayer* player = idle_players[i];
+  idle_players.erase(idle_players.begin() + i);
+  return player;
+}
+
+static void release_player(PSIDPlayer* player)
+{
+  std::lock_guard<std::mutex> lock(pool_lock);
+  if (idle_players.size() == MAX_IDLE) {
+    delete idle_players[0];
+    idle_players.erase(idle_players.begin());
+  }
+  idle_players.push_back(player);
+}
+
+
+// ----------------------------------------------------------------------------
+// Serve one connection.
+// ----------------------------------------------------------------------------
+static void serve(int fd)
+{
+  std::string line, data;
+  Request request;
+  const char* error = 0;
+
+  if (!read_request(fd, line, data)) {
+    close(fd);
+    return;
+  }
+  error = parse_request(line, request);
+
+  PSIDPlayer* player = 0;
+  SID* sid = 0;
+  Trace trace;
+  TracePlayer* trace_player = 0;
+
+  bool is_trace = request.path.size() > 4 &&
+    request.path.compare(request.path.size() - 4, 4, ".trc") == 0;
+
+  if (!error && request.data_size &&
+      !read_data(fd, data, request.data_size))
+  {
+    error = "short data";
+  }
+
+  if (error) {
+    // Nothing to set up.
+  }
+  else if (is_trace) {
+    if (!trace.load(request.path.c_str())) {
+      error = "cannot load trace";
+    }
+    else if (!(sid = acquire_sid(request.settings))) {
+      error = "invalid sampling parameters";
+    }
+    else {
+      trace_player = new TracePlayer(*sid, trace);
+    }
+  }
+  else {
+    player = acquire_player(request.settings);
+    bool loaded = request.path == "-" ?
+      player->load((const unsigned char*)data.data(), data.size()) :
+      player->load(request.path.c_str());
+    if (!loaded) {
+      error = "not a playable PSID/RSID file";
+    }
+    else if (!player->start(request.song, request.settings,
+			    request.use_header))
+    {
+      error = "invalid sampling parameters";
+    }
+  }
+
+  if (error) {
+    char reply[128];
+    snprintf(reply, sizeof(reply), "ERR %s\n", error);
+    send_line(fd, reply);
+  }
+  else {
+    char reply[64];
+    snprintf(reply, sizeof(reply), "OK %d 1\n",
+	     (int)request.settings.sample_freq);
+
+    double seconds = request.seconds;
+    if (seconds < 0) {
+      seconds = is_trace ? 1e12 : 180;
+    }
+    unsigned long long remaining =
+      (unsigned long long)(seconds*request.settings.sample_freq);
+
+    short buf[MAX_CHUNK];
+    int chunk = FIRST_CHUNK;
+    bool ok = send_line(fd, reply);
+
+    while (ok && remaining) {
+      int n = remaining < (unsigned long long)chunk ? (int)remaining : chunk;
+      int s = player ? player->clock(buf, n) : trace_player->clock(buf, n);
+      if (!s) {
+	break;
+      }
+      ok = send_chunk(fd, buf, s);
+      remaining -= s;
+      if (s < n) {
+	// End of trace.
+	break;
+      }
+      // Double the chunk size up to the maximum.
+      if (chunk < MAX_CHUNK) {
+	chunk <<= 1;
+      }
+    }
+
+    if (ok) {
+      send_chunk(fd, 0, 0);
+    }
+  }
+
+  delete trace_player;
+  if (sid) {
+    release_sid(request.settings, sid);
+  }
+  if (player) {
+    release_player(player);
+  }
+  close(fd);
+}
+
+
+// ----------------------------------------------------------------------------
+// Worker pool. Accepted connections are queued for the workers, up to
+// MAX_QUEUE connections.
+// ----------------------------------------------------------------------------
+static std::mutex queue_lock;
+static std::condition_variable queue_ready;
+static std::deque<int> queue;
+
+static bool enqueue(int client)
+{
+  {
+    std::lock_guard<std::mutex> lock(queue_lock);
+    if (queue.size() == MAX_QUEUE) {
+      return false;
+    }
+    queue.push_back(client);
+  }
+  queue_ready.notify_one();
+  return true;
+}
+
+static void worker()
+{
+  for (;;) {
+    int client;
+    {
+      std::unique_lock<std::mutex> lock(queue_lock);
+      while (queue.empty()) {
+	queue_ready.wait(lock);
+      }
+      client = queue.front();
+      queue.pop_front();
+    }
+    serve(client);
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  const char* socket_path = 0;
+  int port = 0;
+  int threads = std::thread::hardware_concurrency();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "u:p:j:")) != -1) {
+    switch (opt) {
+    case 'u':
+      socket_path = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (!socket_path == !port) {
+    usage();
+    return 1;
+  }
+
+  int fd;
+  if (socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "residserver: %s: path too long\n", socket_path);
+      return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      perror("residserver: bind");
+      return 1;
+    }
+  }
+  else {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    if (fd < 0 ||
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+	bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+      perror("residserver: bind");
+      return 1;
+    }
+  }
+
+  if (listen(fd, 64) < 0) {
+    perror("residserver: listen");
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  // Initialize the static model tables before accepting connections, to
+  // keep this out of the first request, and keep a SID configured for the
+  // default settings.
+  release_sid(RenderSettings(), acquire_sid(RenderSettings()));
+
+  if (threads < 1) {
+    threads = 1;
+  }
+  for (int i = 0; i < threads; i++) {
+    std::thread(worker).detach();
+  }
+
+  for (;;) {
+    int client = accept(fd, 0, 0);
+    if (client < 0) {
+      continue;
+    }
+    if (port) {
+      // Send small chunks immediately.
+      int on = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (!enqueue(client)) {
+      send_line(client, "ERR busy\n");
+      close(client);
+    }
+  }
+
+  return 0;
+}
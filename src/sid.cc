@@ -20,7 +20,9 @@
 #define RESID_SID_CC
 
 #include "sid.h"
+#include "numa.h"
 #include <math.h>
+#include <string.h>
 
 #ifndef round
 #define round(x) (x>=0.0?floor(x+0.5):ceil(x-0.5))
@@ -118,6 +120,31 @@ void SID::input(short sample)
 }
 
 
+// ----------------------------------------------------------------------------
+// Silence detection.
+// ----------------------------------------------------------------------------
+bool SID::voices_silent()
+{
+  if (write_pipeline) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    EnvelopeGenerator& envelope = voice[i].envelope;
+    if (envelope.envelope_counter || !envelope.hold_zero || envelope.gate ||
+	envelope.envelope_pipeline)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+short SID::filter_output()
+{
+  return filter.output();
+}
+
+
 // ----------------------------------------------------------------------------
 // Read registers.
 //
@@ -305,6 +332,29 @@ SID::State::State()
     envelope_state[i] = EnvelopeGenerator::RELEASE;
     hold_zero[i] = true;
     envelope_pipeline[i] = 0;
+
+    msb_rising[i] = false;
+    tri_saw_pipeline[i] = 0x555;
+    osc3[i] = 0;
+    waveform_output[i] = 0;
+    noise_output[i] = 0;
+  }
+
+  filter_Vhp = 0;
+  filter_Vbp = filter_Vbp_x = filter_Vbp_vc = 0;
+  filter_Vlp = filter_Vlp_x = filter_Vlp_vc = 0;
+  filter_ve = filter_v3 = filter_v2 = filter_v1 = 0;
+
+  extfilt_vlp = 0;
+  extfilt_vhp = 0;
+
+  sample_offset = 0;
+  sample_index = 0;
+  sample_prev = 0;
+  sample_now = 0;
+
+  for (i = 0; i < RINGSIZE; i++) {
+    sample[i] = 0;
   }
 }
 
@@ -340,9 +390,11 @@ SID::State SID::read_state()
   state.sid_register[j++] = filter.mode | filter.vol;
 
   // These registers are superfluous, but are included for completeness.
-  for (; j < 0x1d; j++) {
-    state.sid_register[j] = read(j);
-  }
+  // They are read without side effects on the data bus.
+  state.sid_register[j++] = potx.readPOT();
+  state.sid_register[j++] = poty.readPOT();
+  state.sid_register[j++] = voice[2].wave.readOSC();
+  state.sid_register[j++] = voice[2].envelope.readENV();
   for (; j < 0x20; j++) {
     state.sid_register[j] = 0;
   }
@@ -369,6 +421,38 @@ SID::State SID::read_state()
     state.envelope_state[i] = voice[i].envelope.state;
     state.hold_zero[i] = voice[i].envelope.hold_zero;
     state.envelope_pipeline[i] = voice[i].envelope.envelope_pipeline;
+
+    state.msb_rising[i] = voice[i].wave.msb_rising;
+    state.tri_saw_pipeline[i] = voice[i].wave.tri_saw_pipeline;
+    state.osc3[i] = voice[i].wave.osc3;
+    state.waveform_output[i] = voice[i].wave.waveform_output;
+    state.noise_output[i] = voice[i].wave.noise_output;
+  }
+
+  state.filter_Vhp = filter.Vhp;
+  state.filter_Vbp = filter.Vbp;
+  state.filter_Vbp_x = filter.Vbp_x;
+  state.filter_Vbp_vc = filter.Vbp_vc;
+  state.filter_Vlp = filter.Vlp;
+  state.filter_Vlp_x = filter.Vlp_x;
+  state.filter_Vlp_vc = filter.Vlp_vc;
+  state.filter_ve = filter.ve;
+  state.filter_v3 = filter.v3;
+  state.filter_v2 = filter.v2;
+  state.filter_v1 = filter.v1;
+
+  state.extfilt_vlp = extfilt.vlp;
+  state.extfilt_vhp = extfilt.vhp;
+
+  state.sample_offset = sample_offset;
+  state.sample_index = sample_index;
+  state.sample_prev = sample_prev;
+  state.sample_now = sample_now;
+
+  if (sample) {
+    for (i = 0; i < RINGSIZE; i++) {
+      state.sample[i] = sample[i];
+    }
   }
 
   return state;
@@ -382,8 +466,11 @@ void SID::write_state(const State& state)
 {
   int i;
 
+  // Write registers directly, bypassing the MOS8580 write pipeline.
   for (i = 0; i <= 0x18; i++) {
-    write(i, state.sid_register[i]);
+    write_address = i;
+    bus_value = state.sid_register[i] & 0xff;
+    write();
   }
 
   bus_value = state.bus_value;
@@ -408,6 +495,40 @@ void SID::write_state(const State& state)
     voice[i].envelope.state = state.envelope_state[i];
     voice[i].envelope.hold_zero = state.hold_zero[i];
     voice[i].envelope.envelope_pipeline = state.envelope_pipeline[i];
+
+    voice[i].wave.msb_rising = state.msb_rising[i];
+    voice[i].wave.tri_saw_pipeline = state.tri_saw_pipeline[i];
+    voice[i].wave.osc3 = state.osc3[i];
+    voice[i].wave.waveform_output = state.waveform_output[i];
+    voice[i].wave.noise_output = state.noise_output[i];
+    voice[i].wave.no_noise_or_noise_output =
+      voice[i].wave.no_noise | voice[i].wave.noise_output;
+  }
+
+  filter.Vhp = state.filter_Vhp;
+  filter.Vbp = state.filter_Vbp;
+  filter.Vbp_x = state.filter_Vbp_x;
+  filter.Vbp_vc = state.filter_Vbp_vc;
+  filter.Vlp = state.filter_Vlp;
+  filter.Vlp_x = state.filter_Vlp_x;
+  filter.Vlp_vc = state.filter_Vlp_vc;
+  filter.ve = state.filter_ve;
+  filter.v3 = state.filter_v3;
+  filter.v2 = state.filter_v2;
+  filter.v1 = state.filter_v1;
+
+  extfilt.vlp = state.extfilt_vlp;
+  extfilt.vhp = state.extfilt_vhp;
+
+  sample_offset = state.sample_offset;
+  sample_index = state.sample_index;
+  sample_prev = state.sample_prev;
+  sample_now = state.sample_now;
+
+  if (sample) {
+    for (i = 0; i < RINGSIZE; i++) {
+      sample[i] = sample[i + RINGSIZE] = state.sample[i];
+    }
   }
 }
 
@@ -443,6 +564,16 @@ void SID::adjust_filter_bias(double dac_bias) {
 }
 
 
+// ----------------------------------------------------------------------------
+// Use filter tables built for other model parameters, or the built-in
+// tables for 0. See FilterModel.
+// ----------------------------------------------------------------------------
+void SID::set_filter_model(const FilterModel* model)
+{
+  filter.set_model(model);
+}
+
+
 // ----------------------------------------------------------------------------
 // Enable external filter.
 // ----------------------------------------------------------------------------
@@ -645,6 +776,101 @@ void SID::adjust_sampling_frequency(double sample_freq)
 }
 
 
+// ----------------------------------------------------------------------------
+// Move the resampling buffers to the memory node of the calling thread.
+//
+// Under the default first-touch policy of the operating system, pages are
+// placed on the node of the thread which first writes them, i.e. the thread
+// which called set_sampling_parameters(). A render thread may call this
+// function before clocking a SID configured by another thread, to make the
+// FIR tables and the sample ring local to it; they are copied into new
+// allocations. Since an allocation may reuse pages already touched by
+// another thread, the new pages are bound to the node of the calling thread
+// before copying, see numa_bind_local().
+// ----------------------------------------------------------------------------
+void SID::localize_buffers()
+{
+  if (fir) {
+    short* fir_local = new short[fir_N*fir_RES];
+    numa_bind_local(fir_local, sizeof(short)*fir_N*fir_RES);
+    memcpy(fir_local, fir, sizeof(short)*fir_N*fir_RES);
+    delete[] fir;
+    fir = fir_local;
+  }
+
+  if (sample) {
+    short* sample_local = new short[RINGSIZE*2];
+    numa_bind_local(sample_local, sizeof(short)*RINGSIZE*2);
+    memcpy(sample_local, sample, sizeof(short)*RINGSIZE*2);
+    delete[] sample;
+    sample = sample_local;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Map a point in time to output samples.
+//
+// The point in time is given as delta_t cycles from now, i.e. the first
+// cycle which is affected by a register write at that time. The position
+// is returned as the index of the output sample relative to the next sample
+// produced by clock(), plus a fraction of a sample. The position may be
+// negative, for points in time which are already part of samples returned
+// by clock().
+//
+// The sampling methods make samples available with different delays:
+//
+// * SAMPLE_FAST returns the output of the last cycle before the sampling
+//   point, rounded to the nearest cycle.
+// * SAMPLE_INTERPOLATE interpolates between the outputs of the two last
+//   cycles, i.e. a sample is delayed by two cycles.
+// * SAMPLE_RESAMPLE and SAMPLE_RESAMPLE_FASTMEM center the FIR filter on
+//   the sampling point, adding the group delay fir_N/2 of the linear phase
+//   filter. SAMPLE_RESAMPLE additionally interpolates between FIR tables
+//   using the next sample, yielding one more cycle of delay.
+//
+// The mapping is exact, using the same 16.16 fixed point arithmetic as
+// the clocking functions. It remains valid until the sampling parameters
+// are changed.
+// ----------------------------------------------------------------------------
+void SID::sample_position(long long delta_t, long long& index,
+			  double& fraction)
+{
+  // Delay in 16.16 fixed point.
+  long long delay;
+  switch (sampling) {
+  default:
+  case SAMPLE_FAST:
+    // sample_offset is biased by half a cycle for rounding.
+    delay = (1 << FIXP_SHIFT) - (1 << (FIXP_SHIFT - 1));
+    break;
+  case SAMPLE_INTERPOLATE:
+    delay = 2 << FIXP_SHIFT;
+    break;
+  case SAMPLE_RESAMPLE:
+    delay = (fir_N/2 + 2) << FIXP_SHIFT;
+    break;
+  case SAMPLE_RESAMPLE_FASTMEM:
+    delay = (fir_N/2 + 1) << FIXP_SHIFT;
+    break;
+  }
+
+  // The next sample is taken at sample_offset + cycles_per_sample, in 16.16
+  // fixed point relative to the current cycle.
+  long long offset = (delta_t << FIXP_SHIFT) + delay -
+    sample_offset - cycles_per_sample;
+
+  // Round towards minus infinity.
+  index = offset/cycles_per_sample;
+  long long rmd = offset - index*cycles_per_sample;
+  if (rmd < 0) {
+    index--;
+    rmd += cycles_per_sample;
+  }
+  fraction = double(rmd)/cycles_per_sample;
+}
+
+
 // ----------------------------------------------------------------------------
 // SID clocking - delta_t cycles.
 // ----------------------------------------------------------------------------
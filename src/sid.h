@@ -41,22 +41,53 @@ public:
   void set_voice_mask(reg4 mask);
   void enable_filter(bool enable);
   void adjust_filter_bias(double dac_bias);
+  void set_filter_model(const FilterModel* model);
   void enable_external_filter(bool enable);
   bool set_sampling_parameters(double clock_freq, sampling_method method,
 			       double sample_freq, double pass_freq = -1,
 			       double filter_scale = 0.97);
   void adjust_sampling_frequency(double sample_freq);
+  void localize_buffers();
 
   void clock();
   void clock(cycle_count delta_t);
   int clock(cycle_count& delta_t, short* buf, int n, int interleave = 1);
   void reset();
 
+  // Map a point in time to output samples.
+  void sample_position(long long delta_t, long long& index,
+		       double& fraction);
+
   // Read/write registers.
   reg8 read(reg8 offset);
   void write(reg8 offset, reg8 value);
 
+protected:
+  enum {
+    // Resampling constants.
+    // The error in interpolated lookup is bounded by 1.234/L^2,
+    // while the error in non-interpolated lookup is bounded by
+    // 0.7854/L + 0.4113/L^2, see
+    // http://www-ccrma.stanford.edu/~jos/resample/Choice_Table_Size.html
+    // For a resolution of 16 bits this yields L >= 285 and L >= 51473,
+    // respectively.
+    FIR_N = 125,
+    FIR_RES = 285,
+    FIR_RES_FASTMEM = 51473,
+    FIR_SHIFT = 15,
+
+    RINGSIZE = 1 << 14,
+    RINGMASK = RINGSIZE - 1,
+
+    // Fixed point constants (16.16 bits).
+    FIXP_SHIFT = 16,
+    FIXP_MASK = 0xffff
+  };
+
+public:
   // Read/write state.
+  // The state is complete, i.e. writing a state read from another SID with
+  // the same configuration makes the two SIDs produce identical output.
   class State
   {
   public:
@@ -85,6 +116,29 @@ public:
     EnvelopeGenerator::State envelope_state[3];
     bool hold_zero[3];
     cycle_count envelope_pipeline[3];
+
+    bool msb_rising[3];
+    reg12 tri_saw_pipeline[3];
+    reg12 osc3[3];
+    reg12 waveform_output[3];
+    reg12 noise_output[3];
+
+    // Filter integrators and inputs.
+    int filter_Vhp;
+    int filter_Vbp, filter_Vbp_x, filter_Vbp_vc;
+    int filter_Vlp, filter_Vlp_x, filter_Vlp_vc;
+    int filter_ve, filter_v3, filter_v2, filter_v1;
+
+    // External filter.
+    int extfilt_vlp, extfilt_vhp;
+
+    // Sampling state.
+    cycle_count sample_offset;
+    int sample_index;
+    short sample_prev, sample_now;
+    // Resampling ring buffer, only used for SAMPLE_RESAMPLE and
+    // SAMPLE_RESAMPLE_FASTMEM.
+    short sample[RINGSIZE];
   };
 
   State read_state();
@@ -96,6 +150,14 @@ public:
   // 16-bit output (AUDIO OUT).
   short output();
 
+  // Silence detection.
+  // True if the voices are silent, and stay silent until the next register
+  // write: no register write or envelope step is pending, and all
+  // envelopes are held at zero with the gate off.
+  bool voices_silent();
+  // 16-bit output of the filter stage, before the external filter.
+  short filter_output();
+
  protected:
   static double I0(double x);
   int clock_fast(cycle_count& delta_t, short* buf, int n, int interleave);
@@ -125,27 +187,6 @@ public:
 
   double clock_frequency;
 
-  enum {
-    // Resampling constants.
-    // The error in interpolated lookup is bounded by 1.234/L^2,
-    // while the error in non-interpolated lookup is bounded by
-    // 0.7854/L + 0.4113/L^2, see
-    // http://www-ccrma.stanford.edu/~jos/resample/Choice_Table_Size.html
-    // For a resolution of 16 bits this yields L >= 285 and L >= 51473,
-    // respectively.
-    FIR_N = 125,
-    FIR_RES = 285,
-    FIR_RES_FASTMEM = 51473,
-    FIR_SHIFT = 15,
-
-    RINGSIZE = 1 << 14,
-    RINGMASK = RINGSIZE - 1,
-
-    // Fixed point constants (16.16 bits).
-    FIXP_SHIFT = 16,
-    FIXP_MASK = 0xffff
-  };
-
   // Sampling variables.
   sampling_method sampling;
   cycle_count cycles_per_sample;
@@ -160,6 +201,15 @@ public:
 
   // FIR_RES filter tables (FIR_N*FIR_RES).
   short* fir;
+
+friend class SIDFanout;
+friend class MultiSID;
+friend class SIDBatch;
+friend class SegmentRenderer;
+friend class PipelinedRenderer;
+friend class SIDMatrix;
+friend int numa_buffer_node(const SID& sid);
+friend int numa_filter_node(const SID& sid);
 };
 
 
@@ -0,0 +1,1346 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "sidbatch.h"
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace reSID
+{
+
+// Summer and mixer offsets by input mask, see Filter::clock() and
+// Filter::output().
+static int summer_offsets[1 << 4];
+static int mixer_offsets[1 << 7];
+
+// New exponential counter period by envelope counter value, or 0 for no
+// change; see EnvelopeGenerator::set_exponential_counter().
+static int exponential_periods[1 << 8];
+
+
+// ----------------------------------------------------------------------------
+// Vector operations on VLANES lanes. With AVX-512 a block is one vector, with
+// AVX2 two vectors, otherwise the lanes are clocked one at a time. Masks are
+// vectors of 0 or -1.
+//
+// The 16 bit tables are gathered with 32 bit loads. Each value is loaded as
+// the upper half of the 32 bits starting two bytes before it, so that no
+// lookup reads past the end of a table. All such tables are preceded by
+// other data; see Filter::model_filter_t and SIDBatch::wave_table.
+// ----------------------------------------------------------------------------
+#if defined(__AVX512F__)
+
+// The operations are masked with all lanes enabled; the unmasked forms
+// trigger spurious uninitialized value warnings with some versions of g++.
+typedef __m512i vint;
+enum { VLANES = 16 };
+static const __mmask16 all = (__mmask16)~0;
+
+static inline vint vload(const int* p) { return _mm512_loadu_si512(p); }
+static inline void vstore(int* p, vint a) { _mm512_storeu_si512(p, a); }
+static inline vint vset(int a) { return _mm512_set1_epi32(a); }
+static inline vint vadd(vint a, vint b) { return _mm512_add_epi32(a, b); }
+static inline vint vsub(vint a, vint b) { return _mm512_sub_epi32(a, b); }
+static inline vint vmul(vint a, vint b) { return _mm512_mullo_epi32(a, b); }
+static inline vint vand(vint a, vint b) { return _mm512_and_si512(a, b); }
+static inline vint vor(vint a, vint b) { return _mm512_or_si512(a, b); }
+static inline vint vxor(vint a, vint b) { return _mm512_xor_si512(a, b); }
+// ~a & b
+static inline vint vandnot(vint a, vint b)
+{
+  return _mm512_maskz_andnot_epi32(all, a, b);
+}
+static inline vint vmax0(vint a)
+{
+  return _mm512_maskz_max_epi32(all, a, _mm512_setzero_si512());
+}
+static inline vint veq(vint a, vint b)
+{
+  return _mm512_maskz_set1_epi32(_mm512_cmpeq_epi32_mask(a, b), -1);
+}
+static inline vint vgt(vint a, vint b)
+{
+  return _mm512_maskz_set1_epi32(_mm512_cmpgt_epi32_mask(a, b), -1);
+}
+// m ? a : b
+static inline vint vsel(vint m, vint a, vint b)
+{
+  return _mm512_ternarylogic_epi32(m, a, b, 0xca);
+}
+static inline bool vany(vint m) { return _mm512_test_epi32_mask(m, m); }
+template<int n> static inline vint vsll(vint a)
+{
+  return _mm512_maskz_slli_epi32(all, a, n);
+}
+template<int n> static inline vint vsra(vint a)
+{
+  return _mm512_maskz_srai_epi32(all, a, n);
+}
+template<int n> static inline vint vsrl(vint a)
+{
+  return _mm512_maskz_srli_epi32(all, a, n);
+}
+static inline vint vlookup(const int* table, vint i)
+{
+  return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), all, i,
+				     table, 4);
+}
+static inline vint vlookup(const unsigned short* table, vint i)
+{
+  return vsrl<16>(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), all, i,
+					      (const char*)table - 2, 2));
+}
+
+#elif defined(__AVX2__)
+
+typedef __m256i vint;
+enum { VLANES = 8 };
+
+static inline vint vload(const int* p)
+{
+  return _mm256_loadu_si256((const __m256i*)p);
+}
+static inline void vstore(int* p, vint a)
+{
+  _mm256_storeu_si256((__m256i*)p, a);
+}
+static inline vint vset(int a) { return _mm256_set1_epi32(a); }
+static inline vint vadd(vint a, vint b) { return _mm256_add_epi32(a, b); }
+static inline vint vsub(vint a, vint b) { return _mm256_sub_epi32(a, b); }
+static inline vint vmul(vint a, vint b) { return _mm256_mullo_epi32(a, b); }
+static inline vint vand(vint a, vint b) { return _mm256_and_si256(a, b); }
+static inline vint vor(vint a, vint b) { return _mm256_or_si256(a, b); }
+static inline vint vxor(vint a, vint b) { return _mm256_xor_si256(a, b); }
+// ~a & b
+static inline vint vandnot(vint a, vint b)
+{
+  return _mm256_andnot_si256(a, b);
+}
+static inline vint vmax0(vint a)
+{
+  return _mm256_max_epi32(a, _mm256_setzero_si256());
+}
+static inline vint veq(vint a, vint b) { return _mm256_cmpeq_epi32(a, b); }
+static inline vint vgt(vint a, vint b) { return _mm256_cmpgt_epi32(a, b); }
+// m ? a : b
+static inline vint vsel(vint m, vint a, vint b)
+{
+  return _mm256_blendv_epi8(b, a, m);
+}
+static inline bool vany(vint m) { return !_mm256_testz_si256(m, m); }
+template<int n> static inline vint vsll(vint a)
+{
+  return _mm256_slli_epi32(a, n);
+}
+template<int n> static inline vint vsra(vint a)
+{
+  return _mm256_srai_epi32(a, n);
+}
+template<int n> static inline vint vsrl(vint a)
+{
+  return _mm256_srli_epi32(a, n);
+}
+static inline vint vlookup(const int* table, vint i)
+{
+  return _mm256_i32gather_epi32(table, i, 4);
+}
+static inline vint vlookup(const unsigned short* table, vint i)
+{
+  return vsrl<16>(
+    _mm256_i32gather_epi32((const int*)((const char*)table - 2), i, 2));
+}
+
+#else
+
+typedef int vint;
+enum { VLANES = 1 };
+
+static inline vint vload(const int* p) { return *p; }
+static inline void vstore(int* p, vint a) { *p = a; }
+static inline vint vset(int a) { return a; }
+static inline vint vadd(vint a, vint b) { return a + b; }
+static inline vint vsub(vint a, vint b) { return a - b; }
+static inline vint vmul(vint a, vint b)
+{
+  return (unsigned int)a*(unsigned int)b;
+}
+static inline vint vand(vint a, vint b) { return a & b; }
+static inline vint vor(vint a, vint b) { return a | b; }
+static inline vint vxor(vint a, vint b) { return a ^ b; }
+// ~a & b
+static inline vint vandnot(vint a, vint b) { return ~a & b; }
+static inline vint vmax0(vint a) { return a < 0 ? 0 : a; }
+static inline vint veq(vint a, vint b) { return -(a == b); }
+static inline vint vgt(vint a, vint b) { return -(a > b); }
+// m ? a : b
+static inline vint vsel(vint m, vint a, vint b) { return m ? a : b; }
+static inline bool vany(vint m) { return m; }
+template<int n> static inline vint vsll(vint a)
+{
+  return (unsigned int)a << n;
+}
+template<int n> static inline vint vsra(vint a) { return a >> n; }
+template<int n> static inline vint vsrl(vint a)
+{
+  return (unsigned int)a >> n;
+}
+static inline vint vlookup(const int* table, vint i) { return table[i]; }
+static inline vint vlookup(const unsigned short* table, vint i)
+{
+  return table[i];
+}
+
+#endif
+
+// a != 0
+static inline vint vnz(vint a)
+{
+  return vandnot(veq(a, vset(0)), vset(-1));
+}
+
+
+// ----------------------------------------------------------------------------
+// Noise waveform output from the shift register; see
+// WaveformGenerator::set_noise_output().
+// ----------------------------------------------------------------------------
+static inline vint noise_output(vint shift_register)
+{
+  return vor(vor(vor(vsrl<9>(vand(shift_register, vset(0x100000))),
+		     vsrl<8>(vand(shift_register, vset(0x040000)))),
+		 vor(vsrl<5>(vand(shift_register, vset(0x004000))),
+		     vsrl<3>(vand(shift_register, vset(0x000800))))),
+	     vor(vor(vsrl<2>(vand(shift_register, vset(0x000200))),
+		     vsll<1>(vand(shift_register, vset(0x000020)))),
+		 vor(vsll<3>(vand(shift_register, vset(0x000004))),
+		     vsll<4>(vand(shift_register, vset(0x000001))))));
+}
+
+// ----------------------------------------------------------------------------
+// Shift register bits written by combined waveforms, and the mask of those
+// bits; see WaveformGenerator::write_shift_register().
+// ----------------------------------------------------------------------------
+static const int shift_register_outputs =
+  (1<<20)|(1<<18)|(1<<14)|(1<<11)|(1<<9)|(1<<5)|(1<<2)|(1<<0);
+
+static inline vint shift_register_input(vint waveform_output)
+{
+  return vor(vor(vor(vsll<9>(vand(waveform_output, vset(0x800))),
+		     vsll<8>(vand(waveform_output, vset(0x400)))),
+		 vor(vsll<5>(vand(waveform_output, vset(0x200))),
+		     vsll<3>(vand(waveform_output, vset(0x100))))),
+	     vor(vor(vsll<2>(vand(waveform_output, vset(0x080))),
+		     vsrl<1>(vand(waveform_output, vset(0x040)))),
+		 vor(vsrl<3>(vand(waveform_output, vset(0x020))),
+		     vsrl<4>(vand(waveform_output, vset(0x010))))));
+}
+
+// ----------------------------------------------------------------------------
+// EnvelopeGenerator::set_exponential_counter() for the lanes in m.
+// ----------------------------------------------------------------------------
+static inline void set_exponential_counter(vint m, vint envelope_counter,
+					   vint& exponential_counter_period,
+					   vint& hold_zero)
+{
+  vint period = vlookup(exponential_periods,
+			vand(envelope_counter, vset(0xff)));
+  exponential_counter_period =
+    vsel(vand(m, vnz(period)), period, exponential_counter_period);
+  hold_zero = vor(hold_zero, vand(m, veq(envelope_counter, vset(0))));
+}
+
+
+// ----------------------------------------------------------------------------
+// Filter::solve_integrate_6581() for dt = 1.
+// ----------------------------------------------------------------------------
+struct Integrator6581
+{
+  vint kVddt;
+  vint n_snake;
+  const unsigned short* vcr_kVg;
+  const unsigned short* vcr_n_Ids_term;
+  const unsigned short* opamp_rev;
+};
+
+static inline vint solve_integrate_6581(vint vi, vint& x, vint& vc,
+					vint Vddt_Vw_2,
+					const Integrator6581& p)
+{
+  vint kVddt = p.kVddt;
+
+  // Triode/saturation mode current of the snake.
+  vint Vgst = vsub(kVddt, x);
+  vint Vgdt = vsub(kVddt, vi);
+  vint Vgdt_2 = vmul(Vgdt, Vgdt);
+  vint n_I_snake =
+    vmul(p.n_snake, vsra<15>(vsub(vmul(Vgst, Vgst), Vgdt_2)));
+
+  // VCR gate voltage, and VCR current.
+  vint kVg = vlookup(p.vcr_kVg, vsrl<16>(vadd(Vddt_Vw_2, vsrl<1>(Vgdt_2))));
+  vint Vgs = vmax0(vsub(kVg, x));
+  vint Vgd = vmax0(vsub(kVg, vi));
+  vint n_I_vcr = vsll<15>(vsub(vlookup(p.vcr_n_Ids_term, Vgs),
+			       vlookup(p.vcr_n_Ids_term, Vgd)));
+
+  // Change in capacitor charge, and the op-amp input voltage.
+  vc = vsub(vc, vadd(n_I_snake, n_I_vcr));
+  x = vlookup(p.opamp_rev, vadd(vsra<15>(vc), vset(1 << 15)));
+
+  // Return Vo.
+  return vadd(x, vsra<14>(vc));
+}
+
+
+// ----------------------------------------------------------------------------
+// Build the lookup tables.
+// ----------------------------------------------------------------------------
+bool SIDBatch::build_tables()
+{
+  static const int summer[] = {
+    summer_offset<0>::value, summer_offset<1>::value, summer_offset<2>::value,
+    summer_offset<3>::value, summer_offset<4>::value
+  };
+  static const int mixer[] = {
+    mixer_offset<0>::value, mixer_offset<1>::value, mixer_offset<2>::value,
+    mixer_offset<3>::value, mixer_offset<4>::value, mixer_offset<5>::value,
+    mixer_offset<6>::value, mixer_offset<7>::value
+  };
+
+  for (int i = 0; i < (1 << 7); i++) {
+    int n = 0;
+    for (int j = 0; j < 7; j++) {
+      n += (i >> j) & 1;
+    }
+    if (i < (1 << 4)) {
+      summer_offsets[i] = summer[n];
+    }
+    mixer_offsets[i] = mixer[n];
+  }
+
+  exponential_periods[0xff] = 1;
+  exponential_periods[0x5d] = 2;
+  exponential_periods[0x36] = 4;
+  exponential_periods[0x1a] = 8;
+  exponential_periods[0x0e] = 16;
+  exponential_periods[0x06] = 30;
+  exponential_periods[0x00] = 1;
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SIDBatch::SIDBatch()
+{
+  static bool class_init = build_tables();
+  (void)class_init;
+
+  n_chips = 0;
+  extfilt_enabled = true;
+  ring_size = 0;
+  ring_index = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+SIDBatch::~SIDBatch()
+{
+  for (size_t c = 0; c < chip.size(); c++) {
+    delete chip[c];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Set up chips.
+// ----------------------------------------------------------------------------
+bool SIDBatch::open(int chips, chip_model model, double clock_freq,
+		    sampling_method method, double sample_freq,
+		    double pass_freq, double filter_scale)
+{
+  if (chips < 1) {
+    return false;
+  }
+
+  for (size_t c = 0; c < chip.size(); c++) {
+    delete chip[c];
+  }
+  chip.clear();
+  n_chips = 0;
+
+  // The first chip holds the sampling parameters and FIR tables. The other
+  // chips are not sampled, however the handling of writes depends on the
+  // sampling method.
+  SID* first = new SID();
+  chip.push_back(first);
+  first->set_chip_model(model);
+  if (!first->set_sampling_parameters(clock_freq, method, sample_freq,
+				      pass_freq, filter_scale))
+  {
+    return false;
+  }
+
+  for (int c = 1; c < chips; c++) {
+    SID* sid = new SID();
+    sid->set_chip_model(model);
+    sid->sampling = method;
+    chip.push_back(sid);
+  }
+  n_chips = chips;
+
+  block.resize((chips + LANES - 1)/LANES);
+
+  // The ring buffer only needs to hold one convolution.
+  ring_size = 0;
+  if (method == SAMPLE_RESAMPLE || method == SAMPLE_RESAMPLE_FASTMEM) {
+    ring_size = 1;
+    while (ring_size < first->fir_N + 1) {
+      ring_size <<= 1;
+    }
+  }
+  ring.assign(ring_size*2*block.size()*LANES, 0);
+  ring_index = 0;
+  acc.assign(2*block.size()*LANES, 0);
+
+  // Waveform and DAC tables of the chip model.
+  wave_table.assign(1, 0);
+  for (int w = 0; w < 8; w++) {
+    const unsigned short* table = WaveformGenerator::model_wave[model][w];
+    wave_table.insert(wave_table.end(), table, table + (1 << 12));
+  }
+  wave_dac.resize(1 << 12);
+  for (int i = 0; i < (1 << 12); i++) {
+    wave_dac[i] = WaveformGenerator::model_dac[model][i];
+  }
+  envelope_dac.resize(1 << 8);
+  for (int i = 0; i < (1 << 8); i++) {
+    envelope_dac[i] = EnvelopeGenerator::model_dac[model][i];
+  }
+  wave_zero = first->voice[0].wave_zero;
+  pending.clear();
+
+  reset();
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Settings.
+// ----------------------------------------------------------------------------
+void SIDBatch::enable_filter(bool enable)
+{
+  for (int c = 0; c < n_chips; c++) {
+    chip[c]->enable_filter(enable);
+    load(c, c);
+  }
+}
+
+void SIDBatch::enable_external_filter(bool enable)
+{
+  extfilt_enabled = enable;
+}
+
+void SIDBatch::adjust_filter_bias(int c, double dac_bias)
+{
+  chip[c]->adjust_filter_bias(dac_bias);
+  load(c, c);
+}
+
+void SIDBatch::set_voice_mask(int c, reg4 mask)
+{
+  chip[c]->set_voice_mask(mask);
+  load(c, c);
+}
+
+
+// ----------------------------------------------------------------------------
+// Use filter tables built for other model parameters, for all chips. As
+// with SID::set_filter_model(), the filter state is cleared.
+// ----------------------------------------------------------------------------
+void SIDBatch::set_filter_model(const FilterModel* model)
+{
+  for (int c = 0; c < n_chips; c++) {
+    chip[c]->set_filter_model(model);
+  }
+  for (int lane = 0; lane < (int)block.size()*LANES; lane++) {
+    load(lane < n_chips ? lane : 0, lane);
+    clear(lane);
+  }
+}
+
+void SIDBatch::input(int c, short sample)
+{
+  chip[c]->filter.input(sample);
+  block[c/LANES].ve[c%LANES] = chip[c]->filter.ve;
+}
+
+
+// ----------------------------------------------------------------------------
+// Reset. Padding lanes are set up as a reset chip.
+// ----------------------------------------------------------------------------
+void SIDBatch::reset()
+{
+  for (int c = 0; c < n_chips; c++) {
+    chip[c]->reset();
+  }
+  for (int lane = 0; lane < (int)block.size()*LANES; lane++) {
+    store(lane < n_chips ? lane : 0, lane);
+    load(lane < n_chips ? lane : 0, lane);
+    clear(lane);
+  }
+  pending.clear();
+  std::fill(ring.begin(), ring.end(), 0);
+}
+
+
+// ----------------------------------------------------------------------------
+// Set the state of a chip. The voices and filter parameters are taken from
+// the SID as after a register write, and the filter and external filter
+// state are copied to the lane.
+// ----------------------------------------------------------------------------
+void SIDBatch::write_state(int c, const SID::State& state)
+{
+  SID& sid = *chip[c];
+  Block& b = block[c/LANES];
+  int i = c%LANES;
+
+  sid.write_state(state);
+  store(c, c);
+  load(c, c);
+
+  b.v1[i] = sid.filter.v1;
+  b.v2[i] = sid.filter.v2;
+  b.v3[i] = sid.filter.v3;
+  b.Vhp[i] = sid.filter.Vhp;
+  b.Vbp[i] = sid.filter.Vbp;
+  b.Vbp_x[i] = sid.filter.Vbp_x;
+  b.Vbp_vc[i] = sid.filter.Vbp_vc;
+  b.Vlp[i] = sid.filter.Vlp;
+  b.Vlp_x[i] = sid.filter.Vlp_x;
+  b.Vlp_vc[i] = sid.filter.Vlp_vc;
+  b.ext_vlp[i] = sid.extfilt.vlp;
+  b.ext_vhp[i] = sid.extfilt.vhp;
+
+  pending.erase(std::remove(pending.begin(), pending.end(), c),
+		pending.end());
+  if (sid.write_pipeline) {
+    pending.push_back(c);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Read and write registers. The register logic is that of the SID of the
+// chip, which is brought up to date from the lanes first.
+// ----------------------------------------------------------------------------
+reg8 SIDBatch::read(int c, reg8 offset)
+{
+  fetch(c);
+  return chip[c]->read(offset);
+}
+
+void SIDBatch::write(int c, reg8 offset, reg8 value)
+{
+  SID& sid = *chip[c];
+  bool pipelined = sid.write_pipeline;
+
+  fetch(c);
+  sid.write(offset, value);
+  if (sid.write_pipeline) {
+    // The write takes effect after the next cycle.
+    if (!pipelined) {
+      pending.push_back(c);
+    }
+  }
+  else {
+    store(c, c);
+    load(c, c);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Complete the writes in the MOS8580 write pipeline.
+// ----------------------------------------------------------------------------
+void SIDBatch::write_pending()
+{
+  for (size_t k = 0; k < pending.size(); k++) {
+    int c = pending[k];
+    fetch(c);
+    chip[c]->write();
+    store(c, c);
+    load(c, c);
+  }
+  pending.clear();
+}
+
+
+// ----------------------------------------------------------------------------
+// Store the state and the voice register parameters of the voices of a chip
+// in a lane.
+// ----------------------------------------------------------------------------
+void SIDBatch::store(int c, int lane)
+{
+  Block& b = block[lane/LANES];
+  int i = lane%LANES;
+
+  for (int v = 0; v < 3; v++) {
+    WaveformGenerator& wave = chip[c]->voice[v].wave;
+    EnvelopeGenerator& envelope = chip[c]->voice[v].envelope;
+
+    b.accumulator[v][i] = wave.accumulator;
+    b.msb_rising[v][i] = -wave.msb_rising;
+    b.shift_register[v][i] = wave.shift_register;
+    b.shift_register_reset[v][i] = wave.shift_register_reset;
+    b.shift_pipeline[v][i] = wave.shift_pipeline;
+    b.noise_output[v][i] = wave.noise_output;
+    b.no_noise_or_noise_output[v][i] = wave.no_noise_or_noise_output;
+    b.pulse_output[v][i] = wave.pulse_output;
+    b.tri_saw_pipeline[v][i] = wave.tri_saw_pipeline;
+    b.osc3[v][i] = wave.osc3;
+    b.waveform_output[v][i] = wave.waveform_output;
+    b.floating_output_ttl[v][i] = wave.floating_output_ttl;
+
+    b.rate_counter[v][i] = envelope.rate_counter;
+    b.rate_period[v][i] = envelope.rate_period;
+    b.exponential_counter[v][i] = envelope.exponential_counter;
+    b.exponential_counter_period[v][i] = envelope.exponential_counter_period;
+    b.envelope_counter[v][i] = envelope.envelope_counter;
+    b.envelope_pipeline[v][i] = -!!envelope.envelope_pipeline;
+    b.hold_zero[v][i] = -envelope.hold_zero;
+    b.state[v][i] = envelope.state;
+
+    b.freq[v][i] = wave.freq;
+    b.pw[v][i] = wave.pw;
+    b.waveform[v][i] = wave.waveform;
+    b.test[v][i] = -!!wave.test;
+    b.sync[v][i] = -!!wave.sync;
+    b.ring_msb_mask[v][i] = wave.ring_msb_mask;
+    b.no_noise[v][i] = wave.no_noise;
+    b.no_pulse[v][i] = wave.no_pulse;
+    b.decay_period[v][i] =
+      EnvelopeGenerator::rate_counter_period[envelope.decay];
+    b.sustain_level[v][i] = EnvelopeGenerator::sustain_level[envelope.sustain];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Copy the state of the voices of a chip from its lane back to its SID.
+// ----------------------------------------------------------------------------
+void SIDBatch::fetch(int c)
+{
+  Block& b = block[c/LANES];
+  int i = c%LANES;
+
+  for (int v = 0; v < 3; v++) {
+    WaveformGenerator& wave = chip[c]->voice[v].wave;
+    EnvelopeGenerator& envelope = chip[c]->voice[v].envelope;
+
+    wave.accumulator = b.accumulator[v][i];
+    wave.msb_rising = b.msb_rising[v][i] != 0;
+    wave.shift_register = b.shift_register[v][i];
+    wave.shift_register_reset = b.shift_register_reset[v][i];
+    wave.shift_pipeline = b.shift_pipeline[v][i];
+    wave.noise_output = b.noise_output[v][i];
+    wave.no_noise_or_noise_output = b.no_noise_or_noise_output[v][i];
+    wave.pulse_output = b.pulse_output[v][i];
+    wave.tri_saw_pipeline = b.tri_saw_pipeline[v][i];
+    wave.osc3 = b.osc3[v][i];
+    wave.waveform_output = b.waveform_output[v][i];
+    wave.floating_output_ttl = b.floating_output_ttl[v][i];
+
+    envelope.rate_counter = b.rate_counter[v][i];
+    envelope.rate_period = b.rate_period[v][i];
+    envelope.exponential_counter = b.exponential_counter[v][i];
+    envelope.exponential_counter_period =
+      b.exponential_counter_period[v][i];
+    envelope.envelope_counter = b.envelope_counter[v][i];
+    envelope.envelope_pipeline = b.envelope_pipeline[v][i] != 0;
+    envelope.hold_zero = b.hold_zero[v][i] != 0;
+    envelope.state = (EnvelopeGenerator::State)b.state[v][i];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Load the parameters derived from the filter registers of a chip into a
+// lane.
+// ----------------------------------------------------------------------------
+void SIDBatch::load(int c, int lane)
+{
+  Filter& filter = chip[c]->filter;
+  Block& b = block[lane/LANES];
+  int i = lane%LANES;
+
+  b.ve[i] = filter.ve;
+  b.sum[i] = filter.sum;
+  b.mix[i] = filter.mix;
+  b.sum_offset[i] = summer_offsets[filter.sum & 0xf];
+  b.mix_offset[i] = mixer_offsets[filter.mix & 0x7f];
+  b.vol[i] = filter.vol;
+  b.Vddt_Vw_2[i] = filter.Vddt_Vw_2;
+  b._8_div_Q[i] = filter._8_div_Q;
+  b.w0[i] = filter.w0;
+  b._1024_div_Q[i] = filter._1024_div_Q;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clear the state of a lane.
+// ----------------------------------------------------------------------------
+void SIDBatch::clear(int lane)
+{
+  Block& b = block[lane/LANES];
+  int i = lane%LANES;
+
+  b.v1[i] = b.v2[i] = b.v3[i] = 0;
+  b.Vhp[i] = 0;
+  b.Vbp[i] = b.Vbp_x[i] = b.Vbp_vc[i] = 0;
+  b.Vlp[i] = b.Vlp_x[i] = b.Vlp_vc[i] = 0;
+  b.ext_vlp[i] = b.ext_vhp[i] = 0;
+  b.out[i] = b.sample_prev[i] = b.sample_now[i] = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the envelope generators and the waveform generators of a block one
+// cycle, and calculate the voice outputs, [voice][lane]; this is SID::clock()
+// up to the filter. See EnvelopeGenerator::clock(), WaveformGenerator::clock(),
+// WaveformGenerator::synchronize(), WaveformGenerator::set_waveform_output()
+// and Voice::output(). Work which is done by few lanes is skipped when no
+// lane needs it.
+// ----------------------------------------------------------------------------
+void SIDBatch::clock_voices(Block& b, int* voice)
+{
+  const bool mos6581 = chip[0]->sid_model == MOS6581;
+  const unsigned short* wave = &wave_table[1];
+  const vint zero = vset(0);
+  const vint one = vset(1);
+  int i, v;
+
+  for (i = 0; i < LANES; i += VLANES) {
+    vint accumulator[3];
+    vint msb_rising[3];
+
+    // Clock amplitude modulators.
+    for (v = 0; v < 3; v++) {
+      vint rate_counter = vload(b.rate_counter[v] + i);
+      vint rate_period = vload(b.rate_period[v] + i);
+      vint envelope_pipeline = vload(b.envelope_pipeline[v] + i);
+
+      // The pipelined envelope decrement.
+      if (unlikely(vany(envelope_pipeline))) {
+	vint envelope_counter = vload(b.envelope_counter[v] + i);
+	vint exponential_counter_period =
+	  vload(b.exponential_counter_period[v] + i);
+	vint hold_zero = vload(b.hold_zero[v] + i);
+
+	envelope_counter = vadd(envelope_counter, envelope_pipeline);
+	set_exponential_counter(envelope_pipeline, envelope_counter,
+				exponential_counter_period, hold_zero);
+
+	vstore(b.envelope_counter[v] + i, envelope_counter);
+	vstore(b.exponential_counter_period[v] + i,
+	       exponential_counter_period);
+	vstore(b.hold_zero[v] + i, hold_zero);
+	vstore(b.envelope_pipeline[v] + i, zero);
+      }
+
+      // ADSR delay bug.
+      rate_counter = vadd(rate_counter, one);
+      rate_counter = vsel(vnz(vand(rate_counter, vset(0x8000))),
+			  vand(vadd(rate_counter, one), vset(0x7fff)),
+			  rate_counter);
+
+      vint step = veq(rate_counter, rate_period);
+      if (unlikely(vany(step))) {
+	vint envelope_counter = vload(b.envelope_counter[v] + i);
+	vint exponential_counter = vload(b.exponential_counter[v] + i);
+	vint exponential_counter_period =
+	  vload(b.exponential_counter_period[v] + i);
+	vint hold_zero = vload(b.hold_zero[v] + i);
+	vint state = vload(b.state[v] + i);
+
+	rate_counter = vandnot(step, rate_counter);
+
+	// The first envelope step in the attack state also resets the
+	// exponential counter.
+	vint attack = veq(state, vset(EnvelopeGenerator::ATTACK));
+	exponential_counter =
+	  vsub(exponential_counter, vandnot(attack, step));
+	step = vand(step, vor(attack, veq(exponential_counter,
+					  exponential_counter_period)));
+	exponential_counter = vandnot(step, exponential_counter);
+	step = vandnot(hold_zero, step);
+
+	vint up = vand(step, attack);
+	vint decay_sustain =
+	  vand(step, veq(state, vset(EnvelopeGenerator::DECAY_SUSTAIN)));
+	vint release =
+	  vand(step, veq(state, vset(EnvelopeGenerator::RELEASE)));
+	decay_sustain = vandnot(veq(envelope_counter,
+				    vload(b.sustain_level[v] + i)),
+				decay_sustain);
+
+	// The decrement is delayed one cycle if the exponential counter
+	// period != 1.
+	vint down = vor(decay_sustain, release);
+	vint period_1 = veq(exponential_counter_period, one);
+	vstore(b.envelope_pipeline[v] + i, vandnot(period_1, down));
+	down = vand(down, period_1);
+
+	envelope_counter =
+	  vsel(up, vand(vadd(envelope_counter, one), vset(0xff)),
+	       envelope_counter);
+	vint top = vand(up, veq(envelope_counter, vset(0xff)));
+	state = vsel(top, vset(EnvelopeGenerator::DECAY_SUSTAIN), state);
+	rate_period = vsel(top, vload(b.decay_period[v] + i), rate_period);
+
+	envelope_counter = vadd(envelope_counter, down);
+	envelope_counter = vsel(vand(down, release),
+				vand(envelope_counter, vset(0xff)),
+				envelope_counter);
+
+	set_exponential_counter(vor(up, down), envelope_counter,
+				exponential_counter_period, hold_zero);
+
+	vstore(b.envelope_counter[v] + i, envelope_counter);
+	vstore(b.exponential_counter[v] + i, exponential_counter);
+	vstore(b.exponential_counter_period[v] + i,
+	       exponential_counter_period);
+	vstore(b.hold_zero[v] + i, hold_zero);
+	vstore(b.state[v] + i, state);
+	vstore(b.rate_period[v] + i, rate_period);
+      }
+
+      vstore(b.rate_counter[v] + i, rate_counter);
+    }
+
+    // Clock oscillators.
+    for (v = 0; v < 3; v++) {
+      vint test = vload(b.test[v] + i);
+      vint shift_pipeline = vload(b.shift_pipeline[v] + i);
+      accumulator[v] = vload(b.accumulator[v] + i);
+      msb_rising[v] = vload(b.msb_rising[v] + i);
+
+      if (unlikely(vany(test))) {
+	// Count down time to fully reset shift register.
+	vint shift_register_reset = vload(b.shift_register_reset[v] + i);
+	vint count = vand(test, vnz(shift_register_reset));
+	shift_register_reset = vadd(shift_register_reset, count);
+	vint reset = vand(count, veq(shift_register_reset, zero));
+	if (unlikely(vany(reset))) {
+	  vint shift_register =
+	    vsel(reset, vset(0x7fffff), vload(b.shift_register[v] + i));
+	  vint noise = noise_output(shift_register);
+	  vstore(b.shift_register[v] + i, shift_register);
+	  vstore(b.noise_output[v] + i,
+		 vsel(reset, noise, vload(b.noise_output[v] + i)));
+	  vstore(b.no_noise_or_noise_output[v] + i,
+		 vsel(reset, vor(vload(b.no_noise[v] + i), noise),
+		      vload(b.no_noise_or_noise_output[v] + i)));
+	}
+	vstore(b.shift_register_reset[v] + i, shift_register_reset);
+
+	// The test bit sets pulse high.
+	vstore(b.pulse_output[v] + i,
+	       vsel(test, vset(0xfff), vload(b.pulse_output[v] + i)));
+      }
+
+      vint accumulator_next =
+	vand(vadd(accumulator[v], vload(b.freq[v] + i)), vset(0xffffff));
+      vint accumulator_bits_set = vandnot(accumulator[v], accumulator_next);
+      accumulator[v] = vsel(test, accumulator[v], accumulator_next);
+      msb_rising[v] =
+	vsel(test, msb_rising[v],
+	     vnz(vand(accumulator_bits_set, vset(0x800000))));
+
+      // Shift noise register once for each time accumulator bit 19 is set
+      // high. The shift is delayed 2 cycles.
+      vint bit19 =
+	vandnot(test, vnz(vand(accumulator_bits_set, vset(0x080000))));
+      vint count = vandnot(vor(test, bit19), vnz(shift_pipeline));
+      shift_pipeline =
+	vsel(bit19, vset(2), vadd(shift_pipeline, count));
+      vint shift = vand(count, veq(shift_pipeline, zero));
+      if (unlikely(vany(shift))) {
+	vint shift_register = vload(b.shift_register[v] + i);
+	vint bit0 = vand(vxor(vsrl<22>(shift_register),
+			      vsrl<17>(shift_register)), one);
+	shift_register =
+	  vsel(shift, vand(vor(vsll<1>(shift_register), bit0),
+			   vset(0x7fffff)),
+	       shift_register);
+	vint noise = noise_output(shift_register);
+	vstore(b.shift_register[v] + i, shift_register);
+	vstore(b.noise_output[v] + i,
+	       vsel(shift, noise, vload(b.noise_output[v] + i)));
+	vstore(b.no_noise_or_noise_output[v] + i,
+	       vsel(shift, vor(vload(b.no_noise[v] + i), noise),
+		    vload(b.no_noise_or_noise_output[v] + i)));
+      }
+      vstore(b.shift_pipeline[v] + i, shift_pipeline);
+    }
+
+    // Synchronize oscillators. Voice v is the sync source of voice v + 1.
+    vint sync[3];
+    for (v = 0; v < 3; v++) {
+      sync[v] = vload(b.sync[v] + i);
+    }
+    for (v = 0; v < 3; v++) {
+      int dest = (v + 1)%3;
+      int source = (v + 2)%3;
+      vint hard_sync = vandnot(vand(sync[v], msb_rising[source]),
+			       vand(msb_rising[v], sync[dest]));
+      accumulator[dest] = vandnot(hard_sync, accumulator[dest]);
+    }
+
+    // Calculate waveform output. This must be done in voice order, since
+    // the 6581 sawtooth may change the accumulator of the sync source of
+    // the next voice.
+    for (v = 0; v < 3; v++) {
+      vint waveform = vload(b.waveform[v] + i);
+      vint pulse_output = vload(b.pulse_output[v] + i);
+      vint no_noise_or_noise_output =
+	vload(b.no_noise_or_noise_output[v] + i);
+      vint waveform_output = vload(b.waveform_output[v] + i);
+      vint osc3 = vload(b.osc3[v] + i);
+      vint floating = veq(waveform, zero);
+
+      vint ix = vsrl<12>(vxor(accumulator[v],
+			      vandnot(accumulator[(v + 2)%3],
+				      vload(b.ring_msb_mask[v] + i))));
+      vint sample = vlookup(wave, vor(vsll<12>(vand(waveform, vset(0x7))),
+				      ix));
+      vint mask = vand(vor(vload(b.no_pulse[v] + i), pulse_output),
+		       no_noise_or_noise_output);
+      vint output = vand(sample, mask);
+
+      // Noise and pulse combined.
+      vint noise_pulse = veq(vand(waveform, vset(0xc)), vset(0xc));
+      if (unlikely(vany(noise_pulse))) {
+	vint combined;
+	if (mos6581) {
+	  combined = vandnot(vgt(vset(0xf00), output),
+			     vand(vand(output, vsll<1>(output)),
+				  vsll<2>(output)));
+	}
+	else {
+	  combined = vsel(vgt(vset(0xfc0), output),
+			  vand(output, vsll<1>(output)), vset(0xfc0));
+	}
+	output = vsel(noise_pulse, combined, output);
+      }
+
+      vint osc3_next = output;
+      if (!mos6581) {
+	// Triangle/Sawtooth output is delayed half cycle on 8580.
+	vint tri_saw = vnz(vand(waveform, vset(0x3)));
+	vint tri_saw_pipeline = vload(b.tri_saw_pipeline[v] + i);
+	osc3_next = vsel(tri_saw, vand(tri_saw_pipeline, mask), output);
+	vstore(b.tri_saw_pipeline[v] + i,
+	       vsel(tri_saw, sample, tri_saw_pipeline));
+      }
+      else {
+	// In the 6581 the top bit of the accumulator may be driven low by
+	// combined waveforms when the sawtooth is selected.
+	vint saw = vand(vnz(vand(waveform, vset(0x2))),
+			vnz(vand(waveform, vset(0xd))));
+	accumulator[v] =
+	  vsel(saw, vand(accumulator[v],
+			 vor(vsll<12>(output), vset(0x7fffff))),
+	       accumulator[v]);
+      }
+
+      // Combined waveforms write to the shift register.
+      vint write = vandnot(vor(vload(b.test[v] + i),
+			       veq(vload(b.shift_pipeline[v] + i), one)),
+			   vgt(waveform, vset(0x8)));
+      if (unlikely(vany(write))) {
+	vint shift_register = vload(b.shift_register[v] + i);
+	vint noise = vload(b.noise_output[v] + i);
+	shift_register =
+	  vsel(write, vand(shift_register,
+			   vor(vset(~shift_register_outputs),
+			       shift_register_input(output))),
+	       shift_register);
+	noise = vsel(write, vand(noise, output), noise);
+	vstore(b.shift_register[v] + i, shift_register);
+	vstore(b.noise_output[v] + i, noise);
+	vstore(b.no_noise_or_noise_output[v] + i,
+	       vsel(write, vor(vload(b.no_noise[v] + i), noise),
+		    no_noise_or_noise_output));
+      }
+
+      waveform_output = vsel(floating, waveform_output, output);
+      osc3 = vsel(floating, osc3, osc3_next);
+
+      // Age floating DAC input.
+      vint floating_output_ttl = vload(b.floating_output_ttl[v] + i);
+      vint age = vand(floating, vnz(floating_output_ttl));
+      if (unlikely(vany(age))) {
+	floating_output_ttl = vadd(floating_output_ttl, age);
+	vint faded = vand(age, veq(floating_output_ttl, zero));
+	waveform_output = vandnot(faded, waveform_output);
+	osc3 = vandnot(faded, osc3);
+	vstore(b.floating_output_ttl[v] + i, floating_output_ttl);
+      }
+
+      // The result of the pulse width compare is delayed one cycle.
+      pulse_output = vandnot(vgt(vload(b.pw[v] + i),
+				 vsrl<12>(accumulator[v])),
+			     vset(0xfff));
+
+      vstore(b.pulse_output[v] + i, pulse_output);
+      vstore(b.waveform_output[v] + i, waveform_output);
+      vstore(b.osc3[v] + i, osc3);
+
+      // Multiply oscillator output with envelope output.
+      vstore(voice + v*LANES + i,
+	     vmul(vsub(vlookup(&wave_dac[0], waveform_output),
+		       vset(wave_zero)),
+		  vlookup(&envelope_dac[0],
+			  vand(vload(b.envelope_counter[v] + i),
+			       vset(0xff)))));
+    }
+
+    for (v = 0; v < 3; v++) {
+      vstore(b.accumulator[v] + i, accumulator[v]);
+      vstore(b.msb_rising[v] + i, msb_rising[v]);
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the filter, mixer, output stage and external filter of a block one
+// cycle; see Filter::clock(), Filter::output() and ExternalFilter::clock().
+// The table lookups of the MOS 6581 are gathered; the other loops are left
+// to the compiler to vectorize.
+// ----------------------------------------------------------------------------
+void SIDBatch::clock_analog(Block& b, const int* voice)
+{
+  Filter::model_filter_t& f = *chip[0]->filter.model;
+  const int voice_scale_s14 = f.voice_scale_s14;
+  const int voice_DC = f.voice_DC;
+  const unsigned short* gain = f.gain[0];
+  bool mos6581 = chip[0]->sid_model == MOS6581;
+  int Vi[LANES];
+  int i;
+
+  // Filter inputs, and the sum of the inputs routed into the filter.
+  for (i = 0; i < LANES; i++) {
+    b.v1[i] = (voice[i]*voice_scale_s14 >> 18) + voice_DC;
+    b.v2[i] = (voice[i + LANES]*voice_scale_s14 >> 18) + voice_DC;
+    b.v3[i] = (voice[i + 2*LANES]*voice_scale_s14 >> 18) + voice_DC;
+    int s = b.sum[i];
+    Vi[i] =
+      (s & 0x01 ? b.v1[i] : 0) + (s & 0x02 ? b.v2[i] : 0) +
+      (s & 0x04 ? b.v3[i] : 0) + (s & 0x08 ? b.ve[i] : 0);
+  }
+
+  if (mos6581) {
+    // MOS 6581.
+    Integrator6581 p = {
+      vset(f.kVddt), vset(f.n_snake), f.vcr_kVg, f.vcr_n_Ids_term, f.opamp_rev
+    };
+
+    for (i = 0; i < LANES; i += VLANES) {
+      vint Vddt_Vw_2 = vload(b.Vddt_Vw_2 + i);
+      vint Vlp_x = vload(b.Vlp_x + i);
+      vint Vlp_vc = vload(b.Vlp_vc + i);
+      vint Vbp_x = vload(b.Vbp_x + i);
+      vint Vbp_vc = vload(b.Vbp_vc + i);
+
+      vint Vlp = solve_integrate_6581(vload(b.Vbp + i), Vlp_x, Vlp_vc,
+				      Vddt_Vw_2, p);
+      vint Vbp = solve_integrate_6581(vload(b.Vhp + i), Vbp_x, Vbp_vc,
+				      Vddt_Vw_2, p);
+      vint Vhp = vlookup(f.summer,
+			 vadd(vadd(vload(b.sum_offset + i),
+				   vlookup(gain,
+					   vadd(vsll<16>(vload(b._8_div_Q + i)),
+						Vbp))),
+			      vadd(Vlp, vload(Vi + i))));
+
+      vstore(b.Vlp_x + i, Vlp_x);
+      vstore(b.Vlp_vc + i, Vlp_vc);
+      vstore(b.Vbp_x + i, Vbp_x);
+      vstore(b.Vbp_vc + i, Vbp_vc);
+      vstore(b.Vlp + i, Vlp);
+      vstore(b.Vbp + i, Vbp);
+      vstore(b.Vhp + i, Vhp);
+    }
+  }
+  else {
+    // MOS 8580.
+    for (i = 0; i < LANES; i++) {
+      int dVbp = b.w0[i]*(b.Vhp[i] >> 4) >> 16;
+      int dVlp = b.w0[i]*(b.Vbp[i] >> 4) >> 16;
+      b.Vbp[i] -= dVbp;
+      b.Vlp[i] -= dVlp;
+      b.Vhp[i] = (b.Vbp[i]*b._1024_div_Q[i] >> 10) - b.Vlp[i] - Vi[i];
+    }
+  }
+
+  // Sum the inputs in the mixer and run the mixer output through the gain.
+  int vo[LANES];
+  for (i = 0; i < LANES; i++) {
+    int m = b.mix[i];
+    vo[i] =
+      (m & 0x01 ? b.v1[i] : 0) + (m & 0x02 ? b.v2[i] : 0) +
+      (m & 0x04 ? b.v3[i] : 0) + (m & 0x08 ? b.ve[i] : 0) +
+      (m & 0x10 ? b.Vlp[i] : 0) + (m & 0x20 ? b.Vbp[i] : 0) +
+      (m & 0x40 ? b.Vhp[i] : 0);
+  }
+
+  if (mos6581) {
+    for (i = 0; i < LANES; i += VLANES) {
+      vint vm = vlookup(f.mixer, vadd(vload(b.mix_offset + i), vload(vo + i)));
+      vstore(vo + i, vsub(vlookup(gain, vadd(vsll<16>(vload(b.vol + i)), vm)),
+			  vset(1 << 15)));
+    }
+  }
+  else {
+    for (i = 0; i < LANES; i++) {
+      vo[i] = vo[i]*b.vol[i] >> 4;
+    }
+  }
+
+  // External filter.
+  if (likely(extfilt_enabled)) {
+    const int mullp = ExternalFilter::t1.mullp;
+    const int shiftlp = ExternalFilter::t1.shiftlp;
+    const int mulhp = ExternalFilter::t1.mulhp;
+    const int shifthp = ExternalFilter::t1.shifthp;
+
+    for (i = 0; i < LANES; i++) {
+      int vlp = b.ext_vlp[i];
+      int vhp = b.ext_vhp[i];
+      vhp += mulhp*(vlp - vhp) >> shifthp;
+      vlp += mullp*(((short)vo[i] << 11) - vlp) >> shiftlp;
+      b.ext_vlp[i] = vlp;
+      b.ext_vhp[i] = vhp;
+      b.out[i] = (vlp - vhp) >> 11;
+    }
+  }
+  else {
+    for (i = 0; i < LANES; i++) {
+      b.ext_vlp[i] = (short)vo[i] << 11;
+      b.ext_vhp[i] = 0;
+      b.out[i] = vo[i];
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Convolution of the rows of the ring buffer with a filter impulse
+// response, for all lanes.
+// ----------------------------------------------------------------------------
+void SIDBatch::convolve(const short* sample_start, int width,
+			const short* fir_start, int fir_N, int* v)
+{
+  int i;
+
+  for (i = 0; i < width; i++) {
+    v[i] = 0;
+  }
+
+  for (int j = 0; j < fir_N; j++) {
+    const short* row = sample_start + j*width;
+    short k = fir_start[j];
+    for (i = 0; i < width; i++) {
+      v[i] += row[i]*k;
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock with audio sampling. The sampling phase and FIR tables are those
+// of the first chip.
+// ----------------------------------------------------------------------------
+int SIDBatch::clock(cycle_count& delta_t, short* buf, int n)
+{
+  const int FIXP_SHIFT = SID::FIXP_SHIFT;
+  const int FIXP_MASK = SID::FIXP_MASK;
+  const int blocks = (int)block.size();
+  const int width = blocks*LANES;
+
+  SID& sid = *chip[0];
+  sampling_method method = sid.sampling;
+  cycle_count& sample_offset = sid.sample_offset;
+  bool resample = ring_size > 0;
+  int s, k, i;
+
+  for (s = 0; s < n; s++) {
+    cycle_count next_sample_offset = sample_offset + sid.cycles_per_sample;
+    if (method == SAMPLE_FAST) {
+      next_sample_offset += 1 << (FIXP_SHIFT - 1);
+    }
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+
+    if (delta_t_sample > delta_t) {
+      delta_t_sample = delta_t;
+    }
+
+    for (int t = 0; t < delta_t_sample; t++) {
+      for (k = 0; k < blocks; k++) {
+	Block& b = block[k];
+	int voice[3*LANES];
+	clock_voices(b, voice);
+	clock_analog(b, voice);
+
+	if (resample) {
+	  short* row = &ring[ring_index*width + k*LANES];
+	  for (i = 0; i < LANES; i++) {
+	    row[i] = row[i + ring_size*width] = b.out[i];
+	  }
+	}
+	else if (t >= delta_t_sample - 2) {
+	  for (i = 0; i < LANES; i++) {
+	    b.sample_prev[i] = b.sample_now[i];
+	    b.sample_now[i] = b.out[i];
+	  }
+	}
+      }
+
+      if (resample) {
+	++ring_index &= ring_size - 1;
+      }
+
+      // Pipelined writes on the MOS8580.
+      if (unlikely(!pending.empty())) {
+	write_pending();
+      }
+    }
+
+    // Age bus values.
+    for (k = 0; k < n_chips; k++) {
+      cycle_count& bus_value_ttl = chip[k]->bus_value_ttl;
+      if (bus_value_ttl > 0 && bus_value_ttl <= delta_t_sample) {
+	chip[k]->bus_value = 0;
+      }
+      bus_value_ttl -= delta_t_sample;
+    }
+
+    if ((delta_t -= delta_t_sample) == 0) {
+      sample_offset -= delta_t_sample << FIXP_SHIFT;
+      break;
+    }
+
+    if (method == SAMPLE_FAST) {
+      sample_offset =
+	(next_sample_offset & FIXP_MASK) - (1 << (FIXP_SHIFT - 1));
+    }
+    else {
+      sample_offset = next_sample_offset & FIXP_MASK;
+    }
+
+    short* frame = buf + s*n_chips;
+
+    if (method == SAMPLE_FAST) {
+      for (k = 0; k < blocks; k++) {
+	Block& b = block[k];
+	int lanes = n_chips - k*LANES < LANES ? n_chips - k*LANES : LANES;
+	for (i = 0; i < lanes; i++) {
+	  frame[k*LANES + i] = b.sample_now[i];
+	}
+      }
+      continue;
+    }
+
+    if (method == SAMPLE_INTERPOLATE) {
+      for (k = 0; k < blocks; k++) {
+	Block& b = block[k];
+	int lanes = n_chips - k*LANES < LANES ? n_chips - k*LANES : LANES;
+	for (i = 0; i < lanes; i++) {
+	  frame[k*LANES + i] = b.sample_prev[i] +
+	    (sample_offset*(b.sample_now[i] - b.sample_prev[i]) >> FIXP_SHIFT);
+	}
+      }
+      continue;
+    }
+
+    int fir_N = sid.fir_N;
+    int fir_offset = sample_offset*sid.fir_RES >> FIXP_SHIFT;
+    const short* fir_start = sid.fir + fir_offset*fir_N;
+    int* v = &acc[0];
+
+    if (method == SAMPLE_RESAMPLE) {
+      int fir_offset_rmd = sample_offset*sid.fir_RES & FIXP_MASK;
+      const short* sample_start =
+	&ring[(ring_index - fir_N - 1 + ring_size)*width];
+      int* v2 = &acc[width];
+
+      // Convolution with filter impulse response.
+      convolve(sample_start, width, fir_start, fir_N, v);
+
+      // Use next FIR table, wrap around to first FIR table using
+      // next sample.
+      if (unlikely(++fir_offset == sid.fir_RES)) {
+	fir_offset = 0;
+	sample_start += width;
+      }
+      fir_start = sid.fir + fir_offset*fir_N;
+
+      // Convolution with filter impulse response.
+      convolve(sample_start, width, fir_start, fir_N, v2);
+
+      // Linear interpolation.
+      for (i = 0; i < width; i++) {
+	v[i] += fir_offset_rmd*(v2[i] - v[i]) >> FIXP_SHIFT;
+      }
+    }
+    else {
+      const short* sample_start = &ring[(ring_index - fir_N + ring_size)*width];
+
+      // Convolution with filter impulse response.
+      convolve(sample_start, width, fir_start, fir_N, v);
+    }
+
+    for (i = 0; i < n_chips; i++) {
+      int vo = v[i] >> SID::FIR_SHIFT;
+
+      // Saturated arithmetics to guard against 16 bit sample overflow.
+      const int half = 1 << 15;
+      if (vo >= half) {
+	vo = half - 1;
+      }
+      else if (vo < -half) {
+	vo = -half;
+      }
+
+      frame[i] = vo;
+    }
+  }
+
+  return s;
+}
+
+} // namespace reSID
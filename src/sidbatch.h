@@ -0,0 +1,206 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_SIDBATCH_H
+#define RESID_SIDBATCH_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Many independent SIDs clocked in lockstep, for batch rendering.
+//
+// All chips have the same chip model and sampling parameters, and are
+// clocked for the same number of cycles, however each chip has its own
+// register writes, filter bias, voice mask and EXT IN level.
+//
+// The state which changes from cycle to cycle, i.e. the oscillator
+// accumulators and shift registers, the rate, exponential and envelope
+// counters, the filter integrators and the external filter, is kept in
+// structure-of-arrays layout in blocks of LANES chips. Each cycle, a block
+// is clocked as fixed length loops over its lanes, in which all conditionals
+// are replaced by masks. With AVX2 or AVX-512 (see --enable-arch), the loops
+// run on vectors of 8 or 16 lanes, and the waveform, DAC, filter and mixer
+// tables are read with gathers; otherwise the lanes are clocked one at a
+// time, which is slower than clocking separate SIDs.
+//
+// Register writes and reads are rare compared to cycles, and are left to the
+// SID code: the lanes of the chip are copied to its SID, the register is
+// accessed, and the lanes are copied back.
+//
+// The resampling ring buffer holds one row of output samples per cycle, so
+// that the FIR convolution runs over all lanes with the same filter table
+// and contiguous loads.
+//
+// The output is identical to that of SIDs with the same settings, except
+// with SAMPLE_FAST, for which the chips are clocked cycle by cycle and the
+// output of the cycle at each sampling point is taken, and with the FPGA
+// waveform code (see --enable-fpga-code), for which the batch still uses the
+// waveform tables.
+// ----------------------------------------------------------------------------
+class SIDBatch
+{
+public:
+  SIDBatch();
+  ~SIDBatch();
+
+  // Set up the given number of chips. Returns false for invalid sampling
+  // parameters.
+  bool open(int chips, chip_model model, double clock_freq,
+	    sampling_method method, double sample_freq,
+	    double pass_freq = -1, double filter_scale = 0.97);
+  int chips() const { return n_chips; }
+
+  void enable_filter(bool enable);
+  void enable_external_filter(bool enable);
+  void adjust_filter_bias(int chip, double dac_bias);
+  void set_voice_mask(int chip, reg4 mask);
+  void set_filter_model(const FilterModel* model);
+  // EXT IN (16 bits).
+  void input(int chip, short sample);
+
+  void reset();
+  // Set the state of a chip; see SID::write_state(). The sampling state is
+  // that of the batch, and is kept.
+  void write_state(int chip, const SID::State& state);
+  reg8 read(int chip, reg8 offset);
+  void write(int chip, reg8 offset, reg8 value);
+
+  // Clock all chips for delta_t cycles or n samples. Sample s of chip c is
+  // written to buf[s*chips() + c]. Returns the number of samples.
+  int clock(cycle_count& delta_t, short* buf, int n);
+
+protected:
+  enum { LANES = 16 };
+
+  // State of LANES chips. Chips are padded to a whole number of blocks.
+  // Flags are stored as masks, i.e. 0 or -1.
+  struct Block
+  {
+    // Waveform generators.
+    int accumulator[3][LANES];
+    int msb_rising[3][LANES];
+    int shift_register[3][LANES];
+    int shift_register_reset[3][LANES];
+    int shift_pipeline[3][LANES];
+    int noise_output[3][LANES];
+    int no_noise_or_noise_output[3][LANES];
+    int pulse_output[3][LANES];
+    int tri_saw_pipeline[3][LANES];
+    int osc3[3][LANES];
+    int waveform_output[3][LANES];
+    int floating_output_ttl[3][LANES];
+
+    // Envelope generators.
+    int rate_counter[3][LANES];
+    int rate_period[3][LANES];
+    int exponential_counter[3][LANES];
+    int exponential_counter_period[3][LANES];
+    int envelope_counter[3][LANES];
+    int envelope_pipeline[3][LANES];
+    int hold_zero[3][LANES];
+    int state[3][LANES];
+
+    // Parameters loaded from the voice registers.
+    int freq[3][LANES];
+    int pw[3][LANES];
+    int waveform[3][LANES];
+    int test[3][LANES];
+    int sync[3][LANES];
+    int ring_msb_mask[3][LANES];
+    int no_noise[3][LANES];
+    int no_pulse[3][LANES];
+    int decay_period[3][LANES];
+    int sustain_level[3][LANES];
+
+    // Filter state, and parameters loaded from the filter registers.
+    int v1[LANES];
+    int v2[LANES];
+    int v3[LANES];
+    int ve[LANES];
+    int Vhp[LANES];
+    int Vbp[LANES];
+    int Vbp_x[LANES];
+    int Vbp_vc[LANES];
+    int Vlp[LANES];
+    int Vlp_x[LANES];
+    int Vlp_vc[LANES];
+    int sum[LANES];
+    int mix[LANES];
+    int sum_offset[LANES];
+    int mix_offset[LANES];
+    int vol[LANES];
+    int Vddt_Vw_2[LANES];
+    int _8_div_Q[LANES];
+    int w0[LANES];
+    int _1024_div_Q[LANES];
+
+    // External filter state.
+    int ext_vlp[LANES];
+    int ext_vhp[LANES];
+
+    // Audio output for the current cycle, and for interpolation.
+    short out[LANES];
+    short sample_prev[LANES];
+    short sample_now[LANES];
+  };
+
+  static bool build_tables();
+  void store(int c, int lane);
+  void fetch(int c);
+  void load(int c, int lane);
+  void clear(int lane);
+  void write_pending();
+  void clock_voices(Block& b, int* voice);
+  void clock_analog(Block& b, const int* voice);
+  static void convolve(const short* sample_start, int width,
+		       const short* fir_start, int fir_N, int* v);
+
+  int n_chips;
+  std::vector<SID*> chip;
+  std::vector<Block> block;
+  bool extfilt_enabled;
+
+  // Chips with a write in the MOS8580 write pipeline.
+  std::vector<int> pending;
+
+  // Waveform tables of the chip model, preceded by one entry of padding,
+  // and waveform and envelope DAC tables.
+  std::vector<unsigned short> wave_table;
+  std::vector<int> wave_dac;
+  std::vector<int> envelope_dac;
+  int wave_zero;
+
+  // Ring buffer of output rows of block.size()*LANES samples, with overflow
+  // for contiguous storage of ring_size rows, as in SID.
+  std::vector<short> ring;
+  int ring_size;
+  int ring_index;
+
+  // Convolution results, two rows.
+  std::vector<int> acc;
+};
+
+} // namespace reSID
+
+#endif // not RESID_SIDBATCH_H
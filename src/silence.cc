@@ -0,0 +1,73 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "silence.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SilenceDetector::SilenceDetector(cycle_count hold, int threshold)
+{
+  this->hold = hold;
+  this->threshold = threshold;
+  reset();
+}
+
+
+// ----------------------------------------------------------------------------
+// Reset.
+// ----------------------------------------------------------------------------
+void SilenceDetector::reset()
+{
+  is_silent = false;
+  start = 0;
+  filter_prev = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Check for silence.
+// ----------------------------------------------------------------------------
+bool SilenceDetector::check(SID& sid, unsigned long long cycle)
+{
+  short filter_now = sid.filter_output();
+  int filter_change = filter_now - filter_prev;
+  int output = sid.output();
+  filter_prev = filter_now;
+
+  if (!sid.voices_silent() ||
+      filter_change > threshold || filter_change < -threshold ||
+      output > threshold || output < -threshold)
+  {
+    is_silent = false;
+    return false;
+  }
+
+  if (!is_silent) {
+    is_silent = true;
+    start = cycle;
+  }
+
+  return cycle - start >= (unsigned long long)hold;
+}
+
+} // namespace reSID
@@ -0,0 +1,70 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_SILENCE_H
+#define RESID_SILENCE_H
+
+#include "siddefs.h"
+#include "sid.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Detection of silence, for ending renders early.
+//
+// Rather than only looking at the audio, the detector watches the digital
+// state: the SID is silent when SID::voices_silent() holds (the envelopes
+// have decayed to zero), and the filter and external filter outputs have
+// settled, i.e. the filter output changes by no more than threshold
+// between checks, and the audio output is within threshold of zero.
+//
+// check() is called at regular intervals while rendering, e.g. once per
+// output buffer, and returns true once the SID has been continuously
+// silent for hold cycles. Since a tune may continue after a pause, hold
+// should be a few seconds for tunes; for traces, silence following the
+// last write is final.
+// ----------------------------------------------------------------------------
+class SilenceDetector
+{
+public:
+  SilenceDetector(cycle_count hold = 3*985248, int threshold = 16);
+
+  void reset();
+
+  // Check SID state at the given cycle. Returns true if the SID has been
+  // silent for at least hold cycles.
+  bool check(SID& sid, unsigned long long cycle);
+
+  // Start of the current silence, if any.
+  bool silent() const { return is_silent; }
+  unsigned long long silence_start() const { return start; }
+
+protected:
+  cycle_count hold;
+  int threshold;
+
+  bool is_silent;
+  unsigned long long start;
+  short filter_prev;
+};
+
+} // namespace reSID
+
+#endif // not RESID_SILENCE_H
@@ -0,0 +1,703 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "sink.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if RESID_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Little endian header fields.
+// ----------------------------------------------------------------------------
+static void put16(char* p, unsigned int v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(char* p, unsigned int v)
+{
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+static void put64(char* p, unsigned long long v)
+{
+  put32(p, (unsigned int)(v & 0xffffffff));
+  put32(p + 4, (unsigned int)(v >> 32));
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SampleSink::SampleSink()
+{
+  sample_freq = 0;
+  n_channels = 1;
+  data_size = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+SampleSink::~SampleSink()
+{
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock the SID delta_t cycles, rendering directly into the sink.
+// For multi-channel sinks, the SID renders into the first channel.
+// ----------------------------------------------------------------------------
+bool SampleSink::clock(SID& sid, cycle_count delta_t, int chunk)
+{
+  while (delta_t > 0) {
+    short* buf = reserve(chunk);
+    if (unlikely(!buf)) {
+      return false;
+    }
+    int n = sid.clock(delta_t, buf, chunk, n_channels);
+    if (unlikely(!commit(n))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Create WAV header for 16 bit PCM.
+//
+// A JUNK chunk is always reserved after the RIFF header. If the data does
+// not fit in a RIFF file, RIFF is replaced by RF64, and the JUNK chunk is
+// replaced by a ds64 chunk holding the 64 bit sizes, see EBU Tech 3306.
+// ----------------------------------------------------------------------------
+void SampleSink::wav_header(char* header, int sample_freq, int channels,
+			    unsigned long long data_size)
+{
+  unsigned long long riff_size = data_size + WAV_HEADER_SIZE - 8;
+  bool rf64 = riff_size > 0xffffffffULL;
+
+  memset(header, 0, WAV_HEADER_SIZE);
+
+  memcpy(header, rf64 ? "RF64" : "RIFF", 4);
+  put32(header + 4, rf64 ? 0xffffffff : (unsigned int)riff_size);
+  memcpy(header + 8, "WAVE", 4);
+
+  memcpy(header + 12, rf64 ? "ds64" : "JUNK", 4);
+  put32(header + 16, 28);
+  if (rf64) {
+    put64(header + 20, riff_size);
+    put64(header + 28, data_size);
+    put64(header + 36, data_size/(2*channels));
+    put32(header + 44, 0);
+  }
+
+  memcpy(header + 48, "fmt ", 4);
+  put32(header + 52, 16);
+  put16(header + 56, 1);
+  put16(header + 58, channels);
+  put32(header + 60, sample_freq);
+  put32(header + 64, sample_freq*channels*2);
+  put16(header + 68, channels*2);
+  put16(header + 70, 16);
+
+  memcpy(header + 72, "data", 4);
+  put32(header + 76, rf64 ? 0xffffffff : (unsigned int)data_size);
+}
+
+
+// ----------------------------------------------------------------------------
+// WAV samples are little endian.
+// ----------------------------------------------------------------------------
+void SampleSink::swap_samples(short* buf, int n)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (int i = 0; i < n; i++) {
+    unsigned short v = buf[i];
+    buf[i] = (short)((v << 8) | (v >> 8));
+  }
+#else
+  (void)buf;
+  (void)n;
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+WavFileSink::WavFileSink()
+{
+  fd = -1;
+  window = 0;
+  window_offset = 0;
+  window_length = 0;
+  window_size = 0;
+  page_size = sysconf(_SC_PAGESIZE);
+  file_size = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+WavFileSink::~WavFileSink()
+{
+  close();
+}
+
+
+// ----------------------------------------------------------------------------
+// Create file. The window size is rounded up to a whole number of pages.
+// ----------------------------------------------------------------------------
+bool WavFileSink::open(const char* filename, int sample_freq, int channels,
+		       int window_size)
+{
+  close();
+
+  fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return false;
+  }
+
+  this->sample_freq = sample_freq;
+  n_channels = channels;
+  this->window_size = (window_size + page_size - 1) & ~(page_size - 1);
+  data_size = 0;
+  file_size = 0;
+
+  if (!map_window(0, this->window_size)) {
+    ::close(fd);
+    fd = -1;
+    unlink(filename);
+    return false;
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Map file window, growing the file as necessary.
+// The file is grown using posix_fallocate rather than ftruncate, so that
+// running out of disk space is reported here instead of as SIGBUS when
+// rendering into the mapping.
+// ----------------------------------------------------------------------------
+bool WavFileSink::map_window(unsigned long long offset, size_t size)
+{
+  unmap_window();
+
+  if (offset + size > file_size) {
+    if (posix_fallocate(fd, file_size, offset + size - file_size) != 0) {
+      return false;
+    }
+    file_size = offset + size;
+  }
+
+  void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  madvise(p, size, MADV_SEQUENTIAL);
+
+  window = (char*)p;
+  window_offset = offset;
+  window_length = size;
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Unmap file window. Dirty pages are written back by the kernel.
+// ----------------------------------------------------------------------------
+void WavFileSink::unmap_window()
+{
+  if (window) {
+    munmap(window, window_length);
+    window = 0;
+    window_length = 0;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Return pointer into the mapped file for n sample frames.
+// ----------------------------------------------------------------------------
+short* WavFileSink::reserve(int n)
+{
+  if (unlikely(fd < 0)) {
+    return 0;
+  }
+
+  unsigned long long pos = WAV_HEADER_SIZE + data_size;
+  size_t bytes = n*n_channels*sizeof(short);
+
+  if (unlikely(!window || pos + bytes > window_offset + window_length)) {
+    // Slide window, keeping page alignment.
+    unsigned long long offset = pos & ~(unsigned long long)(page_size - 1);
+    size_t size = pos + bytes - offset;
+    size = (size + page_size - 1) & ~(page_size - 1);
+    if (size < window_size) {
+      size = window_size;
+    }
+    if (!map_window(offset, size)) {
+      return 0;
+    }
+  }
+
+  return (short*)(window + (pos - window_offset));
+}
+
+
+// ----------------------------------------------------------------------------
+// Commit n sample frames.
+// ----------------------------------------------------------------------------
+bool WavFileSink::commit(int n)
+{
+  if (unlikely(!window)) {
+    return false;
+  }
+
+  unsigned long long pos = WAV_HEADER_SIZE + data_size;
+  swap_samples((short*)(window + (pos - window_offset)), n*n_channels);
+  data_size += n*n_channels*sizeof(short);
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Write header, truncate file to its exact size and close it.
+// ----------------------------------------------------------------------------
+bool WavFileSink::close()
+{
+  if (fd < 0) {
+    return true;
+  }
+
+  unmap_window();
+
+  char header[WAV_HEADER_SIZE];
+  wav_header(header, sample_freq, n_channels, data_size);
+
+  bool ok = pwrite(fd, header, WAV_HEADER_SIZE, 0) == WAV_HEADER_SIZE;
+  ok = ftruncate(fd, WAV_HEADER_SIZE + data_size) == 0 && ok;
+  ok = ::close(fd) == 0 && ok;
+  fd = -1;
+
+  return ok;
+}
+
+
+#if RESID_IO_URING
+
+// ----------------------------------------------------------------------------
+// io_uring system calls.
+// ----------------------------------------------------------------------------
+static int io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			  unsigned flags)
+{
+  int ret;
+  do {
+    ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, 0, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg,
+			     unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+UringFileSink::UringFileSink()
+{
+  fd = -1;
+  ring_fd = -1;
+  sq_ring = cq_ring = 0;
+  sq_ring_size = cq_ring_size = 0;
+  sqes = 0;
+  sqes_size = 0;
+  buffers = 0;
+  in_flight = 0;
+  lengths = 0;
+  buffer_count = 0;
+  buffer_size = 0;
+  n_in_flight = 0;
+  current = 0;
+  fill = 0;
+  file_offset = 0;
+  error = false;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+UringFileSink::~UringFileSink()
+{
+  close();
+}
+
+
+// ----------------------------------------------------------------------------
+// Create file, set up io_uring and register buffers.
+// ----------------------------------------------------------------------------
+bool UringFileSink::open(const char* filename, int sample_freq, int channels,
+			 int buffer_count, int buffer_size)
+{
+  close();
+
+  this->sample_freq = sample_freq;
+  n_channels = channels;
+  this->buffer_count = buffer_count;
+  // Keep buffers a whole number of sample frames.
+  this->buffer_size = buffer_size - buffer_size % (channels*sizeof(short));
+  data_size = 0;
+  file_offset = WAV_HEADER_SIZE;
+  current = 0;
+  fill = 0;
+  n_in_flight = 0;
+  error = false;
+
+  fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring_fd = io_uring_setup(buffer_count, &p);
+  if (ring_fd < 0) {
+    release();
+    return false;
+  }
+
+  sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  cq_ring_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && cq_ring_size > sq_ring_size) {
+    sq_ring_size = cq_ring_size;
+  }
+
+  sq_ring = mmap(0, sq_ring_size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    sq_ring = 0;
+    release();
+    return false;
+  }
+
+  if (single_mmap) {
+    cq_ring = sq_ring;
+    cq_ring_size = 0;
+  }
+  else {
+    cq_ring = mmap(0, cq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      cq_ring = 0;
+      release();
+      return false;
+    }
+  }
+
+  sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+  void* s = mmap(0, sqes_size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (s == MAP_FAILED) {
+    release();
+    return false;
+  }
+  sqes = (struct io_uring_sqe*)s;
+
+  char* sq = (char*)sq_ring;
+  sq_head = (unsigned*)(sq + p.sq_off.head);
+  sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+  sq_array = (unsigned*)(sq + p.sq_off.array);
+
+  char* cq = (char*)cq_ring;
+  cq_head = (unsigned*)(cq + p.cq_off.head);
+  cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  // Allocate and register buffers.
+  void* b;
+  if (posix_memalign(&b, sysconf(_SC_PAGESIZE),
+		     (size_t)buffer_count*this->buffer_size) != 0)
+  {
+    release();
+    return false;
+  }
+  buffers = (char*)b;
+  // With several channels, samples not written by the caller, e.g. for a
+  // channel rendered with fewer samples than the others, are written as
+  // zero, as for WavFileSink. The buffers are thus cleared before use.
+  if (channels > 1) {
+    memset(buffers, 0, (size_t)buffer_count*this->buffer_size);
+  }
+  in_flight = new bool[buffer_count];
+  lengths = new unsigned int[buffer_count];
+
+  struct iovec* iov = new struct iovec[buffer_count];
+  for (int i = 0; i < buffer_count; i++) {
+    iov[i].iov_base = buffers + (size_t)i*this->buffer_size;
+    iov[i].iov_len = this->buffer_size;
+    in_flight[i] = false;
+    lengths[i] = 0;
+  }
+  int ret = io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iov,
+			      buffer_count);
+  delete[] iov;
+  if (ret < 0) {
+    release();
+    return false;
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Submit write of registered buffer.
+// ----------------------------------------------------------------------------
+bool UringFileSink::submit(int buffer, unsigned int length)
+{
+  // There are at least as many submission queue entries as buffers, and
+  // entries are consumed by io_uring_enter(), so the queue is never full.
+  unsigned tail = *sq_tail;
+  unsigned index = tail & *sq_mask;
+  struct io_uring_sqe* sqe = &sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long long)(buffers + (size_t)buffer*buffer_size);
+  sqe->len = length;
+  sqe->off = file_offset;
+  sqe->buf_index = buffer;
+  sqe->user_data = buffer;
+
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  in_flight[buffer] = true;
+  lengths[buffer] = length;
+  n_in_flight++;
+  file_offset += length;
+
+  if (io_uring_enter(ring_fd, 1, 0, 0) < 0) {
+    error = true;
+    return false;
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Reap completions, optionally waiting for at least one.
+// ----------------------------------------------------------------------------
+bool UringFileSink::reap(bool wait)
+{
+  unsigned head = *cq_head;
+
+  if (wait && head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    if (io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+      error = true;
+      return false;
+    }
+  }
+
+  while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+    int buffer = (int)cqe->user_data;
+    // Short writes are not resubmitted; they should not occur for regular
+    // files unless the disk is full.
+    if (cqe->res < 0 || (unsigned int)cqe->res != lengths[buffer]) {
+      error = true;
+    }
+    in_flight[buffer] = false;
+    n_in_flight--;
+    head++;
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+  return !error;
+}
+
+
+// ----------------------------------------------------------------------------
+// Return pointer into the current registered buffer for n sample frames.
+// n must not exceed the buffer size.
+// ----------------------------------------------------------------------------
+short* UringFileSink::reserve(int n)
+{
+  unsigned int bytes = n*n_channels*sizeof(short);
+
+  if (unlikely(ring_fd < 0 || error || bytes > (unsigned int)buffer_size)) {
+    return 0;
+  }
+
+  if (fill + bytes > (unsigned int)buffer_size) {
+    // Submit full buffer, and move on to the next one.
+    if (!submit(current, fill)) {
+      return 0;
+    }
+    if (++current == buffer_count) {
+      current = 0;
+    }
+    fill = 0;
+
+    while (in_flight[current]) {
+      if (!reap(true)) {
+	return 0;
+      }
+    }
+    if (n_channels > 1) {
+      memset(buffers + (size_t)current*buffer_size, 0, lengths[current]);
+    }
+  }
+
+  return (short*)(buffers + (size_t)current*buffer_size + fill);
+}
+
+
+// ----------------------------------------------------------------------------
+// Commit n sample frames.
+// ----------------------------------------------------------------------------
+bool UringFileSink::commit(int n)
+{
+  if (unlikely(ring_fd < 0 || error)) {
+    return false;
+  }
+
+  swap_samples((short*)(buffers + (size_t)current*buffer_size + fill),
+	       n*n_channels);
+  fill += n*n_channels*sizeof(short);
+  data_size += n*n_channels*sizeof(short);
+
+  // Opportunistically reap completed writes.
+  return reap(false);
+}
+
+
+// ----------------------------------------------------------------------------
+// Flush buffers, wait for completion, write header and close file.
+// ----------------------------------------------------------------------------
+bool UringFileSink::close()
+{
+  if (fd < 0) {
+    return true;
+  }
+
+  bool ok = ring_fd >= 0 && !error;
+
+  if (ok && fill) {
+    ok = submit(current, fill);
+    fill = 0;
+  }
+  while (ring_fd >= 0 && n_in_flight) {
+    if (!reap(true)) {
+      ok = false;
+      break;
+    }
+  }
+
+  if (ok) {
+    char header[WAV_HEADER_SIZE];
+    wav_header(header, sample_freq, n_channels, data_size);
+    ok = pwrite(fd, header, WAV_HEADER_SIZE, 0) == WAV_HEADER_SIZE;
+  }
+
+  release();
+
+  return ok;
+}
+
+
+// ----------------------------------------------------------------------------
+// Release ring, buffers and file.
+// ----------------------------------------------------------------------------
+void UringFileSink::release()
+{
+  if (sqes) {
+    munmap(sqes, sqes_size);
+    sqes = 0;
+  }
+  if (cq_ring && cq_ring != sq_ring) {
+    munmap(cq_ring, cq_ring_size);
+  }
+  cq_ring = 0;
+  if (sq_ring) {
+    munmap(sq_ring, sq_ring_size);
+    sq_ring = 0;
+  }
+  if (ring_fd >= 0) {
+    // Closing the ring also unregisters the buffers.
+    ::close(ring_fd);
+    ring_fd = -1;
+  }
+
+  free(buffers);
+  buffers = 0;
+  delete[] in_flight;
+  in_flight = 0;
+  delete[] lengths;
+  lengths = 0;
+  n_in_flight = 0;
+
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+#endif // RESID_IO_URING
+
+} // namespace reSID
@@ -0,0 +1,189 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_SINK_H
+#define RESID_SINK_H
+
+#include "siddefs.h"
+#include "sid.h"
+
+#if RESID_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Output sinks receive the short* buffers from SID::clock directly.
+//
+// Rather than having SID::clock render into an intermediate buffer which is
+// subsequently copied by write(), a sink hands out a pointer into its own
+// output storage (reserve()), SID::clock renders straight into it, and the
+// number of samples actually produced is handed back (commit()).
+//
+// All sinks write WAV files. The header is written on close(), and is
+// promoted to RF64 if the file grows beyond the 4GB limit of RIFF.
+// ----------------------------------------------------------------------------
+class SampleSink
+{
+public:
+  SampleSink();
+  virtual ~SampleSink();
+
+  // Return storage for at least n sample frames, or 0 on error.
+  virtual short* reserve(int n) = 0;
+  // Commit n sample frames written into the storage returned by reserve().
+  virtual bool commit(int n) = 0;
+  // Finalize header and close the file.
+  virtual bool close() = 0;
+
+  // Clock the SID delta_t cycles, rendering directly into the sink.
+  bool clock(SID& sid, cycle_count delta_t, int chunk = 4096);
+
+  int channels() const { return n_channels; }
+
+protected:
+  enum {
+    // RIFF(12) + JUNK/ds64(8 + 28) + fmt(8 + 16) + data(8).
+    WAV_HEADER_SIZE = 80
+  };
+
+  static void wav_header(char* header, int sample_freq, int channels,
+			 unsigned long long data_size);
+  static void swap_samples(short* buf, int n);
+
+  int sample_freq;
+  int n_channels;
+  // Number of data bytes committed.
+  unsigned long long data_size;
+};
+
+
+// ----------------------------------------------------------------------------
+// WAV / RF64 writer rendering into a memory-mapped file.
+//
+// The file is mapped through a sliding window, so that arbitrarily long
+// renders only occupy a bounded amount of address space. The file is grown
+// ahead of the window, and truncated to its exact size on close().
+// ----------------------------------------------------------------------------
+class WavFileSink : public SampleSink
+{
+public:
+  WavFileSink();
+  ~WavFileSink();
+
+  bool open(const char* filename, int sample_freq, int channels = 1,
+	    int window_size = 1 << 24);
+
+  short* reserve(int n);
+  bool commit(int n);
+  bool close();
+
+protected:
+  bool map_window(unsigned long long offset, size_t size);
+  void unmap_window();
+
+  int fd;
+  size_t window_size;
+  size_t page_size;
+
+  // Current mapping.
+  char* window;
+  unsigned long long window_offset;
+  size_t window_length;
+
+  // Current size of the underlying file.
+  unsigned long long file_size;
+};
+
+
+#if RESID_IO_URING
+
+// ----------------------------------------------------------------------------
+// Asynchronous WAV / RF64 writer using io_uring with registered buffers.
+//
+// A small set of buffers is registered with the kernel once. SID::clock
+// renders into the current buffer, and full buffers are submitted as
+// IORING_OP_WRITE_FIXED without any copying or per-write syscall setup.
+// The render thread only blocks when all buffers are in flight.
+//
+// io_uring is accessed through raw system calls; liburing is not required.
+// open() fails if io_uring is not available at run time.
+// ----------------------------------------------------------------------------
+class UringFileSink : public SampleSink
+{
+public:
+  UringFileSink();
+  ~UringFileSink();
+
+  bool open(const char* filename, int sample_freq, int channels = 1,
+	    int buffer_count = 4, int buffer_size = 1 << 18);
+
+  short* reserve(int n);
+  bool commit(int n);
+  bool close();
+
+protected:
+  bool submit(int buffer, unsigned int length);
+  bool reap(bool wait);
+  void release();
+
+  int fd;
+  int ring_fd;
+
+  // Submission queue.
+  void* sq_ring;
+  size_t sq_ring_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  // Completion queue.
+  void* cq_ring;
+  size_t cq_ring_size;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // Registered buffers.
+  int buffer_count;
+  int buffer_size;
+  char* buffers;
+  bool* in_flight;
+  unsigned int* lengths;
+  int n_in_flight;
+  int current;
+  unsigned int fill;
+
+  // File offset of the next submitted write.
+  unsigned long long file_offset;
+  bool error;
+};
+
+#endif // RESID_IO_URING
+
+} // namespace reSID
+
+#endif // not RESID_SINK_H
@@ -0,0 +1,478 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "synth.h"
+#include <math.h>
+#include <algorithm>
+
+namespace reSID
+{
+
+enum {
+  NOTE_OFF = 0x80,
+  NOTE_ON = 0x90,
+  CONTROL_CHANGE = 0xb0,
+  PROGRAM_CHANGE = 0xc0,
+  PITCH_BEND = 0xe0
+};
+
+static const int DRUM_CHANNEL = 9;
+
+struct Patch
+{
+  reg8 waveform;
+  reg4 attack, decay, sustain, release;
+  reg12 pw;
+  bool filter;
+};
+
+// The last patch is used for drums.
+static const int n_patches = 8;
+static const Patch patches[n_patches + 1] = {
+  { 0x40, 0, 9, 10, 9, 0x800, false },	// Pulse lead.
+  { 0x20, 1, 8, 12, 8, 0x800, false },	// Sawtooth.
+  { 0x10, 3, 6, 12, 10, 0x800, false },	// Triangle flute.
+  { 0x40, 0, 8, 8, 4, 0x400, true },	// Pulse bass.
+  { 0x20, 8, 8, 12, 12, 0x800, true },	// Filtered pad.
+  { 0x10, 0, 9, 0, 9, 0x800, false },	// Triangle bell.
+  { 0x20, 0, 6, 6, 3, 0x800, true },	// Filtered sawtooth bass.
+  { 0x50, 0, 8, 10, 8, 0x600, false },	// Pulse + triangle.
+  { 0x80, 0, 6, 0, 6, 0x800, false }	// Drums.
+};
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SIDSynth::SIDSynth()
+{
+  clock_freq = 985248;
+  counter = 0;
+  volume = 0x0f;
+  resonance = 0;
+  block = 0;
+  for (int i = 0; i < 16; i++) {
+    channel[i].program = 0;
+    channel[i].bend = 0;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+SIDSynth::~SIDSynth()
+{
+  for (size_t i = 0; i < chip.size(); i++) {
+    delete chip[i];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Set up pool of chips.
+// ----------------------------------------------------------------------------
+bool SIDSynth::open(int chips, const RenderSettings& settings)
+{
+  for (size_t i = 0; i < chip.size(); i++) {
+    delete chip[i];
+  }
+  chip.clear();
+  voice.clear();
+  route.clear();
+  events.clear();
+  position.clear();
+  carry.clear();
+  block = 0;
+
+  for (int c = 0; c < chips; c++) {
+    SID* sid = new SID();
+    chip.push_back(sid);
+    if (!settings.configure(*sid)) {
+      return false;
+    }
+    route.push_back(0);
+    position.push_back(0);
+    carry.push_back(std::vector<short>());
+    for (int i = 0; i < 3; i++) {
+      Voice v = { 0, -1, false, 0, 0, 0 };
+      voice.push_back(v);
+    }
+  }
+
+  clock_freq = settings.clock_freq;
+  write_all(0x15, 0x00);
+  write_all(0x16, 0x80);
+  write_all(0x17, resonance << 4);
+  write_all(0x18, 0x10 | volume);
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Queue events.
+// ----------------------------------------------------------------------------
+void SIDSynth::midi(int offset, const unsigned char* msg)
+{
+  int status = msg[0] & 0xf0;
+  int ch = msg[0] & 0x0f;
+
+  switch (status) {
+  case NOTE_OFF:
+    note_off(offset, ch, msg[1]);
+    break;
+  case NOTE_ON:
+    note_on(offset, ch, msg[1], msg[2]);
+    break;
+  case CONTROL_CHANGE:
+    control_change(offset, ch, msg[1], msg[2]);
+    break;
+  case PROGRAM_CHANGE:
+    program_change(offset, ch, msg[1]);
+    break;
+  case PITCH_BEND:
+    pitch_bend(offset, ch, (msg[1] | msg[2] << 7) - 8192);
+    break;
+  }
+}
+
+void SIDSynth::note_on(int offset, int channel, int note, int velocity)
+{
+  // Note on with zero velocity is note off.
+  Event event = { offset, velocity ? NOTE_ON : NOTE_OFF, channel & 0x0f,
+		  note & 0x7f, velocity & 0x7f };
+  events.push_back(event);
+}
+
+void SIDSynth::note_off(int offset, int channel, int note)
+{
+  Event event = { offset, NOTE_OFF, channel & 0x0f, note & 0x7f, 0 };
+  events.push_back(event);
+}
+
+void SIDSynth::control_change(int offset, int channel, int controller,
+			      int value)
+{
+  Event event = { offset, CONTROL_CHANGE, channel & 0x0f, controller & 0x7f,
+		  value & 0x7f };
+  events.push_back(event);
+}
+
+void SIDSynth::program_change(int offset, int channel, int program)
+{
+  Event event = { offset, PROGRAM_CHANGE, channel & 0x0f, program & 0x7f, 0 };
+  events.push_back(event);
+}
+
+void SIDSynth::pitch_bend(int offset, int channel, int value)
+{
+  Event event = { offset, PITCH_BEND, channel & 0x0f, value, 0 };
+  events.push_back(event);
+}
+
+
+// ----------------------------------------------------------------------------
+// Register writes. Each write is followed by one cycle, since the 8580 with
+// SAMPLE_FAST only keeps the last write in its pipeline. The cycle is part
+// of the output: a sample falling due is rendered at the current position
+// of the chip in the block, or carried over to the next block.
+// ----------------------------------------------------------------------------
+void SIDSynth::write(int c, reg8 offset, reg8 value)
+{
+  SID* sid = chip[c];
+  sid->write(offset, value);
+
+  cycle_count delta_t = 1;
+  while (delta_t) {
+    if (position[c] < block) {
+      position[c] += sid->clock(delta_t, &mix[c*block + position[c]],
+				block - position[c]);
+    }
+    else {
+      short sample;
+      if (sid->clock(delta_t, &sample, 1)) {
+	carry[c].push_back(sample);
+      }
+    }
+  }
+}
+
+void SIDSynth::write_all(reg8 offset, reg8 value)
+{
+  for (size_t c = 0; c < chip.size(); c++) {
+    write(c, offset, value);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Voice handling.
+// ----------------------------------------------------------------------------
+void SIDSynth::set_freq(int v)
+{
+  const Voice& vc = voice[v];
+  double note = vc.note + channel[vc.channel].bend*2/8192.0;
+  double f = 440*pow(2.0, (note - 69)/12)*16777216.0/clock_freq;
+  reg16 freq = f < 65535 ? (reg16)(f + 0.5) : 0xffff;
+
+  int c = v/3;
+  reg8 base = (v%3)*7;
+  write(c, base + 0x00, freq & 0xff);
+  write(c, base + 0x01, freq >> 8);
+}
+
+void SIDSynth::start(int v, int ch, int note, int velocity)
+{
+  Voice& vc = voice[v];
+  const Patch& p = ch == DRUM_CHANNEL ?
+    patches[n_patches] : patches[channel[ch].program%n_patches];
+  int c = v/3;
+  reg8 base = (v%3)*7;
+
+  // Retrigger the envelope.
+  if (vc.gate) {
+    write(c, base + 0x04, vc.control);
+  }
+
+  vc.channel = ch;
+  vc.note = note;
+  vc.gate = true;
+  vc.started = ++counter;
+  vc.control = p.waveform;
+
+  reg8 bit = 1 << (v%3);
+  reg8 r = p.filter ? route[c] | bit : route[c] & ~bit;
+  if (r != route[c]) {
+    route[c] = r;
+    write(c, 0x17, resonance << 4 | r);
+  }
+
+  reg4 sustain = (p.sustain*velocity + 63)/127;
+
+  set_freq(v);
+  write(c, base + 0x02, p.pw & 0xff);
+  write(c, base + 0x03, p.pw >> 8);
+  write(c, base + 0x05, p.attack << 4 | p.decay);
+  write(c, base + 0x06, sustain << 4 | p.release);
+  write(c, base + 0x04, p.waveform | 0x01);
+}
+
+void SIDSynth::stop(int v)
+{
+  Voice& vc = voice[v];
+  if (!vc.gate) {
+    return;
+  }
+  vc.gate = false;
+  vc.released = ++counter;
+  write(v/3, (v%3)*7 + 0x04, vc.control);
+}
+
+
+// ----------------------------------------------------------------------------
+// Apply event.
+// ----------------------------------------------------------------------------
+void SIDSynth::apply(const Event& event)
+{
+  int n = (int)voice.size();
+  int v;
+
+  switch (event.type) {
+  case NOTE_ON:
+    {
+      // Reuse the voice of the same note, else the voice released for the
+      // longest time, else steal the oldest note.
+      int best = -1;
+      for (v = 0; v < n; v++) {
+	if (voice[v].channel == event.channel && voice[v].note == event.a) {
+	  best = v;
+	  break;
+	}
+      }
+      if (best < 0) {
+	for (v = 0; v < n; v++) {
+	  if (!voice[v].gate &&
+	      (best < 0 || voice[v].released < voice[best].released))
+	  {
+	    best = v;
+	  }
+	}
+      }
+      if (best < 0) {
+	for (v = 0; v < n; v++) {
+	  if (best < 0 || voice[v].started < voice[best].started) {
+	    best = v;
+	  }
+	}
+      }
+      start(best, event.channel, event.a, event.b);
+    }
+    break;
+
+  case NOTE_OFF:
+    for (v = 0; v < n; v++) {
+      if (voice[v].gate && voice[v].channel == event.channel &&
+	  voice[v].note == event.a)
+      {
+	stop(v);
+      }
+    }
+    break;
+
+  case CONTROL_CHANGE:
+    switch (event.a) {
+    case 7:
+      volume = event.b >> 3;
+      write_all(0x18, 0x10 | volume);
+      break;
+    case 71:
+      resonance = event.b >> 3;
+      for (size_t c = 0; c < chip.size(); c++) {
+	write(c, 0x17, resonance << 4 | route[c]);
+      }
+      break;
+    case 74:
+      // The 7 bit value maps to the upper bits of the 11 bit cutoff.
+      write_all(0x15, 0x00);
+      write_all(0x16, event.b << 1);
+      break;
+    case 120:
+      // Lowering the release rate only takes effect once the rate counter
+      // wraps around, so the envelopes are cleared through the chip state.
+      for (v = 0; v < n; v++) {
+	if (voice[v].channel == event.channel) {
+	  stop(v);
+	}
+      }
+      for (size_t c = 0; c < chip.size(); c++) {
+	SID::State state = chip[c]->read_state();
+	bool cut = false;
+	for (int i = 0; i < 3; i++) {
+	  if (voice[c*3 + i].channel == event.channel) {
+	    state.envelope_counter[i] = 0;
+	    state.hold_zero[i] = true;
+	    state.envelope_pipeline[i] = 0;
+	    cut = true;
+	  }
+	}
+	if (cut) {
+	  chip[c]->write_state(state);
+	}
+      }
+      break;
+    case 123:
+      for (v = 0; v < n; v++) {
+	if (voice[v].channel == event.channel) {
+	  stop(v);
+	}
+      }
+      break;
+    }
+    break;
+
+  case PROGRAM_CHANGE:
+    channel[event.channel].program = event.a;
+    break;
+
+  case PITCH_BEND:
+    channel[event.channel].bend = event.a;
+    for (v = 0; v < n; v++) {
+      if (voice[v].channel == event.channel && voice[v].note >= 0) {
+	set_freq(v);
+      }
+    }
+    break;
+  }
+}
+
+
+bool SIDSynth::earlier(const Event& a, const Event& b)
+{
+  return a.offset < b.offset;
+}
+
+// ----------------------------------------------------------------------------
+// Render block, applying queued events at their sample offsets.
+// ----------------------------------------------------------------------------
+void SIDSynth::render(short* buf, int n)
+{
+  int chips = (int)chip.size();
+  if (!chips) {
+    return;
+  }
+
+  std::stable_sort(events.begin(), events.end(), earlier);
+
+  mix.resize(n*chips);
+  block = n;
+  for (int c = 0; c < chips; c++) {
+    std::vector<short>& cc = carry[c];
+    int k = std::min((int)cc.size(), n);
+    std::copy(cc.begin(), cc.begin() + k, mix.begin() + c*n);
+    cc.erase(cc.begin(), cc.begin() + k);
+    position[c] = k;
+  }
+
+  int s = 0;
+  size_t e = 0;
+  for (;;) {
+    int end = e < events.size() ?
+      std::min(std::max(events[e].offset, s), n) : n;
+    if (end > s) {
+      for (int c = 0; c < chips; c++) {
+	if (position[c] < end) {
+	  cycle_count delta_t = 1 << 30;
+	  position[c] += chip[c]->clock(delta_t, &mix[c*n + position[c]],
+					end - position[c]);
+	}
+      }
+      s = end;
+    }
+    if (e == events.size()) {
+      break;
+    }
+    apply(events[e++]);
+  }
+  events.clear();
+  block = 0;
+
+  for (int i = 0; i < n; i++) {
+    int sum = 0;
+    for (int c = 0; c < chips; c++) {
+      sum += mix[c*n + i];
+    }
+    buf[i] = sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Number of sounding notes.
+// ----------------------------------------------------------------------------
+int SIDSynth::active_voices() const
+{
+  int n = 0;
+  for (size_t v = 0; v < voice.size(); v++) {
+    n += voice[v].gate;
+  }
+  return n;
+}
+
+} // namespace reSID
@@ -0,0 +1,138 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_SYNTH_H
+#define RESID_SYNTH_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "trace.h"
+#include <vector>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Polyphonic synthesizer playing MIDI events on a pool of SIDs.
+//
+// Each SID contributes three voices. A note is given a free voice if there
+// is one, preferring the voice that has been released for the longest time,
+// so that release tails are cut as late as possible; otherwise the oldest
+// note is stolen. A repeated note on the same channel reuses its voice.
+//
+// Events are queued with a sample offset into the next block passed to
+// render(), and their register writes are applied right at that sample, by
+// rendering the block in segments between events. The latency is thus
+// bounded by the block size chosen by the caller.
+//
+// Each MIDI program selects one of a small set of built-in patches;
+// channel 10 plays noise drums. Velocity scales the sustain level, pitch
+// bend covers +-2 semitones, and the following controllers are supported:
+//
+//   7    volume
+//   71   filter resonance
+//   74   filter cutoff
+//   120  all sound off
+//   123  all notes off
+// ----------------------------------------------------------------------------
+class SIDSynth
+{
+public:
+  SIDSynth();
+  ~SIDSynth();
+
+  // Set up a pool of chips. Returns false for invalid sampling parameters.
+  bool open(int chips, const RenderSettings& settings);
+
+  // Queue MIDI message (status byte with running status resolved, and up to
+  // two data bytes) at the given sample offset into the next block.
+  void midi(int offset, const unsigned char* msg);
+
+  void note_on(int offset, int channel, int note, int velocity);
+  void note_off(int offset, int channel, int note);
+  void control_change(int offset, int channel, int controller, int value);
+  void program_change(int offset, int channel, int program);
+  // value is -8192 to 8191.
+  void pitch_bend(int offset, int channel, int value);
+
+  // Render n samples, applying the queued events. The chip outputs are
+  // summed, with clipping.
+  void render(short* buf, int n);
+
+  // Number of voices with the gate on.
+  int active_voices() const;
+  int voices() const { return (int)voice.size(); }
+
+protected:
+  struct Event
+  {
+    int offset;
+    int type;
+    int channel;
+    int a, b;
+  };
+
+  struct Voice
+  {
+    int channel;
+    int note;
+    bool gate;
+    // Order of the last note on / note off.
+    unsigned long long started, released;
+    reg8 control;
+  };
+
+  struct Channel
+  {
+    int program;
+    int bend;
+  };
+
+  static bool earlier(const Event& a, const Event& b);
+  void apply(const Event& event);
+  void start(int v, int channel, int note, int velocity);
+  void stop(int v);
+  void set_freq(int v);
+  void write(int c, reg8 offset, reg8 value);
+  void write_all(reg8 offset, reg8 value);
+
+  std::vector<SID*> chip;
+  std::vector<Voice> voice;
+  Channel channel[16];
+  std::vector<Event> events;
+
+  // Output of each chip in the current block of block samples, rendered up
+  // to position. Samples rendered by register writes outside the block are
+  // carried over to the next block.
+  std::vector<short> mix;
+  std::vector<int> position;
+  std::vector<std::vector<short> > carry;
+  int block;
+
+  double clock_freq;
+  unsigned long long counter;
+  reg8 volume;
+  reg8 resonance;
+  // Filter routing per chip.
+  std::vector<reg8> route;
+};
+
+} // namespace reSID
+
+#endif // not RESID_SYNTH_H
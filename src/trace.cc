@@ -0,0 +1,491 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace reSID
+{
+
+static const char trace_magic[8] = { 'r', 'e', 'S', 'I', 'D', 't', 'r', 'c' };
+static const unsigned int trace_version = 1;
+
+static void put32(unsigned char* p, unsigned int v)
+{
+  for (int i = 0; i < 4; i++) {
+    p[i] = (v >> 8*i) & 0xff;
+  }
+}
+
+static unsigned int get32(const unsigned char* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+Trace::Trace()
+{
+  tail = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Remove all writes.
+// ----------------------------------------------------------------------------
+void Trace::clear()
+{
+  writes.clear();
+  tail = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Append write, delta cycles after the previous write.
+// ----------------------------------------------------------------------------
+void Trace::add(cycle_count delta, reg8 offset, reg8 value)
+{
+  Write w = { delta, offset & 0x1f, value & 0xff };
+  writes.push_back(w);
+}
+
+
+// ----------------------------------------------------------------------------
+// Read trace file.
+// ----------------------------------------------------------------------------
+bool Trace::load(const char* filename)
+{
+  clear();
+
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return false;
+  }
+
+  unsigned char header[20];
+  if (fread(header, sizeof(header), 1, f) != 1 ||
+      memcmp(header, trace_magic, sizeof(trace_magic)) != 0 ||
+      get32(header + 8) != trace_version)
+  {
+    fclose(f);
+    return false;
+  }
+
+  unsigned int count = get32(header + 12);
+  tail = get32(header + 16);
+
+  const int chunk = 4096;
+  unsigned char buf[chunk*6];
+  writes.reserve(count);
+
+  while (count) {
+    unsigned int n = count < chunk ? count : chunk;
+    if (fread(buf, 6, n, f) != n) {
+      fclose(f);
+      clear();
+      return false;
+    }
+    for (unsigned int i = 0; i < n; i++) {
+      add(get32(buf + 6*i), buf[6*i + 4], buf[6*i + 5]);
+    }
+    count -= n;
+  }
+
+  fclose(f);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Write trace file.
+// ----------------------------------------------------------------------------
+bool Trace::save(const char* filename) const
+{
+  FILE* f = fopen(filename, "wb");
+  if (!f) {
+    return false;
+  }
+
+  unsigned char header[20];
+  memcpy(header, trace_magic, sizeof(trace_magic));
+  put32(header + 8, trace_version);
+  put32(header + 12, writes.size());
+  put32(header + 16, tail);
+
+  bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+  for (size_t i = 0; ok && i < writes.size(); i++) {
+    unsigned char record[6];
+    put32(record, writes[i].delta);
+    record[4] = writes[i].offset;
+    record[5] = writes[i].value;
+    ok = fwrite(record, sizeof(record), 1, f) == 1;
+  }
+
+  return fclose(f) == 0 && ok;
+}
+
+
+// ----------------------------------------------------------------------------
+// Total number of cycles.
+// ----------------------------------------------------------------------------
+unsigned long long Trace::cycles() const
+{
+  unsigned long long cycles = tail;
+  for (size_t i = 0; i < writes.size(); i++) {
+    cycles += writes[i].delta;
+  }
+  return cycles;
+}
+
+
+// ----------------------------------------------------------------------------
+// Hash writes [begin, end).
+// ----------------------------------------------------------------------------
+void Trace::hash(Hash& hash, size_t begin, size_t end) const
+{
+  for (size_t i = begin; i < end; i++) {
+    unsigned char record[6];
+    put32(record, writes[i].delta);
+    record[4] = writes[i].offset;
+    record[5] = writes[i].value;
+    hash.update(record, sizeof(record));
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Remove writes which provably have no effect on the output.
+//
+// A write is dead if:
+//
+// * It is overwritten in the MOS8580 write pipeline (SAMPLE_FAST only) by a
+//   write in the same cycle, before taking effect.
+// * It is a write to one of the read-only registers $19 - $1f.
+// * It writes the same value to a register as the previous write, ignoring
+//   unused bits (FC_LO bits 3-7, PW_HI bits 4-7). Registers are assumed to
+//   be unknown at the start of the trace.
+//
+// The last rule needs care, since some register functions do more than
+// store the register value:
+//
+// * writePW_LO / writePW_HI recompute the pulse level. The pulse level is
+//   recomputed in every cycle in the same way before it is used, so this is
+//   not observable.
+// * Voice::writeCONTROL_REG acts on edges of the test bit and the gate bit,
+//   which require a change of value. However, for non-zero waveforms
+//   WaveformGenerator::writeCONTROL_REG also calls set_waveform_output(),
+//   which writes combined waveforms back into the noise shift register, and
+//   on the MOS6581 lets combined waveforms including sawtooth pull down the
+//   accumulator MSB. These writes are kept unless the test bit is set.
+//   The waveform output itself is recomputed before use in the next cycle.
+// * writeATTACK_DECAY / writeSUSTAIN_RELEASE recompute the rate period for
+//   the current envelope state, which yields the current rate period.
+// * The filter register functions only compute values from the registers.
+//
+// All writes also set the data bus value, which is visible when reading
+// write-only registers. If keep_bus_value is set, a dead write is only
+// removed when it is followed by another write in the same cycle.
+//
+// The same restriction applies to SAMPLE_FAST, since the SID is clocked
+// delta_t cycles at a time between writes, and delta_t clocking is not
+// exactly equivalent to clocking the same cycles in smaller steps.
+// ----------------------------------------------------------------------------
+size_t Trace::optimize(const RenderSettings& settings, bool keep_bus_value)
+{
+  // Significant bits of each register.
+  static const reg8 significant[0x20] = {
+    0xff, 0xff, 0xff, 0x0f, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x0f, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x0f, 0xff, 0xff, 0xff,
+    0x07, 0xff, 0xff, 0xff,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+  };
+
+  bool pipeline = settings.model == MOS8580 && settings.method == SAMPLE_FAST;
+
+  // Last value written to each register, or -1 if unknown.
+  int reg[0x20];
+  for (int i = 0; i < 0x20; i++) {
+    reg[i] = -1;
+  }
+
+  size_t size = writes.size();
+  size_t j = 0;
+  cycle_count carry = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    Write w = writes[i];
+    w.delta += carry;
+    carry = 0;
+
+    bool same_cycle = i + 1 < size && writes[i + 1].delta == 0;
+    bool dead;
+
+    if (pipeline && same_cycle) {
+      // Overwritten in the write pipeline; the register is not changed.
+      dead = true;
+    }
+    else if (!significant[w.offset]) {
+      dead = true;
+    }
+    else if (reg[w.offset] < 0 ||
+	     ((reg[w.offset] ^ w.value) & significant[w.offset]))
+    {
+      dead = false;
+    }
+    else if (w.offset == 0x04 || w.offset == 0x0b || w.offset == 0x12) {
+      reg8 waveform = (w.value >> 4) & 0x0f;
+      dead = (w.value & 0x08) ||
+	(waveform <= 0x8 &&
+	 !(settings.model == MOS6581 && (waveform & 0x2) && (waveform & 0xd)));
+    }
+    else {
+      dead = true;
+    }
+
+    if (dead && (keep_bus_value || settings.method == SAMPLE_FAST) &&
+	!same_cycle)
+    {
+      dead = false;
+    }
+
+    if (dead) {
+      carry = w.delta;
+      continue;
+    }
+
+    reg[w.offset] = w.value;
+    writes[j++] = w;
+  }
+
+  tail += carry;
+  writes.resize(j);
+
+  return size - j;
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+RenderSettings::RenderSettings()
+{
+  model = MOS6581;
+  clock_freq = 985248;
+  method = SAMPLE_RESAMPLE;
+  sample_freq = 44100;
+  pass_freq = -1;
+  filter_scale = 0.97;
+  filter_bias = 0.5;
+  filter = true;
+  external_filter = true;
+  voice_mask = 0x07;
+}
+
+
+// ----------------------------------------------------------------------------
+// Configure SID, and put it in its initial state.
+// Returns false if the sampling parameters are rejected.
+// ----------------------------------------------------------------------------
+bool RenderSettings::configure(SID& sid) const
+{
+  sid.set_chip_model(model);
+  if (!sid.set_sampling_parameters(clock_freq, method, sample_freq,
+				   pass_freq, filter_scale))
+  {
+    return false;
+  }
+  restart(sid);
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Put SID in its initial state. The sampling parameters are assumed to be
+// unchanged since configure(), which saves recalculating the resampling
+// filter when rendering many short pieces with the same settings.
+// ----------------------------------------------------------------------------
+void RenderSettings::restart(SID& sid) const
+{
+  sid.set_chip_model(model);
+  sid.enable_filter(filter);
+  sid.enable_external_filter(external_filter);
+  sid.adjust_filter_bias(filter_bias);
+
+  // The initial state must not depend on what the SID was used for earlier.
+  sid.reset();
+  sid.write_state(SID::State());
+  sid.set_voice_mask(voice_mask);
+}
+
+
+// ----------------------------------------------------------------------------
+// Compare sampling parameters.
+// ----------------------------------------------------------------------------
+bool RenderSettings::same_sampling(const RenderSettings& settings) const
+{
+  return clock_freq == settings.clock_freq && method == settings.method &&
+    sample_freq == settings.sample_freq &&
+    pass_freq == settings.pass_freq &&
+    filter_scale == settings.filter_scale;
+}
+
+
+// ----------------------------------------------------------------------------
+// Hash settings.
+// ----------------------------------------------------------------------------
+void RenderSettings::hash(Hash& hash) const
+{
+  hash.update((int)model);
+  hash.update(clock_freq);
+  hash.update((int)method);
+  hash.update(sample_freq);
+  hash.update(pass_freq);
+  hash.update(filter_scale);
+  hash.update(filter_bias);
+  hash.update((int)filter);
+  hash.update((int)external_filter);
+  hash.update(voice_mask);
+}
+
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+TracePlayer::TracePlayer(SID& sid, const Trace& trace) :
+  sid(sid), trace(trace)
+{
+  stop = (size_t)-1;
+  next_marker = 0;
+  seek(0);
+}
+
+
+// ----------------------------------------------------------------------------
+// Restart at write number index.
+// ----------------------------------------------------------------------------
+void TracePlayer::seek(size_t index, unsigned long long samples)
+{
+  this->index = index;
+  delta_t = index < trace.writes.size() ? trace.writes[index].delta : trace.tail;
+
+  now = 0;
+  for (size_t i = 0; i < index; i++) {
+    now += trace.writes[i].delta;
+  }
+  rendered = samples;
+}
+
+
+// ----------------------------------------------------------------------------
+// Set stop position.
+// ----------------------------------------------------------------------------
+void TracePlayer::set_stop(size_t index)
+{
+  stop = index;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render up to n samples, applying writes at their exact cycles.
+// ----------------------------------------------------------------------------
+int TracePlayer::clock(short* buf, int n, int interleave)
+{
+  size_t size = trace.writes.size();
+  int s = 0;
+
+  for (;;) {
+    if (unlikely(index == stop)) {
+      break;
+    }
+
+    if (!delta_t) {
+      if (index == size) {
+	// End of trace.
+	break;
+      }
+      const Trace::Write& w = trace.writes[index++];
+      sid.write(w.offset, w.value);
+      delta_t = index < size ? trace.writes[index].delta : trace.tail;
+      continue;
+    }
+
+    if (s == n) {
+      break;
+    }
+
+    cycle_count delta_t_prev = delta_t;
+    s += sid.clock(delta_t, buf + s*interleave, n - s, interleave);
+    now += delta_t_prev - delta_t;
+  }
+
+  rendered += s;
+  return s;
+}
+
+
+// ----------------------------------------------------------------------------
+// Output sample position of a cycle.
+// ----------------------------------------------------------------------------
+void TracePlayer::map(unsigned long long cycle, long long& sample,
+		      double& fraction)
+{
+  sid.sample_position((long long)(cycle - now), sample, fraction);
+  sample += rendered;
+}
+
+
+// ----------------------------------------------------------------------------
+// Add marker.
+// ----------------------------------------------------------------------------
+void TracePlayer::add_marker(unsigned long long cycle, int id)
+{
+  Marker m = { cycle, id, 0, 0 };
+  markers.push_back(m);
+}
+
+
+// ----------------------------------------------------------------------------
+// Get the next marker whose sample has been rendered.
+// ----------------------------------------------------------------------------
+bool TracePlayer::poll_marker(Marker& marker)
+{
+  if (next_marker == markers.size()) {
+    markers.clear();
+    next_marker = 0;
+    return false;
+  }
+
+  Marker& m = markers[next_marker];
+  map(m.cycle, m.sample, m.fraction);
+  if (m.sample >= (long long)rendered) {
+    return false;
+  }
+
+  marker = m;
+  next_marker++;
+  return true;
+}
+
+} // namespace reSID
@@ -0,0 +1,182 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_TRACE_H
+#define RESID_TRACE_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include "hash.h"
+#include <stddef.h>
+#include <vector>
+
+namespace reSID
+{
+
+class RenderSettings;
+
+// ----------------------------------------------------------------------------
+// A trace is a sequence of timestamped SID register writes, e.g. captured
+// from a C64 emulator or produced by a player routine.
+//
+// Each write is timestamped relative to the previous write. The trace ends
+// tail cycles after the last write.
+//
+// File format (all values little endian):
+//
+//   "reSIDtrc"                  magic
+//   u32 version                 1
+//   u32 count                   number of writes
+//   u32 tail                    cycles after last write
+//   count * { u32 delta, u8 offset, u8 value }
+// ----------------------------------------------------------------------------
+class Trace
+{
+public:
+  Trace();
+
+  struct Write
+  {
+    cycle_count delta;
+    reg8 offset;
+    reg8 value;
+  };
+
+  void clear();
+  void add(cycle_count delta, reg8 offset, reg8 value);
+
+  bool load(const char* filename);
+  bool save(const char* filename) const;
+
+  // Total number of cycles.
+  unsigned long long cycles() const;
+
+  // Hash writes [begin, end).
+  void hash(Hash& hash, size_t begin, size_t end) const;
+
+  // Remove writes which provably have no effect on the output, folding
+  // their delta into the next write. Returns the number of removed writes.
+  size_t optimize(const RenderSettings& settings,
+		  bool keep_bus_value = false);
+
+  std::vector<Write> writes;
+  cycle_count tail;
+};
+
+
+// ----------------------------------------------------------------------------
+// Settings needed to reproduce a render.
+// ----------------------------------------------------------------------------
+class RenderSettings
+{
+public:
+  RenderSettings();
+
+  // Configure SID, and put it in its initial state.
+  bool configure(SID& sid) const;
+  // Put a SID configured with the same sampling parameters in the initial
+  // state for these settings, without recalculating the resampling filter.
+  void restart(SID& sid) const;
+  // Whether the sampling parameters, and thus the resampling filter, are
+  // the same as for other settings.
+  bool same_sampling(const RenderSettings& settings) const;
+
+  void hash(Hash& hash) const;
+
+  chip_model model;
+  double clock_freq;
+  sampling_method method;
+  double sample_freq;
+  double pass_freq;
+  double filter_scale;
+  double filter_bias;
+  bool filter;
+  bool external_filter;
+  reg4 voice_mask;
+};
+
+
+// ----------------------------------------------------------------------------
+// Play back a trace, applying writes at their exact cycles while rendering
+// samples.
+// ----------------------------------------------------------------------------
+class TracePlayer
+{
+public:
+  TracePlayer(SID& sid, const Trace& trace);
+
+  // Restart at write number index; the SID must be in the state it had
+  // right after the previous write, having rendered the given number of
+  // samples.
+  void seek(size_t index, unsigned long long samples = 0);
+
+  // Stop clock() right after the write before write number index has been
+  // applied. Default is no stop.
+  void set_stop(size_t index);
+
+  // Render up to n samples. Returns the number of samples rendered, which
+  // is less than n at the end of the trace or at the stop position.
+  int clock(short* buf, int n, int interleave = 1);
+
+  // Number of writes applied.
+  size_t position() const { return index; }
+  bool done() const { return index == trace.writes.size() && !delta_t; }
+
+  // Number of cycles clocked and samples rendered.
+  unsigned long long cycle() const { return now; }
+  unsigned long long samples() const { return rendered; }
+
+  // Output sample position of a cycle, counting from the start of the
+  // trace. See SID::sample_position().
+  void map(unsigned long long cycle, long long& sample, double& fraction);
+
+  // Markers attach caller ids to cycles, e.g. frame starts or song
+  // positions. Once the sample a marker maps to has been rendered, the
+  // marker is returned by poll_marker(). Markers must be added in cycle
+  // order.
+  struct Marker
+  {
+    unsigned long long cycle;
+    int id;
+    long long sample;
+    double fraction;
+  };
+
+  void add_marker(unsigned long long cycle, int id);
+  bool poll_marker(Marker& marker);
+
+protected:
+  SID& sid;
+  const Trace& trace;
+
+  // Index of next write, and cycles until it is applied.
+  size_t index;
+  cycle_count delta_t;
+  size_t stop;
+
+  unsigned long long now;
+  unsigned long long rendered;
+
+  std::vector<Marker> markers;
+  size_t next_marker;
+};
+
+} // namespace reSID
+
+#endif // not RESID_TRACE_H
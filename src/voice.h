@@ -50,6 +50,7 @@ protected:
   short wave_zero;
 
 friend class SID;
+friend class SIDBatch;
 };
 
 
@@ -75,31 +75,38 @@ RESID_CONSTINIT const DAC<12> WaveformGenerator::model_dac[2] = {
 
 
 // ----------------------------------------------------------------------------
-// Constructor.
+// Calculate tables for normal waveforms.
 // ----------------------------------------------------------------------------
-WaveformGenerator::WaveformGenerator()
+bool WaveformGenerator::build_tables()
 {
-  static bool class_init;
+  reg24 accumulator = 0;
+  for (int i = 0; i < (1 << 12); i++) {
+    reg24 msb = accumulator & 0x800000;
+
+    // Noise mask, triangle, sawtooth, pulse mask.
+    // The triangle calculation is made branch-free, just for the hell of it.
+    model_wave[0][0][i] = model_wave[1][0][i] = 0xfff;
+    model_wave[0][1][i] = model_wave[1][1][i] =
+      ((accumulator ^ -!!msb) >> 11) & 0xffe;
+    model_wave[0][2][i] = model_wave[1][2][i] = accumulator >> 12;
+    model_wave[0][4][i] = model_wave[1][4][i] = 0xfff;
+
+    accumulator += 0x1000;
+  }
 
-  if (!class_init) {
-    // Calculate tables for normal waveforms.
-    accumulator = 0;
-    for (int i = 0; i < (1 << 12); i++) {
-      reg24 msb = accumulator & 0x800000;
-
-      // Noise mask, triangle, sawtooth, pulse mask.
-      // The triangle calculation is made branch-free, just for the hell of it.
-      model_wave[0][0][i] = model_wave[1][0][i] = 0xfff;
-      model_wave[0][1][i] = model_wave[1][1][i] =
-	((accumulator ^ -!!msb) >> 11) & 0xffe;
-      model_wave[0][2][i] = model_wave[1][2][i] = accumulator >> 12;
-      model_wave[0][4][i] = model_wave[1][4][i] = 0xfff;
-
-      accumulator += 0x1000;
-    }
+  return true;
+}
 
-    class_init = true;
-  }
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+WaveformGenerator::WaveformGenerator()
+{
+  // The tables are calculated once, by the first constructor call.
+  // Concurrent first calls wait for it to finish.
+  static bool class_init = build_tables();
+  (void)class_init;
 
   sync_source = this;
 
@@ -122,11 +122,13 @@ protected:
   // Sample data for waveforms, not including noise.
   unsigned short* wave;
   static unsigned short model_wave[2][8][1 << 12];
+  static bool build_tables();
   // DAC lookup tables.
   static const DAC<12> model_dac[2];
 
 friend class Voice;
 friend class SID;
+friend class SIDBatch;
 };
 
 
@@ -0,0 +1,91 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#include "writequeue.h"
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+WriteQueue::WriteQueue(int capacity) :
+  tail(0), head(0)
+{
+  unsigned int size = 1;
+  while (size < (unsigned int)capacity) {
+    size <<= 1;
+  }
+
+  writes = new Write[size];
+  mask = size - 1;
+
+  now = 0;
+  late = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+WriteQueue::~WriteQueue()
+{
+  delete[] writes;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render up to n samples, applying queued writes at their cycles.
+// Returns the number of samples rendered; this is less than n if max_cycles
+// cycles were clocked first.
+// ----------------------------------------------------------------------------
+int WriteQueue::clock(SID& sid, short* buf, int n, int interleave,
+		      cycle_count max_cycles)
+{
+  int s = 0;
+  Write w;
+
+  while (s < n && max_cycles > 0) {
+    // Apply due writes.
+    while (peek(w) && w.cycle <= now) {
+      if (unlikely(w.cycle < now)) {
+	late++;
+      }
+      sid.write(w.offset, w.value);
+      pop(w);
+    }
+
+    // Clock up to the next write, or until the buffer is full.
+    cycle_count delta_t = max_cycles;
+    if (peek(w) && w.cycle - now < (unsigned long long)delta_t) {
+      delta_t = w.cycle - now;
+    }
+
+    cycle_count clocked = delta_t;
+    s += sid.clock(delta_t, buf + s*interleave, n - s, interleave);
+    clocked -= delta_t;
+
+    now += clocked;
+    max_cycles -= clocked;
+  }
+
+  return s;
+}
+
+} // namespace reSID
@@ -0,0 +1,144 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 1998 - 2022  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+#ifndef RESID_WRITEQUEUE_H
+#define RESID_WRITEQUEUE_H
+
+#include "siddefs.h"
+#include "sid.h"
+#include <atomic>
+
+namespace reSID
+{
+
+// ----------------------------------------------------------------------------
+// Lock-free single producer / single consumer queue of timestamped register
+// writes.
+//
+// The producer (typically a CPU emulation thread) calls push(), while the
+// consumer (typically an audio thread) calls clock(), which renders samples
+// and applies the queued writes at their cycles. Both sides are wait-free,
+// and no memory is allocated after construction.
+//
+// Timestamps are absolute cycle counts, starting at 0 when the queue is
+// created. Writes must be pushed in timestamp order. A write which arrives
+// after the consumer has clocked past its cycle is applied as soon as
+// possible, and counted in late_writes().
+// ----------------------------------------------------------------------------
+class WriteQueue
+{
+public:
+  struct Write
+  {
+    unsigned long long cycle;
+    reg8 offset;
+    reg8 value;
+  };
+
+  // The capacity is rounded up to a power of two.
+  WriteQueue(int capacity = 4096);
+  ~WriteQueue();
+
+  // Producer. Returns false if the queue is full.
+  bool push(unsigned long long cycle, reg8 offset, reg8 value);
+
+  // Consumer.
+  bool peek(Write& write) const;
+  bool pop(Write& write);
+  // Render up to n samples, applying queued writes at their cycles. At most
+  // max_cycles cycles are clocked; this is used to keep the consumer from
+  // running ahead of the producer.
+  int clock(SID& sid, short* buf, int n, int interleave = 1,
+	    cycle_count max_cycles = 0x7fffffff);
+
+  // Consumer position.
+  unsigned long long cycle() const { return now; }
+  unsigned long late_writes() const { return late; }
+
+protected:
+  Write* writes;
+  unsigned int mask;
+
+  // Indices are only ever incremented; the difference is the fill level.
+  // Producer and consumer indices are kept on separate cache lines.
+  alignas(64) std::atomic<unsigned int> tail;
+  alignas(64) std::atomic<unsigned int> head;
+
+  // Consumer state.
+  unsigned long long now;
+  unsigned long late;
+};
+
+
+// ----------------------------------------------------------------------------
+// Append write.
+// ----------------------------------------------------------------------------
+inline
+bool WriteQueue::push(unsigned long long cycle, reg8 offset, reg8 value)
+{
+  unsigned int t = tail.load(std::memory_order_relaxed);
+  if (unlikely(t - head.load(std::memory_order_acquire) > mask)) {
+    return false;
+  }
+
+  Write& w = writes[t & mask];
+  w.cycle = cycle;
+  w.offset = offset;
+  w.value = value;
+  tail.store(t + 1, std::memory_order_release);
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Get next write without removing it.
+// ----------------------------------------------------------------------------
+inline
+bool WriteQueue::peek(Write& write) const
+{
+  unsigned int h = head.load(std::memory_order_relaxed);
+  if (h == tail.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  write = writes[h & mask];
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Remove next write.
+// ----------------------------------------------------------------------------
+inline
+bool WriteQueue::pop(Write& write)
+{
+  unsigned int h = head.load(std::memory_order_relaxed);
+  if (h == tail.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  write = writes[h & mask];
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
+
+} // namespace reSID
+
+#endif // not RESID_WRITEQUEUE_H